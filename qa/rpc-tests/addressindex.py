@@ -12,6 +12,7 @@ from test_framework.util import *
 from test_framework.script import *
 from test_framework.mininode import *
 import binascii
+import time
 
 class AddressIndexTest(BitcoinTestFramework):
 
@@ -170,6 +171,10 @@ class AddressIndexTest(BitcoinTestFramework):
 
         balance2 = self.nodes[1].getaddressbalance(address2)
         assert_equal(balance2["balance"], change_amount)
+        balance2 = self.nodes[1].getaddressbalance({"addresses": [address2], "verify": True})
+        assert_equal(balance2["balance"], change_amount)
+        assert_equal(balance2["received"], amount + change_amount)
+        assert_equal(balance2["txcount"], 2)
 
         # Check that deltas are returned correctly
         deltas = self.nodes[1].getaddressdeltas({"addresses": [address2], "start": 0, "end": 200})
@@ -184,6 +189,34 @@ class AddressIndexTest(BitcoinTestFramework):
         deltasAll = self.nodes[1].getaddressdeltas({"addresses": [address2]})
         assert_equal(len(deltasAll), len(deltas))
 
+        # Check that deltas can be paged through
+        self.log.info("Testing pagination...")
+        paged = []
+        cursor = None
+        while True:
+            params = {"addresses": [address2], "limit": 1}
+            if cursor is not None:
+                params["cursor"] = cursor
+            page = self.nodes[1].getaddressdeltas(params)
+            assert(len(page["deltas"]) <= 1)
+            paged += page["deltas"]
+            cursor = page["cursor"]
+            if cursor is None:
+                break
+        assert_equal(paged, deltasAll)
+
+        page = self.nodes[1].getaddresstxids({"addresses": ["93bVhahvUKmQu8gu9g3QnPPa2cxFK98pMB"], "limit": 3})
+        assert_equal(page["txids"], txidsmany[:3])
+        page = self.nodes[1].getaddresstxids({"addresses": ["93bVhahvUKmQu8gu9g3QnPPa2cxFK98pMB"], "cursor": page["cursor"]})
+        assert_equal(page["txids"], txidsmany[3:])
+        assert_equal(page["cursor"], None)
+
+        try:
+            self.nodes[1].getaddressdeltas({"addresses": [address2], "cursor": "00"})
+            raise AssertionError("invalid cursor accepted")
+        except JSONRPCException as e:
+            assert_equal(e.error["code"], -8)
+
         # Check that deltas can be returned from range of block heights
         deltas = self.nodes[1].getaddressdeltas({"addresses": [address2], "start": 113, "end": 113})
         assert_equal(len(deltas), 1)
@@ -328,6 +361,29 @@ class AddressIndexTest(BitcoinTestFramework):
         mempool_deltas = self.nodes[2].getaddressmempool({"addresses": [address1]})
         assert_equal(len(mempool_deltas), 2)
 
+        # Enabling the index on a node without it builds it in the background
+        self.log.info("Testing the index builder...")
+        self.nodes[0].generate(1)
+        self.sync_all()
+        stop_node(self.nodes[0], 0)
+        self.nodes[0] = start_node(0, self.options.tmpdir, ["-relaypriority=0", "-addressindex"])
+        connect_nodes(self.nodes[0], 1)
+        connect_nodes(self.nodes[0], 2)
+        connect_nodes(self.nodes[0], 3)
+
+        addresses = {"addresses": [address1, address2, "93bVhahvUKmQu8gu9g3QnPPa2cxFK98pMB", "yMNJePdcKvXtWWQnFYHNeJ5u8TF2v1dfK4"]}
+        for i in range(100):
+            try:
+                balance = self.nodes[0].getaddressbalance(addresses)
+                break
+            except JSONRPCException:
+                time.sleep(0.1)
+        assert_equal(balance, self.nodes[1].getaddressbalance(addresses))
+        assert_equal(self.nodes[0].getaddresstxids(addresses), self.nodes[1].getaddresstxids(addresses))
+        assert_equal(self.nodes[0].getaddressdeltas(addresses), self.nodes[1].getaddressdeltas(addresses))
+        assert_equal(self.nodes[0].getaddressutxos(addresses), self.nodes[1].getaddressutxos(addresses))
+        assert_equal(self.nodes[0].getaddressbalance(dict(addresses, verify=True)), balance)
+
         self.log.info("Passed")
 
 
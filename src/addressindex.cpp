@@ -0,0 +1,126 @@
+// Copyright (c) 2019 The Sierra Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addressindex.h"
+
+#include "memusage.h"
+
+#include <algorithm>
+
+const uint32_t CMempoolAddressIndex::NONE;
+
+void CMempoolAddressIndex::Add(const CMempoolAddressDeltaKey& key, const CMempoolAddressDelta& delta)
+{
+    uint32_t n;
+    if (nFree != NONE) {
+        n = nFree;
+        nFree = vDeltas[n].nNextAddress;
+        nFreeCount--;
+    } else {
+        n = vDeltas.size();
+        vDeltas.emplace_back();
+    }
+
+    AddressMap::iterator ait = mapAddresses.emplace(AddressKey(key.addressBytes, key.type), AddressList()).first;
+    uint32_t& nTxHead = mapTxs.emplace(key.txhash, NONE).first->second;
+
+    Delta& d = vDeltas[n];
+    d.txhash = key.txhash;
+    d.prevhash = delta.prevhash;
+    d.time = delta.time;
+    d.amount = delta.amount;
+    d.index = key.index;
+    d.prevout = delta.prevout;
+    d.spending = key.spending;
+    d.address = &*ait;
+
+    AddressList& list = ait->second;
+    d.nPrevAddress = NONE;
+    d.nNextAddress = list.nHead;
+    if (list.nHead != NONE) {
+        vDeltas[list.nHead].nPrevAddress = n;
+    }
+    list.nHead = n;
+    list.nCount++;
+
+    d.nNextTx = nTxHead;
+    nTxHead = n;
+}
+
+void CMempoolAddressIndex::Get(const std::vector<std::pair<uint160, int> >& addresses,
+                               std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> >& results) const
+{
+    CMempoolAddressDeltaKeyCompare comparator;
+    for (const auto& address : addresses) {
+        AddressMap::const_iterator ait = mapAddresses.find(address);
+        if (ait == mapAddresses.end()) {
+            continue;
+        }
+
+        size_t nStart = results.size();
+        results.reserve(nStart + ait->second.nCount);
+        for (uint32_t n = ait->second.nHead; n != NONE; n = vDeltas[n].nNextAddress) {
+            const Delta& d = vDeltas[n];
+            results.emplace_back(CMempoolAddressDeltaKey(address.second, address.first, d.txhash, d.index, d.spending),
+                                 CMempoolAddressDelta(d.time, d.amount, d.prevhash, d.prevout));
+        }
+        std::sort(results.begin() + nStart, results.end(), [&](const std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta>& a,
+                                                              const std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta>& b) {
+            return comparator(a.first, b.first);
+        });
+    }
+}
+
+void CMempoolAddressIndex::Remove(const uint256& txhash)
+{
+    auto tit = mapTxs.find(txhash);
+    if (tit == mapTxs.end()) {
+        return;
+    }
+
+    uint32_t n = tit->second;
+    while (n != NONE) {
+        Delta& d = vDeltas[n];
+        AddressList& list = d.address->second;
+        if (d.nPrevAddress != NONE) {
+            vDeltas[d.nPrevAddress].nNextAddress = d.nNextAddress;
+        } else {
+            list.nHead = d.nNextAddress;
+        }
+        if (d.nNextAddress != NONE) {
+            vDeltas[d.nNextAddress].nPrevAddress = d.nPrevAddress;
+        }
+        if (--list.nCount == 0) {
+            AddressKey address = d.address->first;
+            mapAddresses.erase(address);
+        }
+
+        uint32_t nNext = d.nNextTx;
+        d.address = nullptr;
+        d.nNextAddress = nFree;
+        nFree = n;
+        nFreeCount++;
+        n = nNext;
+    }
+    mapTxs.erase(tit);
+
+    if (mapTxs.empty()) {
+        // keep the capacity of the arena, but restart with a contiguous one
+        Clear();
+    }
+}
+
+void CMempoolAddressIndex::Clear()
+{
+    vDeltas.clear();
+    nFree = NONE;
+    nFreeCount = 0;
+    mapAddresses.clear();
+    mapTxs.clear();
+}
+
+size_t CMempoolAddressIndex::DynamicMemoryUsage() const
+{
+    return memusage::DynamicUsage(vDeltas) + memusage::DynamicUsage(mapAddresses) + memusage::DynamicUsage(mapTxs);
+}
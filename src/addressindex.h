@@ -8,6 +8,13 @@
 
 #include "uint256.h"
 #include "amount.h"
+#include "hash.h"
+#include "saltedhasher.h"
+
+#include <limits>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
 
 struct CMempoolAddressDelta
 {
@@ -79,4 +86,73 @@ struct CMempoolAddressDeltaKeyCompare
     }
 };
 
+template<>
+struct SaltedHasherImpl<std::pair<uint160, int>>
+{
+    static std::size_t CalcHash(const std::pair<uint160, int>& v, uint64_t k0, uint64_t k1)
+    {
+        uint32_t type = v.second;
+        return CSipHasher(k0, k1).Write(v.first.begin(), v.first.size()).Write((const unsigned char*)&type, sizeof(type)).Finalize();
+    }
+};
+
+/**
+ * Address index of the mempool.
+ *
+ * The deltas of all transactions live in one arena which is recycled through a free list.
+ * Each delta is linked into a list of its address and a list of its transaction, so adding
+ * and removing a transaction only allocates for addresses and transactions which are not in
+ * the index yet, instead of a tree node per delta and a vector of keys per transaction.
+ * The deltas of an address are sorted by CMempoolAddressDeltaKeyCompare when queried.
+ */
+class CMempoolAddressIndex
+{
+private:
+    static const uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+    /** (address hash, address type) */
+    typedef std::pair<uint160, int> AddressKey;
+
+    struct AddressList
+    {
+        uint32_t nHead{NONE};
+        uint32_t nCount{0};
+    };
+
+    typedef std::unordered_map<AddressKey, AddressList, StaticSaltedHasher> AddressMap;
+
+    struct Delta
+    {
+        uint256 txhash;
+        uint256 prevhash;
+        int64_t time;
+        CAmount amount;
+        uint32_t index;
+        uint32_t prevout;
+        bool spending;
+        AddressMap::value_type* address;
+        /** Links of the address list, nNextAddress also links the free list */
+        uint32_t nPrevAddress;
+        uint32_t nNextAddress;
+        uint32_t nNextTx;
+    };
+
+    std::vector<Delta> vDeltas;
+    uint32_t nFree{NONE};
+    size_t nFreeCount{0};
+    AddressMap mapAddresses;
+    /** txhash -> first delta of the transaction */
+    std::unordered_map<uint256, uint32_t, StaticSaltedHasher> mapTxs;
+
+public:
+    void Add(const CMempoolAddressDeltaKey& key, const CMempoolAddressDelta& delta);
+    void Get(const std::vector<std::pair<uint160, int> >& addresses,
+             std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> >& results) const;
+    void Remove(const uint256& txhash);
+    void Clear();
+
+    size_t Size() const { return vDeltas.size() - nFreeCount; }
+    size_t DynamicMemoryUsage() const;
+};
+
 #endif // BITCOIN_ADDRESSINDEX_H
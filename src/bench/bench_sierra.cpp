@@ -9,6 +9,9 @@
 #include "validation.h"
 #include "util.h"
 
+void InitBLSTests();
+void CleanupBLSTests();
+
 int
 main(int argc, char** argv)
 {
@@ -19,7 +22,12 @@ main(int argc, char** argv)
     SetupEnvironment();
     fPrintToDebugLog = false; // don't want to write to debug.log file
 
+    InitBLSTests();
+
     benchmark::BenchRunner::RunAll();
 
+    // need to be called before global destructors kick in (PoolAllocator is needed due to many BLSSecretKeys)
+    CleanupBLSTests();
+
     ECC_Stop();
 }
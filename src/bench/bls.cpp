@@ -4,6 +4,7 @@
 
 #include "bench.h"
 #include "random.h"
+#include "bls/bls_batchverifier.h"
 #include "bls/bls_worker.h"
 #include "utiltime.h"
 
@@ -11,6 +12,11 @@
 
 CBLSWorker blsWorker;
 
+void InitBLSTests()
+{
+    blsWorker.Start();
+}
+
 void CleanupBLSTests()
 {
     blsWorker.Stop();
@@ -343,6 +349,81 @@ static void BLSVerify_BatchedParallel(benchmark::State& state)
     }
 }
 
+static void BuildSigShareTestVectors(size_t quorumSize, size_t sessionCount, size_t invalidCount,
+                                     BLSPublicKeyVector& pubKeyShares, BLSSignatureVector& sigShares,
+                                     std::vector<uint256>& signHashes, std::vector<uint32_t>& sources)
+{
+    BLSSecretKeyVector skShares(quorumSize);
+    pubKeyShares.resize(quorumSize);
+    for (size_t i = 0; i < quorumSize; i++) {
+        skShares[i].MakeNewKey();
+        pubKeyShares[i] = skShares[i].GetPublicKey();
+    }
+
+    // every member signs every session, the shares arrive from a few different nodes
+    for (size_t i = 0; i < sessionCount; i++) {
+        uint256 signHash = GetRandHash();
+        for (size_t j = 0; j < quorumSize; j++) {
+            sigShares.emplace_back(skShares[j].Sign(signHash));
+            signHashes.emplace_back(signHash);
+            sources.emplace_back((uint32_t)(j % 8));
+        }
+    }
+    for (size_t i = 0; i < invalidCount; i++) {
+        CBLSSecretKey s;
+        s.MakeNewKey();
+        size_t idx = GetRandInt((int)sigShares.size());
+        sigShares[idx] = s.Sign(signHashes[idx]);
+    }
+}
+
+// Verifies sig shares like CSigSharesManager::ProcessPendingSigShares does. A full batch is only verified every
+// batch-size iterations, so the reported time is per sig share and its inverse is the throughput in sig shares/s
+static void BLSVerify_SigShares(bool useWorker, size_t invalidCount, benchmark::State& state)
+{
+    const size_t quorumSize = 50;
+    const size_t sessionCount = 8;
+
+    BLSPublicKeyVector pubKeyShares;
+    BLSSignatureVector sigShares;
+    std::vector<uint256> signHashes;
+    std::vector<uint32_t> sources;
+    BuildSigShareTestVectors(quorumSize, sessionCount, invalidCount, pubKeyShares, sigShares, signHashes, sources);
+
+    // Benchmark.
+    size_t j = 0;
+    while (state.KeepRunning()) {
+        if ((j++ % sigShares.size()) != 0) {
+            continue;
+        }
+
+        CBLSBatchVerifier<uint32_t, uint32_t> batchVerifier(false, true, 0, useWorker ? &blsWorker : nullptr);
+        for (size_t i = 0; i < sigShares.size(); i++) {
+            batchVerifier.PushMessage(sources[i], (uint32_t)i, signHashes[i], sigShares[i], pubKeyShares[i % quorumSize]);
+        }
+        batchVerifier.Verify();
+        if (batchVerifier.badMessages.size() > invalidCount) {
+            std::cout << "expected at most " << invalidCount << " invalid sig shares" << std::endl;
+            assert(false);
+        }
+    }
+}
+
+static void BLSVerify_SigShares_Single(benchmark::State& state)
+{
+    BLSVerify_SigShares(false, 0, state);
+}
+
+static void BLSVerify_SigShares_Worker(benchmark::State& state)
+{
+    BLSVerify_SigShares(true, 0, state);
+}
+
+static void BLSVerify_SigShares_WorkerInvalid(benchmark::State& state)
+{
+    BLSVerify_SigShares(true, 2, state);
+}
+
 BENCHMARK(BLSPubKeyAggregate_Normal)
 BENCHMARK(BLSSecKeyAggregate_Normal)
 BENCHMARK(BLSSign_Normal)
@@ -355,3 +436,6 @@ BENCHMARK(BLSVerify_LargeAggregatedBlock10000)
 BENCHMARK(BLSVerify_LargeAggregatedBlock1000PreVerified)
 BENCHMARK(BLSVerify_Batched)
 BENCHMARK(BLSVerify_BatchedParallel)
+BENCHMARK(BLSVerify_SigShares_Single)
+BENCHMARK(BLSVerify_SigShares_Worker)
+BENCHMARK(BLSVerify_SigShares_WorkerInvalid)
@@ -6,6 +6,8 @@
 #include "random.h"
 #include "bls/bls_worker.h"
 
+#include <list>
+
 extern CBLSWorker blsWorker;
 
 struct Member {
@@ -109,6 +111,45 @@ struct DKG
             memberIdx = (memberIdx + 1) % members.size();
         }
     }
+
+    // Like CDKGSession does it: contributions are verified in batches while they arrive and the vvecs of each batch
+    // are aggregated in the background, so that only the batch aggregates are left to aggregate into the quorum vvec.
+    // Compare with BuildQuorumVerificationVectors plus VerifyContributionShares, which do all the work at the end
+    void Bench_Pipelined(benchmark::State& state, size_t batchSize)
+    {
+        ReceiveVvecs();
+
+        // Benchmark.
+        size_t memberIdx = 0;
+        while (state.KeepRunning()) {
+            ReceiveShares(memberIdx);
+
+            std::list<std::pair<size_t, std::future<std::vector<bool>>>> verifications;
+            std::vector<std::shared_ptr<std::vector<BLSVerificationVectorPtr>>> batchVvecs;
+            std::vector<std::shared_ptr<BLSSecretKeyVector>> batchSkShares;
+            std::vector<std::future<BLSVerificationVectorPtr>> aggregates;
+
+            for (size_t start = 0; start < members.size(); start += batchSize) {
+                size_t end = std::min(start + batchSize, members.size());
+                batchVvecs.emplace_back(std::make_shared<std::vector<BLSVerificationVectorPtr>>(receivedVvecs.begin() + start, receivedVvecs.begin() + end));
+                batchSkShares.emplace_back(std::make_shared<BLSSecretKeyVector>(receivedSkShares.begin() + start, receivedSkShares.begin() + end));
+                verifications.emplace_back(batchVvecs.size() - 1, blsWorker.AsyncVerifyContributionShares(members[memberIdx].id, *batchVvecs.back(), *batchSkShares.back(), true, true));
+            }
+            for (auto& p : verifications) {
+                auto result = p.second.get();
+                assert(std::all_of(result.begin(), result.end(), [](bool v) { return v; }));
+                aggregates.emplace_back(blsWorker.AsyncBuildQuorumVerificationVector(*batchVvecs[p.first], 0, 0, false));
+            }
+
+            std::vector<BLSVerificationVectorPtr> aggregatedVvecs;
+            for (auto& f : aggregates) {
+                aggregatedVvecs.emplace_back(f.get());
+            }
+            quorumVvec = blsWorker.BuildQuorumVerificationVector(aggregatedVvecs);
+
+            memberIdx = (memberIdx + 1) % members.size();
+        }
+    }
 };
 
 std::shared_ptr<DKG> dkg10;
@@ -179,3 +220,17 @@ BENCH_VerifyContributionShares(parallel, 400, 5, true, false)
 BENCH_VerifyContributionShares(parallel_aggregated, 10, 5, true, true)
 BENCH_VerifyContributionShares(parallel_aggregated, 100, 5, true, true)
 BENCH_VerifyContributionShares(parallel_aggregated, 400, 5, true, true)
+
+///////////////////////////////
+
+#define BENCH_Pipelined(quorumSize, batchSize) \
+    static void BLSDKG_Pipelined_##quorumSize(benchmark::State& state) \
+    { \
+        InitIfNeeded(); \
+        dkg##quorumSize->Bench_Pipelined(state, batchSize); \
+    } \
+    BENCHMARK(BLSDKG_Pipelined_##quorumSize)
+
+BENCH_Pipelined(10, 16)
+BENCH_Pipelined(100, 16)
+BENCH_Pipelined(400, 16)
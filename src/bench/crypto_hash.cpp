@@ -70,6 +70,17 @@ static void HASH_DSHA256_0032b(benchmark::State& state)
     }
 }
 
+static void HASH_DSHA256_0032b_batch(benchmark::State& state)
+{
+    std::vector<uint8_t> in(32 * 16, 0);
+    std::vector<uint8_t> out(32 * 16);
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 1000000 / 16; i++) {
+            SHA256D32(out.data(), in.data(), 16);
+        }
+    }
+}
+
 static void HASH_SHA512(benchmark::State& state)
 {
     uint8_t hash[CSHA512::OUTPUT_SIZE];
@@ -195,6 +206,7 @@ BENCHMARK(HASH_X11);
 
 BENCHMARK(HASH_SHA256_0032b);
 BENCHMARK(HASH_DSHA256_0032b);
+BENCHMARK(HASH_DSHA256_0032b_batch);
 BENCHMARK(HASH_SipHash_0032b);
 
 BENCHMARK(HASH_DSHA256_0032b_single);
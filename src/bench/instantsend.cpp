@@ -0,0 +1,130 @@
+// Copyright (c) 2019 The Sierra Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "llmq/quorums_instantsend.h"
+#include "random.h"
+#include "sync.h"
+
+#include <atomic>
+#include <thread>
+
+using namespace llmq;
+
+static const size_t ISLOCK_COUNT = 10000;
+static const size_t INPUTS_PER_ISLOCK = 2;
+static const int LOOKUP_THREADS = 4;
+static const size_t LOOKUPS_PER_ITERATION = 1000;
+
+/** The previous approach: one map behind one lock, like the caches of CInstantSendDb under CInstantSendManager::cs */
+class CSingleLockISIndex
+{
+private:
+    mutable CCriticalSection cs;
+    std::unordered_map<COutPoint, CInstantSendLockIndex::Entry, SaltedOutpointHasher> byInput;
+
+public:
+    void Add(const uint256& islockHash, const CInstantSendLockPtr& islock)
+    {
+        LOCK(cs);
+        for (auto& in : islock->inputs) {
+            byInput[in] = CInstantSendLockIndex::Entry{islockHash, islock};
+        }
+    }
+    void Remove(const uint256& islockHash, const CInstantSendLock& islock)
+    {
+        LOCK(cs);
+        for (auto& in : islock.inputs) {
+            byInput.erase(in);
+        }
+    }
+    bool GetByInput(const COutPoint& outpoint, CInstantSendLockIndex::Entry& ret) const
+    {
+        LOCK(cs);
+        auto it = byInput.find(outpoint);
+        if (it == byInput.end()) {
+            return false;
+        }
+        ret = it->second;
+        return true;
+    }
+};
+
+static std::pair<uint256, CInstantSendLockPtr> RandomISLock()
+{
+    auto islock = std::make_shared<CInstantSendLock>();
+    islock->txid = GetRandHash();
+    for (size_t i = 0; i < INPUTS_PER_ISLOCK; i++) {
+        islock->inputs.emplace_back(GetRandHash(), i);
+    }
+    return std::make_pair(GetRandHash(), islock);
+}
+
+// Looks up the inputs of mempool txs while other threads do the same and one thread keeps adding and removing
+// islocks, which is what mempool acceptance, block connection and islock processing do concurrently.
+template<typename Index>
+static void ISLockLookup_Contention(benchmark::State& state)
+{
+    Index index;
+    std::vector<std::pair<uint256, CInstantSendLockPtr>> islocks;
+    for (size_t i = 0; i < ISLOCK_COUNT; i++) {
+        islocks.emplace_back(RandomISLock());
+        index.Add(islocks.back().first, islocks.back().second);
+    }
+
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < LOOKUP_THREADS; i++) {
+        threads.emplace_back([&]() {
+            FastRandomContext rnd(true);
+            CInstantSendLockIndex::Entry e;
+            while (!stop) {
+                auto& islock = islocks[rnd.rand32() % ISLOCK_COUNT].second;
+                index.GetByInput(islock->inputs[0], e);
+                index.GetByInput(COutPoint(islock->txid, 0), e);
+            }
+        });
+    }
+    threads.emplace_back([&]() {
+        std::vector<std::pair<uint256, CInstantSendLockPtr>> newISLocks;
+        for (size_t i = 0; i < ISLOCK_COUNT; i++) {
+            newISLocks.emplace_back(RandomISLock());
+        }
+        size_t i = 0;
+        while (!stop) {
+            auto& p = newISLocks[i++ % newISLocks.size()];
+            index.Add(p.first, p.second);
+            index.Remove(p.first, *p.second);
+        }
+    });
+
+    FastRandomContext rnd(true);
+    CInstantSendLockIndex::Entry e;
+    size_t found = 0;
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < LOOKUPS_PER_ITERATION; i++) {
+            auto& islock = islocks[rnd.rand32() % ISLOCK_COUNT].second;
+            found += index.GetByInput(islock->inputs[i % INPUTS_PER_ISLOCK], e);
+        }
+    }
+
+    stop = true;
+    for (auto& t : threads) {
+        t.join();
+    }
+    assert(found != 0);
+}
+
+static void ISLockLookup_Contention_SingleLock(benchmark::State& state)
+{
+    ISLockLookup_Contention<CSingleLockISIndex>(state);
+}
+
+static void ISLockLookup_Contention_Sharded(benchmark::State& state)
+{
+    ISLockLookup_Contention<CInstantSendLockIndex>(state);
+}
+
+BENCHMARK(ISLockLookup_Contention_SingleLock)
+BENCHMARK(ISLockLookup_Contention_Sharded)
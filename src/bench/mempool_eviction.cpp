@@ -3,22 +3,27 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "bench.h"
+#include "coins.h"
 #include "policy/policy.h"
+#include "random.h"
 #include "txmempool.h"
 
 #include <list>
 #include <vector>
 
-static void AddTx(const CTransaction& tx, const CAmount& nFee, CTxMemPool& pool)
+static void AddTx(const CTransaction& tx, const CAmount& nFee, CTxMemPool& pool, const CCoinsViewCache* pview = nullptr)
 {
     int64_t nTime = 0;
     unsigned int nHeight = 1;
     bool spendsCoinbase = false;
     unsigned int sigOpCost = 4;
     LockPoints lp;
-    pool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(
-                                        MakeTransactionRef(tx), nFee, nTime, nHeight,
-                                        spendsCoinbase, sigOpCost, lp));
+    CTxMemPoolEntry entry(MakeTransactionRef(tx), nFee, nTime, nHeight, spendsCoinbase, sigOpCost, lp);
+    pool.addUnchecked(tx.GetHash(), entry);
+    if (pview) {
+        pool.addAddressIndex(entry, *pview);
+        pool.addSpentIndex(entry, *pview);
+    }
 }
 
 // Right now this is only testing eviction performance in an extremely small
@@ -111,4 +116,76 @@ static void MempoolEviction(benchmark::State& state)
     }
 }
 
+
+// Fills the mempool with chains of transactions between a few P2PKH addresses,
+// maintaining the address and spent indexes, queries them and evicts everything
+// again, like a node running with -addressindex and -spentindex would.
+static void MempoolEvictionIndexed(benchmark::State& state)
+{
+    const int nChains = 20;
+    const int nChainLength = 10;
+    const int nAddresses = 16;
+
+    std::vector<CScript> scripts;
+    std::vector<std::pair<uint160, int> > addresses;
+    for (int i = 0; i < nAddresses; i++) {
+        uint160 hashBytes;
+        GetRandBytes(hashBytes.begin(), hashBytes.size());
+        scripts.push_back(CScript() << OP_DUP << OP_HASH160 << ToByteVector(hashBytes) << OP_EQUALVERIFY << OP_CHECKSIG);
+        addresses.emplace_back(hashBytes, 1);
+    }
+
+    CCoinsView coinsDummy;
+    CCoinsViewCache coins(&coinsDummy);
+    std::vector<CTransaction> txs;
+    for (int i = 0; i < nChains; i++) {
+        CMutableTransaction funding;
+        funding.vin.resize(1);
+        funding.vin[0].scriptSig = CScript() << i;
+        funding.vout.resize(2);
+        for (int k = 0; k < 2; k++) {
+            funding.vout[k].scriptPubKey = scripts[(i + k) % nAddresses];
+            funding.vout[k].nValue = 10 * COIN;
+        }
+        AddCoins(coins, funding, 1);
+
+        uint256 prevhash = funding.GetHash();
+        for (int j = 0; j < nChainLength; j++) {
+            CMutableTransaction tx;
+            tx.vin.resize(2);
+            tx.vin[0].prevout = COutPoint(prevhash, 0);
+            tx.vin[1].prevout = COutPoint(prevhash, 1);
+            tx.vout.resize(2);
+            for (int k = 0; k < 2; k++) {
+                tx.vout[k].scriptPubKey = scripts[(i + j + k + 1) % nAddresses];
+                tx.vout[k].nValue = (10 - j) * COIN;
+            }
+            txs.emplace_back(tx);
+            // the view also serves the outputs of unconfirmed parents, like the mempool backed view does
+            AddCoins(coins, txs.back(), 1);
+            prevhash = txs.back().GetHash();
+        }
+    }
+
+    CTxMemPool pool;
+
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < txs.size(); i++) {
+            AddTx(txs[i], 1000LL + i, pool, &coins);
+        }
+
+        std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> > results;
+        pool.getAddressIndex(addresses, results);
+        assert(results.size() == txs.size() * 4);
+
+        CSpentIndexKey key(txs.back().vin[0].prevout.hash, 0);
+        CSpentIndexValue value;
+        bool fSpent = pool.getSpentIndex(key, value);
+        assert(fSpent);
+
+        pool.TrimToSize(0);
+    }
+}
+
 BENCHMARK(MempoolEviction);
+BENCHMARK(MempoolEvictionIndexed);
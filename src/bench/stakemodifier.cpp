@@ -0,0 +1,71 @@
+// Copyright (c) 2019 The Sierra Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "chain.h"
+#include "kernel.h"
+#include "validation.h"
+
+#include <deque>
+
+// Builds a chain of one minute blocks where every other block generated a new stake modifier
+static void BuildStakeModifierChain(std::deque<CBlockIndex>& blocks, int nBlocks)
+{
+    for (int i = 0; i < nBlocks; i++) {
+        blocks.emplace_back();
+        CBlockIndex& index = blocks.back();
+        index.nHeight = i;
+        index.nTime = 1546300800 + i * 60;
+        index.pprev = i > 0 ? &blocks[i - 1] : nullptr;
+        index.SetStakeModifier(((uint64_t)i << 32) | i, i % 2 == 0);
+    }
+    LOCK(cs_main);
+    chainActive.SetTip(&blocks.back());
+    UpdateStakeModifierIndex();
+}
+
+static void ResetStakeModifierChain()
+{
+    LOCK(cs_main);
+    chainActive.SetTip(nullptr);
+    UpdateStakeModifierIndex();
+}
+
+template <bool fChainWalk>
+static void StakeModifierLookup(benchmark::State& state)
+{
+    const int nBlocks = 50000;
+    std::deque<CBlockIndex> blocks;
+    BuildStakeModifierChain(blocks, nBlocks);
+
+    int nFrom = 0;
+    uint64_t nStakeModifier;
+    bool fComplete;
+    while (state.KeepRunning()) {
+        // stay well below the tip so that the modifier is always found
+        const CBlockIndex* pindexFrom = &blocks[nFrom];
+        if (fChainWalk) {
+            assert(GetKernelStakeModifierChainWalk(pindexFrom, nStakeModifier, fComplete));
+        } else {
+            assert(GetKernelStakeModifier(pindexFrom, nStakeModifier, fComplete));
+        }
+        nFrom = (nFrom + 7919) % (nBlocks / 2);
+    }
+
+    ResetStakeModifierChain();
+}
+
+static void StakeModifierChainWalk(benchmark::State& state)
+{
+    StakeModifierLookup<true>(state);
+}
+
+static void StakeModifierIndex(benchmark::State& state)
+{
+    StakeModifierLookup<false>(state);
+}
+
+BENCHMARK(StakeModifierChainWalk);
+BENCHMARK(StakeModifierIndex);
@@ -6,11 +6,16 @@
 #define DASH_CRYPTO_BLS_BATCHVERIFIER_H
 
 #include "bls.h"
+#include "bls_worker.h"
+#include "saltedhasher.h"
 
+#include <algorithm>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
-template<typename SourceId, typename MessageId>
+template<typename SourceId, typename MessageId, typename MessageIdHasher = std::hash<MessageId>>
 class CBLSBatchVerifier
 {
 private:
@@ -21,26 +26,29 @@ private:
         CBLSPublicKey pubKey;
     };
 
-    typedef std::map<MessageId, Message> MessageMap;
+    typedef std::unordered_map<MessageId, Message, MessageIdHasher> MessageMap;
     typedef typename MessageMap::iterator MessageMapIterator;
-    typedef std::map<SourceId, std::vector<MessageMapIterator>> MessagesBySourceMap;
+    typedef std::unordered_map<SourceId, std::vector<MessageMapIterator>> MessagesBySourceMap;
 
     bool secureVerification;
     bool perMessageFallback;
     size_t subBatchSize;
+    // when set, insecure verification is split across the worker pool and invalid messages are found by bisection
+    CBLSWorker* worker;
 
     MessageMap messages;
     MessagesBySourceMap messagesBySource;
 
 public:
-    std::set<SourceId> badSources;
-    std::set<MessageId> badMessages;
+    std::unordered_set<SourceId> badSources;
+    std::unordered_set<MessageId, MessageIdHasher> badMessages;
 
 public:
-    CBLSBatchVerifier(bool _secureVerification, bool _perMessageFallback, size_t _subBatchSize = 0) :
+    CBLSBatchVerifier(bool _secureVerification, bool _perMessageFallback, size_t _subBatchSize = 0, CBLSWorker* _worker = nullptr) :
             secureVerification(_secureVerification),
             perMessageFallback(_perMessageFallback),
-            subBatchSize(_subBatchSize)
+            subBatchSize(_subBatchSize),
+            worker(_worker)
     {
     }
 
@@ -65,6 +73,11 @@ public:
 
     void Verify()
     {
+        if (worker && !secureVerification) {
+            VerifyWithWorker();
+            return;
+        }
+
         std::map<uint256, std::vector<MessageMapIterator>> byMessageHash;
 
         for (auto it = messages.begin(); it != messages.end(); ++it) {
@@ -115,6 +128,61 @@ public:
     }
 
 private:
+    void VerifyWithWorker()
+    {
+        BLSSignatureVector sigs;
+        BLSPublicKeyVector pubKeys;
+        std::vector<uint256> msgHashes;
+        std::vector<MessageId> msgIds;
+        sigs.reserve(messages.size());
+        pubKeys.reserve(messages.size());
+        msgHashes.reserve(messages.size());
+        msgIds.reserve(messages.size());
+
+        // The worker splits the batch into consecutive sub batches. Ordering by message hash keeps the messages of
+        // the same hash (e.g. all shares of one signing session) together, so that their public keys can be aggregated
+        // and each sub batch needs as few pairings as possible
+        std::vector<MessageMapIterator> sorted;
+        sorted.reserve(messages.size());
+        for (auto it = messages.begin(); it != messages.end(); ++it) {
+            sorted.emplace_back(it);
+        }
+        std::sort(sorted.begin(), sorted.end(), [](const MessageMapIterator& a, const MessageMapIterator& b) {
+            return a->second.msgHash < b->second.msgHash;
+        });
+
+        for (const auto& it : sorted) {
+            sigs.emplace_back(it->second.sig);
+            pubKeys.emplace_back(it->second.pubKey);
+            msgHashes.emplace_back(it->second.msgHash);
+            msgIds.emplace_back(it->first);
+        }
+
+        auto valid = worker->VerifySigBatch(sigs, pubKeys, msgHashes);
+
+        std::unordered_set<MessageId, MessageIdHasher> invalid;
+        for (size_t i = 0; i < valid.size(); i++) {
+            if (!valid[i]) {
+                invalid.emplace(msgIds[i]);
+            }
+        }
+        if (invalid.empty()) {
+            return;
+        }
+
+        for (const auto& p : messagesBySource) {
+            for (const auto& msgIt : p.second) {
+                if (invalid.count(msgIt->first)) {
+                    badSources.emplace(p.first);
+                    break;
+                }
+            }
+        }
+        if (perMessageFallback) {
+            badMessages.insert(invalid.begin(), invalid.end());
+        }
+    }
+
     // All Verify methods take ownership of the passed byMessageHash map and thus might modify the map. This is to avoid
     // unnecessary copies
 
@@ -47,6 +47,63 @@ std::pair<std::function<void(T)>, std::future<T> > BuildFutureDoneCallback2()
 }
 
 
+// Aggregated verification of the signatures at the given indexes. Signatures of the same message hash are verified
+// against the aggregate of their public keys, as aggregated verification does not allow duplicate hashes
+static bool VerifySigsAggregated(const BLSSignatureVector& sigs, const BLSPublicKeyVector& pubKeys, const std::vector<uint256>& msgHashes,
+                                 const size_t* indexes, size_t count)
+{
+    if (count == 1) {
+        size_t i = indexes[0];
+        return sigs[i].VerifyInsecure(pubKeys[i], msgHashes[i]);
+    }
+
+    CBLSSignature aggSig;
+    std::map<uint256, CBLSPublicKey> byMsgHash;
+    for (size_t j = 0; j < count; j++) {
+        size_t i = indexes[j];
+        if (j == 0) {
+            aggSig = sigs[i];
+        } else {
+            aggSig.AggregateInsecure(sigs[i]);
+        }
+        auto it = byMsgHash.emplace(msgHashes[i], pubKeys[i]);
+        if (!it.second) {
+            it.first->second.AggregateInsecure(pubKeys[i]);
+        }
+    }
+
+    std::vector<uint256> aggMsgHashes;
+    std::vector<CBLSPublicKey> aggPubKeys;
+    aggMsgHashes.reserve(byMsgHash.size());
+    aggPubKeys.reserve(byMsgHash.size());
+    for (const auto& p : byMsgHash) {
+        aggMsgHashes.emplace_back(p.first);
+        aggPubKeys.emplace_back(p.second);
+    }
+    return aggSig.VerifyInsecureAggregated(aggPubKeys, aggMsgHashes);
+}
+
+// Finds the invalid signatures of a batch which failed aggregated verification by splitting it in halves
+static void BisectInvalidSigs(const BLSSignatureVector& sigs, const BLSPublicKeyVector& pubKeys, const std::vector<uint256>& msgHashes,
+                              const size_t* indexes, size_t count, std::vector<char>& invalid)
+{
+    if (count == 1) {
+        invalid[indexes[0]] = 1;
+        return;
+    }
+
+    size_t half = count / 2;
+    if (VerifySigsAggregated(sigs, pubKeys, msgHashes, indexes, half)) {
+        // the whole batch failed, so the other half must contain an invalid signature
+        BisectInvalidSigs(sigs, pubKeys, msgHashes, indexes + half, count - half, invalid);
+        return;
+    }
+    BisectInvalidSigs(sigs, pubKeys, msgHashes, indexes, half, invalid);
+    if (!VerifySigsAggregated(sigs, pubKeys, msgHashes, indexes + half, count - half)) {
+        BisectInvalidSigs(sigs, pubKeys, msgHashes, indexes + half, count - half, invalid);
+    }
+}
+
 /////
 
 CBLSWorker::CBLSWorker()
@@ -887,6 +944,87 @@ bool CBLSWorker::IsAsyncVerifyInProgress()
     return sigVerifyBatchesInProgress != 0;
 }
 
+bool CBLSWorker::AsyncRecoverSig(const uint256& signHash, const BLSSignatureVector& sigShares, const BLSIdVector& ids,
+                                 CBLSWorker::SignDoneCallback doneCallback)
+{
+    {
+        std::unique_lock<std::mutex> l(recoverMutex);
+        if (!recoverSignHashes.emplace(signHash).second) {
+            return false;
+        }
+    }
+
+    workerPool.push([this, signHash, sigShares, ids, doneCallback](int threadId) {
+        CBLSSignature recoveredSig;
+        bool fSuccess = recoveredSig.Recover(sigShares, ids);
+        {
+            std::unique_lock<std::mutex> l(recoverMutex);
+            if (!fSuccess) {
+                recoverSignHashes.erase(signHash);
+            } else {
+                recentRecoveries.emplace_back(signHash);
+                if (recentRecoveries.size() > MAX_RECENT_RECOVERIES) {
+                    recoverSignHashes.erase(recentRecoveries.front());
+                    recentRecoveries.pop_front();
+                }
+            }
+        }
+        doneCallback(recoveredSig);
+    });
+    return true;
+}
+
+std::vector<bool> CBLSWorker::VerifySigBatch(const BLSSignatureVector& sigs, const BLSPublicKeyVector& pubKeys, const std::vector<uint256>& msgHashes,
+                                             bool parallel)
+{
+    assert(sigs.size() == pubKeys.size() && sigs.size() == msgHashes.size());
+
+    // not a std::vector<bool>, as the sub batches write to it concurrently
+    std::vector<char> invalid(sigs.size(), 0);
+    std::vector<size_t> indexes;
+    indexes.reserve(sigs.size());
+    for (size_t i = 0; i < sigs.size(); i++) {
+        if (!sigs[i].IsValid() || !pubKeys[i].IsValid()) {
+            invalid[i] = 1;
+        } else {
+            indexes.emplace_back(i);
+        }
+    }
+
+    auto verifyBatch = [&](int threadId, size_t start, size_t count) {
+        if (!VerifySigsAggregated(sigs, pubKeys, msgHashes, indexes.data() + start, count)) {
+            BisectInvalidSigs(sigs, pubKeys, msgHashes, indexes.data() + start, count, invalid);
+        }
+        return true;
+    };
+
+    size_t batchCount = 1;
+    if (parallel && workerPool.size() > 1) {
+        batchCount = std::max((size_t)1, std::min((size_t)workerPool.size(), indexes.size() / SIG_BATCH_MIN_SPLIT_SIZE));
+    }
+    size_t batchSize = (indexes.size() + batchCount - 1) / batchCount;
+
+    if (indexes.empty()) {
+        // nothing to verify
+    } else if (batchCount == 1) {
+        verifyBatch(0, 0, indexes.size());
+    } else {
+        std::list<std::future<bool> > futures;
+        for (size_t start = 0; start < indexes.size(); start += batchSize) {
+            futures.emplace_back(workerPool.push(verifyBatch, start, std::min(batchSize, indexes.size() - start)));
+        }
+        for (auto& f : futures) {
+            f.get();
+        }
+    }
+
+    std::vector<bool> result(sigs.size());
+    for (size_t i = 0; i < sigs.size(); i++) {
+        result[i] = !invalid[i];
+    }
+    return result;
+}
+
 // sigVerifyMutex must be held while calling
 void CBLSWorker::PushSigVerifyBatch()
 {
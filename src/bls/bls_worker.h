@@ -9,8 +9,10 @@
 
 #include "ctpl.h"
 
+#include <deque>
 #include <future>
 #include <mutex>
+#include <set>
 
 #include <boost/lockfree/queue.hpp>
 
@@ -29,6 +31,8 @@ private:
     ctpl::thread_pool workerPool;
 
     static const int SIG_VERIFY_BATCH_SIZE = 8;
+    // smaller batches are not split up, the additional final exponentiation would cost more than it saves
+    static const size_t SIG_BATCH_MIN_SPLIT_SIZE = 16;
     struct SigVerifyJob {
         SigVerifyDoneCallback doneCallback;
         CancelCond cancelCond;
@@ -49,6 +53,14 @@ private:
     int sigVerifyBatchesInProgress{0};
     std::vector<SigVerifyJob> sigVerifyQueue;
 
+    // finished recoveries are remembered for a while, as their results are usually still on the way to the caller
+    // when the next shares for the same sign hash arrive
+    static const size_t MAX_RECENT_RECOVERIES = 1000;
+    std::mutex recoverMutex;
+    // sign hashes of queued, running and recently finished recoveries
+    std::set<uint256> recoverSignHashes;
+    std::deque<uint256> recentRecoveries;
+
 public:
     CBLSWorker();
     ~CBLSWorker();
@@ -139,6 +151,19 @@ public:
     std::future<bool> AsyncVerifySig(const CBLSSignature& sig, const CBLSPublicKey& pubKey, const uint256& msgHash, CancelCond cancelCond = [] { return false; });
     bool IsAsyncVerifyInProgress();
 
+    // Recovers a threshold signature from the given signature shares on the worker pool. Recoveries are deduplicated
+    // by the sign hash, if the same sign hash is already being recovered or was recovered recently, nothing is done and
+    // false is returned. Otherwise doneCallback is called with the recovered signature, which is invalid if
+    // recovery failed. Failed recoveries are forgotten right away, so they can be retried with other shares
+    bool AsyncRecoverSig(const uint256& signHash, const BLSSignatureVector& sigShares, const BLSIdVector& ids, SignDoneCallback doneCallback);
+
+    // Verifies many signatures at once. The signatures are split into one sub batch per worker thread (if parallel is
+    // true) and each sub batch is verified as a single aggregate. When a sub batch fails, it is bisected until the
+    // invalid signatures are found, so that k invalid signatures in a batch of n cost O(k * log(n)) aggregated
+    // verifications instead of n single verifications. The result contains one entry per signature
+    std::vector<bool> VerifySigBatch(const BLSSignatureVector& sigs, const BLSPublicKeyVector& pubKeys, const std::vector<uint256>& msgHashes,
+                                     bool parallel = true);
+
 private:
     void PushSigVerifyBatch();
 };
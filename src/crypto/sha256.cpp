@@ -8,6 +8,13 @@
 
 #include <string.h>
 
+#ifdef __SSE2__
+namespace sha256d32_sse2
+{
+void Transform_4way(unsigned char* out, const unsigned char* in);
+}
+#endif
+
 // Internal implementation code.
 namespace
 {
@@ -127,6 +134,30 @@ void Transform(uint32_t* s, const unsigned char* chunk)
     s[7] += h;
 }
 
+/** Compute the double-SHA256 of a single 32-byte input. */
+void TransformD32(unsigned char* out, const unsigned char* in)
+{
+    static const unsigned char pad[32] = {0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                          0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01, 0x00};
+    unsigned char chunk[64];
+    uint32_t s[8];
+
+    memcpy(chunk, in, 32);
+    memcpy(chunk + 32, pad, 32);
+    Initialize(s);
+    Transform(s, chunk);
+
+    for (int i = 0; i < 8; ++i) {
+        WriteBE32(chunk + i * 4, s[i]);
+    }
+    Initialize(s);
+    Transform(s, chunk);
+
+    for (int i = 0; i < 8; ++i) {
+        WriteBE32(out + i * 4, s[i]);
+    }
+}
+
 } // namespace sha256
 } // namespace
 
@@ -187,3 +218,21 @@ CSHA256& CSHA256::Reset()
     sha256::Initialize(s);
     return *this;
 }
+
+void SHA256D32(unsigned char* out, const unsigned char* in, size_t blocks)
+{
+#ifdef __SSE2__
+    while (blocks >= 4) {
+        sha256d32_sse2::Transform_4way(out, in);
+        out += 128;
+        in += 128;
+        blocks -= 4;
+    }
+#endif
+    while (blocks) {
+        sha256::TransformD32(out, in);
+        out += 32;
+        in += 32;
+        --blocks;
+    }
+}
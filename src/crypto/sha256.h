@@ -25,4 +25,11 @@ public:
     CSHA256& Reset();
 };
 
+/** Compute multiple double-SHA256's of 32-byte blobs.
+ *  output:  pointer to a blocks*32 byte output buffer
+ *  input:   pointer to a blocks*32 byte input buffer
+ *  blocks:  the number of hashes to compute.
+ */
+void SHA256D32(unsigned char* output, const unsigned char* input, size_t blocks);
+
 #endif // BITCOIN_CRYPTO_SHA256_H
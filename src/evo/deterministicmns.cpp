@@ -8,6 +8,7 @@
 #include "base58.h"
 #include "chainparams.h"
 #include "core_io.h"
+#include "memusage.h"
 #include "script/standard.h"
 #include "ui_interface.h"
 #include "validation.h"
@@ -498,8 +499,36 @@ void CDeterministicMNList::RemoveMN(const uint256& proTxHash)
     mnInternalIdMap = mnInternalIdMap.erase(dmn->internalId);
 }
 
-CDeterministicMNManager::CDeterministicMNManager(CEvoDB& _evoDb) :
-    evoDb(_evoDb)
+// Rough estimate of the memory used by nCount MNs in a list: the MN and its state, its entries in the three maps of
+// the list (with about 5 unique properties per MN) and the inner nodes of the maps
+size_t CDeterministicMNManager::EstimateMNsUsage(size_t nCount)
+{
+    return nCount * (memusage::MallocUsage(sizeof(CDeterministicMN)) + memusage::MallocUsage(sizeof(CDeterministicMNState)) +
+                     sizeof(std::pair<uint256, CDeterministicMNCPtr>) + sizeof(std::pair<uint64_t, uint256>) +
+                     5 * sizeof(std::pair<uint256, std::pair<uint256, uint32_t> >) + 4 * sizeof(void*));
+}
+
+// Lists derived from each other share all map nodes except the paths to the changed entries, so a list only adds
+// the changed entries and the copied inner nodes (up to 32 pointers wide) on top of the list it was derived from
+size_t CDeterministicMNManager::EstimateDiffUsage(const CDeterministicMNListDiff& diff, size_t nListSize)
+{
+    size_t nDepth = 1;
+    for (size_t n = nListSize; n > 32; n /= 32) {
+        nDepth++;
+    }
+    size_t nChanges = diff.addedMNs.size() + diff.updatedMNs.size() + diff.removedMns.size();
+    return nChanges * (EstimateMNsUsage(1) + 3 * nDepth * memusage::MallocUsage(32 * sizeof(void*)));
+}
+
+// Memory used by a cache entry besides the list
+size_t CDeterministicMNManager::EstimateCacheEntryUsage()
+{
+    return memusage::MallocUsage(sizeof(std::pair<uint256, CachedList>) + sizeof(void*)) + memusage::MallocUsage(sizeof(uint256) + 2 * sizeof(void*));
+}
+
+CDeterministicMNManager::CDeterministicMNManager(CEvoDB& _evoDb, size_t _nMaxListsCacheUsage) :
+    evoDb(_evoDb),
+    nMaxListsCacheUsage(_nMaxListsCacheUsage)
 {
 }
 
@@ -539,10 +568,15 @@ bool CDeterministicMNManager::ProcessBlock(const CBlock& block, const CBlockInde
         diff = oldList.BuildDiff(newList);
 
         evoDb.Write(std::make_pair(DB_LIST_DIFF, newList.GetBlockHash()), diff);
-        if ((nHeight % SNAPSHOT_LIST_PERIOD) == 0 || oldList.GetHeight() == -1) {
+
+        // Besides the regular snapshots, write one as soon as replaying the diffs since the last snapshot costs more than
+        // loading a snapshot, which keeps rebuilding lists of busy periods cheap
+        nChangesSinceSnapshot += diff.addedMNs.size() + diff.updatedMNs.size() + diff.removedMns.size();
+        if (IsSnapshotDue(nHeight, oldList.GetHeight() == -1, nChangesSinceSnapshot, newList.GetAllMNsCount())) {
             evoDb.Write(std::make_pair(DB_LIST_SNAPSHOT, newList.GetBlockHash()), newList);
-            LogPrintf("CDeterministicMNManager::%s -- Wrote snapshot. nHeight=%d, mapCurMNs.allMNsCount=%d\n",
-                __func__, nHeight, newList.GetAllMNsCount());
+            LogPrintf("CDeterministicMNManager::%s -- Wrote snapshot. nHeight=%d, mapCurMNs.allMNsCount=%d, changes=%d\n",
+                __func__, nHeight, newList.GetAllMNsCount(), nChangesSinceSnapshot);
+            nChangesSinceSnapshot = 0;
         }
     }
 
@@ -561,12 +595,15 @@ bool CDeterministicMNManager::ProcessBlock(const CBlock& block, const CBlockInde
         LogPrintf("CDeterministicMNManager::%s -- DIP3 is enforced now. nHeight=%d\n", __func__, nHeight);
     }
 
-    LOCK(cs);
-    CleanupCache(nHeight);
-
     return true;
 }
 
+bool CDeterministicMNManager::IsSnapshotDue(int nHeight, bool fFirstList, size_t nChangesSinceSnapshot, size_t nListSize)
+{
+    return (nHeight % SNAPSHOT_LIST_PERIOD) == 0 || fFirstList ||
+           nChangesSinceSnapshot >= std::max((size_t)SNAPSHOT_MIN_CHANGES, nListSize);
+}
+
 bool CDeterministicMNManager::UndoBlock(const CBlock& block, const CBlockIndex* pindex)
 {
     int nHeight = pindex->nHeight;
@@ -588,7 +625,7 @@ bool CDeterministicMNManager::UndoBlock(const CBlock& block, const CBlockIndex*
         evoDb.Erase(std::make_pair(DB_LIST_DIFF, blockHash));
         evoDb.Erase(std::make_pair(DB_LIST_SNAPSHOT, blockHash));
 
-        mnListsCache.erase(blockHash);
+        EraseCachedList(blockHash);
     }
 
     if (diff.HasChanges()) {
@@ -903,21 +940,19 @@ CDeterministicMNList CDeterministicMNManager::GetListForBlock(const CBlockIndex*
 
     while (true) {
         // try using cache before reading from disk
-        auto it = mnListsCache.find(pindex->GetBlockHash());
-        if (it != mnListsCache.end()) {
-            snapshot = it->second;
+        if (GetCachedList(pindex->GetBlockHash(), snapshot)) {
             break;
         }
 
         if (evoDb.Read(std::make_pair(DB_LIST_SNAPSHOT, pindex->GetBlockHash()), snapshot)) {
-            mnListsCache.emplace(pindex->GetBlockHash(), snapshot);
+            AddCachedList(snapshot, EstimateMNsUsage(snapshot.GetAllMNsCount()));
             break;
         }
 
         CDeterministicMNListDiff diff;
         if (!evoDb.Read(std::make_pair(DB_LIST_DIFF, pindex->GetBlockHash()), diff)) {
             snapshot = CDeterministicMNList(pindex->GetBlockHash(), -1, 0);
-            mnListsCache.emplace(pindex->GetBlockHash(), snapshot);
+            AddCachedList(snapshot, 0);
             break;
         }
 
@@ -925,17 +960,27 @@ CDeterministicMNList CDeterministicMNManager::GetListForBlock(const CBlockIndex*
         pindex = pindex->pprev;
     }
 
+    // Only cache every LISTS_CACHE_INTERVAL-th list on the way, so that rebuilding a list at an old height does not
+    // flush the recently used lists out of the cache. Each cached list is charged for the changes since the last
+    // cached list it shares its nodes with, and at full size once that one is evicted
+    size_t nUsage = 0;
+    uint256 baseHash = snapshot.GetBlockHash();
     for (const auto& p : listDiff) {
         auto diffIndex = p.first;
         auto& diff = p.second;
         if (diff.HasChanges()) {
             snapshot = snapshot.ApplyDiff(diffIndex, diff);
+            nUsage += EstimateDiffUsage(diff, snapshot.GetAllMNsCount());
         } else {
             snapshot.SetBlockHash(diffIndex->GetBlockHash());
             snapshot.SetHeight(diffIndex->nHeight);
         }
 
-        mnListsCache.emplace(diffIndex->GetBlockHash(), snapshot);
+        if (diffIndex->nHeight % LISTS_CACHE_INTERVAL == 0 || &p == &listDiff.back()) {
+            AddCachedList(snapshot, nUsage, baseHash);
+            nUsage = 0;
+            baseHash = snapshot.GetBlockHash();
+        }
     }
 
     return snapshot;
@@ -983,21 +1028,92 @@ bool CDeterministicMNManager::IsDIP3Enforced(int nHeight)
     return nHeight >= Params().GetConsensus().DIP0003EnforcementHeight;
 }
 
-void CDeterministicMNManager::CleanupCache(int nHeight)
+bool CDeterministicMNManager::GetCachedList(const uint256& blockHash, CDeterministicMNList& mnListRet)
 {
     AssertLockHeld(cs);
 
-    std::vector<uint256> toDelete;
-    for (const auto& p : mnListsCache) {
-        if (p.second.GetHeight() + LISTS_CACHE_SIZE < nHeight) {
-            toDelete.emplace_back(p.first);
+    auto it = mnListsCache.find(blockHash);
+    if (it == mnListsCache.end()) {
+        return false;
+    }
+    mnListsLru.splice(mnListsLru.begin(), mnListsLru, it->second.lruIt);
+    mnListRet = it->second.mnList;
+    return true;
+}
+
+void CDeterministicMNManager::AddCachedList(const CDeterministicMNList& mnList, size_t nUsage, const uint256& baseHash)
+{
+    AssertLockHeld(cs);
+
+    const uint256 blockHash = mnList.GetBlockHash();
+    EraseCachedList(blockHash);
+
+    // account for the cache entry itself too
+    nUsage += EstimateCacheEntryUsage();
+    const size_t nFullUsage = EstimateMNsUsage(mnList.GetAllMNsCount()) + EstimateCacheEntryUsage();
+
+    // evict the least recently used lists, but always keep the new one. A list only shares its nodes with its
+    // base as long as the base is cached
+    bool fShared = !baseHash.IsNull() && baseHash != blockHash;
+    while (true) {
+        if (fShared && !mnListsCache.count(baseHash)) {
+            nUsage = std::max(nUsage, nFullUsage);
+            fShared = false;
+        }
+        if (mnListsLru.empty() || nListsCacheUsage + nUsage <= nMaxListsCacheUsage) {
+            break;
         }
+        uint256 oldestHash = mnListsLru.back();
+        EraseCachedList(oldestHash);
     }
-    for (const auto& h : toDelete) {
-        mnListsCache.erase(h);
+
+    mnListsLru.emplace_front(blockHash);
+    mnListsCache.emplace(blockHash, CachedList{mnList, nUsage, mnListsLru.begin(), fShared ? baseHash : uint256(), {}});
+    nListsCacheUsage += nUsage;
+    if (fShared) {
+        mnListsCache.at(baseHash).vDerivedHashes.emplace_back(blockHash);
     }
 }
 
+size_t CDeterministicMNManager::GetListsCacheUsage()
+{
+    LOCK(cs);
+    return nListsCacheUsage;
+}
+
+bool CDeterministicMNManager::IsListCached(const uint256& blockHash)
+{
+    LOCK(cs);
+    return mnListsCache.count(blockHash) != 0;
+}
+
+void CDeterministicMNManager::EraseCachedList(const uint256& blockHash)
+{
+    AssertLockHeld(cs);
+
+    auto it = mnListsCache.find(blockHash);
+    if (it == mnListsCache.end()) {
+        return;
+    }
+
+    // the lists derived from this one now own all of their nodes, charge them at full size
+    for (const uint256& derivedHash : it->second.vDerivedHashes) {
+        auto derivedIt = mnListsCache.find(derivedHash);
+        if (derivedIt == mnListsCache.end() || derivedIt->second.baseHash != blockHash) {
+            continue;
+        }
+        CachedList& derived = derivedIt->second;
+        size_t nFullUsage = std::max(derived.nUsage, EstimateMNsUsage(derived.mnList.GetAllMNsCount()) + EstimateCacheEntryUsage());
+        nListsCacheUsage += nFullUsage - derived.nUsage;
+        derived.nUsage = nFullUsage;
+        derived.baseHash.SetNull();
+    }
+
+    nListsCacheUsage -= it->second.nUsage;
+    mnListsLru.erase(it->second.lruIt);
+    mnListsCache.erase(it);
+}
+
 bool CDeterministicMNManager::UpgradeDiff(CDBBatch& batch, const CBlockIndex* pindexNext, const CDeterministicMNList& curMNList, CDeterministicMNList& newMNList)
 {
     CDataStream oldDiffData(SER_DISK, CLIENT_VERSION);
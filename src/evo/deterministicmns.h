@@ -11,12 +11,15 @@
 #include "evodb.h"
 #include "providertx.h"
 #include "simplifiedmns.h"
+#include "saltedhasher.h"
 #include "sync.h"
 
 #include "immer/map.hpp"
 #include "immer/map_transient.hpp"
 
+#include <list>
 #include <map>
+#include <unordered_map>
 
 class CBlock;
 class CBlockIndex;
@@ -623,10 +626,16 @@ public:
     }
 };
 
+/** Default for -dmnlistcache, the memory used for cached MN lists in MiB */
+static const int64_t DEFAULT_DMN_LIST_CACHE_SIZE = 100;
+
 class CDeterministicMNManager
 {
-    static const int SNAPSHOT_LIST_PERIOD = 576; // once per day
-    static const int LISTS_CACHE_SIZE = 576;
+    static const int SNAPSHOT_LIST_PERIOD = 576; // at least once per day
+    // a snapshot is written earlier when the diffs since the last one changed more entries than this (or the list size)
+    static const size_t SNAPSHOT_MIN_CHANGES = 1000;
+    // when a list is rebuilt from diffs, every list at a height divisible by this is cached on the way
+    static const int LISTS_CACHE_INTERVAL = 64;
 
 public:
     CCriticalSection cs;
@@ -634,11 +643,30 @@ public:
 private:
     CEvoDB& evoDb;
 
-    std::map<uint256, CDeterministicMNList> mnListsCache;
+    struct CachedList {
+        CDeterministicMNList mnList;
+        // estimated memory not shared with the list it was derived from
+        size_t nUsage;
+        std::list<uint256>::iterator lruIt;
+        // the cached list this list shares its nodes with, null once the list is charged at full size
+        uint256 baseHash;
+        // cached lists which were derived from this one
+        std::vector<uint256> vDerivedHashes;
+    };
+    // LRU cache of lists, bounded by the estimated memory usage of the lists
+    std::unordered_map<uint256, CachedList, StaticSaltedHasher> mnListsCache;
+    // most recently used first
+    std::list<uint256> mnListsLru;
+    size_t nListsCacheUsage{0};
+    size_t nMaxListsCacheUsage;
+
+    // entries changed by the diffs written since the last snapshot
+    size_t nChangesSinceSnapshot{0};
+
     const CBlockIndex* tipIndex{nullptr};
 
 public:
-    CDeterministicMNManager(CEvoDB& _evoDb);
+    CDeterministicMNManager(CEvoDB& _evoDb, size_t _nMaxListsCacheUsage = DEFAULT_DMN_LIST_CACHE_SIZE << 20);
 
     bool ProcessBlock(const CBlock& block, const CBlockIndex* pindex, CValidationState& state, bool fJustCheck);
     bool UndoBlock(const CBlock& block, const CBlockIndex* pindex);
@@ -658,13 +686,26 @@ public:
 
     bool IsDIP3Enforced(int nHeight = -1);
 
+    // Whether the list of a block is written as a snapshot instead of only as a diff
+    static bool IsSnapshotDue(int nHeight, bool fFirstList, size_t nChangesSinceSnapshot, size_t nListSize);
+
+    // Estimated memory used by lists in the cache, see AddCachedList
+    static size_t EstimateMNsUsage(size_t nCount);
+    static size_t EstimateDiffUsage(const CDeterministicMNListDiff& diff, size_t nListSize);
+    static size_t EstimateCacheEntryUsage();
+    size_t GetListsCacheUsage();
+    // Does not change the order in which lists are evicted
+    bool IsListCached(const uint256& blockHash);
+
 public:
     // TODO these can all be removed in a future version
     bool UpgradeDiff(CDBBatch& batch, const CBlockIndex* pindexNext, const CDeterministicMNList& curMNList, CDeterministicMNList& newMNList);
     void UpgradeDBIfNeeded();
 
 private:
-    void CleanupCache(int nHeight);
+    bool GetCachedList(const uint256& blockHash, CDeterministicMNList& mnListRet);
+    void AddCachedList(const CDeterministicMNList& mnList, size_t nUsage, const uint256& baseHash = uint256());
+    void EraseCachedList(const uint256& blockHash);
 };
 
 extern CDeterministicMNManager* deterministicMNManager;
@@ -14,9 +14,18 @@
 #include "base58.h"
 #include "chainparams.h"
 #include "consensus/merkle.h"
+#include "memusage.h"
+#include "saltedhasher.h"
+#include "streams.h"
+#include "sync.h"
 #include "univalue.h"
 #include "validation.h"
 
+#include <algorithm>
+#include <limits>
+#include <list>
+#include <unordered_map>
+
 CSimplifiedMNListEntry::CSimplifiedMNListEntry(const CDeterministicMN& dmn) :
     proRegTxHash(dmn.proTxHash),
     confirmedHash(dmn.pdmnState->confirmedHash),
@@ -88,6 +97,183 @@ uint256 CSimplifiedMNList::CalcMerkleRoot(bool* pmutated) const
     return ComputeMerkleRoot(leaves, pmutated);
 }
 
+CSimplifiedMNListMerkleTree::CSimplifiedMNListMerkleTree() :
+    levels(1),
+    mutatedNodes(1)
+{
+}
+
+CSimplifiedMNListMerkleTree::~CSimplifiedMNListMerkleTree()
+{
+}
+
+void CSimplifiedMNListMerkleTree::Update(const CDeterministicMNList& newMNList)
+{
+    std::vector<uint256> removed;
+    std::vector<std::pair<uint256, uint256>> upserts;
+
+    if (!mnList) {
+        newMNList.ForEachMN(false, [&](const CDeterministicMNCPtr& dmn) {
+            upserts.emplace_back(dmn->proTxHash, CSimplifiedMNListEntry(*dmn).CalcHash());
+        });
+    } else {
+        // this only compares pointers for the unchanged MNs, which share their objects between the lists
+        auto diff = mnList->BuildDiff(newMNList);
+        for (const auto& id : diff.removedMns) {
+            removed.emplace_back(mnList->GetMNByInternalId(id)->proTxHash);
+        }
+        for (const auto& dmn : diff.addedMNs) {
+            upserts.emplace_back(dmn->proTxHash, CSimplifiedMNListEntry(*dmn).CalcHash());
+        }
+        for (const auto& p : diff.updatedMNs) {
+            auto dmn = newMNList.GetMNByInternalId(p.first);
+            upserts.emplace_back(dmn->proTxHash, CSimplifiedMNListEntry(*dmn).CalcHash());
+        }
+    }
+
+    Update(removed, upserts);
+    mnList = std::make_unique<CDeterministicMNList>(newMNList);
+}
+
+void CSimplifiedMNListMerkleTree::Update(const std::vector<uint256>& removed, const std::vector<std::pair<uint256, uint256>>& upserts)
+{
+    auto& leaves = levels[0];
+    std::vector<size_t> changed;
+    std::vector<std::pair<uint256, uint256>> inserted;
+
+    for (const auto& p : upserts) {
+        auto it = std::lower_bound(proRegTxHashes.begin(), proRegTxHashes.end(), p.first);
+        if (it != proRegTxHashes.end() && *it == p.first) {
+            size_t i = it - proRegTxHashes.begin();
+            if (leaves[i] != p.second) {
+                leaves[i] = p.second;
+                changed.emplace_back(i);
+            }
+        } else {
+            inserted.emplace_back(p);
+        }
+    }
+
+    // everything from this leaf on moved or changed
+    size_t shiftedFrom = leaves.size();
+
+    if (!removed.empty() || !inserted.empty()) {
+        std::vector<uint256> sortedRemoved(removed);
+        std::sort(sortedRemoved.begin(), sortedRemoved.end());
+        std::sort(inserted.begin(), inserted.end());
+
+        std::vector<uint256> newProRegTxHashes;
+        std::vector<uint256> newLeaves;
+        newProRegTxHashes.reserve(proRegTxHashes.size() + inserted.size());
+        newLeaves.reserve(proRegTxHashes.size() + inserted.size());
+
+        size_t i = 0, r = 0, a = 0;
+        shiftedFrom = std::numeric_limits<size_t>::max();
+        while (i < proRegTxHashes.size() || a < inserted.size()) {
+            if (a < inserted.size() && (i == proRegTxHashes.size() || inserted[a].first < proRegTxHashes[i])) {
+                shiftedFrom = std::min(shiftedFrom, newLeaves.size());
+                newProRegTxHashes.emplace_back(inserted[a].first);
+                newLeaves.emplace_back(inserted[a].second);
+                a++;
+                continue;
+            }
+            while (r < sortedRemoved.size() && sortedRemoved[r] < proRegTxHashes[i]) {
+                r++;
+            }
+            if (r < sortedRemoved.size() && sortedRemoved[r] == proRegTxHashes[i]) {
+                shiftedFrom = std::min(shiftedFrom, newLeaves.size());
+            } else {
+                newProRegTxHashes.emplace_back(proRegTxHashes[i]);
+                newLeaves.emplace_back(leaves[i]);
+            }
+            i++;
+        }
+        shiftedFrom = std::min(shiftedFrom, newLeaves.size());
+
+        proRegTxHashes = std::move(newProRegTxHashes);
+        leaves = std::move(newLeaves);
+
+        // leaves right of the shift are rehashed anyway and their old positions are stale
+        changed.erase(std::remove_if(changed.begin(), changed.end(), [&](size_t i) { return i >= shiftedFrom; }), changed.end());
+    }
+
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+    UpdateLevels(std::move(changed), shiftedFrom);
+}
+
+void CSimplifiedMNListMerkleTree::UpdateLevels(std::vector<size_t> changed, size_t shiftedFrom)
+{
+    const size_t nLeaves = levels[0].size();
+
+    size_t k = 0;
+    for (; levels[k].size() > 1; k++) {
+        if (levels.size() == k + 1) {
+            levels.emplace_back();
+            mutatedNodes.emplace_back();
+        }
+        const auto& cur = levels[k];
+        auto& next = levels[k + 1];
+        auto& nextMutated = mutatedNodes[k + 1];
+
+        size_t nextSize = (cur.size() + 1) / 2;
+        for (size_t j = nextSize; j < next.size(); j++) {
+            nMutatedNodes -= nextMutated[j];
+        }
+        size_t nextShiftedFrom = std::min(shiftedFrom / 2, std::min(next.size(), nextSize));
+        next.resize(nextSize);
+        nextMutated.resize(nextSize, false);
+
+        std::vector<size_t> nextChanged;
+        for (size_t i : changed) {
+            size_t j = i / 2;
+            if (j < nextShiftedFrom && (nextChanged.empty() || nextChanged.back() != j)) {
+                nextChanged.emplace_back(j);
+            }
+        }
+
+        auto calcNode = [&](size_t j) {
+            const uint256& left = cur[2 * j];
+            bool fHasRight = 2 * j + 1 < cur.size();
+            const uint256& right = fHasRight ? cur[2 * j + 1] : left;
+            // like ComputeMerkleRoot, only identical children of complete subtrees count as mutation
+            bool fMutated = fHasRight && left == right && ((2 * j + 2) << k) <= nLeaves;
+            nMutatedNodes = nMutatedNodes - nextMutated[j] + fMutated;
+            nextMutated[j] = fMutated;
+            CHash256().Write(left.begin(), 32).Write(right.begin(), 32).Finalize(next[j].begin());
+        };
+        for (size_t j : nextChanged) {
+            calcNode(j);
+        }
+        for (size_t j = nextShiftedFrom; j < nextSize; j++) {
+            calcNode(j);
+        }
+
+        changed = std::move(nextChanged);
+        shiftedFrom = nextShiftedFrom;
+    }
+
+    // drop the levels above the root
+    for (size_t l = k + 1; l < levels.size(); l++) {
+        for (bool fMutated : mutatedNodes[l]) {
+            nMutatedNodes -= fMutated;
+        }
+    }
+    levels.resize(k + 1);
+    mutatedNodes.resize(k + 1);
+}
+
+uint256 CSimplifiedMNListMerkleTree::GetRoot(bool* pmutated) const
+{
+    if (pmutated) {
+        *pmutated = nMutatedNodes != 0;
+    }
+    if (levels[0].empty()) {
+        return uint256();
+    }
+    return levels.back()[0];
+}
+
 CSimplifiedMNListDiff::CSimplifiedMNListDiff()
 {
 }
@@ -185,10 +371,10 @@ void CSimplifiedMNListDiff::ToJson(UniValue& obj) const
     }
 }
 
-bool BuildSimplifiedMNListDiff(const uint256& baseBlockHash, const uint256& blockHash, CSimplifiedMNListDiff& mnListDiffRet, std::string& errorRet)
+static bool GetSimplifiedMNListDiffBlocks(const uint256& baseBlockHash, const uint256& blockHash,
+                                          const CBlockIndex*& baseBlockIndexRet, const CBlockIndex*& blockIndexRet, std::string& errorRet)
 {
     AssertLockHeld(cs_main);
-    mnListDiffRet = CSimplifiedMNListDiff();
 
     const CBlockIndex* baseBlockIndex = chainActive.Genesis();
     if (!baseBlockHash.IsNull()) {
@@ -215,6 +401,17 @@ bool BuildSimplifiedMNListDiff(const uint256& baseBlockHash, const uint256& bloc
         return false;
     }
 
+    baseBlockIndexRet = baseBlockIndex;
+    blockIndexRet = blockIndex;
+    return true;
+}
+
+static bool BuildSimplifiedMNListDiff(const uint256& baseBlockHash, const CBlockIndex* baseBlockIndex, const CBlockIndex* blockIndex,
+                                      CSimplifiedMNListDiff& mnListDiffRet, std::string& errorRet)
+{
+    AssertLockHeld(cs_main);
+    mnListDiffRet = CSimplifiedMNListDiff();
+
     LOCK(deterministicMNManager->cs);
 
     auto baseDmnList = deterministicMNManager->GetListForBlock(baseBlockIndex);
@@ -234,7 +431,7 @@ bool BuildSimplifiedMNListDiff(const uint256& baseBlockHash, const uint256& bloc
     // TODO store coinbase TX in CBlockIndex
     CBlock block;
     if (!ReadBlockFromDisk(block, blockIndex, Params().GetConsensus())) {
-        errorRet = strprintf("failed to read block %s from disk", blockHash.ToString());
+        errorRet = strprintf("failed to read block %s from disk", blockIndex->GetBlockHash().ToString());
         return false;
     }
 
@@ -250,3 +447,109 @@ bool BuildSimplifiedMNListDiff(const uint256& baseBlockHash, const uint256& bloc
 
     return true;
 }
+
+std::shared_ptr<const CSimplifiedMNListDiff> CSimplifiedMNListDiffCache::Get(const uint256& baseBlockHash, const uint256& blockHash,
+                                                                            const BuildFunc& build, std::string& errorRet)
+{
+    LOCK(cs);
+    Entry* entry = GetOrBuild(Key(baseBlockHash, blockHash), build, errorRet);
+    return entry ? entry->diff : nullptr;
+}
+
+std::shared_ptr<const std::vector<unsigned char>> CSimplifiedMNListDiffCache::GetSerialized(const uint256& baseBlockHash, const uint256& blockHash,
+                                                                                           int nVersion, const BuildFunc& build, std::string& errorRet)
+{
+    LOCK(cs);
+    Entry* entry = GetOrBuild(Key(baseBlockHash, blockHash), build, errorRet);
+    if (!entry) {
+        return nullptr;
+    }
+    auto& data = entry->data[nVersion >= LLMQS_PROTO_VERSION ? 1 : 0];
+    if (!data) {
+        auto v = std::make_shared<std::vector<unsigned char>>();
+        CVectorWriter(SER_NETWORK, nVersion, *v, 0, *entry->diff);
+        entry->nUsage += memusage::DynamicUsage(*v);
+        nCacheUsage += memusage::DynamicUsage(*v);
+        data = std::move(v);
+    }
+    return data;
+}
+
+size_t CSimplifiedMNListDiffCache::GetUsage()
+{
+    LOCK(cs);
+    return nCacheUsage;
+}
+
+CSimplifiedMNListDiffCache::Entry* CSimplifiedMNListDiffCache::GetOrBuild(const Key& key, const BuildFunc& build, std::string& errorRet)
+{
+    AssertLockHeld(cs);
+
+    auto it = cache.find(key);
+    if (it != cache.end()) {
+        lru.splice(lru.begin(), lru, it->second.lruIt);
+        return &it->second;
+    }
+
+    auto diff = std::make_shared<CSimplifiedMNListDiff>();
+    if (!build(*diff, errorRet)) {
+        return nullptr;
+    }
+
+    // the deserialized diff takes about as much memory as its serialized form
+    size_t nUsage = ::GetSerializeSize(*diff, SER_NETWORK, PROTOCOL_VERSION);
+    while (!lru.empty() && nCacheUsage + nUsage > nMaxCacheUsage) {
+        auto oldestIt = cache.find(lru.back());
+        nCacheUsage -= oldestIt->second.nUsage;
+        cache.erase(oldestIt);
+        lru.pop_back();
+    }
+
+    lru.emplace_front(key);
+    Entry& entry = cache[key];
+    entry.diff = std::move(diff);
+    entry.nUsage = nUsage;
+    entry.lruIt = lru.begin();
+    nCacheUsage += nUsage;
+    return &entry;
+}
+
+static CSimplifiedMNListDiffCache mnListDiffCache;
+
+bool BuildSimplifiedMNListDiff(const uint256& baseBlockHash, const uint256& blockHash, CSimplifiedMNListDiff& mnListDiffRet, std::string& errorRet)
+{
+    AssertLockHeld(cs_main);
+    mnListDiffRet = CSimplifiedMNListDiff();
+
+    const CBlockIndex* baseBlockIndex;
+    const CBlockIndex* blockIndex;
+    if (!GetSimplifiedMNListDiffBlocks(baseBlockHash, blockHash, baseBlockIndex, blockIndex, errorRet)) {
+        return false;
+    }
+
+    auto diff = mnListDiffCache.Get(baseBlockHash, blockHash, [&](CSimplifiedMNListDiff& mnListDiff, std::string& error) {
+        return BuildSimplifiedMNListDiff(baseBlockHash, baseBlockIndex, blockIndex, mnListDiff, error);
+    }, errorRet);
+    if (!diff) {
+        return false;
+    }
+    mnListDiffRet = *diff;
+    return true;
+}
+
+bool GetSerializedSimplifiedMNListDiff(const uint256& baseBlockHash, const uint256& blockHash, int nVersion,
+                                       std::shared_ptr<const std::vector<unsigned char>>& dataRet, std::string& errorRet)
+{
+    AssertLockHeld(cs_main);
+
+    const CBlockIndex* baseBlockIndex;
+    const CBlockIndex* blockIndex;
+    if (!GetSimplifiedMNListDiffBlocks(baseBlockHash, blockHash, baseBlockIndex, blockIndex, errorRet)) {
+        return false;
+    }
+
+    dataRet = mnListDiffCache.GetSerialized(baseBlockHash, blockHash, nVersion, [&](CSimplifiedMNListDiff& mnListDiff, std::string& error) {
+        return BuildSimplifiedMNListDiff(baseBlockHash, baseBlockIndex, blockIndex, mnListDiff, error);
+    }, errorRet);
+    return dataRet != nullptr;
+}
@@ -9,9 +9,16 @@
 #include "merkleblock.h"
 #include "netaddress.h"
 #include "pubkey.h"
+#include "saltedhasher.h"
 #include "serialize.h"
+#include "sync.h"
 #include "version.h"
 
+#include <functional>
+#include <list>
+#include <memory>
+#include <unordered_map>
+
 class UniValue;
 class CDeterministicMNList;
 class CDeterministicMN;
@@ -84,6 +91,41 @@ public:
     uint256 CalcMerkleRoot(bool* pmutated = NULL) const;
 };
 
+/**
+ * Merkle tree of a simplified MN list, with the leaves sorted by proRegTxHash like in CSimplifiedMNList.
+ * All levels of the tree are kept, so when the tree is moved to another list only the changed leaves and
+ * the paths above them are rehashed. Added and removed entries shift the leaves right of them, which
+ * requires rehashing the inner nodes right of them, but still none of the other leaves.
+ */
+class CSimplifiedMNListMerkleTree
+{
+private:
+    // list the tree currently represents
+    std::unique_ptr<CDeterministicMNList> mnList;
+
+    // leaf order
+    std::vector<uint256> proRegTxHashes;
+    // levels[0] holds the leaf hashes, the last level holds the root
+    std::vector<std::vector<uint256>> levels;
+    // whether a node was built from two identical children, which makes the tree mutated (see ComputeMerkleRoot)
+    std::vector<std::vector<bool>> mutatedNodes;
+    size_t nMutatedNodes{0};
+
+public:
+    CSimplifiedMNListMerkleTree();
+    ~CSimplifiedMNListMerkleTree();
+
+    // Move the tree to the given list, only rehashing what changed compared to the list it represented before
+    void Update(const CDeterministicMNList& newMNList);
+    // Update single entries, upserts holds (proRegTxHash, leaf hash) pairs
+    void Update(const std::vector<uint256>& removed, const std::vector<std::pair<uint256, uint256>>& upserts);
+
+    uint256 GetRoot(bool* pmutated = nullptr) const;
+
+private:
+    void UpdateLevels(std::vector<size_t> changed, size_t shiftedFrom);
+};
+
 /// P2P messages
 
 class CGetSimplifiedMNListDiff
@@ -145,6 +187,58 @@ public:
     void ToJson(UniValue& obj) const;
 };
 
+/**
+ * LRU cache of mnlistdiffs keyed by the requested (baseBlockHash, blockHash) pair, bounded by the size of the
+ * serialized diffs. A diff only depends on the two blocks, so entries never become stale. Callers must however
+ * check that both blocks are still in the active chain before serving a cached diff.
+ */
+class CSimplifiedMNListDiffCache
+{
+public:
+    static const size_t DEFAULT_MAX_CACHE_USAGE = 32 << 20;
+
+    // builds the diff when it is not cached
+    typedef std::function<bool(CSimplifiedMNListDiff& mnListDiffRet, std::string& errorRet)> BuildFunc;
+
+private:
+    typedef std::pair<uint256, uint256> Key;
+
+    struct Entry {
+        std::shared_ptr<const CSimplifiedMNListDiff> diff;
+        // serialized for peers without and with LLMQ support, see CSimplifiedMNListDiff::SerializationOp
+        std::shared_ptr<const std::vector<unsigned char>> data[2];
+        size_t nUsage;
+        std::list<Key>::iterator lruIt;
+    };
+
+    CCriticalSection cs;
+    std::unordered_map<Key, Entry, StaticSaltedHasher> cache;
+    // most recently used first
+    std::list<Key> lru;
+    size_t nCacheUsage{0};
+    size_t nMaxCacheUsage;
+
+public:
+    explicit CSimplifiedMNListDiffCache(size_t _nMaxCacheUsage = DEFAULT_MAX_CACHE_USAGE) : nMaxCacheUsage(_nMaxCacheUsage) {}
+
+    std::shared_ptr<const CSimplifiedMNListDiff> Get(const uint256& baseBlockHash, const uint256& blockHash, const BuildFunc& build,
+                                                     std::string& errorRet);
+    std::shared_ptr<const std::vector<unsigned char>> GetSerialized(const uint256& baseBlockHash, const uint256& blockHash, int nVersion,
+                                                                    const BuildFunc& build, std::string& errorRet);
+    size_t GetUsage();
+
+private:
+    Entry* GetOrBuild(const Key& key, const BuildFunc& build, std::string& errorRet);
+};
+
 bool BuildSimplifiedMNListDiff(const uint256& baseBlockHash, const uint256& blockHash, CSimplifiedMNListDiff& mnListDiffRet, std::string& errorRet);
 
+/**
+ * Get the mnlistdiff message for the given blocks, serialized for a peer with the given protocol version.
+ * Diffs are cached together with their serialized form, so answering repeated requests for the same
+ * (baseBlockHash, blockHash) pair requires neither building nor serializing the diff again.
+ */
+bool GetSerializedSimplifiedMNListDiff(const uint256& baseBlockHash, const uint256& blockHash, int nVersion,
+                                       std::shared_ptr<const std::vector<unsigned char>>& dataRet, std::string& errorRet);
+
 #endif //DASH_SIMPLIFIEDMNS_H
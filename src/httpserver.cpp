@@ -19,12 +19,14 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <signal.h>
+#include <atomic>
 #include <future>
 
 #include <event2/event.h>
 #include <event2/http.h>
 #include <event2/thread.h>
 #include <event2/buffer.h>
+#include <event2/bufferevent.h>
 #include <event2/util.h>
 #include <event2/keyvalq_struct.h>
 
@@ -37,6 +39,21 @@
 
 /** Maximum size of http request (request line + headers) */
 static const size_t MAX_HEADERS_SIZE = 8192;
+/** Maximum number of chunks of a chunked reply which may be waiting to be sent to the client */
+static const size_t MAX_QUEUED_REPLY_CHUNKS = 4;
+
+/** Flow control for a chunked reply, shared between the worker writing it and the event loop sending it */
+struct HTTPChunkedReply
+{
+    std::mutex cs;
+    std::condition_variable cond;
+    /** Chunks which were handed to the event loop but not added to the connection's output buffer yet */
+    size_t nPending = 0;
+    /** Chunks in the connection's output buffer which weren't written to the socket yet */
+    size_t nBuffered = 0;
+    /** The connection was closed, nothing written anymore will reach the client */
+    bool fClosed = false;
+};
 
 /** HTTP request work item */
 class HTTPWorkItem : public HTTPClosure
@@ -172,6 +189,8 @@ struct HTTPPathHandler
 
 //! libevent event loop
 static struct event_base* eventBase = 0;
+//! Set when the server is interrupted, to stop workers waiting for a client to read a chunked reply
+static std::atomic<bool> fChunkedRepliesInterrupted(false);
 //! HTTP server
 struct evhttp* eventHTTP = 0;
 //! List of subnets to allow RPC connections from
@@ -475,6 +494,7 @@ void InterruptHTTPServer()
     }
     if (workQueue)
         workQueue->Interrupt();
+    fChunkedRepliesInterrupted = true;
 }
 
 void StopHTTPServer()
@@ -547,12 +567,16 @@ void HTTPEvent::trigger(struct timeval* tv)
         evtimer_add(ev, tv); // trigger after timeval passed
 }
 HTTPRequest::HTTPRequest(struct evhttp_request* _req) : req(_req),
-                                                       replySent(false)
+                                                       replySent(false),
+                                                       replyStarted(false)
 {
 }
 HTTPRequest::~HTTPRequest()
 {
-    if (!replySent) {
+    if (replyStarted && !replySent) {
+        // Chunked replies must always be completed, or evhttp won't clean up the request
+        WriteReplyEnd();
+    } else if (!replySent) {
         // Keep track of whether reply was sent to avoid request leaks
         LogPrintf("%s: Unhandled request\n", __func__);
         WriteReply(HTTP_INTERNAL, "Unhandled request");
@@ -605,7 +629,7 @@ void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
  */
 void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
 {
-    assert(!replySent && req);
+    assert(!replySent && !replyStarted && req);
     // Send event to main http thread to send reply message
     struct evbuffer* evb = evhttp_request_get_output_buffer(req);
     assert(evb);
@@ -617,6 +641,107 @@ void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
     req = 0; // transferred back to main thread
 }
 
+/** All chunks in the output buffer were written to the socket, see WriteReplyChunk */
+static void http_reply_chunks_sent_cb(struct evhttp_connection* evcon, void* arg)
+{
+    HTTPChunkedReply* reply = (HTTPChunkedReply*)arg;
+    std::lock_guard<std::mutex> lock(reply->cs);
+    reply->nBuffered = 0;
+    reply->cond.notify_all();
+}
+
+/** The connection of a chunked reply was closed before the reply was completed */
+static void http_reply_close_cb(struct evhttp_connection* evcon, void* arg)
+{
+    HTTPChunkedReply* reply = (HTTPChunkedReply*)arg;
+    std::lock_guard<std::mutex> lock(reply->cs);
+    reply->fClosed = true;
+    reply->cond.notify_all();
+}
+
+void HTTPRequest::WriteReplyStart(int nStatus)
+{
+    assert(!replySent && !replyStarted && req);
+    chunkedReply = std::make_shared<HTTPChunkedReply>();
+    struct evhttp_request* evreq = req;
+    std::shared_ptr<HTTPChunkedReply> reply = chunkedReply;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [evreq, nStatus, reply]() {
+        evhttp_send_reply_start(evreq, nStatus, NULL);
+        // Wakes up the worker if the client goes away. The callback is removed again when the
+        // reply is completed, and the reply state is kept alive until then by WriteReplyEnd.
+        evhttp_connection* evcon = evhttp_request_get_connection(evreq);
+        if (evcon) {
+            evhttp_connection_set_closecb(evcon, http_reply_close_cb, reply.get());
+        } else {
+            http_reply_close_cb(NULL, reply.get());
+        }
+    });
+    ev->trigger(0);
+    replyStarted = true;
+}
+
+bool HTTPRequest::WriteReplyChunk(const std::string& strChunk)
+{
+    assert(replyStarted && !replySent && req);
+    if (strChunk.empty())
+        return true;
+    {
+        std::unique_lock<std::mutex> lock(chunkedReply->cs);
+        while (chunkedReply->nPending + chunkedReply->nBuffered >= MAX_QUEUED_REPLY_CHUNKS && !chunkedReply->fClosed && !fChunkedRepliesInterrupted) {
+            chunkedReply->cond.wait_for(lock, std::chrono::milliseconds(100));
+        }
+        if (chunkedReply->fClosed || fChunkedRepliesInterrupted)
+            return false;
+        chunkedReply->nPending++;
+    }
+
+    // Events are handled in the order they were triggered, so the chunks stay in order.
+    // If the client went away in the meantime, evhttp detaches the request from the
+    // connection and ignores the chunks until the reply is completed.
+    struct evbuffer* evb = evbuffer_new();
+    assert(evb);
+    evbuffer_add(evb, strChunk.data(), strChunk.size());
+    struct evhttp_request* evreq = req;
+    std::shared_ptr<HTTPChunkedReply> reply = chunkedReply;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [evreq, evb, reply]() {
+        evhttp_connection* evcon = evhttp_request_get_connection(evreq);
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100
+        // The callback is called once the connection's output buffer is empty again
+        evhttp_send_reply_chunk_with_cb(evreq, evb, http_reply_chunks_sent_cb, reply.get());
+        bool fBuffered = evcon && evbuffer_get_length(bufferevent_get_output(evhttp_connection_get_bufferevent(evcon))) > 0;
+#else
+        // No way to find out when the chunk was sent, libevent has to buffer what the client doesn't read
+        evhttp_send_reply_chunk(evreq, evb);
+        bool fBuffered = false;
+#endif
+        evbuffer_free(evb);
+        std::lock_guard<std::mutex> lock(reply->cs);
+        reply->nPending--;
+        reply->nBuffered = fBuffered ? reply->nBuffered + 1 : 0;
+        reply->cond.notify_all();
+    });
+    ev->trigger(0);
+    return true;
+}
+
+void HTTPRequest::WriteReplyEnd()
+{
+    assert(replyStarted && !replySent && req);
+    struct evhttp_request* evreq = req;
+    std::shared_ptr<HTTPChunkedReply> reply = chunkedReply;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [evreq, reply]() {
+        evhttp_connection* evcon = evhttp_request_get_connection(evreq);
+        if (evcon) {
+            evhttp_connection_set_closecb(evcon, NULL, NULL);
+        }
+        evhttp_send_reply_end(evreq);
+    });
+    ev->trigger(0);
+    chunkedReply.reset();
+    replySent = true;
+    req = 0; // transferred back to main thread
+}
+
 CService HTTPRequest::GetPeer()
 {
     evhttp_connection* con = evhttp_request_get_connection(req);
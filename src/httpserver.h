@@ -8,6 +8,7 @@
 #include <string>
 #include <stdint.h>
 #include <functional>
+#include <memory>
 
 static const int DEFAULT_HTTP_THREADS=4;
 static const int DEFAULT_HTTP_WORKQUEUE=16;
@@ -17,6 +18,7 @@ struct evhttp_request;
 struct event_base;
 class CService;
 class HTTPRequest;
+struct HTTPChunkedReply;
 
 /** Initialize HTTP server.
  * Call this before RegisterHTTPHandler or EventBase().
@@ -55,6 +57,8 @@ class HTTPRequest
 private:
     struct evhttp_request* req;
     bool replySent;
+    bool replyStarted;
+    std::shared_ptr<HTTPChunkedReply> chunkedReply;
 
 public:
     HTTPRequest(struct evhttp_request* req);
@@ -110,6 +114,32 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     void WriteReply(int nStatus, const std::string& strReply = "");
+
+    /**
+     * Start a chunked HTTP reply, for results too large to build in memory first.
+     * The body is sent with WriteReplyChunk and the reply is completed with WriteReplyEnd.
+     *
+     * @note Call this instead of WriteReply. Once the reply is started the status can't
+     * be changed anymore, so errors have to be reported inside the body.
+     */
+    void WriteReplyStart(int nStatus);
+
+    /**
+     * Send a chunk of the body of a reply started with WriteReplyStart.
+     * Chunks are sent in the order they are written. Blocks while the client has
+     * MAX_QUEUED_REPLY_CHUNKS chunks left to read, so a slow client can't make the
+     * reply pile up in memory.
+     * Returns false if the client went away or the server is shutting down, in which
+     * case there is no point in producing more chunks.
+     */
+    bool WriteReplyChunk(const std::string& strChunk);
+
+    /**
+     * Complete a reply started with WriteReplyStart.
+     *
+     * @note Same as for WriteReply, do not call any other HTTPRequest methods after calling this.
+     */
+    void WriteReplyEnd();
 };
 
 /** Event handler closure.
@@ -0,0 +1,585 @@
+// Copyright (c) 2019 The Sierra Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "indexbuilder.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "coins.h"
+#include "hash.h"
+#include "primitives/block.h"
+#include "spentindex.h"
+#include "txdb.h"
+#include "undo.h"
+#include "util.h"
+#include "utiltime.h"
+#include "validation.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+namespace {
+
+/** Number of consecutive blocks a worker reads and indexes in one go */
+const int BLOCKS_PER_CHUNK = 100;
+/** Number of blocks whose entries are written together */
+const int BLOCKS_PER_WRITE = 2000;
+/** Number of chunks the workers may get ahead of the writer */
+const size_t MAX_PENDING_CHUNKS_PER_WORKER = 4;
+/** Number of unspent outputs whose entries are written together */
+const size_t UNSPENT_PER_WRITE = 50000;
+/** Number of unspent outputs looked up in the UTXO set per cs_main lock */
+const size_t UNSPENT_PER_LOCK = 1000;
+const int MAX_INDEXBUILDER_THREADS = 8;
+
+std::atomic<int> nIndexesBuilding(0);
+
+const char* GetIndexFlag(IndexBuilderIndex index)
+{
+    if (index == INDEXBUILDER_ADDRESS)
+        return "addressindex";
+    if (index == INDEXBUILDER_SPENT)
+        return "spentindex";
+    return "timestampindex";
+}
+
+/** Flags of the indexes whose history is still being built, they survive restarts */
+std::string GetBuildingFlag(IndexBuilderIndex index)
+{
+    return std::string("building.") + GetIndexFlag(index);
+}
+
+const IndexBuilderIndex ALL_INDEXES[] = {INDEXBUILDER_ADDRESS, INDEXBUILDER_SPENT, INDEXBUILDER_TIMESTAMP};
+
+/** The index entries of a range of blocks */
+struct IndexChunk
+{
+    std::vector<const CBlockIndex*> vBlocks;
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentIndex;
+    std::vector<CTimestampIndexKey> timestampIndex;
+};
+
+/** Get the address index type and hash of the address a script pays to */
+bool GetAddressKey(const CScript& script, int& type, uint160& hashBytes)
+{
+    if (script.IsPayToScriptHash()) {
+        hashBytes = uint160(std::vector<unsigned char>(script.begin()+2, script.begin()+22));
+        type = 2;
+    } else if (script.IsPayToPublicKeyHash()) {
+        hashBytes = uint160(std::vector<unsigned char>(script.begin()+3, script.begin()+23));
+        type = 1;
+    } else if (script.IsPayToPublicKey()) {
+        hashBytes = Hash160(script.begin()+1, script.end()-1);
+        type = 1;
+    } else {
+        hashBytes.SetNull();
+        type = 0;
+        return false;
+    }
+    return true;
+}
+
+/** Derive the entries ConnectBlock adds to the history indexes for a block */
+void IndexBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, int nIndexes, IndexChunk& chunk)
+{
+    if (nIndexes & INDEXBUILDER_TIMESTAMP) {
+        chunk.timestampIndex.push_back(CTimestampIndexKey(pindex->nTime, pindex->GetBlockHash()));
+    }
+
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = *block.vtx[i];
+        const uint256 txhash = tx.GetHash();
+
+        if (!tx.IsCoinBase()) {
+            const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+            for (size_t j = 0; j < tx.vin.size(); j++) {
+                const CTxOut& prevout = txundo.vprevout[j].out;
+                uint160 hashBytes;
+                int type;
+                bool fAddress = GetAddressKey(prevout.scriptPubKey, type, hashBytes);
+
+                if ((nIndexes & INDEXBUILDER_ADDRESS) && fAddress) {
+                    chunk.addressIndex.push_back(std::make_pair(CAddressIndexKey(type, hashBytes, pindex->nHeight, i, txhash, j, true), prevout.nValue * -1));
+                }
+                if (nIndexes & INDEXBUILDER_SPENT) {
+                    chunk.spentIndex.push_back(std::make_pair(CSpentIndexKey(tx.vin[j].prevout.hash, tx.vin[j].prevout.n), CSpentIndexValue(txhash, j, pindex->nHeight, prevout.nValue, type, hashBytes)));
+                }
+            }
+        }
+
+        if (nIndexes & INDEXBUILDER_ADDRESS) {
+            for (unsigned int k = 0; k < tx.vout.size(); k++) {
+                const CTxOut& out = tx.vout[k];
+                uint160 hashBytes;
+                int type;
+                if (GetAddressKey(out.scriptPubKey, type, hashBytes)) {
+                    chunk.addressIndex.push_back(std::make_pair(CAddressIndexKey(type, hashBytes, pindex->nHeight, i, txhash, k, false), out.nValue));
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Write the entries of the chunks, sorted by key. Blocks which were disconnected after they were
+ * read are left out, their replacements are indexed by ConnectBlock. cs_main is not held while
+ * writing, so blocks can also be disconnected while their entries are written. DisconnectBlock
+ * had nothing to erase for those yet, so their entries are erased here afterwards.
+ */
+bool WriteChunks(const std::vector<IndexChunk>& vChunks, int nIndexes)
+{
+    std::set<int> setStaleHeights;
+    std::set<uint256> setStaleHashes;
+    std::vector<const CBlockIndex*> vWritten;
+    {
+        LOCK(cs_main);
+        for (const IndexChunk& chunk : vChunks) {
+            for (const CBlockIndex* pindex : chunk.vBlocks) {
+                if (chainActive.Contains(pindex)) {
+                    vWritten.push_back(pindex);
+                } else {
+                    setStaleHeights.insert(pindex->nHeight);
+                    setStaleHashes.insert(pindex->GetBlockHash());
+                }
+            }
+        }
+    }
+
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentIndex;
+    std::vector<CTimestampIndexKey> timestampIndex;
+    for (const IndexChunk& chunk : vChunks) {
+        for (const auto& entry : chunk.addressIndex) {
+            if (!setStaleHeights.count(entry.first.blockHeight))
+                addressIndex.push_back(entry);
+        }
+        for (const auto& entry : chunk.spentIndex) {
+            if (!setStaleHeights.count(entry.second.blockHeight))
+                spentIndex.push_back(entry);
+        }
+        for (const auto& entry : chunk.timestampIndex) {
+            if (!setStaleHashes.count(entry.blockHash))
+                timestampIndex.push_back(entry);
+        }
+    }
+
+    std::sort(addressIndex.begin(), addressIndex.end(), [](const std::pair<CAddressIndexKey, CAmount>& a, const std::pair<CAddressIndexKey, CAmount>& b) {
+        return CAddressIndexKeyCompare()(a.first, b.first);
+    });
+    std::sort(spentIndex.begin(), spentIndex.end(), [](const std::pair<CSpentIndexKey, CSpentIndexValue>& a, const std::pair<CSpentIndexKey, CSpentIndexValue>& b) {
+        return CSpentIndexKeyCompare()(a.first, b.first);
+    });
+    std::sort(timestampIndex.begin(), timestampIndex.end(), [](const CTimestampIndexKey& a, const CTimestampIndexKey& b) {
+        return a.timestamp < b.timestamp || (a.timestamp == b.timestamp && a.blockHash < b.blockHash);
+    });
+
+    if ((nIndexes & INDEXBUILDER_ADDRESS) && !pblocktree->WriteAddressIndex(addressIndex))
+        return error("%s: failed to write address index", __func__);
+    if ((nIndexes & INDEXBUILDER_SPENT) && !pblocktree->UpdateSpentIndex(spentIndex))
+        return error("%s: failed to write spent index", __func__);
+    if ((nIndexes & INDEXBUILDER_TIMESTAMP) && !pblocktree->WriteTimestampIndex(timestampIndex))
+        return error("%s: failed to write timestamp index", __func__);
+
+    // Holding cs_main until the entries are erased keeps the blocks from being connected again in
+    // the meantime. Timestamp entries are left alone, DisconnectBlock doesn't erase those either.
+    LOCK(cs_main);
+    std::set<int> setDisconnectedHeights;
+    for (const CBlockIndex* pindex : vWritten) {
+        if (!chainActive.Contains(pindex))
+            setDisconnectedHeights.insert(pindex->nHeight);
+    }
+    if (setDisconnectedHeights.empty())
+        return true;
+
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndexErase;
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentIndexErase;
+    for (const auto& entry : addressIndex) {
+        if (setDisconnectedHeights.count(entry.first.blockHeight))
+            addressIndexErase.push_back(entry);
+    }
+    for (const auto& entry : spentIndex) {
+        if (setDisconnectedHeights.count(entry.second.blockHeight))
+            spentIndexErase.push_back(std::make_pair(entry.first, CSpentIndexValue()));
+    }
+    if ((nIndexes & INDEXBUILDER_ADDRESS) && !pblocktree->EraseAddressIndex(addressIndexErase))
+        return error("%s: failed to erase address index entries of disconnected blocks", __func__);
+    if ((nIndexes & INDEXBUILDER_SPENT) && !pblocktree->UpdateSpentIndex(spentIndexErase))
+        return error("%s: failed to erase spent index entries of disconnected blocks", __func__);
+    return true;
+}
+
+/**
+ * Erase the unspent index entries of outputs in vUnspent which are spent by now. cs_main is held
+ * while looking up a slice of the outputs and erasing their entries, so that ConnectBlock and
+ * DisconnectBlock can't change them in between.
+ */
+bool EraseSpentUnspent(std::vector<std::pair<COutPoint, std::pair<CAddressUnspentKey, CAddressUnspentValue> > >& vUnspent)
+{
+    for (size_t i = 0; i < vUnspent.size(); i += UNSPENT_PER_LOCK) {
+        LOCK(cs_main);
+        std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > addressUnspentErase;
+        for (size_t j = i; j < std::min(i + UNSPENT_PER_LOCK, vUnspent.size()); j++) {
+            if (!pcoinsTip->HaveCoin(vUnspent[j].first))
+                addressUnspentErase.push_back(std::make_pair(vUnspent[j].second.first, CAddressUnspentValue()));
+        }
+        if (!pblocktree->UpdateAddressUnspentIndex(addressUnspentErase))
+            return error("%s: failed to erase address unspent index entries", __func__);
+    }
+    return true;
+}
+
+/**
+ * Write the unspent index entries of outputs which are still unspent. cs_main is only held while
+ * looking up a slice of the outputs at a time, not while writing. If blocks were connected or
+ * disconnected in the meantime, outputs they spent may have had their entries erased by
+ * ConnectBlock before they were written, so those are looked up and erased once more.
+ */
+bool WriteUnspent(std::vector<std::pair<COutPoint, std::pair<CAddressUnspentKey, CAddressUnspentValue> > >& vUnspent)
+{
+    const CBlockIndex* pindexTip;
+    {
+        LOCK(cs_main);
+        pindexTip = chainActive.Tip();
+    }
+
+    // outputs spent since the snapshot had their entry erased by ConnectBlock already
+    std::vector<std::pair<COutPoint, std::pair<CAddressUnspentKey, CAddressUnspentValue> > > vWritten;
+    for (size_t i = 0; i < vUnspent.size(); i += UNSPENT_PER_LOCK) {
+        LOCK(cs_main);
+        for (size_t j = i; j < std::min(i + UNSPENT_PER_LOCK, vUnspent.size()); j++) {
+            if (pcoinsTip->HaveCoin(vUnspent[j].first))
+                vWritten.push_back(std::move(vUnspent[j]));
+        }
+    }
+    vUnspent.clear();
+
+    std::sort(vWritten.begin(), vWritten.end(), [](const std::pair<COutPoint, std::pair<CAddressUnspentKey, CAddressUnspentValue> >& entryA,
+                                                 const std::pair<COutPoint, std::pair<CAddressUnspentKey, CAddressUnspentValue> >& entryB) {
+        const CAddressUnspentKey& a = entryA.second.first;
+        const CAddressUnspentKey& b = entryB.second.first;
+        if (a.type != b.type)
+            return a.type < b.type;
+        if (a.hashBytes != b.hashBytes)
+            return a.hashBytes < b.hashBytes;
+        if (a.txhash != b.txhash)
+            return a.txhash < b.txhash;
+        return a.index < b.index;
+    });
+
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > addressUnspentIndex;
+    addressUnspentIndex.reserve(vWritten.size());
+    for (const auto& entry : vWritten) {
+        addressUnspentIndex.push_back(entry.second);
+    }
+    if (!pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex))
+        return error("%s: failed to write address unspent index", __func__);
+
+    bool fTipChanged;
+    {
+        LOCK(cs_main);
+        fTipChanged = chainActive.Tip() != pindexTip;
+    }
+    return !fTipChanged || EraseSpentUnspent(vWritten);
+}
+
+/** Derive the unspent address index from a snapshot of the UTXO set */
+bool BuildAddressUnspentIndex(CCoinsViewCursor* pcursor)
+{
+    std::vector<std::pair<COutPoint, std::pair<CAddressUnspentKey, CAddressUnspentValue> > > vUnspent;
+    size_t nUnspent = 0;
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        COutPoint outpoint;
+        Coin coin;
+        if (!pcursor->GetKey(outpoint) || !pcursor->GetValue(coin))
+            return error("%s: unable to read the UTXO set", __func__);
+
+        uint160 hashBytes;
+        int type;
+        if (GetAddressKey(coin.out.scriptPubKey, type, hashBytes)) {
+            vUnspent.push_back(std::make_pair(outpoint, std::make_pair(CAddressUnspentKey(type, hashBytes, outpoint.hash, outpoint.n),
+                                                                      CAddressUnspentValue(coin.out.nValue, coin.out.scriptPubKey, coin.nHeight))));
+            nUnspent++;
+        }
+        if (vUnspent.size() >= UNSPENT_PER_WRITE && !WriteUnspent(vUnspent))
+            return false;
+        pcursor->Next();
+    }
+    if (!WriteUnspent(vUnspent))
+        return false;
+
+    LogPrintf("%s: indexed %u unspent outputs\n", __func__, nUnspent);
+    return true;
+}
+
+/** Derive the history entries of the blocks, see RunIndexBuilderPipeline */
+bool BuildHistoryIndexes(const std::vector<const CBlockIndex*>& vBlocks, int nIndexes)
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    const size_t nChunks = (vBlocks.size() + BLOCKS_PER_CHUNK - 1) / BLOCKS_PER_CHUNK;
+    const int nWorkers = std::max(1, std::min(GetNumCores(), MAX_INDEXBUILDER_THREADS));
+    // each chunk is only touched by the worker which derives it and then by this thread
+    std::vector<IndexChunk> vChunks(nChunks);
+
+    auto process = [&](size_t nChunk) {
+        IndexChunk& chunk = vChunks[nChunk];
+        for (size_t i = nChunk * BLOCKS_PER_CHUNK; i < std::min(vBlocks.size(), (nChunk + 1) * BLOCKS_PER_CHUNK); i++) {
+            const CBlockIndex* pindex = vBlocks[i];
+            CBlock block;
+            CBlockUndo blockundo;
+            CDiskBlockPos pos = pindex->GetUndoPos();
+            if (!ReadBlockFromDisk(block, pindex, consensusParams) || pos.IsNull() ||
+                !UndoReadFromDisk(blockundo, pos, pindex->pprev->GetBlockHash()) ||
+                blockundo.vtxundo.size() + 1 != block.vtx.size()) {
+                LogPrintf("IndexBuilder: unable to read block %s with its undo data\n", pindex->GetBlockHash().ToString());
+                return false;
+            }
+            IndexBlock(block, blockundo, pindex, nIndexes, chunk);
+            chunk.vBlocks.push_back(pindex);
+        }
+        return true;
+    };
+
+    size_t nBlocksDone = 0;
+    int64_t nLastLog = GetTime();
+    auto write = [&](const std::vector<size_t>& vReady) {
+        std::vector<IndexChunk> vWrite;
+        for (size_t nChunk : vReady) {
+            vWrite.push_back(std::move(vChunks[nChunk]));
+            vChunks[nChunk] = IndexChunk();
+        }
+        if (!WriteChunks(vWrite, nIndexes))
+            return false;
+        for (const IndexChunk& chunk : vWrite) {
+            nBlocksDone += chunk.vBlocks.size();
+        }
+        if (GetTime() - nLastLog >= 60) {
+            LogPrintf("IndexBuilder: indexed %u of %u blocks\n", nBlocksDone, vBlocks.size());
+            nLastLog = GetTime();
+        }
+        return true;
+    };
+
+    if (!RunIndexBuilderPipeline(vBlocks.size(), nWorkers, process, write))
+        return false;
+    LogPrintf("IndexBuilder: indexed %u blocks\n", nBlocksDone);
+    return true;
+}
+
+/** Takes ownership of pcursorIn, which is only used for the address index */
+void ThreadIndexBuilder(int nIndexes, const std::vector<const CBlockIndex*>& vBlocks, CCoinsViewCursor* pcursorIn)
+{
+    std::unique_ptr<CCoinsViewCursor> pcursor(pcursorIn);
+    int64_t nStart = GetTimeMillis();
+
+    if ((nIndexes & INDEXBUILDER_ADDRESS) && !BuildAddressUnspentIndex(pcursor.get())) {
+        LogPrintf("IndexBuilder: building the address unspent index failed, restart to try again or use -reindex\n");
+        return;
+    }
+    // release the snapshot of the UTXO set
+    pcursor.reset();
+
+    if (!BuildHistoryIndexes(vBlocks, nIndexes)) {
+        LogPrintf("IndexBuilder: building the indexes failed, restart to try again or use -reindex\n");
+        return;
+    }
+
+    for (IndexBuilderIndex index : ALL_INDEXES) {
+        if (nIndexes & index) {
+            pblocktree->WriteFlag(GetBuildingFlag(index), false);
+        }
+    }
+    nIndexesBuilding &= ~nIndexes;
+    LogPrintf("IndexBuilder: done in %dms\n", GetTimeMillis() - nStart);
+}
+
+} // namespace
+
+bool RunIndexBuilderPipeline(size_t nBlocks, int nWorkers, const std::function<bool(size_t)>& fnProcess,
+                             const std::function<bool(const std::vector<size_t>&)>& fnWrite)
+{
+    const size_t nChunks = (nBlocks + BLOCKS_PER_CHUNK - 1) / BLOCKS_PER_CHUNK;
+    const size_t nMaxPending = std::max(nWorkers, 1) * MAX_PENDING_CHUNKS_PER_WORKER;
+
+    std::mutex cs;
+    std::condition_variable cvPending;
+    std::condition_variable cvDone;
+    std::vector<size_t> vDone;
+    std::atomic<size_t> nNextChunk(0);
+    size_t nPending = 0;
+    bool fStop = false;
+    bool fFailed = false;
+
+    auto worker = [&]() {
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(cs);
+                cvPending.wait(lock, [&] { return fStop || nPending < nMaxPending; });
+                if (fStop)
+                    return;
+                nPending++;
+            }
+            size_t nChunk = nNextChunk++;
+            if (nChunk >= nChunks) {
+                std::unique_lock<std::mutex> lock(cs);
+                nPending--;
+                cvDone.notify_one();
+                return;
+            }
+
+            bool fOk = fnProcess(nChunk);
+
+            std::unique_lock<std::mutex> lock(cs);
+            if (!fOk) {
+                fFailed = true;
+                fStop = true;
+                cvPending.notify_all();
+            } else {
+                vDone.push_back(nChunk);
+            }
+            cvDone.notify_one();
+        }
+    };
+
+    std::vector<std::thread> vWorkers;
+    for (int i = 0; i < std::max(nWorkers, 1); i++) {
+        vWorkers.emplace_back([&worker, i] {
+            RenameThread(strprintf("sierra-indexbld.%d", i).c_str());
+            worker();
+        });
+    }
+
+    auto stopWorkers = [&]() {
+        {
+            std::unique_lock<std::mutex> lock(cs);
+            fStop = true;
+        }
+        cvPending.notify_all();
+        for (std::thread& thread : vWorkers) {
+            thread.join();
+        }
+        vWorkers.clear();
+    };
+
+    try {
+        while (true) {
+            boost::this_thread::interruption_point();
+
+            std::vector<size_t> vWrite;
+            bool fFinished;
+            {
+                std::unique_lock<std::mutex> lock(cs);
+                cvDone.wait_for(lock, std::chrono::milliseconds(100));
+                if (fFailed)
+                    break;
+                // done when no chunk is in the works anymore
+                fFinished = nPending == vDone.size() && nNextChunk >= nChunks;
+                // the workers can't get further ahead, so the ready chunks have to be written even if they
+                // are fewer than BLOCKS_PER_WRITE blocks
+                bool fWorkersBlocked = nPending >= nMaxPending;
+                size_t nBlocksReady = vDone.size() * BLOCKS_PER_CHUNK;
+                if (!fFinished && vDone.empty())
+                    continue;
+                if (!fFinished && !fWorkersBlocked && nBlocksReady < (size_t)BLOCKS_PER_WRITE)
+                    continue;
+                vWrite.swap(vDone);
+                nPending -= vWrite.size();
+            }
+            cvPending.notify_all();
+
+            if (!fnWrite(vWrite)) {
+                fFailed = true;
+                break;
+            }
+            if (fFinished)
+                break;
+        }
+    } catch (...) {
+        stopWorkers();
+        throw;
+    }
+    stopWorkers();
+
+    return !fFailed;
+}
+
+bool StartIndexBuilder(boost::thread_group& threadGroup, int nIndexes, std::string& strError)
+{
+    LOCK(cs_main);
+
+    for (IndexBuilderIndex index : ALL_INDEXES) {
+        bool fBuilding = false;
+        if (pblocktree->ReadFlag(GetBuildingFlag(index), fBuilding) && fBuilding) {
+            nIndexes |= index;
+        }
+    }
+    if (nIndexes == 0)
+        return true;
+
+    if (fReindex) {
+        // blocks are connected from scratch, which indexes everything anyway
+        for (IndexBuilderIndex index : ALL_INDEXES) {
+            if (nIndexes & index) {
+                pblocktree->WriteFlag(GetIndexFlag(index), true);
+                pblocktree->WriteFlag(GetBuildingFlag(index), false);
+            }
+        }
+        fAddressIndex |= (nIndexes & INDEXBUILDER_ADDRESS) != 0;
+        fSpentIndex |= (nIndexes & INDEXBUILDER_SPENT) != 0;
+        fTimestampIndex |= (nIndexes & INDEXBUILDER_TIMESTAMP) != 0;
+        return true;
+    }
+
+    if (fHavePruned) {
+        strError = _("Enabling -addressindex, -spentindex or -timestampindex on a pruned node needs a -reindex");
+        return false;
+    }
+
+    // Everything after this snapshot of the chain and UTXO set is indexed by ConnectBlock
+    FlushStateToDisk();
+    CCoinsViewCursor* pcursor = (nIndexes & INDEXBUILDER_ADDRESS) ? pcoinsdbview->Cursor() : nullptr;
+    std::vector<const CBlockIndex*> vBlocks;
+    for (int nHeight = 1; nHeight <= chainActive.Height(); nHeight++) {
+        vBlocks.push_back(chainActive[nHeight]);
+    }
+
+    for (IndexBuilderIndex index : ALL_INDEXES) {
+        if (nIndexes & index) {
+            pblocktree->WriteFlag(GetIndexFlag(index), true);
+            pblocktree->WriteFlag(GetBuildingFlag(index), true);
+        }
+    }
+    if (nIndexes & INDEXBUILDER_ADDRESS) {
+        // the balances are accumulated while the address index is written
+        pblocktree->WriteFlag("addressbalances", true);
+        fAddressIndex = true;
+    }
+    fSpentIndex |= (nIndexes & INDEXBUILDER_SPENT) != 0;
+    fTimestampIndex |= (nIndexes & INDEXBUILDER_TIMESTAMP) != 0;
+    nIndexesBuilding = nIndexes;
+
+    LogPrintf("IndexBuilder: building%s%s%s for %u blocks\n",
+              (nIndexes & INDEXBUILDER_ADDRESS) ? " addressindex" : "",
+              (nIndexes & INDEXBUILDER_SPENT) ? " spentindex" : "",
+              (nIndexes & INDEXBUILDER_TIMESTAMP) ? " timestampindex" : "",
+              vBlocks.size());
+    std::function<void()> fn = std::bind(&ThreadIndexBuilder, nIndexes, std::move(vBlocks), pcursor);
+    threadGroup.create_thread(boost::bind(&TraceThread<std::function<void()> >, "indexbuild", fn));
+    return true;
+}
+
+bool IsIndexBuilding(IndexBuilderIndex index)
+{
+    return (nIndexesBuilding & index) != 0;
+}
@@ -0,0 +1,46 @@
+// Copyright (c) 2019 The Sierra Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEXBUILDER_H
+#define BITCOIN_INDEXBUILDER_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace boost {
+class thread_group;
+} // namespace boost
+
+/** The optional indexes which can be built without a reindex */
+enum IndexBuilderIndex {
+    INDEXBUILDER_ADDRESS   = (1 << 0),
+    INDEXBUILDER_SPENT     = (1 << 1),
+    INDEXBUILDER_TIMESTAMP = (1 << 2),
+};
+
+/**
+ * Build the given indexes (plus the ones an interrupted earlier build left unfinished)
+ * for the blocks of the active chain, without a reindex.
+ *
+ * The indexes are enabled right away, so ConnectBlock and DisconnectBlock keep them up
+ * to date from now on. The entries of the existing chain are derived from the block and
+ * undo files by a pool of worker threads and written in sorted batches, the unspent
+ * address index is derived from the UTXO set. Until the build is finished the indexes
+ * are incomplete and queries for them fail, see IsIndexBuilding.
+ */
+bool StartIndexBuilder(boost::thread_group& threadGroup, int nIndexes, std::string& strError);
+
+/**
+ * The work distribution of the index build, exposed for unit testing: worker threads claim chunks of
+ * consecutive blocks and call fnProcess for them, while the calling thread passes the finished chunks
+ * to fnWrite in batches. The workers stay a bounded number of chunks ahead of the writer.
+ */
+bool RunIndexBuilderPipeline(size_t nBlocks, int nWorkers, const std::function<bool(size_t)>& fnProcess,
+                             const std::function<bool(const std::vector<size_t>&)>& fnWrite);
+
+/** Whether the history of an index is still being built */
+bool IsIndexBuilding(IndexBuilderIndex index);
+
+#endif // BITCOIN_INDEXBUILDER_H
@@ -19,6 +19,7 @@
 #include "compat/sanity.h"
 #include "consensus/validation.h"
 #include "httpserver.h"
+#include "indexbuilder.h"
 #include "httprpc.h"
 #include "key.h"
 #include "validation.h"
@@ -248,8 +249,10 @@ void PrepareShutdown()
         privateSendClient.fEnablePrivateSend = false;
         privateSendClient.ResetPool();
     }
-    if (pwalletMain)
+    if (pwalletMain) {
+        pwalletMain->StopKeyPoolFiller();
         pwalletMain->Flush(false);
+    }
 #endif
     MapPort(false);
     UnregisterValidationInterface(peerLogic.get());
@@ -443,6 +446,7 @@ std::string HelpMessage(HelpMessageMode mode)
     }
     strUsage += HelpMessageOpt("-datadir=<dir>", _("Specify data directory"));
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
+    strUsage += HelpMessageOpt("-dmnlistcache=<n>", strprintf(_("Set the memory used to cache masternode lists in megabytes (default: %d)"), DEFAULT_DMN_LIST_CACHE_SIZE));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file on startup"));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
@@ -462,6 +466,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
     strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)"), DEFAULT_TXINDEX));
+    strUsage += HelpMessageOpt("-verifyblockindex", strprintf(_("Verify the block hashes stored in the block index against their headers in a background thread after startup (default: %u)"), DEFAULT_VERIFYBLOCKINDEX));
 
     strUsage += HelpMessageOpt("-addressindex", strprintf(_("Maintain a full address index, used to query for the balance, txids and unspent outputs for addresses (default: %u)"), DEFAULT_ADDRESSINDEX));
     strUsage += HelpMessageOpt("-timestampindex", strprintf(_("Maintain a timestamp index for block hashes, used to query blocks hashes by a range of timestamps (default: %u)"), DEFAULT_TIMESTAMPINDEX));
@@ -1168,6 +1173,7 @@ bool AppInitParameterInteraction()
         mempool.setSanityCheck(1.0 / ratio);
     }
     fCheckBlockIndex = GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
+    fVerifyBlockIndex = GetBoolArg("-verifyblockindex", DEFAULT_VERIFYBLOCKINDEX);
     fCheckpointsEnabled = GetBoolArg("-checkpoints", DEFAULT_CHECKPOINTS_ENABLED);
 
     hashAssumeValid = uint256S(GetArg("-assumevalid", chainparams.GetConsensus().defaultAssumeValid.GetHex()));
@@ -1736,10 +1742,12 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     nCoinCacheUsage = nTotalCache; // the rest goes to in-memory cache
     int64_t nMempoolSizeMax = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
     int64_t nEvoDbCache = 1024 * 1024 * 16; // TODO
+    int64_t nDmnListCache = std::max(GetArg("-dmnlistcache", DEFAULT_DMN_LIST_CACHE_SIZE), (int64_t)1) << 20;
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set (plus up to %.1fMiB of unused mempool space)\n", nCoinCacheUsage * (1.0 / 1024 / 1024), nMempoolSizeMax * (1.0 / 1024 / 1024));
+    LogPrintf("* Using %.1fMiB for masternode lists\n", nDmnListCache * (1.0 / 1024 / 1024));
 
     bool fLoaded = false;
     int64_t nStart = GetTimeMillis();
@@ -1763,7 +1771,7 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
                 delete evoDb;
 
                 evoDb = new CEvoDB(nEvoDbCache, false, fReindex || fReindexChainState);
-                deterministicMNManager = new CDeterministicMNManager(*evoDb);
+                deterministicMNManager = new CDeterministicMNManager(*evoDb, nDmnListCache);
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex || fReindexChainState);
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
@@ -1784,10 +1792,12 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
                 }
                 if (fRequestShutdown) break;
 
+                int64_t nStageStart = GetTimeMillis();
                 if (!LoadBlockIndex(chainparams)) {
                     strLoadError = _("Error loading block database");
                     break;
                 }
+                LogPrintf(" load block index %15dms\n", GetTimeMillis() - nStageStart);
 
                 // If the loaded chain has a wrong genesis, bail out immediately
                 // (we're likely using a testnet datadir, or the other way around).
@@ -1834,11 +1844,13 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
                     }
                 }
 
+                nStageStart = GetTimeMillis();
                 if (!CVerifyDB().VerifyDB(chainparams, pcoinsdbview, GetArg("-checklevel", DEFAULT_CHECKLEVEL),
                               GetArg("-checkblocks", DEFAULT_CHECKBLOCKS))) {
                     strLoadError = _("Corrupted block database detected");
                     break;
                 }
+                LogPrintf(" verify blocks %15dms\n", GetTimeMillis() - nStageStart);
             } catch (const std::exception& e) {
                 if (fDebug) LogPrintf("%s\n", e.what());
                 strLoadError = _("Error opening block database");
@@ -1878,6 +1890,23 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     }
     LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);
 
+    // Entries written by this node during a reindex were hashed from their headers already
+    if (fVerifyBlockIndex && !fReindex) {
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "verifyidx", &ThreadVerifyBlockIndex));
+    }
+
+    // Build the optional indexes which were enabled since the block database was created
+    int nBuildIndexes = 0;
+    if (GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX) && !fAddressIndex)
+        nBuildIndexes |= INDEXBUILDER_ADDRESS;
+    if (GetBoolArg("-spentindex", DEFAULT_SPENTINDEX) && !fSpentIndex)
+        nBuildIndexes |= INDEXBUILDER_SPENT;
+    if (GetBoolArg("-timestampindex", DEFAULT_TIMESTAMPINDEX) && !fTimestampIndex)
+        nBuildIndexes |= INDEXBUILDER_TIMESTAMP;
+    std::string strIndexBuilderError;
+    if (!StartIndexBuilder(threadGroup, nBuildIndexes, strIndexBuilderError))
+        return InitError(strIndexBuilderError);
+
     boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
     CAutoFile est_filein(fopen(est_path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
     // Allowed to fail as this file IS missing on first startup.
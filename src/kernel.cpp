@@ -17,6 +17,8 @@
 #include "validation.h"
 #include <numeric>
 #include "spork.h"
+#include "crypto/common.h"
+#include "crypto/sha256.h"
 
 #define PRI64x  "llx"
 using namespace std;
@@ -225,15 +227,120 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexCurrent, uint64_t& nStake
     return true;
 }
 
-static bool GetKernlStakeModifierV03(uint256 hashBlockFrom, unsigned int nTimeTx, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake)
+/**
+ * Active chain blocks that generated a new stake modifier, ordered by height.
+ * nTimeMax is the maximum block time of all entries up to and including this one,
+ * which makes the entries searchable by time despite the block times not being monotonic.
+ */
+struct CStakeModifierIndexEntry
 {
-    nStakeModifier = 0;
-    if (!mapBlockIndex.count(hashBlockFrom))
-        return error("GetKernelStakeModifier() : block not indexed");
+    const CBlockIndex* pindex;
+    int64_t nTimeMax;
+};
+static CCriticalSection cs_stakeModifierIndex;
+static std::vector<CStakeModifierIndexEntry> vStakeModifierIndex;
+static const CBlockIndex* pindexStakeModifierIndexTip = nullptr;
+
+static void SyncStakeModifierIndex()
+{
+    AssertLockHeld(cs_stakeModifierIndex);
+
+    const CBlockIndex* pindexTip = chainActive.Tip();
+    if (pindexStakeModifierIndexTip == pindexTip)
+        return;
 
-    const CBlockIndex* pindexFrom = mapBlockIndex[hashBlockFrom];
+    if (!pindexTip) {
+        // block index got unloaded, don't touch the old entries
+        vStakeModifierIndex.clear();
+        pindexStakeModifierIndexTip = nullptr;
+        return;
+    }
+
+    // drop the entries of disconnected blocks and append the ones of newly connected blocks
+    const CBlockIndex* pindexFork = pindexStakeModifierIndexTip ? chainActive.FindFork(pindexStakeModifierIndexTip) : nullptr;
+    int nForkHeight = pindexFork ? pindexFork->nHeight : -1;
+    while (!vStakeModifierIndex.empty() && vStakeModifierIndex.back().pindex->nHeight > nForkHeight)
+        vStakeModifierIndex.pop_back();
+
+    for (int nHeight = nForkHeight + 1; nHeight <= chainActive.Height(); nHeight++) {
+        const CBlockIndex* pindex = chainActive[nHeight];
+        if (!pindex->GeneratedStakeModifier())
+            continue;
+        int64_t nTimeMax = pindex->GetBlockTime();
+        if (!vStakeModifierIndex.empty())
+            nTimeMax = std::max(nTimeMax, vStakeModifierIndex.back().nTimeMax);
+        vStakeModifierIndex.push_back({pindex, nTimeMax});
+    }
+    pindexStakeModifierIndexTip = pindexTip;
+}
+
+void UpdateStakeModifierIndex()
+{
+    LOCK(cs_stakeModifierIndex);
+    SyncStakeModifierIndex();
+}
+
+// Find the first active chain block above nHeightFrom that generated a stake modifier at or after nTime
+static const CBlockIndex* FindStakeModifierBlock(int nHeightFrom, int64_t nTime)
+{
+    // kept in sync with chainActive by UpdateTip, so this does not need cs_main
+    LOCK(cs_stakeModifierIndex);
+
+    auto it = std::upper_bound(vStakeModifierIndex.begin(), vStakeModifierIndex.end(), nHeightFrom,
+        [](int nHeight, const CStakeModifierIndexEntry& entry) { return nHeight < entry.pindex->nHeight; });
+    it = std::lower_bound(it, vStakeModifierIndex.end(), nTime,
+        [](const CStakeModifierIndexEntry& entry, int64_t nTime) { return entry.nTimeMax < nTime; });
+    // nTimeMax might come from a block at or below nHeightFrom
+    for (; it != vStakeModifierIndex.end(); ++it) {
+        if (it->pindex->GetBlockTime() >= nTime)
+            return it->pindex;
+    }
+    return nullptr;
+}
+
+static bool GetKernlStakeModifierV03(const CBlockIndex* pindexFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool& fComplete)
+{
+    nStakeModifier = 0;
+    fComplete = false;
     nStakeModifierHeight = pindexFrom->nHeight;
     nStakeModifierTime = pindexFrom->GetBlockTime();
+
+    // the stake modifier generated a selection interval later than the block of the kernel
+    const CBlockIndex* pindex = FindStakeModifierBlock(pindexFrom->nHeight, pindexFrom->GetBlockTime() + GetStakeModifierSelectionInterval());
+    if (!pindex) {
+        // Should never happen
+        if(Params().NetworkIDString() == CBaseChainParams::TESTNET)
+        {
+            const CBlockIndex* pindexLast = chainActive.Height() > pindexFrom->nHeight ? chainActive.Tip() : pindexFrom;
+            if(pindexLast->GeneratedStakeModifier())
+                nStakeModifier = pindexLast->nStakeModifier;
+            return true;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    nStakeModifierHeight = pindex->nHeight;
+    nStakeModifierTime = pindex->GetBlockTime();
+    nStakeModifier = pindex->nStakeModifier;
+    fComplete = true;
+
+    if (fCheckBlockIndex) {
+        uint64_t nStakeModifierWalk = 0;
+        bool fCompleteWalk = false;
+        assert(GetKernelStakeModifierChainWalk(pindexFrom, nStakeModifierWalk, fCompleteWalk));
+        assert(fCompleteWalk && nStakeModifierWalk == nStakeModifier);
+    }
+    return true;
+}
+
+bool GetKernelStakeModifierChainWalk(const CBlockIndex* pindexFrom, uint64_t& nStakeModifier, bool& fComplete)
+{
+    nStakeModifier = 0;
+    fComplete = false;
+    int64_t nStakeModifierTime = pindexFrom->GetBlockTime();
     int64_t nStakeModifierSelectionInterval = GetStakeModifierSelectionInterval();
     const CBlockIndex* pindex = pindexFrom;
     CBlockIndex* pindexNext = chainActive[pindexFrom->nHeight + 1];
@@ -244,8 +351,6 @@ static bool GetKernlStakeModifierV03(uint256 hashBlockFrom, unsigned int nTimeTx
             // Should never happen
             if(Params().NetworkIDString() == CBaseChainParams::TESTNET)
             {
-                nStakeModifierHeight = pindexFrom->nHeight;
-                nStakeModifierTime = pindexFrom->GetBlockTime();
                 if(pindex->GeneratedStakeModifier())
                     nStakeModifier = pindex->nStakeModifier;
                 return true;
@@ -259,18 +364,30 @@ static bool GetKernlStakeModifierV03(uint256 hashBlockFrom, unsigned int nTimeTx
         pindex = pindexNext;
         pindexNext = chainActive[pindexNext->nHeight + 1];
         if (pindex->GeneratedStakeModifier()) {
-            nStakeModifierHeight = pindex->nHeight;
             nStakeModifierTime = pindex->GetBlockTime();
         }
     }
     nStakeModifier = pindex->nStakeModifier;
+    fComplete = true;
     return true;
 }
 
+bool GetKernelStakeModifier(const CBlockIndex* pindexFrom, uint64_t& nStakeModifier, bool& fComplete)
+{
+    int nStakeModifierHeight = 0;
+    int64_t nStakeModifierTime = 0;
+    return GetKernlStakeModifierV03(pindexFrom, nStakeModifier, nStakeModifierHeight, nStakeModifierTime, fComplete);
+}
+
 // Get the stake modifier specified by the protocol to hash for a stake kernel
 static bool GetKernelStakeModifier(uint256 hashBlockFrom, unsigned int nTimeTx, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake)
 {
-    return GetKernlStakeModifierV03(hashBlockFrom, nTimeTx, nStakeModifier, nStakeModifierHeight, nStakeModifierTime, fPrintProofOfStake);
+    nStakeModifier = 0;
+    if (!mapBlockIndex.count(hashBlockFrom))
+        return error("GetKernelStakeModifier() : block not indexed");
+
+    bool fComplete;
+    return GetKernlStakeModifierV03(mapBlockIndex[hashBlockFrom], nStakeModifier, nStakeModifierHeight, nStakeModifierTime, fComplete);
 }
 // ppcoin kernel protocol
 // coinstake must meet hash target according to the protocol:
@@ -299,22 +416,20 @@ static bool GetKernelStakeModifier(uint256 hashBlockFrom, unsigned int nTimeTx,
 //   a proof-of-work situation.
 //
 
-bool CheckStakeKernelHash(unsigned int nBits, const CBlock& blockFrom, unsigned int nTxPrevOffset, const CTransactionRef& txPrev, const COutPoint& prevout, unsigned int nTimeTx, uint256& hashProofOfStake)
+bool CheckStakeKernelHash(unsigned int nBits, unsigned int nTimeBlockFrom, unsigned int nTxPrevOffset, CAmount nValueIn,
+                          uint64_t nStakeModifier, const COutPoint& prevout, unsigned int nTimeTx, uint256& hashProofOfStake)
 {
-
-    auto txPrevTime = blockFrom.GetBlockTime();
+    int64_t txPrevTime = nTimeBlockFrom;
     if (nTimeTx < txPrevTime)  // Transaction timestamp violation
         return error("CheckStakeKernelHash() : nTime violation");
 
     auto nStakeMinAge = CurrentMinStakeAge(nTimeTx);
     auto nStakeMaxAge = Params().GetConsensus().nStakeMaxAge;
-    unsigned int nTimeBlockFrom = blockFrom.GetBlockTime();
     if (nTimeBlockFrom + nStakeMinAge > nTimeTx) // Min age requirement
         return false; //return error("CheckStakeKernelHash() : min age violation");
 
     arith_uint256 bnTargetPerCoinDay;
     bnTargetPerCoinDay.SetCompact(nBits);
-    CAmount nValueIn = txPrev->vout[prevout.n].nValue;
     // v0.3 protocol kernel hash weight starts from 0 at the 30-day min age
     // this change increases active coins participating the hash and helps
     // to secure the network when proof-of-stake difficulty is low
@@ -323,15 +438,8 @@ bool CheckStakeKernelHash(unsigned int nBits, const CBlock& blockFrom, unsigned
 
     // Calculate hash
     CDataStream ss(SER_GETHASH, 0);
-    uint64_t nStakeModifier = 0;
-    int nStakeModifierHeight = 0;
-    int64_t nStakeModifierTime = 0;
-
-    if (IsProtocolV03(nTimeTx)){
-        if (!GetKernelStakeModifier(blockFrom.GetHash(), nTimeTx, nStakeModifier, nStakeModifierHeight, nStakeModifierTime, false))
-            return false;
+    if (IsProtocolV03(nTimeTx))
         ss << nStakeModifier;
-    }
 
     ss << nTimeBlockFrom << nTxPrevOffset << txPrevTime << prevout.n << nTimeTx;
     hashProofOfStake = Hash(ss.begin(), ss.end());
@@ -343,6 +451,90 @@ bool CheckStakeKernelHash(unsigned int nBits, const CBlock& blockFrom, unsigned
     return true;
 }
 
+int FindStakeKernelHash(unsigned int nBits, unsigned int nTimeBlockFrom, unsigned int nTxPrevOffset, CAmount nValueIn,
+                        uint64_t nStakeModifier, const COutPoint& prevout, const std::vector<unsigned int>& vTimeTx,
+                        uint256& hashProofOfStake)
+{
+    // v0.3 kernels serialize to exactly 32 bytes, of which only the trailing nTimeTx differs between candidates
+    static const size_t KERNEL_SIZE = 32;
+    static const size_t KERNEL_BATCH_SIZE = 16;
+
+    arith_uint256 bnTargetPerCoinDay;
+    bnTargetPerCoinDay.SetCompact(nBits);
+    auto nStakeMaxAge = Params().GetConsensus().nStakeMaxAge;
+    int64_t txPrevTime = nTimeBlockFrom;
+
+    unsigned char prefix[KERNEL_SIZE - 4];
+    WriteLE64(prefix, nStakeModifier);
+    WriteLE32(prefix + 8, nTimeBlockFrom);
+    WriteLE32(prefix + 12, nTxPrevOffset);
+    WriteLE64(prefix + 16, (uint64_t)txPrevTime);
+    WriteLE32(prefix + 24, prevout.n);
+
+    unsigned char kernels[KERNEL_BATCH_SIZE * KERNEL_SIZE];
+    unsigned char hashes[KERNEL_BATCH_SIZE * KERNEL_SIZE];
+    size_t vPending[KERNEL_BATCH_SIZE];
+    size_t nPending = 0;
+
+    auto flush = [&]() -> int {
+        SHA256D32(hashes, kernels, nPending);
+        for (size_t i = 0; i < nPending; i++) {
+            uint256 hash;
+            memcpy(hash.begin(), hashes + i * KERNEL_SIZE, KERNEL_SIZE);
+            unsigned int nTimeTx = vTimeTx[vPending[i]];
+            int64_t nTimeWeight = std::min<int64_t>(nTimeTx - txPrevTime, nStakeMaxAge - CurrentMinStakeAge(nTimeTx));
+            arith_uint256 bnCoinDayWeight = nValueIn * nTimeWeight / COIN / 200;
+            if (UintToArith256(hash) <= bnCoinDayWeight * bnTargetPerCoinDay) {
+                hashProofOfStake = hash;
+                nPending = 0;
+                return (int)vPending[i];
+            }
+        }
+        nPending = 0;
+        return -1;
+    };
+
+    for (size_t i = 0; i < vTimeTx.size(); i++) {
+        unsigned int nTimeTx = vTimeTx[i];
+        if (!IsProtocolV03(nTimeTx)) {
+            // pre v0.3 kernels don't include the modifier and are checked one by one
+            int nFound = flush();
+            if (nFound >= 0)
+                return nFound;
+            if (CheckStakeKernelHash(nBits, nTimeBlockFrom, nTxPrevOffset, nValueIn, nStakeModifier, prevout, nTimeTx, hashProofOfStake))
+                return (int)i;
+            continue;
+        }
+        if (nTimeTx < txPrevTime || nTimeBlockFrom + CurrentMinStakeAge(nTimeTx) > nTimeTx)
+            continue;
+
+        memcpy(kernels + nPending * KERNEL_SIZE, prefix, sizeof(prefix));
+        WriteLE32(kernels + nPending * KERNEL_SIZE + sizeof(prefix), nTimeTx);
+        vPending[nPending++] = i;
+        if (nPending == KERNEL_BATCH_SIZE) {
+            int nFound = flush();
+            if (nFound >= 0)
+                return nFound;
+        }
+    }
+    return flush();
+}
+
+bool CheckStakeKernelHash(unsigned int nBits, const CBlock& blockFrom, unsigned int nTxPrevOffset, const CTransactionRef& txPrev, const COutPoint& prevout, unsigned int nTimeTx, uint256& hashProofOfStake)
+{
+    uint64_t nStakeModifier = 0;
+    int nStakeModifierHeight = 0;
+    int64_t nStakeModifierTime = 0;
+
+    if (IsProtocolV03(nTimeTx)) {
+        if (!GetKernelStakeModifier(blockFrom.GetHash(), nTimeTx, nStakeModifier, nStakeModifierHeight, nStakeModifierTime, false))
+            return false;
+    }
+
+    return CheckStakeKernelHash(nBits, blockFrom.GetBlockTime(), nTxPrevOffset, txPrev->vout[prevout.n].nValue,
+                                nStakeModifier, prevout, nTimeTx, hashProofOfStake);
+}
+
 bool CheckKernelScript(CScript scriptVin, CScript scriptVout)
 {
     auto extractKeyID = [](CScript scriptPubKey) {
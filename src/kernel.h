@@ -28,6 +28,23 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeMod
 bool CheckStakeKernelHash(unsigned int nBits, const CBlock& blockFrom, unsigned int nTxPrevOffset,
                           const CTransactionRef& txPrev, const COutPoint& prevout, unsigned int nTimeTx,
                           uint256& hashProofOfStake);
+// Same as above, but with the kernel inputs already resolved by the caller
+bool CheckStakeKernelHash(unsigned int nBits, unsigned int nTimeBlockFrom, unsigned int nTxPrevOffset, CAmount nValueIn,
+                          uint64_t nStakeModifier, const COutPoint& prevout, unsigned int nTimeTx,
+                          uint256& hashProofOfStake);
+// Search nTimeTx candidates, in the given order, for the first one meeting the hash target.
+// Kernels are hashed in batches, returns the index of the matching candidate or -1
+int FindStakeKernelHash(unsigned int nBits, unsigned int nTimeBlockFrom, unsigned int nTxPrevOffset, CAmount nValueIn,
+                        uint64_t nStakeModifier, const COutPoint& prevout, const std::vector<unsigned int>& vTimeTx,
+                        uint256& hashProofOfStake);
+// Get the stake modifier to hash for a kernel whose coin was confirmed in pindexFrom
+// fComplete is false when the selection interval is not yet covered by the active chain
+bool GetKernelStakeModifier(const CBlockIndex* pindexFrom, uint64_t& nStakeModifier, bool& fComplete);
+// Same as above, but walks the active chain block by block instead of using the stake modifier index.
+// Only used to cross-check the index (-checkblockindex) and in benchmarks
+bool GetKernelStakeModifierChainWalk(const CBlockIndex* pindexFrom, uint64_t& nStakeModifier, bool& fComplete);
+// Bring the stake modifier index in sync with chainActive, called whenever the active chain changes
+void UpdateStakeModifierIndex();
 // Check kernel hash target and coinstake signature
 // Sets hashProofOfStake on success return
 bool CheckProofOfStake(const CBlock &block, uint256& hashProofOfStake);
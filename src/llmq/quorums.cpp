@@ -26,6 +26,10 @@ namespace llmq
 
 static const std::string DB_QUORUM_SK_SHARE = "q_Qsk";
 static const std::string DB_QUORUM_QUORUM_VVEC = "q_Qqvvec";
+static const std::string DB_QUORUM_PUBKEY_SHARES = "q_Qpkshares";
+
+// number of threads pre-populating the public key shares of new quorums
+static const int CACHE_POPULATOR_THREADS = 2;
 
 CQuorumManager* quorumManager;
 
@@ -40,17 +44,6 @@ static uint256 MakeQuorumKey(const CQuorum& q)
     return hw.GetHash();
 }
 
-CQuorum::~CQuorum()
-{
-    // most likely the thread is already done
-    stopCachePopulatorThread = true;
-    // watch out to not join the thread when we're called from inside the thread, which might happen on shutdown. This
-    // is because on shutdown the thread is the last owner of the shared CQuorum instance and thus the destroyer of it.
-    if (cachePopulatorThread.joinable() && cachePopulatorThread.get_id() != std::this_thread::get_id()) {
-        cachePopulatorThread.join();
-    }
-}
-
 void CQuorum::Init(const CFinalCommitment& _qc, const CBlockIndex* _pindexQuorum, const uint256& _minedBlockHash, const std::vector<CDeterministicMNCPtr>& _members)
 {
     qc = _qc;
@@ -84,6 +77,13 @@ CBLSPublicKey CQuorum::GetPubKeyShare(size_t memberIdx) const
     if (quorumVvec == nullptr || memberIdx >= members.size() || !qc.validMembers[memberIdx]) {
         return CBLSPublicKey();
     }
+    if (!pubKeyShares.empty()) {
+        const CBLSPublicKey& pubKeyShare = pubKeyShares[memberIdx].Get();
+        if (pubKeyShare.IsValid()) {
+            return pubKeyShare;
+        }
+        // a damaged DB entry, fall back to recovering it
+    }
     auto& m = members[memberIdx];
     return blsCache.BuildPubKeyShare(m->proTxHash, quorumVvec, CBLSId::FromHash(m->proTxHash));
 }
@@ -133,25 +133,43 @@ bool CQuorum::ReadContributions(CEvoDB& evoDb)
     return true;
 }
 
-void CQuorum::StartCachePopulatorThread(std::shared_ptr<CQuorum> _this)
+void CQuorum::WritePubKeyShares(CEvoDB& evoDb, const BLSPublicKeyVector& shares)
+{
+    evoDb.GetRawDB().Write(std::make_pair(DB_QUORUM_PUBKEY_SHARES, MakeQuorumKey(*this)), shares);
+}
+
+bool CQuorum::ReadPubKeyShares(CEvoDB& evoDb)
+{
+    std::vector<CBLSLazyPublicKey> shares;
+    if (!evoDb.Read(std::make_pair(DB_QUORUM_PUBKEY_SHARES, MakeQuorumKey(*this)), shares) || shares.size() != members.size()) {
+        return false;
+    }
+    pubKeyShares = std::move(shares);
+    return true;
+}
+
+void CQuorum::StartCachePopulator(std::shared_ptr<CQuorum> _this, ctpl::thread_pool& pool, CEvoDB& evoDb)
 {
     if (_this->quorumVvec == nullptr) {
         return;
     }
 
     cxxtimer::Timer t(true);
-    LogPrint("llmq", "CQuorum::StartCachePopulatorThread -- start\n");
-
-    // this thread will exit after some time
-    // when then later some other thread tries to get keys, it will be much faster
-    _this->cachePopulatorThread = std::thread([_this, t]() {
-        RenameThread("dash-q-cachepop");
-        for (size_t i = 0; i < _this->members.size() && !_this->stopCachePopulatorThread && !ShutdownRequested(); i++) {
+    LogPrint("llmq", "CQuorum::StartCachePopulator -- start\n");
+
+    // when some other thread later tries to get keys, it will be much faster
+    pool.push([_this, t, &evoDb](int threadId) {
+        BLSPublicKeyVector shares(_this->members.size());
+        for (size_t i = 0; i < _this->members.size(); i++) {
+            if (ShutdownRequested()) {
+                return;
+            }
             if (_this->qc.validMembers[i]) {
-                _this->GetPubKeyShare(i);
+                shares[i] = _this->GetPubKeyShare(i);
             }
         }
-        LogPrint("llmq", "CQuorum::StartCachePopulatorThread -- done. time=%d\n", t.count());
+        _this->WritePubKeyShares(evoDb, shares);
+        LogPrint("llmq", "CQuorum::StartCachePopulator -- done. time=%d\n", t.count());
     });
 }
 
@@ -162,6 +180,18 @@ CQuorumManager::CQuorumManager(CEvoDB& _evoDb, CBLSWorker& _blsWorker, CDKGSessi
 {
 }
 
+void CQuorumManager::StartCachePopulatorPool()
+{
+    cachePopulatorPool.resize(CACHE_POPULATOR_THREADS);
+    RenameThreadPool(cachePopulatorPool, "dash-q-cachepop");
+}
+
+void CQuorumManager::StopCachePopulatorPool()
+{
+    cachePopulatorPool.clear_queue();
+    cachePopulatorPool.stop(true);
+}
+
 void CQuorumManager::UpdatedBlockTip(const CBlockIndex* pindexNew, bool fInitialDownload)
 {
     if (!masternodeSync.IsBlockchainSynced()) {
@@ -228,7 +258,7 @@ void CQuorumManager::EnsureQuorumConnections(Consensus::LLMQType llmqType, const
     }
 }
 
-bool CQuorumManager::BuildQuorumFromCommitment(const CFinalCommitment& qc, const CBlockIndex* pindexQuorum, const uint256& minedBlockHash, std::shared_ptr<CQuorum>& quorum) const
+bool CQuorumManager::BuildQuorumFromCommitment(const CFinalCommitment& qc, const CBlockIndex* pindexQuorum, const uint256& minedBlockHash, std::shared_ptr<CQuorum>& quorum)
 {
     assert(pindexQuorum);
     assert(qc.quorumHash == pindexQuorum->GetBlockHash());
@@ -249,11 +279,11 @@ bool CQuorumManager::BuildQuorumFromCommitment(const CFinalCommitment& qc, const
         }
     }
 
-    if (hasValidVvec) {
+    if (hasValidVvec && !quorum->ReadPubKeyShares(evoDb)) {
         // pre-populate caches in the background
         // recovering public key shares is quite expensive and would result in serious lags for the first few signing
         // sessions if the shares would be calculated on-demand
-        CQuorum::StartCachePopulatorThread(quorum);
+        CQuorum::StartCachePopulator(quorum, cachePopulatorPool, evoDb);
     }
 
     return true;
@@ -46,15 +46,15 @@ public:
     CBLSSecretKey skShare;
 
 private:
-    // Recovery of public key shares is very slow, so we start a background thread that pre-populates a cache so that
-    // the public key shares are ready when needed later
+    // Recovery of public key shares is very slow, so a background job pre-populates a cache so that the public key
+    // shares are ready when needed later. The job then persists the shares, so that they don't have to be recovered
+    // again after a restart
     mutable CBLSWorkerCache blsCache;
-    std::atomic<bool> stopCachePopulatorThread;
-    std::thread cachePopulatorThread;
+    // The persisted public key shares of all members, empty if they were not persisted yet. Deserialized on first use
+    std::vector<CBLSLazyPublicKey> pubKeyShares;
 
 public:
-    CQuorum(const Consensus::LLMQParams& _params, CBLSWorker& _blsWorker) : params(_params), blsCache(_blsWorker), stopCachePopulatorThread(false) {}
-    ~CQuorum();
+    CQuorum(const Consensus::LLMQParams& _params, CBLSWorker& _blsWorker) : params(_params), blsCache(_blsWorker) {}
     void Init(const CFinalCommitment& _qc, const CBlockIndex* _pindexQuorum, const uint256& _minedBlockHash, const std::vector<CDeterministicMNCPtr>& _members);
 
     bool IsMember(const uint256& proTxHash) const;
@@ -67,7 +67,9 @@ public:
 private:
     void WriteContributions(CEvoDB& evoDb);
     bool ReadContributions(CEvoDB& evoDb);
-    static void StartCachePopulatorThread(std::shared_ptr<CQuorum> _this);
+    void WritePubKeyShares(CEvoDB& evoDb, const BLSPublicKeyVector& shares);
+    bool ReadPubKeyShares(CEvoDB& evoDb);
+    static void StartCachePopulator(std::shared_ptr<CQuorum> _this, ctpl::thread_pool& pool, CEvoDB& evoDb);
 };
 typedef std::shared_ptr<CQuorum> CQuorumPtr;
 typedef std::shared_ptr<const CQuorum> CQuorumCPtr;
@@ -85,6 +87,9 @@ private:
     CBLSWorker& blsWorker;
     CDKGSessionManager& dkgManager;
 
+    // shared by all quorums to pre-populate their public key shares, see CQuorum::StartCachePopulator
+    ctpl::thread_pool cachePopulatorPool;
+
     CCriticalSection quorumsCacheCs;
     std::map<std::pair<Consensus::LLMQType, uint256>, CQuorumPtr> quorumsCache;
     unordered_lru_cache<std::pair<Consensus::LLMQType, uint256>, std::vector<CQuorumCPtr>, StaticSaltedHasher, 32> scanQuorumsCache;
@@ -92,6 +97,9 @@ private:
 public:
     CQuorumManager(CEvoDB& _evoDb, CBLSWorker& _blsWorker, CDKGSessionManager& _dkgManager);
 
+    void StartCachePopulatorPool();
+    void StopCachePopulatorPool();
+
     void UpdatedBlockTip(const CBlockIndex *pindexNew, bool fInitialDownload);
 
     bool HasQuorum(Consensus::LLMQType llmqType, const uint256& quorumHash);
@@ -108,7 +116,7 @@ private:
     // all private methods here are cs_main-free
     void EnsureQuorumConnections(Consensus::LLMQType llmqType, const CBlockIndex *pindexNew);
 
-    bool BuildQuorumFromCommitment(const CFinalCommitment& qc, const CBlockIndex* pindexQuorum, const uint256& minedBlockHash, std::shared_ptr<CQuorum>& quorum) const;
+    bool BuildQuorumFromCommitment(const CFinalCommitment& qc, const CBlockIndex* pindexQuorum, const uint256& minedBlockHash, std::shared_ptr<CQuorum>& quorum);
     bool BuildQuorumContributions(const CFinalCommitment& fqc, std::shared_ptr<CQuorum>& quorum) const;
 
     CQuorumCPtr GetQuorum(Consensus::LLMQType llmqType, const CBlockIndex* pindex);
@@ -48,6 +48,16 @@ UniValue CDKGDebugSessionStatus::ToJson(int detailLevel) const
     ret.push_back(Pair("sentPrematureCommitment", sentPrematureCommitment));
     ret.push_back(Pair("aborted", aborted));
 
+    UniValue phaseTimesArr(UniValue::VARR);
+    for (const auto& p : phaseTimes) {
+        UniValue t(UniValue::VOBJ);
+        t.push_back(Pair("phase", (int)p.first));
+        t.push_back(Pair("startTime", p.second.first));
+        t.push_back(Pair("messagesTime", p.second.second));
+        phaseTimesArr.push_back(t);
+    }
+    ret.push_back(Pair("phaseTimes", phaseTimesArr));
+
     struct ArrOrCount {
         int count{0};
         UniValue arr{UniValue::VARR};
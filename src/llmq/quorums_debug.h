@@ -9,6 +9,7 @@
 #include "sync.h"
 #include "univalue.h"
 
+#include <map>
 #include <set>
 
 class CDataStream;
@@ -68,6 +69,9 @@ public:
 
     std::vector<CDKGDebugMemberStatus> members;
 
+    // per phase, the time in ms spent on the local work at the start of the phase and on processing incoming messages
+    std::map<uint8_t, std::pair<int64_t, int64_t>> phaseTimes;
+
 public:
     CDKGDebugSessionStatus() : statusBitset(0) {}
 
@@ -25,6 +25,9 @@
 namespace llmq
 {
 
+// number of received contributions which are verified together in the background
+static const size_t CONTRIBUTION_VERIFICATION_BATCH_SIZE = 16;
+
 // Supported error types:
 // - contribution-omit
 // - contribution-lie
@@ -338,70 +341,112 @@ void CDKGSession::ReceiveMessage(const uint256& hash, const CDKGContribution& qc
 
     logger.Batch("decrypted our contribution share. time=%d", t2.count());
 
-    bool verifyPending = false;
     receivedSkContributions[member->idx] = skContribution;
     pendingContributionVerifications.emplace_back(member->idx);
-    if (pendingContributionVerifications.size() >= 32) {
-        verifyPending = true;
-    }
 
-    if (verifyPending) {
-        VerifyPendingContributions();
+    // verify contributions while they arrive instead of doing all the work at the start of the complain phase
+    FinishContributionVerifications(false);
+    if (pendingContributionVerifications.size() >= CONTRIBUTION_VERIFICATION_BATCH_SIZE) {
+        StartVerifyPendingContributions();
     }
 }
 
-// Verifies all pending secret key contributions in one batch
+// Starts verification of all pending secret key contributions in one batch on the BLS worker
 // This is done by aggregating the verification vectors belonging to the secret key contributions
 // The resulting aggregated vvec is then used to recover a public key share
 // The public key share must match the public key belonging to the aggregated secret key contributions
 // See CBLSWorker::VerifyContributionShares for more details.
-void CDKGSession::VerifyPendingContributions()
+void CDKGSession::StartVerifyPendingContributions()
 {
-    CDKGLogger logger(*this, __func__);
-
-    cxxtimer::Timer t1(true);
-
     std::vector<size_t> pend = std::move(pendingContributionVerifications);
-    if (pend.empty()) {
-        return;
-    }
-
-    std::vector<size_t> memberIndexes;
-    std::vector<BLSVerificationVectorPtr> vvecs;
-    BLSSecretKeyVector skContributions;
+    pendingContributionVerifications.clear();
 
+    ContributionVerificationBatch batch;
+    batch.vvecs = std::make_shared<std::vector<BLSVerificationVectorPtr>>();
+    batch.skContributions = std::make_shared<BLSSecretKeyVector>();
     for (const auto& idx : pend) {
         auto& m = members[idx];
         if (m->bad || m->weComplain) {
             continue;
         }
-        memberIndexes.emplace_back(idx);
-        vvecs.emplace_back(receivedVvecs[idx]);
-        skContributions.emplace_back(receivedSkContributions[idx]);
+        batch.memberIndexes.emplace_back(idx);
+        batch.vvecs->emplace_back(receivedVvecs[idx]);
+        batch.skContributions->emplace_back(receivedSkContributions[idx]);
     }
-
-    auto result = blsWorker.VerifyContributionShares(myId, vvecs, skContributions);
-    if (result.size() != memberIndexes.size()) {
-        logger.Batch("VerifyContributionShares returned result of size %d but size %d was expected, something is wrong", result.size(), memberIndexes.size());
+    if (batch.memberIndexes.empty()) {
         return;
     }
 
-    for (size_t i = 0; i < memberIndexes.size(); i++) {
-        if (!result[i]) {
-            auto& m = members[memberIndexes[i]];
-            logger.Batch("invalid contribution from %s. will complain later", m->dmn->proTxHash.ToString());
-            m->weComplain = true;
-            quorumDKGDebugManager->UpdateLocalMemberStatus(params.type, m->idx, [&](CDKGDebugMemberStatus& status) {
-                status.weComplain = true;
-                return true;
-            });
-        } else {
-            size_t memberIdx = memberIndexes[i];
-            dkgManager.WriteVerifiedSkContribution(params.type, pindexQuorum, members[memberIdx]->dmn->proTxHash, skContributions[i]);
+    auto promise = std::make_shared<std::promise<std::vector<bool>>>();
+    batch.result = promise->get_future();
+    auto vvecs = batch.vvecs;
+    auto skContributions = batch.skContributions;
+    blsWorker.AsyncVerifyContributionShares(myId, *vvecs, *skContributions, true, true,
+        [promise, vvecs, skContributions](const std::vector<bool>& result) {
+            promise->set_value(result);
+        });
+    contributionVerificationBatches.emplace_back(std::move(batch));
+}
+
+// Handles the results of finished contribution verifications, or of all of them if fWait is set
+void CDKGSession::FinishContributionVerifications(bool fWait)
+{
+    CDKGLogger logger(*this, __func__);
+
+    for (auto it = contributionVerificationBatches.begin(); it != contributionVerificationBatches.end(); ) {
+        auto& batch = *it;
+        if (!fWait && batch.result.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            ++it;
+            continue;
+        }
+
+        cxxtimer::Timer t1(true);
+        auto result = batch.result.get();
+        if (result.size() != batch.memberIndexes.size()) {
+            logger.Batch("VerifyContributionShares returned result of size %d but size %d was expected, something is wrong", result.size(), batch.memberIndexes.size());
+            it = contributionVerificationBatches.erase(it);
+            continue;
+        }
+
+        std::vector<uint16_t> validIndexes;
+        auto validVvecs = std::make_shared<std::vector<BLSVerificationVectorPtr>>();
+        for (size_t i = 0; i < batch.memberIndexes.size(); i++) {
+            if (!result[i]) {
+                auto& m = members[batch.memberIndexes[i]];
+                logger.Batch("invalid contribution from %s. will complain later", m->dmn->proTxHash.ToString());
+                m->weComplain = true;
+                quorumDKGDebugManager->UpdateLocalMemberStatus(params.type, m->idx, [&](CDKGDebugMemberStatus& status) {
+                    status.weComplain = true;
+                    return true;
+                });
+            } else {
+                size_t memberIdx = batch.memberIndexes[i];
+                dkgManager.WriteVerifiedSkContribution(params.type, pindexQuorum, members[memberIdx]->dmn->proTxHash, (*batch.skContributions)[i]);
+                validIndexes.emplace_back((uint16_t)memberIdx);
+                validVvecs->emplace_back((*batch.vvecs)[i]);
+            }
+        }
+
+        // start aggregating the vvecs of this batch, so that building the quorum vvec later has less to do
+        if (validVvecs->size() > 1) {
+            auto promise = std::make_shared<std::promise<BLSVerificationVectorPtr>>();
+            vvecAggregates.emplace_back(VvecAggregate{validIndexes, promise->get_future().share()});
+            blsWorker.AsyncBuildQuorumVerificationVector(*validVvecs, 0, validVvecs->size(), false,
+                [promise, validVvecs](const BLSVerificationVectorPtr& vvec) {
+                    promise->set_value(vvec);
+                });
         }
+
+        logger.Batch("verified %d contributions. time=%d", batch.memberIndexes.size(), t1.count());
+        it = contributionVerificationBatches.erase(it);
     }
+}
 
-    logger.Batch("verified %d pending contributions. time=%d", pend.size(), t1.count());
+// Verifies all pending secret key contributions and waits for all verifications which are still in progress
+void CDKGSession::VerifyPendingContributions()
+{
+    StartVerifyPendingContributions();
+    FinishContributionVerifications(true);
 }
 
 void CDKGSession::VerifyAndComplain(CDKGPendingMessages& pendingMessages)
@@ -929,7 +974,7 @@ void CDKGSession::SendCommitment(CDKGPendingMessages& pendingMessages)
         return;
     }
 
-    BLSVerificationVectorPtr vvec = cache.BuildQuorumVerificationVector(::SerializeHash(memberIndexes), vvecs);
+    BLSVerificationVectorPtr vvec = BuildQuorumVerificationVector(memberIndexes, vvecs);
     if (vvec == nullptr) {
         logger.Batch("failed to build quorum verification vector");
         return;
@@ -1091,7 +1136,7 @@ void CDKGSession::ReceiveMessage(const uint256& hash, const CDKGPrematureCommitm
     BLSSecretKeyVector skContributions;
     BLSVerificationVectorPtr quorumVvec;
     if (dkgManager.GetVerifiedContributions(params.type, pindexQuorum, qc.validMembers, memberIndexes, vvecs, skContributions)) {
-        quorumVvec = cache.BuildQuorumVerificationVector(::SerializeHash(memberIndexes), vvecs);
+        quorumVvec = BuildQuorumVerificationVector(memberIndexes, vvecs);
     }
 
     if (quorumVvec == nullptr) {
@@ -1247,6 +1292,41 @@ std::vector<CFinalCommitment> CDKGSession::FinalizeCommitments()
     return finalCommitments;
 }
 
+// Builds the quorum vvec from the given contributions. Batches of contributions which were aggregated while they
+// arrived are used as a whole if all their members are part of the quorum, aggregation is associative so the
+// result is the same
+BLSVerificationVectorPtr CDKGSession::BuildQuorumVerificationVector(const std::vector<uint16_t>& memberIndexes, const std::vector<BLSVerificationVectorPtr>& vvecs)
+{
+    std::vector<bool> inQuorum(members.size(), false);
+    for (auto idx : memberIndexes) {
+        inQuorum[idx] = true;
+    }
+
+    std::vector<bool> aggregated(members.size(), false);
+    std::vector<BLSVerificationVectorPtr> inputs;
+    for (const auto& agg : vvecAggregates) {
+        bool fComplete = std::all_of(agg.memberIndexes.begin(), agg.memberIndexes.end(), [&](uint16_t idx) { return inQuorum[idx]; });
+        if (!fComplete) {
+            continue;
+        }
+        auto vvec = agg.vvec.get();
+        if (vvec == nullptr) {
+            continue;
+        }
+        inputs.emplace_back(vvec);
+        for (auto idx : agg.memberIndexes) {
+            aggregated[idx] = true;
+        }
+    }
+    for (size_t i = 0; i < memberIndexes.size(); i++) {
+        if (!aggregated[memberIndexes[i]]) {
+            inputs.emplace_back(vvecs[i]);
+        }
+    }
+
+    return cache.BuildQuorumVerificationVector(::SerializeHash(memberIndexes), inputs);
+}
+
 CDKGMember* CDKGSession::GetMember(const uint256& proTxHash) const
 {
     auto it = membersMap.find(proTxHash);
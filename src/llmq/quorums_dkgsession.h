@@ -16,6 +16,9 @@
 
 #include "llmq/quorums_utils.h"
 
+#include <future>
+#include <list>
+
 class UniValue;
 
 namespace llmq
@@ -279,6 +282,24 @@ private:
 
     std::vector<size_t> pendingContributionVerifications;
 
+    // Batches of contributions which are verified in the background while further contributions arrive. The inputs
+    // are shared with the worker, as it only keeps references to them
+    struct ContributionVerificationBatch {
+        std::vector<size_t> memberIndexes;
+        std::shared_ptr<std::vector<BLSVerificationVectorPtr>> vvecs;
+        std::shared_ptr<BLSSecretKeyVector> skContributions;
+        std::future<std::vector<bool>> result;
+    };
+    std::list<ContributionVerificationBatch> contributionVerificationBatches;
+
+    // Aggregated vvecs of the batches of valid contributions, built in the background. When all members of a batch
+    // end up in the quorum, the aggregate replaces their individual vvecs when the quorum vvec is built
+    struct VvecAggregate {
+        std::vector<uint16_t> memberIndexes;
+        std::shared_future<BLSVerificationVectorPtr> vvec;
+    };
+    std::vector<VvecAggregate> vvecAggregates;
+
     // filled by ReceivePrematureCommitment and used by FinalizeCommitments
     std::set<uint256> validCommitments;
 
@@ -308,6 +329,8 @@ public:
     void SendContributions(CDKGPendingMessages& pendingMessages);
     bool PreVerifyMessage(const uint256& hash, const CDKGContribution& qc, bool& retBan) const;
     void ReceiveMessage(const uint256& hash, const CDKGContribution& qc, bool& retBan);
+    void StartVerifyPendingContributions();
+    void FinishContributionVerifications(bool fWait);
     void VerifyPendingContributions();
 
     // Phase 2: complaint
@@ -332,6 +355,7 @@ public:
     std::vector<CFinalCommitment> FinalizeCommitments();
 
     bool AreWeMember() const { return !myProTxHash.IsNull(); }
+    BLSVerificationVectorPtr BuildQuorumVerificationVector(const std::vector<uint16_t>& memberIndexes, const std::vector<BLSVerificationVectorPtr>& vvecs);
     void MarkBadMember(size_t idx);
 
     void RelayInvToParticipants(const CInv& inv) const;
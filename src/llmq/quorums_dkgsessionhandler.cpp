@@ -259,9 +259,25 @@ void CDKGSessionHandler::HandlePhase(QuorumPhase curPhase,
                                      const StartPhaseFunc& startPhaseFunc,
                                      const WhileWaitFunc& runWhileWaiting)
 {
-    SleepBeforePhase(curPhase, expectedQuorumHash, randomSleepFactor, runWhileWaiting);
+    // keep track of the time spent on the actual work of the phase, as opposed to waiting for it to end
+    int64_t nMessagesTime = 0;
+    auto timedRunWhileWaiting = [&]() {
+        int64_t nStart = GetTimeMillis();
+        bool didWork = runWhileWaiting();
+        nMessagesTime += GetTimeMillis() - nStart;
+        return didWork;
+    };
+
+    SleepBeforePhase(curPhase, expectedQuorumHash, randomSleepFactor, timedRunWhileWaiting);
+    int64_t nStart = GetTimeMillis();
     startPhaseFunc();
-    WaitForNextPhase(curPhase, nextPhase, expectedQuorumHash, runWhileWaiting);
+    int64_t nStartTime = GetTimeMillis() - nStart;
+    WaitForNextPhase(curPhase, nextPhase, expectedQuorumHash, timedRunWhileWaiting);
+
+    quorumDKGDebugManager->UpdateLocalSessionStatus(params.type, [&](CDKGDebugSessionStatus& status) {
+        status.phaseTimes[(uint8_t)curPhase] = std::make_pair(nStartTime, nMessagesTime);
+        return true;
+    });
 }
 
 // returns a set of NodeIds which sent invalid messages
@@ -537,10 +553,16 @@ void CDKGSessionHandler::HandleDKGRound()
     };
     HandlePhase(QuorumPhase_Commit, QuorumPhase_Finalize, curQuorumHash, 0.1, fCommitStart, fCommitWait);
 
+    int64_t nStart = GetTimeMillis();
     auto finalCommitments = curSession->FinalizeCommitments();
     for (const auto& fqc : finalCommitments) {
         quorumBlockProcessor->AddMinableCommitment(fqc);
     }
+    int64_t nFinalizeTime = GetTimeMillis() - nStart;
+    quorumDKGDebugManager->UpdateLocalSessionStatus(params.type, [&](CDKGDebugSessionStatus& status) {
+        status.phaseTimes[(uint8_t)QuorumPhase_Finalize] = std::make_pair(nFinalizeTime, (int64_t)0);
+        return true;
+    });
 }
 
 void CDKGSessionHandler::PhaseHandlerThread()
@@ -33,10 +33,10 @@ void InitLLMQSystem(CEvoDB& evoDb, CScheduler* scheduler, bool unitTests, bool f
     quorumBlockProcessor = new CQuorumBlockProcessor(evoDb);
     quorumDKGSessionManager = new CDKGSessionManager(*llmqDb, *blsWorker);
     quorumManager = new CQuorumManager(evoDb, *blsWorker, *quorumDKGSessionManager);
-    quorumSigSharesManager = new CSigSharesManager();
+    quorumSigSharesManager = new CSigSharesManager(*blsWorker);
     quorumSigningManager = new CSigningManager(*llmqDb, unitTests);
     chainLocksHandler = new CChainLocksHandler(scheduler);
-    quorumInstantSendManager = new CInstantSendManager(*llmqDb);
+    quorumInstantSendManager = new CInstantSendManager(*llmqDb, *blsWorker);
 }
 
 void DestroyLLMQSystem()
@@ -70,6 +70,9 @@ void StartLLMQSystem()
     if (blsWorker) {
         blsWorker->Start();
     }
+    if (quorumManager) {
+        quorumManager->StartCachePopulatorPool();
+    }
     if (quorumDKGSessionManager) {
         quorumDKGSessionManager->StartMessageHandlerPool();
     }
@@ -97,6 +100,9 @@ void StopLLMQSystem()
         quorumSigSharesManager->StopWorkerThread();
         quorumSigSharesManager->UnregisterAsRecoveredSigsListener();
     }
+    if (quorumManager) {
+        quorumManager->StopCachePopulatorPool();
+    }
     if (quorumDKGSessionManager) {
         quorumDKGSessionManager->StopMessageHandlerPool();
     }
@@ -43,6 +43,119 @@ uint256 CInstantSendLock::GetRequestId() const
 
 ////////////////
 
+void CInstantSendLockIndex::Add(const uint256& islockHash, const CInstantSendLockPtr& islock)
+{
+    Entry e{islockHash, islock};
+    for (auto& in : islock->inputs) {
+        auto& shard = byInput[outpointHasher(in) % SHARD_COUNT];
+        boost::unique_lock<boost::shared_mutex> l(shard.mutex);
+        shard.map[in] = e;
+    }
+    auto& shard = byTxid[txidHasher(islock->txid) % SHARD_COUNT];
+    boost::unique_lock<boost::shared_mutex> l(shard.mutex);
+    shard.map[islock->txid] = e;
+}
+
+void CInstantSendLockIndex::Remove(const uint256& islockHash, const CInstantSendLock& islock)
+{
+    // only remove entries of this islock, a conflicting islock might have replaced them already
+    for (auto& in : islock.inputs) {
+        auto& shard = byInput[outpointHasher(in) % SHARD_COUNT];
+        boost::unique_lock<boost::shared_mutex> l(shard.mutex);
+        auto it = shard.map.find(in);
+        if (it != shard.map.end() && it->second.islockHash == islockHash) {
+            shard.map.erase(it);
+        }
+    }
+    auto& shard = byTxid[txidHasher(islock.txid) % SHARD_COUNT];
+    boost::unique_lock<boost::shared_mutex> l(shard.mutex);
+    auto it = shard.map.find(islock.txid);
+    if (it != shard.map.end() && it->second.islockHash == islockHash) {
+        shard.map.erase(it);
+    }
+}
+
+void CInstantSendLockIndex::Clear()
+{
+    for (auto& shard : byInput) {
+        boost::unique_lock<boost::shared_mutex> l(shard.mutex);
+        shard.map.clear();
+    }
+    for (auto& shard : byTxid) {
+        boost::unique_lock<boost::shared_mutex> l(shard.mutex);
+        shard.map.clear();
+    }
+}
+
+bool CInstantSendLockIndex::GetByInput(const COutPoint& outpoint, Entry& ret) const
+{
+    auto& shard = byInput[outpointHasher(outpoint) % SHARD_COUNT];
+    boost::shared_lock<boost::shared_mutex> l(shard.mutex);
+    auto it = shard.map.find(outpoint);
+    if (it == shard.map.end()) {
+        return false;
+    }
+    ret = it->second;
+    return true;
+}
+
+bool CInstantSendLockIndex::GetByTxid(const uint256& txid, Entry& ret) const
+{
+    auto& shard = byTxid[txidHasher(txid) % SHARD_COUNT];
+    boost::shared_lock<boost::shared_mutex> l(shard.mutex);
+    auto it = shard.map.find(txid);
+    if (it == shard.map.end()) {
+        return false;
+    }
+    ret = it->second;
+    return true;
+}
+
+size_t CInstantSendLockIndex::Size() const
+{
+    size_t cnt = 0;
+    for (auto& shard : byTxid) {
+        boost::shared_lock<boost::shared_mutex> l(shard.mutex);
+        cnt += shard.map.size();
+    }
+    return cnt;
+}
+
+////////////////
+
+CInstantSendDb::CInstantSendDb(CDBWrapper& _db) :
+    db(_db)
+{
+    LoadLockIndex();
+}
+
+void CInstantSendDb::LoadLockIndex()
+{
+    int64_t nStart = GetTimeMillis();
+
+    auto it = std::unique_ptr<CDBIterator>(db.NewIterator());
+    auto firstKey = std::make_tuple(std::string("is_i"), uint256());
+
+    it->Seek(firstKey);
+
+    lockIndex.Clear();
+    while (it->Valid()) {
+        decltype(firstKey) curKey;
+        if (!it->GetKey(curKey) || std::get<0>(curKey) != "is_i") {
+            break;
+        }
+
+        auto islock = std::make_shared<CInstantSendLock>();
+        if (it->GetValue(*islock)) {
+            lockIndex.Add(std::get<1>(curKey), islock);
+        }
+
+        it->Next();
+    }
+
+    LogPrintf("CInstantSendDb::%s -- loaded %d islocks, %dms\n", __func__, lockIndex.Size(), GetTimeMillis() - nStart);
+}
+
 void CInstantSendDb::WriteNewInstantSendLock(const uint256& hash, const CInstantSendLock& islock)
 {
     CDBBatch batch(db);
@@ -55,10 +168,7 @@ void CInstantSendDb::WriteNewInstantSendLock(const uint256& hash, const CInstant
 
     auto p = std::make_shared<CInstantSendLock>(islock);
     islockCache.insert(hash, p);
-    txidCache.insert(islock.txid, hash);
-    for (auto& in : islock.inputs) {
-        outpointCache.insert(in, hash);
-    }
+    lockIndex.Add(hash, p);
 }
 
 void CInstantSendDb::RemoveInstantSendLock(CDBBatch& batch, const uint256& hash, CInstantSendLockPtr islock)
@@ -77,10 +187,7 @@ void CInstantSendDb::RemoveInstantSendLock(CDBBatch& batch, const uint256& hash,
     }
 
     islockCache.erase(hash);
-    txidCache.erase(islock->txid);
-    for (auto& in : islock->inputs) {
-        outpointCache.erase(in);
-    }
+    lockIndex.Remove(hash, *islock);
 }
 
 static std::tuple<std::string, uint32_t, uint256> BuildInversedISLockKey(const std::string& k, int nHeight, const uint256& islockHash)
@@ -216,52 +323,33 @@ CInstantSendLockPtr CInstantSendDb::GetInstantSendLockByHash(const uint256& hash
     return ret;
 }
 
+// The lookups by txid and by input only use the lock index and don't need the caller to hold any lock
+
 uint256 CInstantSendDb::GetInstantSendLockHashByTxid(const uint256& txid)
 {
-    uint256 islockHash;
-
-    bool found = txidCache.get(txid, islockHash);
-    if (found && islockHash.IsNull()) {
-        return uint256();
-    }
-
-    if (!found) {
-        found = db.Read(std::make_tuple(std::string("is_tx"), txid), islockHash);
-        txidCache.insert(txid, islockHash);
-    }
-
-    if (!found) {
+    CInstantSendLockIndex::Entry e;
+    if (!lockIndex.GetByTxid(txid, e)) {
         return uint256();
     }
-    return islockHash;
+    return e.islockHash;
 }
 
 CInstantSendLockPtr CInstantSendDb::GetInstantSendLockByTxid(const uint256& txid)
 {
-    uint256 islockHash = GetInstantSendLockHashByTxid(txid);
-    if (islockHash.IsNull()) {
+    CInstantSendLockIndex::Entry e;
+    if (!lockIndex.GetByTxid(txid, e)) {
         return nullptr;
     }
-    return GetInstantSendLockByHash(islockHash);
+    return e.islock;
 }
 
 CInstantSendLockPtr CInstantSendDb::GetInstantSendLockByInput(const COutPoint& outpoint)
 {
-    uint256 islockHash;
-    bool found = outpointCache.get(outpoint, islockHash);
-    if (found && islockHash.IsNull()) {
-        return nullptr;
-    }
-
-    if (!found) {
-        found = db.Read(std::make_tuple(std::string("is_in"), outpoint), islockHash);
-        outpointCache.insert(outpoint, islockHash);
-    }
-
-    if (!found) {
+    CInstantSendLockIndex::Entry e;
+    if (!lockIndex.GetByInput(outpoint, e)) {
         return nullptr;
     }
-    return GetInstantSendLockByHash(islockHash);
+    return e.islock;
 }
 
 std::vector<uint256> CInstantSendDb::GetInstantSendLocksByParent(const uint256& parent)
@@ -333,8 +421,9 @@ std::vector<uint256> CInstantSendDb::RemoveChainedInstantSendLocks(const uint256
 
 ////////////////
 
-CInstantSendManager::CInstantSendManager(CDBWrapper& _llmqDb) :
-    db(_llmqDb)
+CInstantSendManager::CInstantSendManager(CDBWrapper& _llmqDb, CBLSWorker& _blsWorker) :
+    db(_llmqDb),
+    blsWorker(_blsWorker)
 {
     workInterrupt.reset();
 }
@@ -797,7 +886,8 @@ std::unordered_set<uint256> CInstantSendManager::ProcessPendingInstantSendLocks(
 {
     auto llmqType = Params().GetConsensus().llmqForInstantSend;
 
-    CBLSBatchVerifier<NodeId, uint256> batchVerifier(false, true, 8);
+    // all ISLOCKs are verified at once, split across the BLS worker threads
+    CBLSBatchVerifier<NodeId, uint256, StaticSaltedHasher> batchVerifier(false, true, 0, &blsWorker);
     std::unordered_map<uint256, std::pair<CQuorumCPtr, CRecoveredSig>> recSigs;
 
     for (const auto& p : pend) {
@@ -1469,7 +1559,7 @@ bool CInstantSendManager::IsLocked(const uint256& txHash)
         return false;
     }
 
-    LOCK(cs);
+    // no need to lock cs, the lookup only uses the concurrent lock index
     return db.GetInstantSendLockByTxid(txHash) != nullptr;
 }
 
@@ -1484,7 +1574,7 @@ CInstantSendLockPtr CInstantSendManager::GetConflictingLock(const CTransaction&
         return nullptr;
     }
 
-    LOCK(cs);
+    // no need to lock cs, the lookups only use the concurrent lock index
     for (const auto& in : tx.vin) {
         auto otherIsLock = db.GetInstantSendLockByInput(in.prevout);
         if (!otherIsLock) {
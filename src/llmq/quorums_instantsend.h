@@ -11,9 +11,12 @@
 #include "unordered_lru_cache.h"
 #include "primitives/transaction.h"
 
+#include <array>
 #include <unordered_map>
 #include <unordered_set>
 
+#include <boost/thread/shared_mutex.hpp>
+
 namespace llmq
 {
 
@@ -40,17 +43,55 @@ public:
 
 typedef std::shared_ptr<CInstantSendLock> CInstantSendLockPtr;
 
+/**
+ * In-memory index of all islocks in the DB by input and by txid. It can be queried concurrently without holding
+ * CInstantSendManager::cs, so that mempool acceptance and block connection don't contend with islock processing.
+ * Entries are split into shards by key hash, each shard has its own read/write lock.
+ */
+class CInstantSendLockIndex
+{
+public:
+    struct Entry {
+        uint256 islockHash;
+        CInstantSendLockPtr islock;
+    };
+
+private:
+    static const size_t SHARD_COUNT = 16;
+
+    template<typename K, typename Hasher>
+    struct Shard {
+        mutable boost::shared_mutex mutex;
+        std::unordered_map<K, Entry, Hasher> map;
+    };
+
+    std::array<Shard<COutPoint, SaltedOutpointHasher>, SHARD_COUNT> byInput;
+    std::array<Shard<uint256, StaticSaltedHasher>, SHARD_COUNT> byTxid;
+    SaltedOutpointHasher outpointHasher;
+    StaticSaltedHasher txidHasher;
+
+public:
+    void Add(const uint256& islockHash, const CInstantSendLockPtr& islock);
+    void Remove(const uint256& islockHash, const CInstantSendLock& islock);
+    void Clear();
+
+    bool GetByInput(const COutPoint& outpoint, Entry& ret) const;
+    bool GetByTxid(const uint256& txid, Entry& ret) const;
+    size_t Size() const;
+};
+
 class CInstantSendDb
 {
 private:
     CDBWrapper& db;
 
     unordered_lru_cache<uint256, CInstantSendLockPtr, StaticSaltedHasher, 10000> islockCache;
-    unordered_lru_cache<uint256, uint256, StaticSaltedHasher, 10000> txidCache;
-    unordered_lru_cache<COutPoint, uint256, SaltedOutpointHasher, 10000> outpointCache;
+    CInstantSendLockIndex lockIndex;
+
+    void LoadLockIndex();
 
 public:
-    CInstantSendDb(CDBWrapper& _db) : db(_db) {}
+    CInstantSendDb(CDBWrapper& _db);
 
     void WriteNewInstantSendLock(const uint256& hash, const CInstantSendLock& islock);
     void RemoveInstantSendLock(CDBBatch& batch, const uint256& hash, CInstantSendLockPtr islock);
@@ -77,6 +118,7 @@ class CInstantSendManager : public CRecoveredSigsListener
 private:
     CCriticalSection cs;
     CInstantSendDb db;
+    CBLSWorker& blsWorker;
 
     std::thread workThread;
     CThreadInterrupt workInterrupt;
@@ -112,7 +154,7 @@ private:
     std::unordered_set<uint256, StaticSaltedHasher> pendingRetryTxs;
 
 public:
-    CInstantSendManager(CDBWrapper& _llmqDb);
+    CInstantSendManager(CDBWrapper& _llmqDb, CBLSWorker& _blsWorker);
     ~CInstantSendManager();
 
     void Start();
@@ -9,9 +9,11 @@
 #include "activemasternode.h"
 #include "bls/bls_batchverifier.h"
 #include "cxxtimer.hpp"
+#include "hash.h"
 #include "init.h"
 #include "net_processing.h"
 #include "netmessagemaker.h"
+#include "random.h"
 #include "scheduler.h"
 #include "validation.h"
 
@@ -36,20 +38,90 @@ UniValue CRecoveredSig::ToJson() const
     return ret;
 }
 
+CRecoveredSigsFilter::CRecoveredSigsFilter() :
+    k0(GetRand(std::numeric_limits<uint64_t>::max())),
+    k1(GetRand(std::numeric_limits<uint64_t>::max()))
+{
+}
+
+uint64_t CRecoveredSigsFilter::Hash(KeyType keyType, uint8_t llmqType, const uint256& key) const
+{
+    return CSipHasher(k0, k1).Write(((uint64_t)keyType << 8) | llmqType).Write(key.begin(), key.size()).Finalize();
+}
+
+void CRecoveredSigsFilter::Add(uint32_t writeTime, KeyType keyType, uint8_t llmqType, const uint256& key)
+{
+    auto& chunks = buckets[writeTime / BUCKET_SECONDS];
+    if (chunks.empty() || chunks.back().nEntries >= chunks.back().nMaxEntries) {
+        Chunk chunk;
+        chunk.nMaxEntries = chunks.empty() ? FIRST_CHUNK_ENTRIES : chunks.back().nMaxEntries * 2;
+        chunk.bits.resize((chunk.nMaxEntries * BITS_PER_ENTRY + 63) / 64);
+        chunks.emplace_back(std::move(chunk));
+    }
+
+    auto& chunk = chunks.back();
+    uint64_t h = Hash(keyType, llmqType, key);
+    uint64_t nBits = chunk.bits.size() * 64;
+    uint32_t h1 = (uint32_t)h;
+    uint32_t h2 = (uint32_t)(h >> 32) | 1;
+    for (int i = 0; i < HASH_FUNCS; i++) {
+        uint64_t bit = (h1 + (uint64_t)i * h2) % nBits;
+        chunk.bits[bit >> 6] |= (uint64_t)1 << (bit & 63);
+    }
+    chunk.nEntries++;
+}
+
+bool CRecoveredSigsFilter::MaybeContains(KeyType keyType, uint8_t llmqType, const uint256& key) const
+{
+    if (buckets.empty()) {
+        return false;
+    }
+
+    uint64_t h = Hash(keyType, llmqType, key);
+    uint32_t h1 = (uint32_t)h;
+    uint32_t h2 = (uint32_t)(h >> 32) | 1;
+    for (auto& p : buckets) {
+        for (auto& chunk : p.second) {
+            uint64_t nBits = chunk.bits.size() * 64;
+            int i = 0;
+            for (; i < HASH_FUNCS; i++) {
+                uint64_t bit = (h1 + (uint64_t)i * h2) % nBits;
+                if (!((chunk.bits[bit >> 6] >> (bit & 63)) & 1)) {
+                    break;
+                }
+            }
+            if (i == HASH_FUNCS) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void CRecoveredSigsFilter::RemoveBucketsBefore(uint32_t endTime)
+{
+    buckets.erase(buckets.begin(), buckets.lower_bound(endTime / BUCKET_SECONDS));
+}
+
+void CRecoveredSigsFilter::Clear()
+{
+    buckets.clear();
+}
+
 CRecoveredSigsDb::CRecoveredSigsDb(CDBWrapper& _db) :
     db(_db)
 {
     if (Params().NetworkIDString() == CBaseChainParams::TESTNET) {
         // TODO this can be completely removed after some time (when we're pretty sure the conversion has been run on most testnet MNs)
-        if (db.Exists(std::string("rs_upgraded"))) {
-            return;
-        }
-
-        ConvertInvalidTimeKeys();
-        AddVoteTimeKeys();
+        if (!db.Exists(std::string("rs_upgraded"))) {
+            ConvertInvalidTimeKeys();
+            AddVoteTimeKeys();
 
-        db.Write(std::string("rs_upgraded"), (uint8_t)1);
+            db.Write(std::string("rs_upgraded"), (uint8_t)1);
+        }
     }
+
+    LoadExistenceFilter();
 }
 
 // This converts time values in "rs_t" from host endiannes to big endiannes, which is required to have proper ordering of the keys
@@ -125,8 +197,75 @@ void CRecoveredSigsDb::AddVoteTimeKeys()
     LogPrintf("CRecoveredSigsDb::%s -- added %d rs_vt entries\n", __func__, cnt);
 }
 
+// This fills the existence filter from the "rs_t" keys. Entries which still have the old "rs_t" value
+// (a single byte) are converted to the compact value, which lets the cleanup delete them without reading the recSig.
+void CRecoveredSigsDb::LoadExistenceFilter()
+{
+    int64_t nStart = GetTimeMillis();
+
+    std::unique_ptr<CDBIterator> pcursor(db.NewIterator());
+
+    auto start = std::make_tuple(std::string("rs_t"), (uint32_t)0, (uint8_t)0, uint256());
+    pcursor->Seek(start);
+
+    LOCK(cs);
+    existenceFilter.Clear();
+
+    CDBBatch batch(db);
+    size_t cnt = 0;
+    size_t cntConverted = 0;
+    while (pcursor->Valid()) {
+        decltype(start) k;
+
+        if (!pcursor->GetKey(k) || std::get<0>(k) != "rs_t") {
+            break;
+        }
+
+        uint32_t writeTime = be32toh(std::get<1>(k));
+        uint8_t llmqType = std::get<2>(k);
+        const uint256& id = std::get<3>(k);
+
+        std::tuple<uint256, uint256, uint256> v;
+        if (!pcursor->GetValue(v)) {
+            CRecoveredSig recSig;
+            if (!ReadRecoveredSig((Consensus::LLMQType)llmqType, id, recSig)) {
+                pcursor->Next();
+                continue;
+            }
+            v = std::make_tuple(recSig.msgHash, recSig.GetHash(), CLLMQUtils::BuildSignHash(recSig));
+            batch.Write(k, v);
+            cntConverted++;
+        }
+
+        existenceFilter.Add(writeTime, CRecoveredSigsFilter::KEY_ID, llmqType, id);
+        existenceFilter.Add(writeTime, CRecoveredSigsFilter::KEY_HASH, 0, std::get<1>(v));
+        existenceFilter.Add(writeTime, CRecoveredSigsFilter::KEY_SESSION, 0, std::get<2>(v));
+        cnt++;
+
+        if (batch.SizeEstimate() >= (1 << 24)) {
+            db.WriteBatch(batch);
+            batch.Clear();
+        }
+
+        pcursor->Next();
+    }
+    pcursor.reset();
+
+    db.WriteBatch(batch);
+
+    LogPrintf("CRecoveredSigsDb::%s -- loaded %d recovered sigs into %d buckets, converted %d keys, %dms\n", __func__,
+              cnt, existenceFilter.GetBucketCount(), cntConverted, GetTimeMillis() - nStart);
+}
+
 bool CRecoveredSigsDb::HasRecoveredSig(Consensus::LLMQType llmqType, const uint256& id, const uint256& msgHash)
 {
+    {
+        LOCK(cs);
+        if (!existenceFilter.MaybeContains(CRecoveredSigsFilter::KEY_ID, (uint8_t)llmqType, id)) {
+            return false;
+        }
+    }
+
     auto k = std::make_tuple(std::string("rs_r"), (uint8_t)llmqType, id, msgHash);
     return db.Exists(k);
 }
@@ -140,6 +279,9 @@ bool CRecoveredSigsDb::HasRecoveredSigForId(Consensus::LLMQType llmqType, const
         if (hasSigForIdCache.get(cacheKey, ret)) {
             return ret;
         }
+        if (!existenceFilter.MaybeContains(CRecoveredSigsFilter::KEY_ID, (uint8_t)llmqType, id)) {
+            return false;
+        }
     }
 
 
@@ -159,6 +301,9 @@ bool CRecoveredSigsDb::HasRecoveredSigForSession(const uint256& signHash)
         if (hasSigForSessionCache.get(signHash, ret)) {
             return ret;
         }
+        if (!existenceFilter.MaybeContains(CRecoveredSigsFilter::KEY_SESSION, 0, signHash)) {
+            return false;
+        }
     }
 
     auto k = std::make_tuple(std::string("rs_s"), signHash);
@@ -177,6 +322,9 @@ bool CRecoveredSigsDb::HasRecoveredSigForHash(const uint256& hash)
         if (hasSigForHashCache.get(hash, ret)) {
             return ret;
         }
+        if (!existenceFilter.MaybeContains(CRecoveredSigsFilter::KEY_HASH, 0, hash)) {
+            return false;
+        }
     }
 
     auto k = std::make_tuple(std::string("rs_h"), hash);
@@ -244,15 +392,17 @@ void CRecoveredSigsDb::WriteRecoveredSig(const llmq::CRecoveredSig& recSig)
     batch.Write(k4, (uint8_t)1);
 
     // store by current time. Allows fast cleanup of old recSigs
+    // the value holds everything needed to build the other keys, so that cleanup doesn't have to read the recSig
     auto k5 = std::make_tuple(std::string("rs_t"), (uint32_t)htobe32(curTime), recSig.llmqType, recSig.id);
-    batch.Write(k5, (uint8_t)1);
+    batch.Write(k5, std::make_tuple(recSig.msgHash, recSig.GetHash(), signHash));
 
     db.WriteBatch(batch);
 
     {
-        int64_t t = GetTimeMillis();
-
         LOCK(cs);
+        existenceFilter.Add(curTime, CRecoveredSigsFilter::KEY_ID, recSig.llmqType, recSig.id);
+        existenceFilter.Add(curTime, CRecoveredSigsFilter::KEY_HASH, 0, recSig.GetHash());
+        existenceFilter.Add(curTime, CRecoveredSigsFilter::KEY_SESSION, 0, signHash);
         hasSigForIdCache.insert(std::make_pair((Consensus::LLMQType)recSig.llmqType, recSig.id), true);
         hasSigForSessionCache.insert(signHash, true);
         hasSigForHashCache.insert(recSig.GetHash(), true);
@@ -305,14 +455,19 @@ void CRecoveredSigsDb::RemoveRecoveredSig(Consensus::LLMQType llmqType, const ui
 
 void CRecoveredSigsDb::CleanupOldRecoveredSigs(int64_t maxAge)
 {
+    // only whole time buckets are removed, so that the DB is touched once per bucket instead of on every call
+    // and the matching bucket of the existence filter can be dropped as well
+    uint32_t endTime = (uint32_t)(GetAdjustedTime() - maxAge);
+    endTime -= endTime % CRecoveredSigsFilter::BUCKET_SECONDS;
+
     std::unique_ptr<CDBIterator> pcursor(db.NewIterator());
 
     auto start = std::make_tuple(std::string("rs_t"), (uint32_t)0, (uint8_t)0, uint256());
-    uint32_t endTime = (uint32_t)(GetAdjustedTime() - maxAge);
     pcursor->Seek(start);
 
-    std::vector<std::pair<Consensus::LLMQType, uint256>> toDelete;
-    std::vector<decltype(start)> toDelete2;
+    typedef std::tuple<uint256, uint256, uint256> CompactValue;
+    std::vector<std::pair<decltype(start), CompactValue>> toDelete;
+    std::vector<decltype(start)> toDeleteLegacy;
 
     while (pcursor->Valid()) {
         decltype(start) k;
@@ -324,14 +479,23 @@ void CRecoveredSigsDb::CleanupOldRecoveredSigs(int64_t maxAge)
             break;
         }
 
-        toDelete.emplace_back((Consensus::LLMQType)std::get<2>(k), std::get<3>(k));
-        toDelete2.emplace_back(k);
+        CompactValue v;
+        if (pcursor->GetValue(v)) {
+            toDelete.emplace_back(k, v);
+        } else {
+            toDeleteLegacy.emplace_back(k);
+        }
 
         pcursor->Next();
     }
     pcursor.reset();
 
-    if (toDelete.empty()) {
+    {
+        LOCK(cs);
+        existenceFilter.RemoveBucketsBefore(endTime);
+    }
+
+    if (toDelete.empty() && toDeleteLegacy.empty()) {
         return;
     }
 
@@ -339,22 +503,43 @@ void CRecoveredSigsDb::CleanupOldRecoveredSigs(int64_t maxAge)
     {
         LOCK(cs);
         for (auto& e : toDelete) {
-            RemoveRecoveredSig(batch, e.first, e.second, false);
+            uint8_t llmqType = std::get<2>(e.first);
+            const uint256& id = std::get<3>(e.first);
+            const uint256& msgHash = std::get<0>(e.second);
+            const uint256& hash = std::get<1>(e.second);
+            const uint256& signHash = std::get<2>(e.second);
+
+            batch.Erase(std::make_tuple(std::string("rs_r"), llmqType, id));
+            batch.Erase(std::make_tuple(std::string("rs_r"), llmqType, id, msgHash));
+            batch.Erase(std::make_tuple(std::string("rs_h"), hash));
+            batch.Erase(std::make_tuple(std::string("rs_s"), signHash));
+            batch.Erase(e.first);
+
+            hasSigForIdCache.erase(std::make_pair((Consensus::LLMQType)llmqType, id));
+            hasSigForSessionCache.erase(signHash);
+            hasSigForHashCache.erase(hash);
 
             if (batch.SizeEstimate() >= (1 << 24)) {
                 db.WriteBatch(batch);
                 batch.Clear();
             }
         }
-    }
 
-    for (auto& e : toDelete2) {
-        batch.Erase(e);
+        // entries written by older versions need the recSig to build the keys
+        for (auto& k : toDeleteLegacy) {
+            RemoveRecoveredSig(batch, (Consensus::LLMQType)std::get<2>(k), std::get<3>(k), false);
+            batch.Erase(k);
+
+            if (batch.SizeEstimate() >= (1 << 24)) {
+                db.WriteBatch(batch);
+                batch.Clear();
+            }
+        }
     }
 
     db.WriteBatch(batch);
 
-    LogPrint("llmq", "CRecoveredSigsDb::%d -- deleted %d entries\n", __func__, toDelete.size());
+    LogPrint("llmq", "CRecoveredSigsDb::%s -- deleted %d entries\n", __func__, toDelete.size() + toDeleteLegacy.size());
 }
 
 bool CRecoveredSigsDb::HasVotedOnId(Consensus::LLMQType llmqType, const uint256& id)
@@ -596,7 +781,7 @@ bool CSigningManager::ProcessPendingRecoveredSigs(CConnman& connman)
 
     // It's ok to perform insecure batched verification here as we verify against the quorum public keys, which are not
     // craftable by individual entities, making the rogue public key attack impossible
-    CBLSBatchVerifier<NodeId, uint256> batchVerifier(false, false);
+    CBLSBatchVerifier<NodeId, uint256, StaticSaltedHasher> batchVerifier(false, false);
 
     size_t verifyCount = 0;
     for (auto& p : recSigsByNode) {
@@ -13,6 +13,7 @@
 #include "univalue.h"
 #include "unordered_lru_cache.h"
 
+#include <map>
 #include <unordered_map>
 
 namespace llmq
@@ -61,12 +62,61 @@ public:
     UniValue ToJson() const;
 };
 
+/**
+ * In-memory existence filter for the recovered sigs DB. It never answers "no" for an entry that was
+ * added, so a negative answer allows to skip the DB lookup while a positive answer requires one.
+ * Entries are grouped into buckets by their write time, and whole buckets are dropped when the DB
+ * cleanup removed all entries of that time range. Not thread-safe, the owner must lock.
+ */
+class CRecoveredSigsFilter
+{
+public:
+    static const uint32_t BUCKET_SECONDS = 6 * 60 * 60;
+
+    enum KeyType : uint8_t {
+        KEY_ID,
+        KEY_SESSION,
+        KEY_HASH,
+    };
+
+private:
+    // each chunk is a plain bloom filter, a bucket gets a new chunk (twice as large) when its last one is full
+    struct Chunk {
+        std::vector<uint64_t> bits;
+        size_t nEntries{0};
+        size_t nMaxEntries;
+    };
+
+    static const size_t FIRST_CHUNK_ENTRIES = 4096;
+    static const int BITS_PER_ENTRY = 10;
+    static const int HASH_FUNCS = 7;
+
+    const uint64_t k0, k1;
+    std::map<uint32_t, std::vector<Chunk>> buckets;
+
+public:
+    CRecoveredSigsFilter();
+
+    void Add(uint32_t writeTime, KeyType keyType, uint8_t llmqType, const uint256& key);
+    bool MaybeContains(KeyType keyType, uint8_t llmqType, const uint256& key) const;
+
+    // removes all buckets which only cover times before endTime
+    void RemoveBucketsBefore(uint32_t endTime);
+    void Clear();
+
+    size_t GetBucketCount() const { return buckets.size(); }
+
+private:
+    uint64_t Hash(KeyType keyType, uint8_t llmqType, const uint256& key) const;
+};
+
 class CRecoveredSigsDb
 {
 private:
     CDBWrapper& db;
 
     CCriticalSection cs;
+    CRecoveredSigsFilter existenceFilter;
     unordered_lru_cache<std::pair<Consensus::LLMQType, uint256>, bool, StaticSaltedHasher, 30000> hasSigForIdCache;
     unordered_lru_cache<uint256, bool, StaticSaltedHasher, 30000> hasSigForSessionCache;
     unordered_lru_cache<uint256, bool, StaticSaltedHasher, 30000> hasSigForHashCache;
@@ -76,6 +126,7 @@ public:
 
     void ConvertInvalidTimeKeys();
     void AddVoteTimeKeys();
+    void LoadExistenceFilter();
 
     bool HasRecoveredSig(Consensus::LLMQType llmqType, const uint256& id, const uint256& msgHash);
     bool HasRecoveredSigForId(Consensus::LLMQType llmqType, const uint256& id);
@@ -182,7 +182,8 @@ void CSigSharesNodeState::RemoveSession(const uint256& signHash)
 
 //////////////////////
 
-CSigSharesManager::CSigSharesManager()
+CSigSharesManager::CSigSharesManager(CBLSWorker& _blsWorker) :
+    blsWorker(_blsWorker)
 {
     workInterrupt.reset();
 }
@@ -581,8 +582,10 @@ bool CSigSharesManager::ProcessPendingSigShares(CConnman& connman)
     }
 
     // It's ok to perform insecure batched verification here as we verify against the quorum public key shares,
-    // which are not craftable by individual entities, making the rogue public key attack impossible
-    CBLSBatchVerifier<NodeId, SigShareKey> batchVerifier(false, true);
+    // which are not craftable by individual entities, making the rogue public key attack impossible.
+    // The batch is split by sign hash across the BLS worker threads, so that shares of different sessions (e.g.
+    // ChainLocks and InstantSend at the same time) don't have to be verified one after another on this thread
+    CBLSBatchVerifier<NodeId, SigShareKey, StaticSaltedHasher> batchVerifier(false, true, 0, &blsWorker);
 
     size_t verifyCount = 0;
     for (auto& p : sigSharesByNodes) {
@@ -717,14 +720,13 @@ void CSigSharesManager::TryRecoverSig(const CQuorumCPtr& quorum, const uint256&
         return;
     }
 
-    std::vector<CBLSSignature> sigSharesForRecovery;
-    std::vector<CBLSId> idsForRecovery;
+    auto signHash = CLLMQUtils::BuildSignHash(quorum->params.type, quorum->qc.quorumHash, id, msgHash);
+
+    BLSSignatureVector sigSharesForRecovery;
+    BLSIdVector idsForRecovery;
     {
         LOCK(cs);
 
-        auto k = std::make_pair(quorum->params.type, id);
-
-        auto signHash = CLLMQUtils::BuildSignHash(quorum->params.type, quorum->qc.quorumHash, id, msgHash);
         auto sigShares = this->sigShares.GetAllForSignHash(signHash);
         if (!sigShares) {
             return;
@@ -744,17 +746,26 @@ void CSigSharesManager::TryRecoverSig(const CQuorumCPtr& quorum, const uint256&
         }
     }
 
-    // now recover it
-    cxxtimer::Timer t(true);
-    CBLSSignature recoveredSig;
-    if (!recoveredSig.Recover(sigSharesForRecovery, idsForRecovery)) {
+    // Recovery is expensive for large quorums, so it's done on the BLS worker pool instead of blocking the processing
+    // of all other sig shares. The worker ignores this if the same session is already being recovered
+    int64_t nStartTime = GetTimeMillis();
+    blsWorker.AsyncRecoverSig(signHash, sigSharesForRecovery, idsForRecovery, [this, quorum, id, msgHash, nStartTime](const CBLSSignature& recoveredSig) {
+        FinishRecoverSig(quorum, id, msgHash, recoveredSig, GetTimeMillis() - nStartTime);
+    });
+}
+
+// called on a BLS worker thread
+void CSigSharesManager::FinishRecoverSig(const CQuorumCPtr& quorum, const uint256& id, const uint256& msgHash,
+                                                 const CBLSSignature& recoveredSig, int64_t nTime)
+{
+    if (!recoveredSig.IsValid()) {
         LogPrintf("CSigSharesManager::%s -- failed to recover signature. id=%s, msgHash=%s, time=%d\n", __func__,
-                  id.ToString(), msgHash.ToString(), t.count());
+                  id.ToString(), msgHash.ToString(), nTime);
         return;
     }
 
     LogPrint("llmq-sigs", "CSigSharesManager::%s -- recovered signature. id=%s, msgHash=%s, time=%d\n", __func__,
-              id.ToString(), msgHash.ToString(), t.count());
+              id.ToString(), msgHash.ToString(), nTime);
 
     CRecoveredSig rs;
     rs.llmqType = quorum->params.type;
@@ -778,7 +789,8 @@ void CSigSharesManager::TryRecoverSig(const CQuorumCPtr& quorum, const uint256&
         }
     }
 
-    quorumSigningManager->ProcessRecoveredSig(-1, rs, quorum, connman);
+    // handed over to the sigshares thread, which passes it to CSigningManager::ProcessRecoveredSig
+    quorumSigningManager->PushReconstructedRecoveredSig(rs, quorum);
 }
 
 void CSigSharesManager::CollectSigSharesToRequest(std::unordered_map<NodeId, std::unordered_map<uint256, CSigSharesInv, StaticSaltedHasher>>& sigSharesToRequest)
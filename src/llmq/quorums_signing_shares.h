@@ -343,6 +343,8 @@ class CSigSharesManager : public CRecoveredSigsListener
 private:
     CCriticalSection cs;
 
+    CBLSWorker& blsWorker;
+
     std::thread workThread;
     CThreadInterrupt workInterrupt;
 
@@ -364,7 +366,7 @@ private:
     std::atomic<uint32_t> recoveredSigsCounter{0};
 
 public:
-    CSigSharesManager();
+    CSigSharesManager(CBLSWorker& _blsWorker);
     ~CSigSharesManager();
 
     void StartWorkerThread();
@@ -404,6 +406,8 @@ private:
 
     void ProcessSigShare(NodeId nodeId, const CSigShare& sigShare, CConnman& connman, const CQuorumCPtr& quorum);
     void TryRecoverSig(const CQuorumCPtr& quorum, const uint256& id, const uint256& msgHash, CConnman& connman);
+    void FinishRecoverSig(const CQuorumCPtr& quorum, const uint256& id, const uint256& msgHash,
+                                  const CBLSSignature& recoveredSig, int64_t nTime);
 
 private:
     bool GetSessionInfoByRecvId(NodeId nodeId, uint32_t sessionId, CSigSharesNodeState::SessionInfo& retInfo);
@@ -3193,10 +3193,14 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
 
         LOCK(cs_main);
 
-        CSimplifiedMNListDiff mnListDiff;
+        std::shared_ptr<const std::vector<unsigned char>> mnListDiffData;
         std::string strError;
-        if (BuildSimplifiedMNListDiff(cmd.baseBlockHash, cmd.blockHash, mnListDiff, strError)) {
-            connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::MNLISTDIFF, mnListDiff));
+        if (GetSerializedSimplifiedMNListDiff(cmd.baseBlockHash, cmd.blockHash, pfrom->GetSendVersion(), mnListDiffData, strError)) {
+            // the diff is cached in serialized form, so it can be sent as is without copying it
+            CSerializedNetMsg msg;
+            msg.command = NetMsgType::MNLISTDIFF;
+            msg.sharedData = std::move(mnListDiffData);
+            connman.PushMessage(pfrom, std::move(msg));
         } else {
             LogPrint("net", "getmnlistdiff failed for baseBlockHash=%s, blockHash=%s. error=%s\n", cmd.baseBlockHash.ToString(), cmd.blockHash.ToString(), strError);
             Misbehaving(pfrom->id, 1);
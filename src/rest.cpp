@@ -3,16 +3,19 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "base58.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "validation.h"
 #include "httpserver.h"
+#include "spentindex.h"
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
 #include "txmempool.h"
+#include "util.h"
 #include "utilstrencodings.h"
 #include "version.h"
 
@@ -64,6 +67,8 @@ extern UniValue mempoolInfoToJSON();
 extern UniValue mempoolToJSON(bool fVerbose = false);
 extern void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex);
 extern UniValue blockheaderToJSON(const CBlockIndex* blockindex);
+extern UniValue addressDeltaToJSON(const CAddressIndexKey& key, CAmount amount);
+extern UniValue addressUtxoToJSON(const CAddressUnspentKey& key, const CAddressUnspentValue& value);
 
 static bool RESTERR(HTTPRequest* req, enum HTTPStatusCode status, std::string message)
 {
@@ -591,6 +596,132 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+enum AddressIndexList {
+    ADDRESS_DELTAS,
+    ADDRESS_TXIDS,
+    ADDRESS_UTXOS,
+};
+
+/**
+ * Read the next page of an address index list as comma separated JSON entries.
+ * Returns false if the address index can't be read, fMore tells whether the page ended before the list did.
+ */
+static bool ReadAddressIndexPage(AddressIndexList list, const uint160& hashBytes, int type, bool fFirst,
+                                 CAddressIndexKey& keyIndex, CAddressUnspentKey& keyUnspent,
+                                 std::string& strPage, bool& fMore)
+{
+    size_t nEntries = 0;
+    fMore = false;
+    auto append = [&](const UniValue& entry) {
+        if (nEntries++ > 0 || !fFirst) {
+            strPage += ",";
+        }
+        strPage += entry.write();
+    };
+
+    if (list == ADDRESS_UTXOS) {
+        return GetAddressUnspent(hashBytes, type, fFirst ? nullptr : &keyUnspent, [&](const CAddressUnspentKey& key, const CAddressUnspentValue& value) {
+            if (nEntries >= DEFAULT_ADDRESSINDEX_PAGE_SIZE) {
+                keyUnspent = key;
+                fMore = true;
+                return false;
+            }
+            append(addressUtxoToJSON(key, value));
+            return true;
+        });
+    }
+
+    // all entries of a transaction are next to each other, a page of txids only ends at a new transaction
+    uint256 txhashLast;
+    return GetAddressIndex(hashBytes, type, fFirst ? nullptr : &keyIndex, 0, 0, [&](const CAddressIndexKey& key, CAmount amount) {
+        if (list == ADDRESS_TXIDS && key.txhash == txhashLast) {
+            return true;
+        }
+        if (nEntries >= DEFAULT_ADDRESSINDEX_PAGE_SIZE) {
+            keyIndex = key;
+            fMore = true;
+            return false;
+        }
+        if (list == ADDRESS_TXIDS) {
+            append(UniValue(key.txhash.GetHex()));
+            txhashLast = key.txhash;
+        } else {
+            append(addressDeltaToJSON(key, amount));
+        }
+        return true;
+    });
+}
+
+/**
+ * Address index lists can be arbitrarily long, so they are streamed to the client
+ * in chunks of one page each instead of being built up in memory first.
+ */
+static bool rest_address(HTTPRequest* req, const std::string& strURIPart, AddressIndexList list)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+
+    uint160 hashBytes;
+    int type = 0;
+    if (!CBitcoinAddress(param).GetIndexKey(hashBytes, type))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid address: " + param);
+
+    switch (rf) {
+    case RF_JSON: {
+        CAddressIndexKey keyIndex;
+        CAddressUnspentKey keyUnspent;
+        std::string strPage = "[";
+        bool fMore;
+        if (!ReadAddressIndexPage(list, hashBytes, type, true, keyIndex, keyUnspent, strPage, fMore))
+            return RESTERR(req, HTTP_NOT_FOUND, "No information available for address (is -addressindex enabled?)");
+
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReplyStart(HTTP_OK);
+        while (fMore) {
+            // waits for the client to read earlier pages, so only a few pages are in memory at a time
+            if (!req->WriteReplyChunk(strPage)) {
+                LogPrint("http", "%s: the client went away, stopping the reply\n", __func__);
+                break;
+            }
+            strPage.clear();
+            if (!ReadAddressIndexPage(list, hashBytes, type, false, keyIndex, keyUnspent, strPage, fMore)) {
+                // the status is already sent, all that can be done is to cut the reply short
+                LogPrint("http", "%s: reading the address index failed, truncating the reply\n", __func__);
+                break;
+            }
+        }
+        if (!fMore) {
+            req->WriteReplyChunk(strPage + "]\n");
+        }
+        req->WriteReplyEnd();
+        return true;
+    }
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: json)");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
+static bool rest_address_deltas(HTTPRequest* req, const std::string& strURIPart)
+{
+    return rest_address(req, strURIPart, ADDRESS_DELTAS);
+}
+
+static bool rest_address_txids(HTTPRequest* req, const std::string& strURIPart)
+{
+    return rest_address(req, strURIPart, ADDRESS_TXIDS);
+}
+
+static bool rest_address_utxos(HTTPRequest* req, const std::string& strURIPart)
+{
+    return rest_address(req, strURIPart, ADDRESS_UTXOS);
+}
+
 static const struct {
     const char* prefix;
     bool (*handler)(HTTPRequest* req, const std::string& strReq);
@@ -603,6 +734,9 @@ static const struct {
       {"/rest/mempool/contents", rest_mempool_contents},
       {"/rest/headers/", rest_headers},
       {"/rest/getutxos", rest_getutxos},
+      {"/rest/addressdeltas/", rest_address_deltas},
+      {"/rest/addresstxids/", rest_address_txids},
+      {"/rest/addressutxos/", rest_address_utxos},
 };
 
 bool StartREST()
@@ -23,8 +23,10 @@
 
 #include "masternode-sync.h"
 #include "spork.h"
+#include "streams.h"
 
 #include <stdint.h>
+#include <functional>
 
 #include <boost/assign/list_of.hpp>
 #include <boost/algorithm/string.hpp>
@@ -683,6 +685,158 @@ bool timestampSort(std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> a,
     return a.second.time < b.second.time;
 }
 
+UniValue addressDeltaToJSON(const CAddressIndexKey& key, CAmount amount)
+{
+    std::string address;
+    if (!getAddressFromIndex(key.type, key.hashBytes, address)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown address type");
+    }
+
+    UniValue delta(UniValue::VOBJ);
+    delta.push_back(Pair("satoshis", amount));
+    delta.push_back(Pair("txid", key.txhash.GetHex()));
+    delta.push_back(Pair("index", (int)key.index));
+    delta.push_back(Pair("blockindex", (int)key.txindex));
+    delta.push_back(Pair("height", key.blockHeight));
+    delta.push_back(Pair("address", address));
+    return delta;
+}
+
+UniValue addressUtxoToJSON(const CAddressUnspentKey& key, const CAddressUnspentValue& value)
+{
+    std::string address;
+    if (!getAddressFromIndex(key.type, key.hashBytes, address)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown address type");
+    }
+
+    UniValue output(UniValue::VOBJ);
+    output.push_back(Pair("address", address));
+    output.push_back(Pair("txid", key.txhash.GetHex()));
+    output.push_back(Pair("outputIndex", (int)key.index));
+    output.push_back(Pair("script", HexStr(value.script.begin(), value.script.end())));
+    output.push_back(Pair("satoshis", value.satoshis));
+    output.push_back(Pair("height", value.blockHeight));
+    return output;
+}
+
+/**
+ * Pagination of the address index calls. The results of a page are returned along with a cursor,
+ * which is the hex encoded index key of the first entry of the next page, or null after the last page.
+ */
+struct AddressIndexPage
+{
+    bool fEnabled{false};
+    size_t nLimit{DEFAULT_ADDRESSINDEX_PAGE_SIZE};
+    std::string strCursor;
+};
+
+AddressIndexPage getAddressIndexPageFromParams(const UniValue& params)
+{
+    AddressIndexPage page;
+    if (!params[0].isObject()) {
+        return page;
+    }
+
+    UniValue limitValue = find_value(params[0].get_obj(), "limit");
+    UniValue cursorValue = find_value(params[0].get_obj(), "cursor");
+    if (!limitValue.isNull()) {
+        int64_t nLimit = limitValue.get_int64();
+        if (nLimit <= 0 || nLimit > (int64_t)MAX_ADDRESSINDEX_PAGE_SIZE) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Limit is expected to be between 1 and %u", MAX_ADDRESSINDEX_PAGE_SIZE));
+        }
+        page.fEnabled = true;
+        page.nLimit = nLimit;
+    }
+    if (!cursorValue.isNull()) {
+        page.fEnabled = true;
+        page.strCursor = cursorValue.get_str();
+    }
+    return page;
+}
+
+template<typename Key>
+std::string encodeAddressIndexCursor(const Key& key)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << key;
+    return HexStr(ss.begin(), ss.end());
+}
+
+/** Decode a cursor and return the position of the address it belongs to */
+template<typename Key>
+size_t decodeAddressIndexCursor(const std::string& strCursor, const std::vector<std::pair<uint160, int> >& addresses, Key& key)
+{
+    std::vector<unsigned char> data(ParseHex(strCursor));
+    if (!IsHex(strCursor) || data.size() != key.GetSerializeSize(SER_DISK, CLIENT_VERSION)) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+    }
+    CDataStream ss(data, SER_DISK, CLIENT_VERSION);
+    ss >> key;
+    for (size_t i = 0; i < addresses.size(); i++) {
+        if (addresses[i].first == key.hashBytes && addresses[i].second == (int)key.type) {
+            return i;
+        }
+    }
+    throw JSONRPCError(RPC_INVALID_PARAMETER, "Cursor does not belong to the requested addresses");
+}
+
+/**
+ * Visit the address index entries of the addresses one address after the other, beginning at the cursor.
+ * Returns the cursor of the entry fn stopped at, or an empty string if all entries were visited.
+ */
+std::string pageAddressIndex(const std::vector<std::pair<uint160, int> >& addresses, int start, int end, const std::string& strCursor,
+                             const std::function<bool(const CAddressIndexKey&, CAmount)>& fn)
+{
+    CAddressIndexKey keyCursor;
+    size_t nFirst = strCursor.empty() ? 0 : decodeAddressIndexCursor(strCursor, addresses, keyCursor);
+
+    std::string strNext;
+    for (size_t i = nFirst; i < addresses.size() && strNext.empty(); i++) {
+        auto visit = [&](const CAddressIndexKey& key, CAmount amount) {
+            if (!fn(key, amount)) {
+                strNext = encodeAddressIndexCursor(key);
+                return false;
+            }
+            return true;
+        };
+        if (!GetAddressIndex(addresses[i].first, addresses[i].second, (i == nFirst && !strCursor.empty()) ? &keyCursor : nullptr, start, end, visit)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+        }
+    }
+    return strNext;
+}
+
+/** Same as above for the unspent outputs of the addresses */
+std::string pageAddressUnspent(const std::vector<std::pair<uint160, int> >& addresses, const std::string& strCursor,
+                               const std::function<bool(const CAddressUnspentKey&, const CAddressUnspentValue&)>& fn)
+{
+    CAddressUnspentKey keyCursor;
+    size_t nFirst = strCursor.empty() ? 0 : decodeAddressIndexCursor(strCursor, addresses, keyCursor);
+
+    std::string strNext;
+    for (size_t i = nFirst; i < addresses.size() && strNext.empty(); i++) {
+        auto visit = [&](const CAddressUnspentKey& key, const CAddressUnspentValue& value) {
+            if (!fn(key, value)) {
+                strNext = encodeAddressIndexCursor(key);
+                return false;
+            }
+            return true;
+        };
+        if (!GetAddressUnspent(addresses[i].first, addresses[i].second, (i == nFirst && !strCursor.empty()) ? &keyCursor : nullptr, visit)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+        }
+    }
+    return strNext;
+}
+
+UniValue addressIndexPageToJSON(const std::string& strName, const UniValue& results, const std::string& strNext)
+{
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair(strName, results));
+    result.push_back(Pair("cursor", strNext.empty() ? NullUniValue : UniValue(strNext)));
+    return result;
+}
+
 UniValue getaddressmempool(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 1)
@@ -767,6 +921,8 @@ UniValue getaddressutxos(const JSONRPCRequest& request)
             "      \"address\"  (string) The base58check encoded address\n"
             "      ,...\n"
             "    ]\n"
+            "  \"limit\" (number, optional) Return at most this many outputs, see below\n"
+            "  \"cursor\" (string, optional) Continue with the page of a previous call\n"
             "}\n"
             "\nResult:\n"
             "[\n"
@@ -779,8 +935,14 @@ UniValue getaddressutxos(const JSONRPCRequest& request)
             "    \"height\"  (number) The block height\n"
             "  }\n"
             "]\n"
+            "\nResult (with limit or cursor):\n"
+            "{\n"
+            "  \"utxos\": [ ... ]  (array) The outputs as above, address by address in index order instead of by height\n"
+            "  \"cursor\": \"hex\"  (string) The cursor of the next page, or null after the last page\n"
+            "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getaddressutxos", "'{\"addresses\": [\"PK6NyLfYDqXyKXZz8EhJWjz3rReqT4VR4a\"]}'")
+            + HelpExampleCli("getaddressutxos", "'{\"addresses\": [\"PK6NyLfYDqXyKXZz8EhJWjz3rReqT4VR4a\"], \"limit\": 1000}'")
             + HelpExampleRpc("getaddressutxos", "{\"addresses\": [\"PK6NyLfYDqXyKXZz8EhJWjz3rReqT4VR4a\"]}")
         );
 
@@ -790,6 +952,19 @@ UniValue getaddressutxos(const JSONRPCRequest& request)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
+    AddressIndexPage page = getAddressIndexPageFromParams(request.params);
+    if (page.fEnabled) {
+        UniValue utxos(UniValue::VARR);
+        std::string strNext = pageAddressUnspent(addresses, page.strCursor, [&](const CAddressUnspentKey& key, const CAddressUnspentValue& value) {
+            if (utxos.size() >= page.nLimit) {
+                return false;
+            }
+            utxos.push_back(addressUtxoToJSON(key, value));
+            return true;
+        });
+        return addressIndexPageToJSON("utxos", utxos, strNext);
+    }
+
     std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputs;
 
     for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
@@ -803,19 +978,7 @@ UniValue getaddressutxos(const JSONRPCRequest& request)
     UniValue result(UniValue::VARR);
 
     for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=unspentOutputs.begin(); it!=unspentOutputs.end(); it++) {
-        UniValue output(UniValue::VOBJ);
-        std::string address;
-        if (!getAddressFromIndex(it->first.type, it->first.hashBytes, address)) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown address type");
-        }
-
-        output.push_back(Pair("address", address));
-        output.push_back(Pair("txid", it->first.txhash.GetHex()));
-        output.push_back(Pair("outputIndex", (int)it->first.index));
-        output.push_back(Pair("script", HexStr(it->second.script.begin(), it->second.script.end())));
-        output.push_back(Pair("satoshis", it->second.satoshis));
-        output.push_back(Pair("height", it->second.blockHeight));
-        result.push_back(output);
+        result.push_back(addressUtxoToJSON(it->first, it->second));
     }
 
     return result;
@@ -836,6 +999,8 @@ UniValue getaddressdeltas(const JSONRPCRequest& request)
             "    ]\n"
             "  \"start\" (number) The start block height\n"
             "  \"end\" (number) The end block height\n"
+            "  \"limit\" (number, optional) Return at most this many deltas, see below\n"
+            "  \"cursor\" (string, optional) Continue with the page of a previous call\n"
             "}\n"
             "\nResult:\n"
             "[\n"
@@ -848,8 +1013,14 @@ UniValue getaddressdeltas(const JSONRPCRequest& request)
             "    \"address\"  (string) The base58check encoded address\n"
             "  }\n"
             "]\n"
+            "\nResult (with limit or cursor):\n"
+            "{\n"
+            "  \"deltas\": [ ... ]  (array) The deltas as above\n"
+            "  \"cursor\": \"hex\"  (string) The cursor of the next page, or null after the last page\n"
+            "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getaddressdeltas", "'{\"addresses\": [\"PK6NyLfYDqXyKXZz8EhJWjz3rReqT4VR4a\"]}'")
+            + HelpExampleCli("getaddressdeltas", "'{\"addresses\": [\"PK6NyLfYDqXyKXZz8EhJWjz3rReqT4VR4a\"], \"limit\": 1000}'")
             + HelpExampleRpc("getaddressdeltas", "{\"addresses\": [\"PK6NyLfYDqXyKXZz8EhJWjz3rReqT4VR4a\"]}")
         );
 
@@ -874,6 +1045,19 @@ UniValue getaddressdeltas(const JSONRPCRequest& request)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
+    AddressIndexPage page = getAddressIndexPageFromParams(request.params);
+    if (page.fEnabled) {
+        UniValue deltas(UniValue::VARR);
+        std::string strNext = pageAddressIndex(addresses, start, end, page.strCursor, [&](const CAddressIndexKey& key, CAmount amount) {
+            if (deltas.size() >= page.nLimit) {
+                return false;
+            }
+            deltas.push_back(addressDeltaToJSON(key, amount));
+            return true;
+        });
+        return addressIndexPageToJSON("deltas", deltas, strNext);
+    }
+
     std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
 
     for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
@@ -891,19 +1075,7 @@ UniValue getaddressdeltas(const JSONRPCRequest& request)
     UniValue result(UniValue::VARR);
 
     for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=addressIndex.begin(); it!=addressIndex.end(); it++) {
-        std::string address;
-        if (!getAddressFromIndex(it->first.type, it->first.hashBytes, address)) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown address type");
-        }
-
-        UniValue delta(UniValue::VOBJ);
-        delta.push_back(Pair("satoshis", it->second));
-        delta.push_back(Pair("txid", it->first.txhash.GetHex()));
-        delta.push_back(Pair("index", (int)it->first.index));
-        delta.push_back(Pair("blockindex", (int)it->first.txindex));
-        delta.push_back(Pair("height", it->first.blockHeight));
-        delta.push_back(Pair("address", address));
-        result.push_back(delta);
+        result.push_back(addressDeltaToJSON(it->first, it->second));
     }
 
     return result;
@@ -922,11 +1094,13 @@ UniValue getaddressbalance(const JSONRPCRequest& request)
             "      \"address\"  (string) The base58check encoded address\n"
             "      ,...\n"
             "    ]\n"
+            "  \"verify\" (boolean, optional, default=false) Check the balances against the full history of the addresses\n"
             "}\n"
             "\nResult:\n"
             "{\n"
             "  \"balance\"  (string) The current balance in sierratoshis\n"
             "  \"received\"  (string) The total number of sierratoshis received (including change)\n"
+            "  \"txcount\"  (numeric) The number of transactions of each address, added up\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getaddressbalance", "'{\"addresses\": [\"PK6NyLfYDqXyKXZz8EhJWjz3rReqT4VR4a\"]}'")
@@ -939,27 +1113,49 @@ UniValue getaddressbalance(const JSONRPCRequest& request)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
-    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
-
-    for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        if (!GetAddressIndex((*it).first, (*it).second, addressIndex)) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+    bool fVerify = false;
+    if (request.params[0].isObject()) {
+        UniValue verifyValue = find_value(request.params[0].get_obj(), "verify");
+        if (!verifyValue.isNull()) {
+            fVerify = verifyValue.get_bool();
         }
     }
 
     CAmount balance = 0;
     CAmount received = 0;
+    uint64_t txCount = 0;
 
-    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=addressIndex.begin(); it!=addressIndex.end(); it++) {
-        if (it->second > 0) {
-            received += it->second;
+    for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
+        CAddressBalanceValue value;
+        if (!GetAddressBalance((*it).first, (*it).second, value)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
         }
-        balance += it->second;
+
+        if (fVerify) {
+            CAddressBalanceValue valueHistory;
+            uint256 txhashLast;
+            bool fRead = GetAddressIndex((*it).first, (*it).second, nullptr, 0, 0, [&](const CAddressIndexKey& key, CAmount amount) {
+                valueHistory.Add(amount, key.txhash != txhashLast);
+                txhashLast = key.txhash;
+                return true;
+            });
+            if (!fRead) {
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+            }
+            if (value != valueHistory) {
+                throw JSONRPCError(RPC_DATABASE_ERROR, "Address balance doesn't match the address history, restart with -reindex");
+            }
+        }
+
+        balance += value.balance;
+        received += value.received;
+        txCount += value.txCount;
     }
 
     UniValue result(UniValue::VOBJ);
     result.push_back(Pair("balance", balance));
     result.push_back(Pair("received", received));
+    result.push_back(Pair("txcount", txCount));
 
     return result;
 
@@ -980,14 +1176,22 @@ UniValue getaddresstxids(const JSONRPCRequest& request)
             "    ]\n"
             "  \"start\" (number) The start block height\n"
             "  \"end\" (number) The end block height\n"
+            "  \"limit\" (number, optional) Return at most this many txids, see below\n"
+            "  \"cursor\" (string, optional) Continue with the page of a previous call\n"
             "}\n"
             "\nResult:\n"
             "[\n"
             "  \"transactionid\"  (string) The transaction id\n"
             "  ,...\n"
             "]\n"
+            "\nResult (with limit or cursor):\n"
+            "{\n"
+            "  \"txids\": [ ... ]  (array) The txids as above, address by address instead of merged by height\n"
+            "  \"cursor\": \"hex\"  (string) The cursor of the next page, or null after the last page\n"
+            "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getaddresstxids", "'{\"addresses\": [\"PK6NyLfYDqXyKXZz8EhJWjz3rReqT4VR4a\"]}'")
+            + HelpExampleCli("getaddresstxids", "'{\"addresses\": [\"PK6NyLfYDqXyKXZz8EhJWjz3rReqT4VR4a\"], \"limit\": 1000}'")
             + HelpExampleRpc("getaddresstxids", "{\"addresses\": [\"PK6NyLfYDqXyKXZz8EhJWjz3rReqT4VR4a\"]}")
         );
 
@@ -1008,6 +1212,25 @@ UniValue getaddresstxids(const JSONRPCRequest& request)
         }
     }
 
+    AddressIndexPage page = getAddressIndexPageFromParams(request.params);
+    if (page.fEnabled) {
+        // all entries of a transaction are next to each other in the index, don't split them across pages
+        UniValue txids(UniValue::VARR);
+        uint256 txhashLast;
+        std::string strNext = pageAddressIndex(addresses, start, end, page.strCursor, [&](const CAddressIndexKey& key, CAmount amount) {
+            if (key.txhash == txhashLast) {
+                return true;
+            }
+            if (txids.size() >= page.nLimit) {
+                return false;
+            }
+            txids.push_back(key.txhash.GetHex());
+            txhashLast = key.txhash;
+            return true;
+        });
+        return addressIndexPageToJSON("txids", txids, strNext);
+    }
+
     std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
 
     for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
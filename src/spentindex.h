@@ -85,6 +85,19 @@ struct CSpentIndexValue {
     }
 };
 
+/**
+ * What the mempool spent index keeps about an input, the spending txid and input index of a
+ * CSpentIndexValue are taken from the spending transaction found through mapNextTx
+ */
+struct CMempoolSpentInput
+{
+    CAmount satoshis;
+    int addressType;
+    uint160 addressHash;
+
+    CMempoolSpentInput(CAmount s, int type, uint160 a) : satoshis(s), addressType(type), addressHash(a) {}
+};
+
 struct CSpentIndexKeyCompare
 {
     bool operator()(const CSpentIndexKey& a, const CSpentIndexKey& b) const {
@@ -298,6 +311,31 @@ struct CAddressIndexKey {
 
 };
 
+struct CAddressIndexKeyCompare
+{
+    bool operator()(const CAddressIndexKey& a, const CAddressIndexKey& b) const {
+        if (a.type != b.type) {
+            return a.type < b.type;
+        }
+        if (a.hashBytes != b.hashBytes) {
+            return a.hashBytes < b.hashBytes;
+        }
+        if (a.blockHeight != b.blockHeight) {
+            return a.blockHeight < b.blockHeight;
+        }
+        if (a.txindex != b.txindex) {
+            return a.txindex < b.txindex;
+        }
+        if (a.txhash != b.txhash) {
+            return a.txhash < b.txhash;
+        }
+        if (a.index != b.index) {
+            return a.index < b.index;
+        }
+        return a.spending < b.spending;
+    }
+};
+
 struct CAddressIndexIteratorKey {
     unsigned int type;
     uint160 hashBytes;
@@ -329,6 +367,10 @@ struct CAddressIndexIteratorKey {
         type = 0;
         hashBytes.SetNull();
     }
+
+    friend bool operator<(const CAddressIndexIteratorKey& a, const CAddressIndexIteratorKey& b) {
+        return a.type < b.type || (a.type == b.type && a.hashBytes < b.hashBytes);
+    }
 };
 
 struct CAddressIndexIteratorHeightKey {
@@ -370,4 +412,63 @@ struct CAddressIndexIteratorHeightKey {
 };
 
 
+/** Running totals of the address index entries of one address */
+struct CAddressBalanceValue {
+    CAmount balance;
+    CAmount received;
+    uint64_t txCount;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(balance);
+        READWRITE(received);
+        READWRITE(VARINT(txCount));
+    }
+
+    CAddressBalanceValue() {
+        SetNull();
+    }
+
+    void SetNull() {
+        balance = 0;
+        received = 0;
+        txCount = 0;
+    }
+
+    bool IsNull() const {
+        return balance == 0 && received == 0 && txCount == 0;
+    }
+
+    /** Account for an address index entry, the tx count is only changed for the first entry of a transaction */
+    void Add(CAmount amount, bool fNewTx) {
+        balance += amount;
+        if (amount > 0) {
+            received += amount;
+        }
+        if (fNewTx) {
+            txCount++;
+        }
+    }
+
+    void Subtract(CAmount amount, bool fLastTx) {
+        balance -= amount;
+        if (amount > 0) {
+            received -= amount;
+        }
+        if (fLastTx) {
+            txCount--;
+        }
+    }
+
+    friend bool operator==(const CAddressBalanceValue& a, const CAddressBalanceValue& b) {
+        return a.balance == b.balance && a.received == b.received && a.txCount == b.txCount;
+    }
+
+    friend bool operator!=(const CAddressBalanceValue& a, const CAddressBalanceValue& b) {
+        return !(a == b);
+    }
+};
+
 #endif // BITCOIN_SPENTINDEX_H
@@ -0,0 +1,324 @@
+// Copyright (c) 2019 The Sierra Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addressindex.h"
+#include "chainparams.h"
+#include "consensus/validation.h"
+#include "indexbuilder.h"
+#include "key.h"
+#include "script/interpreter.h"
+#include "script/standard.h"
+#include "txdb.h"
+#include "validation.h"
+#include "test/test_random.h"
+#include "test/test_sierra.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <atomic>
+#include <map>
+#include <set>
+
+BOOST_FIXTURE_TEST_SUITE(addressindex_tests, BasicTestingSetup)
+
+typedef std::vector<std::pair<CAddressIndexKey, CAmount> > AddressIndexEntries;
+
+/** The entries a block with a few transactions between a handful of addresses adds to the address index */
+static AddressIndexEntries RandomBlockEntries(int nHeight)
+{
+    AddressIndexEntries entries;
+    for (int i = 0; i < 5; i++) {
+        uint256 txhash = GetRandHash();
+        for (int j = 0; j < 4; j++) {
+            uint160 hashBytes;
+            *hashBytes.begin() = insecure_rand() % 8;
+            bool fSpending = insecure_rand() % 2;
+            CAmount amount = (1 + insecure_rand() % 1000) * (fSpending ? -1 : 1);
+            entries.push_back(std::make_pair(CAddressIndexKey(1 + insecure_rand() % 2, hashBytes, nHeight, i, txhash, j, fSpending), amount));
+        }
+    }
+    return entries;
+}
+
+/* The address balances must match a rescan of the address index, also when blocks are written or erased twice */
+BOOST_AUTO_TEST_CASE(address_balances)
+{
+    CBlockTreeDB db(1 << 20, true);
+
+    std::vector<AddressIndexEntries> blocks;
+    for (int nHeight = 1; nHeight <= 50; nHeight++) {
+        blocks.push_back(RandomBlockEntries(nHeight));
+        BOOST_CHECK(db.WriteAddressIndex(blocks.back()));
+    }
+    BOOST_CHECK(db.VerifyAddressBalances());
+
+    // VerifyDB style reconnects of the tip must not count blocks twice
+    BOOST_CHECK(db.WriteAddressIndex(blocks.back()));
+    BOOST_CHECK(db.VerifyAddressBalances());
+
+    CAddressBalanceValue value;
+    uint160 hashBytes;
+    *hashBytes.begin() = 3;
+    CAmount balance = 0;
+    CAmount received = 0;
+    std::set<uint256> setTxs;
+    for (const AddressIndexEntries& entries : blocks) {
+        for (const auto& entry : entries) {
+            if (entry.first.type == 1 && entry.first.hashBytes == hashBytes) {
+                balance += entry.second;
+                received += std::max(entry.second, (CAmount)0);
+                setTxs.insert(entry.first.txhash);
+            }
+        }
+    }
+    BOOST_CHECK_EQUAL(db.ReadAddressBalance(hashBytes, 1, value), !setTxs.empty());
+    BOOST_CHECK_EQUAL(value.balance, balance);
+    BOOST_CHECK_EQUAL(value.received, received);
+    BOOST_CHECK_EQUAL(value.txCount, setTxs.size());
+
+    // disconnect the upper half, twice
+    for (int i = 0; i < 25; i++) {
+        BOOST_CHECK(db.EraseAddressIndex(blocks.back()));
+        BOOST_CHECK(db.EraseAddressIndex(blocks.back()));
+        blocks.pop_back();
+    }
+    BOOST_CHECK(db.VerifyAddressBalances());
+
+    // disconnecting everything leaves no balances behind
+    for (const AddressIndexEntries& entries : blocks) {
+        BOOST_CHECK(db.EraseAddressIndex(entries));
+    }
+    BOOST_CHECK(db.VerifyAddressBalances());
+    BOOST_CHECK(!db.ReadAddressBalance(hashBytes, 1, value));
+    BOOST_CHECK(value.IsNull());
+}
+
+/* Rebuilding the balances from the address index must restore lost or damaged balances */
+BOOST_AUTO_TEST_CASE(address_balances_rebuild)
+{
+    CBlockTreeDB db(1 << 20, true);
+
+    for (int nHeight = 1; nHeight <= 20; nHeight++) {
+        BOOST_CHECK(db.WriteAddressIndex(RandomBlockEntries(nHeight)));
+    }
+
+    // damage a balance and add one of an unused address
+    CAddressBalanceValue value;
+    uint160 hashBytes;
+    db.ReadAddressBalance(hashBytes, 1, value);
+    value.balance++;
+    db.Write(std::make_pair('A', CAddressIndexIteratorKey(1, hashBytes)), value);
+    *hashBytes.begin() = 0xff;
+    db.Write(std::make_pair('A', CAddressIndexIteratorKey(2, hashBytes)), value);
+    BOOST_CHECK(!db.VerifyAddressBalances());
+
+    bool fAddressBalances = false;
+    BOOST_CHECK(db.RebuildAddressBalances());
+    BOOST_CHECK(db.VerifyAddressBalances());
+    BOOST_CHECK(db.ReadFlag("addressbalances", fAddressBalances) && fAddressBalances);
+}
+
+/** Check the balance ConnectBlock and DisconnectBlock kept for an address against the sum of its address index */
+static void CheckAddressBalance(const CKeyID& keyID)
+{
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    BOOST_CHECK(GetAddressIndex(keyID, 1, addressIndex));
+    CAddressBalanceValue expected;
+    std::set<uint256> setTxs;
+    for (const auto& entry : addressIndex) {
+        expected.Add(entry.second, setTxs.insert(entry.first.txhash).second);
+    }
+
+    CAddressBalanceValue value;
+    BOOST_CHECK(GetAddressBalance(keyID, 1, value));
+    BOOST_CHECK_EQUAL(value.balance, expected.balance);
+    BOOST_CHECK_EQUAL(value.received, expected.received);
+    BOOST_CHECK_EQUAL(value.txCount, expected.txCount);
+}
+
+/* Connecting and disconnecting blocks must keep the balances equal to a rescan of the address index */
+BOOST_FIXTURE_TEST_CASE(address_balances_connect_disconnect, TestChain100Setup)
+{
+    fAddressIndex = true;
+
+    CKey key;
+    key.MakeNewKey(true);
+    const CKeyID keyID = key.GetPubKey().GetID();
+    const CKeyID coinbaseKeyID = coinbaseKey.GetPubKey().GetID();
+    const CScript scriptCoinbase = GetScriptForRawPubKey(coinbaseKey.GetPubKey());
+    const CScript scriptKey = GetScriptForDestination(keyID);
+
+    // a coinbase to the new key and a spend of a mature coinbase to it
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(coinbaseTxns[0].GetHash(), 0);
+    spend.vout.resize(2);
+    spend.vout[0].nValue = 11 * CENT;
+    spend.vout[0].scriptPubKey = scriptKey;
+    spend.vout[1].nValue = 5 * CENT;
+    spend.vout[1].scriptPubKey = scriptCoinbase;
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(coinbaseKey.Sign(SignatureHash(scriptCoinbase, spend, 0, SIGHASH_ALL), vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+    CBlock block1 = CreateAndProcessBlock({spend}, scriptKey);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block1.GetHash());
+    CheckAddressBalance(keyID);
+    CheckAddressBalance(coinbaseKeyID);
+
+    // the new key spends back to the coinbase key
+    CMutableTransaction spendBack;
+    spendBack.vin.resize(1);
+    spendBack.vin[0].prevout = COutPoint(spend.GetHash(), 0);
+    spendBack.vout.resize(1);
+    spendBack.vout[0].nValue = 10 * CENT;
+    spendBack.vout[0].scriptPubKey = scriptCoinbase;
+    vchSig.clear();
+    BOOST_CHECK(key.Sign(SignatureHash(scriptKey, spendBack, 0, SIGHASH_ALL), vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spendBack.vin[0].scriptSig << vchSig << ToByteVector(key.GetPubKey());
+    CBlock block2 = CreateAndProcessBlock({spendBack}, scriptCoinbase);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block2.GetHash());
+    CheckAddressBalance(keyID);
+    CheckAddressBalance(coinbaseKeyID);
+
+    CAddressBalanceValue valueConnected;
+    BOOST_CHECK(GetAddressBalance(keyID, 1, valueConnected));
+    BOOST_CHECK_EQUAL(valueConnected.txCount, 3U);
+    BOOST_CHECK(pblocktree->VerifyAddressBalances());
+
+    // disconnect both blocks
+    CBlockIndex* pindex1 = chainActive.Tip()->pprev;
+    CValidationState state;
+    BOOST_CHECK(InvalidateBlock(state, Params(), chainActive.Tip()));
+    CheckAddressBalance(keyID);
+    CheckAddressBalance(coinbaseKeyID);
+    BOOST_CHECK(InvalidateBlock(state, Params(), pindex1));
+    CheckAddressBalance(keyID);
+    CheckAddressBalance(coinbaseKeyID);
+    CAddressBalanceValue value;
+    BOOST_CHECK(GetAddressBalance(keyID, 1, value));
+    BOOST_CHECK(value.IsNull());
+    BOOST_CHECK(pblocktree->VerifyAddressBalances());
+
+    // and connect them again
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(ResetBlockFailureFlags(pindex1));
+    }
+    BOOST_CHECK(ActivateBestChain(state, Params()));
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block2.GetHash());
+    CheckAddressBalance(keyID);
+    CheckAddressBalance(coinbaseKeyID);
+    BOOST_CHECK(GetAddressBalance(keyID, 1, value));
+    BOOST_CHECK_EQUAL(value.balance, valueConnected.balance);
+    BOOST_CHECK_EQUAL(value.txCount, valueConnected.txCount);
+    BOOST_CHECK(pblocktree->VerifyAddressBalances());
+
+    fAddressIndex = false;
+}
+
+/* The mempool address index must return the same deltas, in the same order, as a sorted map of them */
+BOOST_AUTO_TEST_CASE(mempool_address_index)
+{
+    CMempoolAddressIndex index;
+    std::map<CMempoolAddressDeltaKey, CMempoolAddressDelta, CMempoolAddressDeltaKeyCompare> mapExpected;
+    std::vector<uint256> vTxs;
+
+    std::vector<std::pair<uint160, int> > addresses;
+    for (int i = 0; i < 8; i++) {
+        uint160 hashBytes;
+        *hashBytes.begin() = i;
+        addresses.emplace_back(hashBytes, 1 + i % 2);
+    }
+
+    for (int round = 0; round < 20; round++) {
+        for (int i = 0; i < 10; i++) {
+            uint256 txhash = GetRandHash();
+            vTxs.push_back(txhash);
+            for (unsigned int j = 0; j < 4; j++) {
+                const auto& address = addresses[insecure_rand() % addresses.size()];
+                int fSpending = insecure_rand() % 2;
+                CMempoolAddressDeltaKey key(address.second, address.first, txhash, j, fSpending);
+                CMempoolAddressDelta delta(round, fSpending ? -1000 : 1000, GetRandHash(), j);
+                index.Add(key, delta);
+                mapExpected.emplace(key, delta);
+            }
+        }
+
+        // remove a few random transactions
+        for (int i = 0; i < 7 && !vTxs.empty(); i++) {
+            size_t n = insecure_rand() % vTxs.size();
+            index.Remove(vTxs[n]);
+            for (auto it = mapExpected.begin(); it != mapExpected.end();) {
+                it = it->first.txhash == vTxs[n] ? mapExpected.erase(it) : std::next(it);
+            }
+            vTxs.erase(vTxs.begin() + n);
+        }
+        BOOST_CHECK_EQUAL(index.Size(), mapExpected.size());
+
+        std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> > results;
+        index.Get(addresses, results);
+        BOOST_CHECK_EQUAL(results.size(), mapExpected.size());
+
+        std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> > expected;
+        for (const auto& address : addresses) {
+            for (const auto& it : mapExpected) {
+                if (it.first.type == address.second && it.first.addressBytes == address.first) {
+                    expected.push_back(it);
+                }
+            }
+        }
+        BOOST_REQUIRE_EQUAL(results.size(), expected.size());
+        for (size_t i = 0; i < results.size(); i++) {
+            BOOST_CHECK(results[i].first.txhash == expected[i].first.txhash);
+            BOOST_CHECK_EQUAL(results[i].first.index, expected[i].first.index);
+            BOOST_CHECK_EQUAL(results[i].first.spending, expected[i].first.spending);
+            BOOST_CHECK(results[i].second.prevhash == expected[i].second.prevhash);
+            BOOST_CHECK_EQUAL(results[i].second.amount, expected[i].second.amount);
+        }
+    }
+
+    // removing everything leaves an empty index which can be reused
+    for (const uint256& txhash : vTxs) {
+        index.Remove(txhash);
+    }
+    BOOST_CHECK_EQUAL(index.Size(), 0);
+    std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> > results;
+    index.Get(addresses, results);
+    BOOST_CHECK(results.empty());
+}
+
+/* The index build must write every chunk once, also with fewer workers than fit into one write batch */
+BOOST_AUTO_TEST_CASE(index_builder_pipeline)
+{
+    const size_t nBlocks = 2550;
+    const size_t nChunks = 26;
+    for (int nWorkers : {1, 2, 8}) {
+        std::vector<std::atomic<int> > vProcessed(nChunks);
+        std::vector<int> vWritten(nChunks, 0);
+        auto process = [&](size_t nChunk) {
+            vProcessed[nChunk]++;
+            return true;
+        };
+        auto write = [&](const std::vector<size_t>& vReady) {
+            for (size_t nChunk : vReady) {
+                BOOST_CHECK_EQUAL(vProcessed[nChunk].load(), 1);
+                vWritten[nChunk]++;
+            }
+            return true;
+        };
+        BOOST_CHECK(RunIndexBuilderPipeline(nBlocks, nWorkers, process, write));
+        for (size_t i = 0; i < nChunks; i++) {
+            BOOST_CHECK_EQUAL(vWritten[i], 1);
+        }
+    }
+
+    // a chunk which can't be read fails the build
+    auto failingProcess = [](size_t nChunk) { return nChunk != 7; };
+    auto write = [](const std::vector<size_t>& vReady) { return true; };
+    BOOST_CHECK(!RunIndexBuilderPipeline(nBlocks, 1, failingProcess, write));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
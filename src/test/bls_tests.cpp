@@ -4,6 +4,7 @@
 
 #include "bls/bls.h"
 #include "bls/bls_batchverifier.h"
+#include "bls/bls_worker.h"
 #include "test/test_sierra.h"
 
 #include <boost/test/unit_test.hpp>
@@ -77,12 +78,12 @@ static void AddMessage(std::vector<Message>& vec, uint32_t sourceId, uint32_t ms
     vec.emplace_back(m);
 }
 
-static void Verify(std::vector<Message>& vec, bool secureVerification, bool perMessageFallback)
+static void Verify(std::vector<Message>& vec, bool secureVerification, bool perMessageFallback, CBLSWorker* worker = nullptr)
 {
-    CBLSBatchVerifier<uint32_t, uint32_t> batchVerifier(secureVerification, perMessageFallback);
+    CBLSBatchVerifier<uint32_t, uint32_t> batchVerifier(secureVerification, perMessageFallback, 0, worker);
 
-    std::set<uint32_t> expectedBadMessages;
-    std::set<uint32_t> expectedBadSources;
+    std::unordered_set<uint32_t> expectedBadMessages;
+    std::unordered_set<uint32_t> expectedBadSources;
     for (auto& m : vec) {
         if (!m.valid) {
             expectedBadMessages.emplace(m.msgId);
@@ -109,6 +110,12 @@ static void Verify(std::vector<Message>& vec)
     Verify(vec, true, false);
     Verify(vec, false, true);
     Verify(vec, true, true);
+
+    CBLSWorker worker;
+    worker.Start();
+    Verify(vec, false, false, &worker);
+    Verify(vec, false, true, &worker);
+    worker.Stop();
 }
 
 BOOST_AUTO_TEST_CASE(batch_verifier_tests)
@@ -154,4 +161,65 @@ BOOST_AUTO_TEST_CASE(batch_verifier_tests)
     Verify(msgs);
 }
 
+BOOST_AUTO_TEST_CASE(batch_verifier_bisect_tests)
+{
+    std::vector<Message> msgs;
+
+    // enough messages to be split across the worker threads, with a few invalid ones which must be found by bisection
+    for (uint32_t i = 0; i < 100; i++) {
+        AddMessage(msgs, i % 10, i, i, i != 3 && i != 57 && i != 58 && i != 99);
+    }
+    Verify(msgs);
+
+    // all invalid
+    msgs.clear();
+    for (uint32_t i = 0; i < 40; i++) {
+        AddMessage(msgs, i, i, i, false);
+    }
+    Verify(msgs);
+}
+
+BOOST_AUTO_TEST_CASE(recover_sig_tests)
+{
+    const size_t threshold = 3;
+    std::vector<CBLSSecretKey> msk(threshold);
+    for (auto& sk : msk) {
+        sk.MakeNewKey();
+    }
+
+    uint256 signHash = GetRandHash();
+    BLSSignatureVector sigShares;
+    BLSIdVector ids;
+    for (int i = 1; i <= (int)threshold; i++) {
+        CBLSId id = CBLSId::FromInt(i);
+        CBLSSecretKey skShare;
+        BOOST_CHECK(skShare.SecretKeyShare(msk, id));
+        sigShares.emplace_back(skShare.Sign(signHash));
+        ids.emplace_back(id);
+    }
+
+    CBLSWorker worker;
+    worker.Start();
+
+    std::promise<CBLSSignature> p;
+    BOOST_CHECK(worker.AsyncRecoverSig(signHash, sigShares, ids, [&](const CBLSSignature& sig) { p.set_value(sig); }));
+    CBLSSignature recoveredSig = p.get_future().get();
+    BOOST_CHECK(recoveredSig.IsValid());
+    BOOST_CHECK(recoveredSig == msk[0].Sign(signHash));
+
+    // the same session is not recovered again
+    BOOST_CHECK(!worker.AsyncRecoverSig(signHash, sigShares, ids, [](const CBLSSignature& sig) { assert(false); }));
+
+    // failed recoveries can be retried
+    uint256 signHash2 = GetRandHash();
+    std::promise<CBLSSignature> p2;
+    BOOST_CHECK(worker.AsyncRecoverSig(signHash2, sigShares, BLSIdVector(), [&](const CBLSSignature& sig) { p2.set_value(sig); }));
+    BOOST_CHECK(!p2.get_future().get().IsValid());
+    std::promise<CBLSSignature> p3;
+    BOOST_CHECK(worker.AsyncRecoverSig(signHash2, sigShares, ids, [&](const CBLSSignature& sig) { p3.set_value(sig); }));
+    BOOST_CHECK(p3.get_future().get().IsValid());
+
+    worker.Stop();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -255,6 +255,23 @@ BOOST_AUTO_TEST_CASE(sha256_testvectors) {
     TestSHA256(test1, "a316d55510b49662420f49d145d42fb83f31ef8dc016aa4e32df049991a91e26");
 }
 
+BOOST_AUTO_TEST_CASE(sha256d32_test) {
+    // Use an odd count so that both the multi-way and the single hash paths are covered
+    for (int count = 0; count < 11; count++) {
+        std::vector<unsigned char> in(32 * count), out(32 * count);
+        for (auto& b : in) {
+            b = insecure_rand() & 0xff;
+        }
+        SHA256D32(out.data(), in.data(), count);
+        for (int i = 0; i < count; i++) {
+            unsigned char ref[CSHA256::OUTPUT_SIZE];
+            CSHA256().Write(in.data() + 32 * i, 32).Finalize(ref);
+            CSHA256().Write(ref, 32).Finalize(ref);
+            BOOST_CHECK(memcmp(ref, out.data() + 32 * i, 32) == 0);
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(sha512_testvectors) {
     TestSHA512("",
                "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
@@ -17,6 +17,7 @@
 #include "evo/specialtx.h"
 #include "evo/providertx.h"
 #include "evo/deterministicmns.h"
+#include "evo/evodb.h"
 
 #include <boost/test/unit_test.hpp>
 
@@ -401,4 +402,100 @@ BOOST_FIXTURE_TEST_CASE(dip3_protx, TestChainDIP3Setup)
 
     const_cast<Consensus::Params&>(Params().GetConsensus()).DIP0003EnforcementHeight = DIP0003EnforcementHeightBackup;
 }
+static CDeterministicMNCPtr MakeTestDMN(uint64_t internalId)
+{
+    auto state = std::make_shared<CDeterministicMNState>();
+    uint256 keySeed = GetRandHash();
+    state->keyIDOwner = CKeyID(Hash160(keySeed.begin(), keySeed.end()));
+
+    auto dmn = std::make_shared<CDeterministicMN>();
+    dmn->proTxHash = GetRandHash();
+    dmn->internalId = internalId;
+    dmn->collateralOutpoint = COutPoint(GetRandHash(), 0);
+    dmn->nOperatorReward = 0;
+    dmn->pdmnState = state;
+    return dmn;
+}
+
+BOOST_FIXTURE_TEST_CASE(dmn_list_cache, BasicTestingSetup)
+{
+    // a chain of 129 blocks with a snapshot of 500 MNs at the bottom and a MN added at heights 10 and 100
+    const size_t nBlocks = 129;
+    std::vector<uint256> vHashes(nBlocks);
+    std::vector<CBlockIndex> vBlocks(nBlocks);
+    for (size_t i = 0; i < nBlocks; i++) {
+        vHashes[i] = GetRandHash();
+        vBlocks[i].phashBlock = &vHashes[i];
+        vBlocks[i].nHeight = i;
+        vBlocks[i].pprev = i > 0 ? &vBlocks[i - 1] : nullptr;
+    }
+
+    CEvoDB evoDb(1 << 20, true);
+    CDeterministicMNList snapshot(vHashes[0], 0, 500);
+    for (uint64_t i = 0; i < 500; i++) {
+        snapshot.AddMN(MakeTestDMN(i));
+    }
+    evoDb.Write(std::make_pair(std::string("dmn_S"), vHashes[0]), snapshot);
+    CDeterministicMNListDiff diff10, diff100;
+    diff10.addedMNs.emplace_back(MakeTestDMN(500));
+    diff100.addedMNs.emplace_back(MakeTestDMN(501));
+    for (size_t i = 1; i < nBlocks; i++) {
+        CDeterministicMNListDiff diff;
+        evoDb.Write(std::make_pair(std::string("dmn_D"), vHashes[i]), i == 10 ? diff10 : i == 100 ? diff100 : diff);
+    }
+
+    const size_t nEntryUsage = CDeterministicMNManager::EstimateCacheEntryUsage();
+    const size_t nSnapshotUsage = CDeterministicMNManager::EstimateMNsUsage(500) + nEntryUsage;
+    const size_t nList64Usage = CDeterministicMNManager::EstimateDiffUsage(diff10, 501) + nEntryUsage;
+    const size_t nList128Usage = CDeterministicMNManager::EstimateDiffUsage(diff100, 502) + nEntryUsage;
+
+    // the snapshot is charged at full size, the list at height 64 only for the changes since the snapshot.
+    // Adding the list at height 128 then needs more room than the limit leaves
+    const size_t nMaxUsage = nSnapshotUsage + nList64Usage + CDeterministicMNManager::EstimateMNsUsage(1);
+    CDeterministicMNManager manager(evoDb, nMaxUsage);
+    BOOST_CHECK_EQUAL(manager.GetListForBlock(&vBlocks[64]).GetAllMNsCount(), 501U);
+    BOOST_CHECK(manager.IsListCached(vHashes[0]));
+    BOOST_CHECK(manager.IsListCached(vHashes[64]));
+    BOOST_CHECK(!manager.IsListCached(vHashes[63]));
+    BOOST_CHECK_EQUAL(manager.GetListsCacheUsage(), nSnapshotUsage + nList64Usage);
+
+    // the list at height 64 is used on the way and the snapshot is the least recently used list, so the snapshot is
+    // evicted. The list at height 64 doesn't share its nodes with a cached list anymore and is charged at full size,
+    // which leaves exactly enough room for the list at height 128
+    BOOST_CHECK_EQUAL(manager.GetListForBlock(&vBlocks[128]).GetAllMNsCount(), 502U);
+    BOOST_CHECK(!manager.IsListCached(vHashes[0]));
+    BOOST_CHECK(manager.IsListCached(vHashes[64]));
+    BOOST_CHECK(manager.IsListCached(vHashes[128]));
+    const size_t nList64FullUsage = CDeterministicMNManager::EstimateMNsUsage(501) + nEntryUsage;
+    BOOST_CHECK_EQUAL(manager.GetListsCacheUsage(), nList64FullUsage + nList128Usage);
+    BOOST_CHECK(manager.GetListsCacheUsage() <= nMaxUsage);
+
+    // the snapshot doesn't fit next to the others anymore, both are evicted, the list at height 64 first. The list at
+    // height 128 loses its base on the way, so it only stays cached if it fits at full size
+    BOOST_CHECK_EQUAL(manager.GetListForBlock(&vBlocks[0]).GetAllMNsCount(), 500U);
+    BOOST_CHECK(manager.IsListCached(vHashes[0]));
+    BOOST_CHECK(!manager.IsListCached(vHashes[64]));
+    BOOST_CHECK(!manager.IsListCached(vHashes[128]));
+    BOOST_CHECK_EQUAL(manager.GetListsCacheUsage(), nSnapshotUsage);
+
+    // lists are rebuilt from the snapshot again and share its nodes
+    BOOST_CHECK_EQUAL(manager.GetListForBlock(&vBlocks[64]).GetAllMNsCount(), 501U);
+    BOOST_CHECK_EQUAL(manager.GetListsCacheUsage(), nSnapshotUsage + nList64Usage);
+}
+
+BOOST_AUTO_TEST_CASE(dmn_snapshot_due)
+{
+    // every SNAPSHOT_LIST_PERIOD blocks and for the first list
+    BOOST_CHECK(CDeterministicMNManager::IsSnapshotDue(576, false, 0, 10));
+    BOOST_CHECK(CDeterministicMNManager::IsSnapshotDue(1152, false, 0, 10));
+    BOOST_CHECK(!CDeterministicMNManager::IsSnapshotDue(577, false, 0, 10));
+    BOOST_CHECK(CDeterministicMNManager::IsSnapshotDue(577, true, 0, 10));
+
+    // and early once the changes since the last one add up to SNAPSHOT_MIN_CHANGES or the list size, whichever is larger
+    BOOST_CHECK(!CDeterministicMNManager::IsSnapshotDue(577, false, 999, 10));
+    BOOST_CHECK(CDeterministicMNManager::IsSnapshotDue(577, false, 1000, 10));
+    BOOST_CHECK(!CDeterministicMNManager::IsSnapshotDue(577, false, 1500, 2000));
+    BOOST_CHECK(CDeterministicMNManager::IsSnapshotDue(577, false, 2000, 2000));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
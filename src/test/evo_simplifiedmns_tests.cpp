@@ -4,9 +4,17 @@
 
 #include "test/test_sierra.h"
 
+#include "arith_uint256.h"
 #include "bls/bls.h"
+#include "consensus/merkle.h"
 #include "evo/simplifiedmns.h"
+#include "llmq/quorums_commitment.h"
+#include "memusage.h"
 #include "netbase.h"
+#include "primitives/transaction.h"
+#include "streams.h"
+#include "version.h"
+#include "test/test_random.h"
 
 #include <boost/test/unit_test.hpp>
 
@@ -69,5 +77,178 @@ BOOST_AUTO_TEST_CASE(simplifiedmns_merkleroots)
     //printf("merkleRoot=\"%s\",\n", calculatedMerkleRoot.c_str());
 
     BOOST_CHECK(expectedMerkleRoot == calculatedMerkleRoot);
+
+    std::vector<std::pair<uint256, uint256>> upserts;
+    for (auto& smle : entries) {
+        upserts.emplace_back(smle.proRegTxHash, smle.CalcHash());
+    }
+    CSimplifiedMNListMerkleTree tree;
+    tree.Update({}, upserts);
+    BOOST_CHECK(expectedMerkleRoot == tree.GetRoot().ToString());
 }
+
+/* The incremental merkle tree must always match a full recalculation, including the mutation flag */
+BOOST_AUTO_TEST_CASE(simplifiedmns_merkletree)
+{
+    CSimplifiedMNListMerkleTree tree;
+    std::map<uint256, uint256> mapLeaves;
+
+    bool mutated = true;
+    BOOST_CHECK(tree.GetRoot(&mutated).IsNull());
+    BOOST_CHECK(!mutated);
+
+    for (int round = 0; round < 200; round++) {
+        std::vector<uint256> removed;
+        std::vector<std::pair<uint256, uint256>> upserts;
+
+        // mostly small changes, sometimes big ones which change the height of the tree
+        int nChanges = 1 + insecure_rand() % (round % 10 == 0 ? 100 : 4);
+        for (int i = 0; i < nChanges; i++) {
+            // leaves are drawn from a small set so identical neighbours show up
+            uint256 leaf = ArithToUint256(insecure_rand() % 4);
+            int nAction = insecure_rand() % 3;
+            if (nAction == 0 && !mapLeaves.empty()) {
+                auto it = std::next(mapLeaves.begin(), insecure_rand() % mapLeaves.size());
+                auto fUpserted = std::any_of(upserts.begin(), upserts.end(), [&](const std::pair<uint256, uint256>& p) { return p.first == it->first; });
+                if (!fUpserted && std::find(removed.begin(), removed.end(), it->first) == removed.end()) {
+                    removed.emplace_back(it->first);
+                }
+            } else if (nAction == 1 && !mapLeaves.empty()) {
+                auto it = std::next(mapLeaves.begin(), insecure_rand() % mapLeaves.size());
+                if (std::find(removed.begin(), removed.end(), it->first) == removed.end()) {
+                    upserts.emplace_back(it->first, leaf);
+                }
+            } else {
+                upserts.emplace_back(GetRandHash(), leaf);
+            }
+        }
+        for (const auto& hash : removed) {
+            mapLeaves.erase(hash);
+        }
+        for (const auto& p : upserts) {
+            mapLeaves[p.first] = p.second;
+        }
+        tree.Update(removed, upserts);
+
+        std::vector<uint256> leaves;
+        for (const auto& p : mapLeaves) {
+            leaves.emplace_back(p.second);
+        }
+        bool expectedMutated = false;
+        uint256 expectedRoot = ComputeMerkleRoot(leaves, &expectedMutated);
+
+        mutated = false;
+        BOOST_CHECK(tree.GetRoot(&mutated) == expectedRoot);
+        BOOST_CHECK_EQUAL(mutated, expectedMutated);
+    }
+
+    // removing everything results in the root of an empty list
+    std::vector<uint256> removed;
+    for (const auto& p : mapLeaves) {
+        removed.emplace_back(p.first);
+    }
+    tree.Update(removed, {});
+    BOOST_CHECK(tree.GetRoot(&mutated).IsNull());
+    BOOST_CHECK(!mutated);
+}
+
+/** Builds a diff with 50 entries for a cache key and counts how often it is called */
+static CSimplifiedMNListDiffCache::BuildFunc TestDiffBuilder(const std::pair<uint256, uint256>& key, int& nBuilds)
+{
+    return [key, &nBuilds](CSimplifiedMNListDiff& diff, std::string& errorRet) {
+        nBuilds++;
+        diff.baseBlockHash = key.first;
+        diff.blockHash = key.second;
+        diff.cbTx = MakeTransactionRef(CMutableTransaction());
+        for (size_t i = 0; i < 50; i++) {
+            CSimplifiedMNListEntry smle;
+            smle.proRegTxHash = GetRandHash();
+            smle.isValid = true;
+            diff.mnList.emplace_back(smle);
+        }
+        diff.deletedQuorums.emplace_back(1, GetRandHash());
+        return true;
+    };
+}
+
+BOOST_AUTO_TEST_CASE(simplifiedmns_diff_cache)
+{
+    std::vector<std::pair<uint256, uint256>> keys;
+    for (size_t i = 0; i < 4; i++) {
+        keys.emplace_back(GetRandHash(), GetRandHash());
+    }
+    int nBuilds = 0;
+    std::string strError;
+
+    // all test diffs have the same size
+    CSimplifiedMNListDiff sample;
+    TestDiffBuilder(keys[0], nBuilds)(sample, strError);
+    const size_t nDiffUsage = ::GetSerializeSize(sample, SER_NETWORK, PROTOCOL_VERSION);
+    nBuilds = 0;
+
+    // a diff is only built on a miss
+    CSimplifiedMNListDiffCache cache(3 * nDiffUsage);
+    auto diff = cache.Get(keys[0].first, keys[0].second, TestDiffBuilder(keys[0], nBuilds), strError);
+    BOOST_REQUIRE(diff);
+    BOOST_CHECK(diff->blockHash == keys[0].second);
+    BOOST_CHECK_EQUAL(nBuilds, 1);
+    BOOST_CHECK(cache.Get(keys[0].first, keys[0].second, TestDiffBuilder(keys[0], nBuilds), strError) == diff);
+    BOOST_CHECK_EQUAL(nBuilds, 1);
+    BOOST_CHECK_EQUAL(cache.GetUsage(), nDiffUsage);
+
+    // failing to build a diff caches nothing
+    auto fail = [&nBuilds](CSimplifiedMNListDiff& mnListDiff, std::string& errorRet) {
+        nBuilds++;
+        errorRet = "block not found";
+        return false;
+    };
+    BOOST_CHECK(!cache.Get(keys[1].first, keys[1].second, fail, strError));
+    BOOST_CHECK_EQUAL(strError, "block not found");
+    BOOST_CHECK(!cache.Get(keys[1].first, keys[1].second, fail, strError));
+    BOOST_CHECK_EQUAL(nBuilds, 3);
+    BOOST_CHECK_EQUAL(cache.GetUsage(), nDiffUsage);
+
+    // the diff is serialized once per protocol version range, without the quorum changes for old peers
+    for (int nVersion : {LLMQS_PROTO_VERSION - 1, LLMQS_PROTO_VERSION, PROTOCOL_VERSION}) {
+        std::vector<unsigned char> expected;
+        CVectorWriter(SER_NETWORK, nVersion, expected, 0, *diff);
+        auto data = cache.GetSerialized(keys[0].first, keys[0].second, nVersion, TestDiffBuilder(keys[0], nBuilds), strError);
+        BOOST_REQUIRE(data);
+        BOOST_CHECK(*data == expected);
+        BOOST_CHECK(cache.GetSerialized(keys[0].first, keys[0].second, nVersion, TestDiffBuilder(keys[0], nBuilds), strError) == data);
+    }
+    auto dataOld = cache.GetSerialized(keys[0].first, keys[0].second, LLMQS_PROTO_VERSION - 1, TestDiffBuilder(keys[0], nBuilds), strError);
+    auto dataNew = cache.GetSerialized(keys[0].first, keys[0].second, PROTOCOL_VERSION, TestDiffBuilder(keys[0], nBuilds), strError);
+    BOOST_CHECK(dataOld->size() < dataNew->size());
+    BOOST_CHECK_EQUAL(nBuilds, 3);
+    BOOST_CHECK_EQUAL(cache.GetUsage(), nDiffUsage + memusage::DynamicUsage(*dataOld) + memusage::DynamicUsage(*dataNew));
+
+    // the least recently used diff is evicted once the cache is full
+    CSimplifiedMNListDiffCache lruCache(3 * nDiffUsage);
+    nBuilds = 0;
+    auto get = [&](size_t i) {
+        return lruCache.Get(keys[i].first, keys[i].second, TestDiffBuilder(keys[i], nBuilds), strError) != nullptr;
+    };
+    BOOST_CHECK(get(0) && get(1) && get(2));
+    BOOST_CHECK_EQUAL(nBuilds, 3);
+    BOOST_CHECK_EQUAL(lruCache.GetUsage(), 3 * nDiffUsage);
+    BOOST_CHECK(get(0));
+    BOOST_CHECK(get(3));
+    BOOST_CHECK_EQUAL(nBuilds, 4);
+    BOOST_CHECK_EQUAL(lruCache.GetUsage(), 3 * nDiffUsage);
+
+    // 1 was evicted, the others are still cached
+    BOOST_CHECK(get(0) && get(2) && get(3));
+    BOOST_CHECK_EQUAL(nBuilds, 4);
+    BOOST_CHECK(get(1));
+    BOOST_CHECK_EQUAL(nBuilds, 5);
+
+    // which evicted 0, the least recently used one now
+    BOOST_CHECK(get(3) && get(2) && get(1));
+    BOOST_CHECK_EQUAL(nBuilds, 5);
+    BOOST_CHECK(get(0));
+    BOOST_CHECK_EQUAL(nBuilds, 6);
+    BOOST_CHECK(lruCache.GetUsage() <= 3 * nDiffUsage);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,107 @@
+// Copyright (c) 2019 The Sierra Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chain.h"
+#include "kernel.h"
+#include "validation.h"
+#include "test/test_random.h"
+#include "test/test_sierra.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <deque>
+
+BOOST_FIXTURE_TEST_SUITE(kernel_tests, BasicTestingSetup)
+
+/* The batched kernel search must pick the same timestamp and hash as testing them one by one */
+BOOST_AUTO_TEST_CASE(find_stake_kernel_hash)
+{
+    // roughly every other kernel of a 1000 coin output meets this target at full weight
+    const unsigned int nBits = 0x20000020;
+    // v0.3 kernels start at 2025-01-01, cover both sides of it
+    const unsigned int nForkTime = 1735689600;
+    const unsigned int nTimeBlockFrom = nForkTime - 10 * 60 * 60;
+
+    for (int nRound = 0; nRound < 200; nRound++) {
+        uint64_t nStakeModifier = ((uint64_t)insecure_rand() << 32) | insecure_rand();
+        unsigned int nTxPrevOffset = 80 + insecure_rand() % 100000;
+        CAmount nValueIn = (100 + insecure_rand() % 900) * COIN;
+        COutPoint prevout(ArithToUint256(arith_uint256(insecure_rand())), insecure_rand() % 10);
+
+        // later rounds use tighter targets so that some of them don't find anything at all
+        unsigned int nRoundBits = nBits - (nRound / 50) * 0x08;
+        unsigned int nTimeStart = nForkTime - 20 + (nRound % 2) * insecure_rand() % 100000;
+        std::vector<unsigned int> vTimeTx;
+        for (unsigned int i = 0; i < 45; i++) {
+            vTimeTx.push_back(nTimeStart + 45 - i);
+        }
+
+        int nExpected = -1;
+        uint256 hashExpected;
+        for (size_t i = 0; i < vTimeTx.size(); i++) {
+            uint256 hash;
+            if (CheckStakeKernelHash(nRoundBits, nTimeBlockFrom, nTxPrevOffset, nValueIn, nStakeModifier, prevout, vTimeTx[i], hash)) {
+                nExpected = (int)i;
+                hashExpected = hash;
+                break;
+            }
+        }
+
+        uint256 hashFound;
+        int nFound = FindStakeKernelHash(nRoundBits, nTimeBlockFrom, nTxPrevOffset, nValueIn, nStakeModifier, prevout, vTimeTx, hashFound);
+        BOOST_CHECK_EQUAL(nFound, nExpected);
+        if (nExpected >= 0) {
+            BOOST_CHECK(hashFound == hashExpected);
+        }
+    }
+}
+
+/* The stake modifier index must resolve the same modifier as walking the chain, also across reorgs */
+BOOST_AUTO_TEST_CASE(stake_modifier_index)
+{
+    LOCK(cs_main);
+
+    // irregular block times, sometimes going backwards, with a modifier generated every few blocks
+    std::deque<CBlockIndex> blocks;
+    for (int i = 0; i < 2000; i++) {
+        blocks.emplace_back();
+        CBlockIndex& index = blocks.back();
+        index.nHeight = i;
+        index.nTime = 1546300800 + i * 60 + (int)(insecure_rand() % 600) - 300;
+        index.pprev = i > 0 ? &blocks[i - 1] : nullptr;
+        index.SetStakeModifier(insecure_rand(), insecure_rand() % 3 == 0);
+    }
+    // a fork from height 1500 which generated a modifier in every block
+    std::deque<CBlockIndex> fork;
+    for (int i = 1501; i < 1800; i++) {
+        fork.emplace_back();
+        CBlockIndex& index = fork.back();
+        index.nHeight = i;
+        index.nTime = 1546300800 + i * 60;
+        index.pprev = i > 1501 ? &fork[fork.size() - 2] : &blocks[1500];
+        index.SetStakeModifier(insecure_rand(), true);
+    }
+
+    for (const CBlockIndex* pindexTip : {&blocks[1000], &blocks.back(), &fork.back(), &blocks[1700], &blocks.back()}) {
+        chainActive.SetTip(const_cast<CBlockIndex*>(pindexTip));
+        UpdateStakeModifierIndex();
+
+        for (int nHeight = 0; nHeight <= chainActive.Height(); nHeight++) {
+            uint64_t nModifierIndex, nModifierWalk;
+            bool fCompleteIndex, fCompleteWalk;
+            bool fIndex = GetKernelStakeModifier(chainActive[nHeight], nModifierIndex, fCompleteIndex);
+            bool fWalk = GetKernelStakeModifierChainWalk(chainActive[nHeight], nModifierWalk, fCompleteWalk);
+            BOOST_CHECK_EQUAL(fIndex, fWalk);
+            if (fWalk && fCompleteWalk) {
+                BOOST_CHECK(fCompleteIndex);
+                BOOST_CHECK_EQUAL(nModifierIndex, nModifierWalk);
+            }
+        }
+    }
+
+    chainActive.SetTip(nullptr);
+    UpdateStakeModifierIndex();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,121 @@
+// Copyright (c) 2019 The Sierra Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "test/test_sierra.h"
+
+#include "dbwrapper.h"
+#include "llmq/quorums_signing.h"
+#include "llmq/quorums_utils.h"
+#include "test/test_random.h"
+#include "utiltime.h"
+
+#include <boost/test/unit_test.hpp>
+
+using namespace llmq;
+
+BOOST_FIXTURE_TEST_SUITE(llmq_signing_tests, BasicTestingSetup)
+
+/* The existence filter must never miss an entry of a bucket which was not removed yet */
+BOOST_AUTO_TEST_CASE(recovered_sigs_filter)
+{
+    CRecoveredSigsFilter filter;
+    const uint32_t bucketSeconds = CRecoveredSigsFilter::BUCKET_SECONDS;
+    const uint32_t startTime = 1000 * bucketSeconds;
+
+    std::vector<std::pair<uint32_t, uint256>> entries;
+    for (int i = 0; i < 20000; i++) {
+        uint32_t writeTime = startTime + insecure_rand() % (4 * bucketSeconds);
+        entries.emplace_back(writeTime, GetRandHash());
+        filter.Add(writeTime, CRecoveredSigsFilter::KEY_ID, 1, entries.back().second);
+    }
+    BOOST_CHECK_EQUAL(filter.GetBucketCount(), 4);
+
+    size_t falsePositives = 0;
+    for (auto& e : entries) {
+        BOOST_CHECK(filter.MaybeContains(CRecoveredSigsFilter::KEY_ID, 1, e.second));
+        // other key types and LLMQ types are separate
+        falsePositives += filter.MaybeContains(CRecoveredSigsFilter::KEY_HASH, 1, e.second);
+        falsePositives += filter.MaybeContains(CRecoveredSigsFilter::KEY_ID, 2, e.second);
+    }
+    BOOST_CHECK(falsePositives < entries.size() / 5);
+
+    // a time in the middle of a bucket keeps that bucket
+    filter.RemoveBucketsBefore(startTime + 2 * bucketSeconds + bucketSeconds / 2);
+    BOOST_CHECK_EQUAL(filter.GetBucketCount(), 2);
+    for (auto& e : entries) {
+        if (e.first >= startTime + 2 * bucketSeconds) {
+            BOOST_CHECK(filter.MaybeContains(CRecoveredSigsFilter::KEY_ID, 1, e.second));
+        }
+    }
+
+    filter.Clear();
+    BOOST_CHECK(!filter.MaybeContains(CRecoveredSigsFilter::KEY_ID, 1, entries.back().second));
+}
+
+static CRecoveredSig RandomRecoveredSig()
+{
+    CRecoveredSig recSig;
+    recSig.llmqType = Consensus::LLMQ_50_60;
+    recSig.quorumHash = GetRandHash();
+    recSig.id = GetRandHash();
+    recSig.msgHash = GetRandHash();
+    recSig.sig.Set(CBLSSignature());
+    recSig.UpdateHash();
+    return recSig;
+}
+
+/* Recovered sigs must be found until the cleanup removed the whole time bucket they were written in */
+BOOST_AUTO_TEST_CASE(recovered_sigs_db_cleanup)
+{
+    CDBWrapper dbw(GetDataDir() / "llmq_signing_tests", 1 << 20, true);
+    const int64_t bucketSeconds = CRecoveredSigsFilter::BUCKET_SECONDS;
+    const int64_t maxAge = 7 * 24 * 60 * 60;
+    const int64_t startTime = 1000 * bucketSeconds;
+
+    SetMockTime(startTime);
+    CRecoveredSigsDb db(dbw);
+
+    CRecoveredSig recSig1 = RandomRecoveredSig();
+    db.WriteRecoveredSig(recSig1);
+    SetMockTime(startTime + bucketSeconds);
+    CRecoveredSig recSig2 = RandomRecoveredSig();
+    db.WriteRecoveredSig(recSig2);
+
+    CRecoveredSig recSig3 = RandomRecoveredSig();
+    BOOST_CHECK(db.HasRecoveredSigForId((Consensus::LLMQType)recSig1.llmqType, recSig1.id));
+    BOOST_CHECK(db.HasRecoveredSigForHash(recSig1.GetHash()));
+    BOOST_CHECK(db.HasRecoveredSigForSession(CLLMQUtils::BuildSignHash(recSig1)));
+    BOOST_CHECK(db.HasRecoveredSig((Consensus::LLMQType)recSig1.llmqType, recSig1.id, recSig1.msgHash));
+    BOOST_CHECK(!db.HasRecoveredSigForId((Consensus::LLMQType)recSig3.llmqType, recSig3.id));
+    BOOST_CHECK(!db.HasRecoveredSigForHash(recSig3.GetHash()));
+
+    // a second instance on the same DB must find the entries through the loaded existence filter
+    {
+        CRecoveredSigsDb db2(dbw);
+        BOOST_CHECK(db2.HasRecoveredSigForId((Consensus::LLMQType)recSig2.llmqType, recSig2.id));
+        BOOST_CHECK(db2.HasRecoveredSigForSession(CLLMQUtils::BuildSignHash(recSig2)));
+    }
+
+    // not old enough yet
+    SetMockTime(startTime + maxAge + bucketSeconds / 2);
+    db.CleanupOldRecoveredSigs(maxAge);
+    BOOST_CHECK(db.HasRecoveredSigForHash(recSig1.GetHash()));
+
+    // the first bucket is now completely expired
+    SetMockTime(startTime + maxAge + bucketSeconds);
+    db.CleanupOldRecoveredSigs(maxAge);
+    BOOST_CHECK(!db.HasRecoveredSigForId((Consensus::LLMQType)recSig1.llmqType, recSig1.id));
+    BOOST_CHECK(!db.HasRecoveredSigForHash(recSig1.GetHash()));
+    BOOST_CHECK(!db.HasRecoveredSigForSession(CLLMQUtils::BuildSignHash(recSig1)));
+    BOOST_CHECK(db.HasRecoveredSigForHash(recSig2.GetHash()));
+
+    CRecoveredSig recSigRet;
+    BOOST_CHECK(!db.GetRecoveredSigById((Consensus::LLMQType)recSig1.llmqType, recSig1.id, recSigRet));
+    BOOST_CHECK(db.GetRecoveredSigById((Consensus::LLMQType)recSig2.llmqType, recSig2.id, recSigRet));
+    BOOST_CHECK(recSigRet.GetHash() == recSig2.GetHash());
+
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
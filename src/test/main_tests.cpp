@@ -2,7 +2,9 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "chain.h"
 #include "net.h"
+#include "validation.h"
 
 #include "test/test_sierra.h"
 
@@ -27,4 +29,30 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     Test.disconnect(&ReturnTrue);
     BOOST_CHECK(Test());
 }
+
+BOOST_AUTO_TEST_CASE(verify_block_index_hashes)
+{
+    BOOST_CHECK(VerifyBlockIndexHashes(1));
+    BOOST_CHECK(VerifyBlockIndexHashes(4));
+
+    // an entry stored under a hash that doesn't match its header
+    CBlockIndex* pindexGenesis = chainActive.Genesis();
+    CBlockIndex index(pindexGenesis->GetBlockHeader());
+    index.nNonce++;
+    index.pprev = pindexGenesis;
+    index.nHeight = 1;
+    uint256 hash = pindexGenesis->GetBlockHash();
+    hash.begin()[0] ^= 1;
+    {
+        LOCK(cs_main);
+        index.phashBlock = &mapBlockIndex.emplace(hash, &index).first->first;
+    }
+    BOOST_CHECK(!VerifyBlockIndexHashes(1));
+    BOOST_CHECK(!VerifyBlockIndexHashes(4));
+    {
+        LOCK(cs_main);
+        mapBlockIndex.erase(hash);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
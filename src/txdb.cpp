@@ -13,6 +13,8 @@
 #include "init.h"
 
 #include <stdint.h>
+#include <map>
+#include <set>
 
 #include <boost/thread.hpp>
 
@@ -22,6 +24,7 @@ static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
 static const char DB_ADDRESSINDEX = 'a';
 static const char DB_ADDRESSUNSPENTINDEX = 'u';
+static const char DB_ADDRESSBALANCE = 'A';
 static const char DB_TIMESTAMPINDEX = 's';
 static const char DB_SPENTINDEX = 'p';
 static const char DB_BLOCK_INDEX = 'b';
@@ -31,6 +34,9 @@ static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
 
+/** Size of the batches written when rebuilding the address balances */
+static const size_t ADDRESSBALANCE_BATCH_SIZE = 1 << 24;
+
 namespace {
 
 struct CoinEntry {
@@ -235,17 +241,32 @@ bool CBlockTreeDB::UpdateAddressUnspentIndex(const std::vector<std::pair<CAddres
 bool CBlockTreeDB::ReadAddressUnspentIndex(uint160 addressHash, int type,
                                            std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs) {
 
+    return ReadAddressUnspentIndex(addressHash, type, nullptr, [&](const CAddressUnspentKey& key, const CAddressUnspentValue& value) {
+        unspentOutputs.push_back(std::make_pair(key, value));
+        return true;
+    });
+}
+
+bool CBlockTreeDB::ReadAddressUnspentIndex(uint160 addressHash, int type, const CAddressUnspentKey* pkeyStart,
+                                           const std::function<bool(const CAddressUnspentKey&, const CAddressUnspentValue&)>& fn) {
+
     std::unique_ptr<CDBIterator> pcursor(NewIterator());
 
-    pcursor->Seek(std::make_pair(DB_ADDRESSUNSPENTINDEX, CAddressIndexIteratorKey(type, addressHash)));
+    if (pkeyStart) {
+        pcursor->Seek(std::make_pair(DB_ADDRESSUNSPENTINDEX, *pkeyStart));
+    } else {
+        pcursor->Seek(std::make_pair(DB_ADDRESSUNSPENTINDEX, CAddressIndexIteratorKey(type, addressHash)));
+    }
 
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
         std::pair<char,CAddressUnspentKey> key;
-        if (pcursor->GetKey(key) && key.first == DB_ADDRESSUNSPENTINDEX && key.second.hashBytes == addressHash) {
+        if (pcursor->GetKey(key) && key.first == DB_ADDRESSUNSPENTINDEX && key.second.hashBytes == addressHash && key.second.type == (unsigned int)type) {
             CAddressUnspentValue nValue;
             if (pcursor->GetValue(nValue)) {
-                unspentOutputs.push_back(std::make_pair(key.second, nValue));
+                if (!fn(key.second, nValue)) {
+                    break;
+                }
                 pcursor->Next();
             } else {
                 return error("failed to get address unspent value");
@@ -260,6 +281,7 @@ bool CBlockTreeDB::ReadAddressUnspentIndex(uint160 addressHash, int type,
 
 bool CBlockTreeDB::WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
     CDBBatch batch(*this);
+    UpdateAddressBalances(batch, vect, false);
     for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
         batch.Write(std::make_pair(DB_ADDRESSINDEX, it->first), it->second);
     return WriteBatch(batch);
@@ -267,18 +289,183 @@ bool CBlockTreeDB::WriteAddressIndex(const std::vector<std::pair<CAddressIndexKe
 
 bool CBlockTreeDB::EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
     CDBBatch batch(*this);
+    UpdateAddressBalances(batch, vect, true);
     for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
         batch.Erase(std::make_pair(DB_ADDRESSINDEX, it->first));
     return WriteBatch(batch);
 }
 
+void CBlockTreeDB::UpdateAddressBalances(CDBBatch& batch, const std::vector<std::pair<CAddressIndexKey, CAmount> >& vect, bool fErase) {
+    // Blocks which are written or erased twice (a reconnect after an unclean shutdown or an index
+    // build racing ConnectBlock) must not be accounted for twice. The entries of a block are always
+    // written and erased together, in a single batch, so looking up one entry per block tells whether
+    // the whole block is already recorded. There is only one block per height in vect.
+    std::map<int, bool> mapHeightChanged;
+    std::map<CAddressIndexIteratorKey, CAddressBalanceValue> mapBalances;
+    std::set<std::pair<CAddressIndexIteratorKey, uint256> > setTxs;
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
+        std::map<int, bool>::iterator hi = mapHeightChanged.find(it->first.blockHeight);
+        if (hi == mapHeightChanged.end()) {
+            hi = mapHeightChanged.emplace(it->first.blockHeight, Exists(std::make_pair(DB_ADDRESSINDEX, it->first)) == fErase).first;
+        }
+        if (!hi->second)
+            continue;
+
+        CAddressIndexIteratorKey address(it->first.type, it->first.hashBytes);
+        std::map<CAddressIndexIteratorKey, CAddressBalanceValue>::iterator mi = mapBalances.find(address);
+        if (mi == mapBalances.end()) {
+            mi = mapBalances.emplace(address, CAddressBalanceValue()).first;
+            Read(std::make_pair(DB_ADDRESSBALANCE, address), mi->second);
+        }
+        // all entries of a transaction are connected and disconnected together
+        bool fTx = setTxs.emplace(address, it->first.txhash).second;
+        if (fErase) {
+            mi->second.Subtract(it->second, fTx);
+        } else {
+            mi->second.Add(it->second, fTx);
+        }
+    }
+
+    for (std::map<CAddressIndexIteratorKey, CAddressBalanceValue>::const_iterator mi=mapBalances.begin(); mi!=mapBalances.end(); mi++) {
+        if (mi->second.IsNull()) {
+            batch.Erase(std::make_pair(DB_ADDRESSBALANCE, mi->first));
+        } else {
+            batch.Write(std::make_pair(DB_ADDRESSBALANCE, mi->first), mi->second);
+        }
+    }
+}
+
+bool CBlockTreeDB::ReadAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &value) {
+    value.SetNull();
+    return Read(std::make_pair(DB_ADDRESSBALANCE, CAddressIndexIteratorKey(type, addressHash)), value);
+}
+
+bool CBlockTreeDB::ComputeAddressBalances(const std::function<bool(const CAddressIndexIteratorKey&, const CAddressBalanceValue&)>& fn) {
+
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(DB_ADDRESSINDEX);
+
+    // the entries are ordered by address first, and by height and transaction within an address
+    CAddressIndexIteratorKey address;
+    CAddressBalanceValue value;
+    uint256 txhashLast;
+    bool fHaveAddress = false;
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char,CAddressIndexKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_ADDRESSINDEX)
+            break;
+        CAmount nValue;
+        if (!pcursor->GetValue(nValue))
+            return error("failed to get address index value");
+
+        if (!fHaveAddress || address.type != key.second.type || address.hashBytes != key.second.hashBytes) {
+            if (fHaveAddress && !fn(address, value))
+                return true;
+            address = CAddressIndexIteratorKey(key.second.type, key.second.hashBytes);
+            value.SetNull();
+            txhashLast.SetNull();
+            fHaveAddress = true;
+        }
+        value.Add(nValue, key.second.txhash != txhashLast);
+        txhashLast = key.second.txhash;
+        pcursor->Next();
+    }
+    if (fHaveAddress)
+        fn(address, value);
+
+    return true;
+}
+
+bool CBlockTreeDB::RebuildAddressBalances() {
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+    CDBBatch batch(*this);
+
+    pcursor->Seek(DB_ADDRESSBALANCE);
+    while (pcursor->Valid()) {
+        std::pair<char,CAddressIndexIteratorKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_ADDRESSBALANCE)
+            break;
+        batch.Erase(key);
+        if (batch.SizeEstimate() > ADDRESSBALANCE_BATCH_SIZE) {
+            WriteBatch(batch);
+            batch.Clear();
+        }
+        pcursor->Next();
+    }
+
+    size_t nAddresses = 0;
+    bool ret = ComputeAddressBalances([&](const CAddressIndexIteratorKey& address, const CAddressBalanceValue& value) {
+        if (!value.IsNull())
+            batch.Write(std::make_pair(DB_ADDRESSBALANCE, address), value);
+        if (batch.SizeEstimate() > ADDRESSBALANCE_BATCH_SIZE) {
+            WriteBatch(batch);
+            batch.Clear();
+        }
+        nAddresses++;
+        return true;
+    });
+    if (!ret || !WriteBatch(batch))
+        return false;
+
+    LogPrintf("%s: computed the balances of %u addresses\n", __func__, nAddresses);
+    return WriteFlag("addressbalances", true);
+}
+
+bool CBlockTreeDB::VerifyAddressBalances() {
+    size_t nAddresses = 0;
+    size_t nMismatches = 0;
+    bool ret = ComputeAddressBalances([&](const CAddressIndexIteratorKey& address, const CAddressBalanceValue& value) {
+        CAddressBalanceValue stored;
+        Read(std::make_pair(DB_ADDRESSBALANCE, address), stored);
+        if (stored != value) {
+            LogPrintf("%s: balance of %s (type %d) is %d/%d/%u, expected %d/%d/%u\n", __func__, address.hashBytes.GetHex(), address.type,
+                      stored.balance, stored.received, stored.txCount, value.balance, value.received, value.txCount);
+            nMismatches++;
+        }
+        if (!value.IsNull())
+            nAddresses++;
+        return true;
+    });
+    if (!ret)
+        return false;
+
+    // there must not be balances of addresses without entries either
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+    size_t nStored = 0;
+    pcursor->Seek(DB_ADDRESSBALANCE);
+    while (pcursor->Valid()) {
+        std::pair<char,CAddressIndexIteratorKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_ADDRESSBALANCE)
+            break;
+        nStored++;
+        pcursor->Next();
+    }
+
+    if (nMismatches > 0 || nStored != nAddresses)
+        return error("%s: %u of %u address balances don't match the address index (%u stored)", __func__, nMismatches, nAddresses, nStored);
+    return true;
+}
+
 bool CBlockTreeDB::ReadAddressIndex(uint160 addressHash, int type,
                                     std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
                                     int start, int end) {
 
+    return ReadAddressIndex(addressHash, type, nullptr, start, end, [&](const CAddressIndexKey& key, CAmount nValue) {
+        addressIndex.push_back(std::make_pair(key, nValue));
+        return true;
+    });
+}
+
+bool CBlockTreeDB::ReadAddressIndex(uint160 addressHash, int type, const CAddressIndexKey* pkeyStart, int start, int end,
+                                    const std::function<bool(const CAddressIndexKey&, CAmount)>& fn) {
+
     std::unique_ptr<CDBIterator> pcursor(NewIterator());
 
-    if (start > 0 && end > 0) {
+    if (pkeyStart) {
+        pcursor->Seek(std::make_pair(DB_ADDRESSINDEX, *pkeyStart));
+    } else if (start > 0 && end > 0) {
         pcursor->Seek(std::make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorHeightKey(type, addressHash, start)));
     } else {
         pcursor->Seek(std::make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorKey(type, addressHash)));
@@ -287,13 +474,15 @@ bool CBlockTreeDB::ReadAddressIndex(uint160 addressHash, int type,
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
         std::pair<char,CAddressIndexKey> key;
-        if (pcursor->GetKey(key) && key.first == DB_ADDRESSINDEX && key.second.hashBytes == addressHash) {
+        if (pcursor->GetKey(key) && key.first == DB_ADDRESSINDEX && key.second.hashBytes == addressHash && key.second.type == (unsigned int)type) {
             if (end > 0 && key.second.blockHeight > end) {
                 break;
             }
             CAmount nValue;
             if (pcursor->GetValue(nValue)) {
-                addressIndex.push_back(std::make_pair(key.second, nValue));
+                if (!fn(key.second, nValue)) {
+                    break;
+                }
                 pcursor->Next();
             } else {
                 return error("failed to get address index value");
@@ -312,6 +501,13 @@ bool CBlockTreeDB::WriteTimestampIndex(const CTimestampIndexKey &timestampIndex)
     return WriteBatch(batch);
 }
 
+bool CBlockTreeDB::WriteTimestampIndex(const std::vector<CTimestampIndexKey> &vect) {
+    CDBBatch batch(*this);
+    for (std::vector<CTimestampIndexKey>::const_iterator it=vect.begin(); it!=vect.end(); it++)
+        batch.Write(std::make_pair(DB_TIMESTAMPINDEX, *it), 0);
+    return WriteBatch(batch);
+}
+
 bool CBlockTreeDB::ReadTimestampIndex(const unsigned int &high, const unsigned int &low, std::vector<uint256> &hashes) {
 
     std::unique_ptr<CDBIterator> pcursor(NewIterator());
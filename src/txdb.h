@@ -11,6 +11,7 @@
 #include "chain.h"
 #include "spentindex.h"
 
+#include <functional>
 #include <map>
 #include <string>
 #include <utility>
@@ -129,16 +130,34 @@ public:
     bool UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue > >&vect);
     bool ReadAddressUnspentIndex(uint160 addressHash, int type,
                                  std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect);
+    /** Visit the unspent outputs of an address in key order, beginning at pkeyStart if given, until fn returns false */
+    bool ReadAddressUnspentIndex(uint160 addressHash, int type, const CAddressUnspentKey* pkeyStart,
+                                 const std::function<bool(const CAddressUnspentKey&, const CAddressUnspentValue&)>& fn);
+    /** Add or erase address index entries, along with updating the balances of their addresses */
     bool WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
     bool EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
+    /** Read the totals of the address index entries of an address, returns false if there are none */
+    bool ReadAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &value);
+    /** Recompute all address balances from the address index */
+    bool RebuildAddressBalances();
+    /** Check all address balances against a full scan of the address index */
+    bool VerifyAddressBalances();
     bool ReadAddressIndex(uint160 addressHash, int type,
                           std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
                           int start = 0, int end = 0);
+    /** Visit the address index entries of an address in key order, beginning at pkeyStart if given or else
+     *  at the start height, up to the end height, until fn returns false */
+    bool ReadAddressIndex(uint160 addressHash, int type, const CAddressIndexKey* pkeyStart, int start, int end,
+                          const std::function<bool(const CAddressIndexKey&, CAmount)>& fn);
     bool WriteTimestampIndex(const CTimestampIndexKey &timestampIndex);
+    bool WriteTimestampIndex(const std::vector<CTimestampIndexKey> &vect);
     bool ReadTimestampIndex(const unsigned int &high, const unsigned int &low, std::vector<uint256> &vect);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex);
+private:
+    void UpdateAddressBalances(CDBBatch& batch, const std::vector<std::pair<CAddressIndexKey, CAmount> >& vect, bool fErase);
+    bool ComputeAddressBalances(const std::function<bool(const CAddressIndexIteratorKey&, const CAddressBalanceValue&)>& fn);
 };
 
 #endif // BITCOIN_TXDB_H
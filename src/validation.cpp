@@ -18,6 +18,7 @@
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
 #include "hash.h"
+#include "indexbuilder.h"
 #include "init.h"
 #include "policy/policy.h"
 #include "pow.h"
@@ -53,6 +54,7 @@
 
 #include <atomic>
 #include <sstream>
+#include <thread>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/algorithm/string/join.hpp>
@@ -91,6 +93,7 @@ bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fRequireStandard = true;
 unsigned int nBytesPerSigOp = DEFAULT_BYTES_PER_SIGOP;
 bool fCheckBlockIndex = false;
+bool fVerifyBlockIndex = DEFAULT_VERIFYBLOCKINDEX;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
 size_t nCoinCacheUsage = 5000 * 300;
 uint64_t nPruneTarget = 0;
@@ -1117,6 +1120,8 @@ bool GetTimestampIndex(const unsigned int &high, const unsigned int &low, std::v
 {
     if (!fTimestampIndex)
         return error("Timestamp index not enabled");
+    if (IsIndexBuilding(INDEXBUILDER_TIMESTAMP))
+        return error("Timestamp index is still being built");
 
     if (!pblocktree->ReadTimestampIndex(high, low, hashes))
         return error("Unable to get hashes for timestamps");
@@ -1126,7 +1131,7 @@ bool GetTimestampIndex(const unsigned int &high, const unsigned int &low, std::v
 
 bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
 {
-    if (!fSpentIndex)
+    if (!fSpentIndex || IsIndexBuilding(INDEXBUILDER_SPENT))
         return false;
 
     if (mempool.getSpentIndex(key, value))
@@ -1143,6 +1148,8 @@ bool GetAddressIndex(uint160 addressHash, int type,
 {
     if (!fAddressIndex)
         return error("address index not enabled");
+    if (IsIndexBuilding(INDEXBUILDER_ADDRESS))
+        return error("address index is still being built");
 
     if (!pblocktree->ReadAddressIndex(addressHash, type, addressIndex, start, end))
         return error("unable to get txids for address");
@@ -1155,6 +1162,8 @@ bool GetAddressUnspent(uint160 addressHash, int type,
 {
     if (!fAddressIndex)
         return error("address index not enabled");
+    if (IsIndexBuilding(INDEXBUILDER_ADDRESS))
+        return error("address index is still being built");
 
     if (!pblocktree->ReadAddressUnspentIndex(addressHash, type, unspentOutputs))
         return error("unable to get txids for address");
@@ -1162,6 +1171,47 @@ bool GetAddressUnspent(uint160 addressHash, int type,
     return true;
 }
 
+bool GetAddressIndex(uint160 addressHash, int type, const CAddressIndexKey* pkeyStart, int start, int end,
+                     const std::function<bool(const CAddressIndexKey&, CAmount)>& fn)
+{
+    if (!fAddressIndex)
+        return error("address index not enabled");
+    if (IsIndexBuilding(INDEXBUILDER_ADDRESS))
+        return error("address index is still being built");
+
+    if (!pblocktree->ReadAddressIndex(addressHash, type, pkeyStart, start, end, fn))
+        return error("unable to get txids for address");
+
+    return true;
+}
+
+bool GetAddressUnspent(uint160 addressHash, int type, const CAddressUnspentKey* pkeyStart,
+                       const std::function<bool(const CAddressUnspentKey&, const CAddressUnspentValue&)>& fn)
+{
+    if (!fAddressIndex)
+        return error("address index not enabled");
+    if (IsIndexBuilding(INDEXBUILDER_ADDRESS))
+        return error("address index is still being built");
+
+    if (!pblocktree->ReadAddressUnspentIndex(addressHash, type, pkeyStart, fn))
+        return error("unable to get txids for address");
+
+    return true;
+}
+
+bool GetAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &value)
+{
+    if (!fAddressIndex)
+        return error("address index not enabled");
+    if (IsIndexBuilding(INDEXBUILDER_ADDRESS))
+        return error("address index is still being built");
+
+    // no balance record just means that the address was never used
+    pblocktree->ReadAddressBalance(addressHash, type, value);
+
+    return true;
+}
+
 /** Return transaction in txOut, and if it was found inside a block, its hash is placed in hashBlock */
 bool GetTransaction(const uint256 &hash, CTransactionRef &txOut, const Consensus::Params& consensusParams, uint256 &hashBlock, bool fAllowSlow)
 {
@@ -1676,6 +1726,8 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     return true;
 }
 
+} // anon namespace
+
 bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
 {
     // Open history file to read
@@ -1702,6 +1754,8 @@ bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uin
     return true;
 }
 
+namespace {
+
 /** Abort with a message */
 bool AbortNode(const std::string& strMessage, const std::string& userMessage="")
 {
@@ -1760,8 +1814,9 @@ int ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out)
 }
 
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
- *  When UNCLEAN or FAILED is returned, view is left in an indeterminate state. */
-static DisconnectResult DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view)
+ *  When UNCLEAN or FAILED is returned, view is left in an indeterminate state.
+ *  With fJustCheck the block is only disconnected from the view, the indexes are left alone. */
+static DisconnectResult DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck = false)
 {
     assert(pindex->GetBlockHash() == view.GetBestBlock());
 
@@ -1899,8 +1954,12 @@ static DisconnectResult DisconnectBlock(const CBlock& block, CValidationState& s
 
                     } else if (prevout.scriptPubKey.IsPayToPublicKey()) {
                         uint160 hashBytes(Hash160(prevout.scriptPubKey.begin()+1, prevout.scriptPubKey.end()-1));
-                        addressIndex.push_back(std::make_pair(CAddressIndexKey(1, hashBytes, pindex->nHeight, i, hash, j, false), prevout.nValue));
-                        addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(1, hashBytes, hash, j), CAddressUnspentValue()));
+
+                        // undo spending activity
+                        addressIndex.push_back(std::make_pair(CAddressIndexKey(1, hashBytes, pindex->nHeight, i, hash, j, true), prevout.nValue * -1));
+
+                        // restore unspent index
+                        addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(1, hashBytes, input.prevout.hash, input.prevout.n), CAddressUnspentValue(prevout.nValue, prevout.scriptPubKey, undoHeight)));
                     } else {
                         continue;
                     }
@@ -1914,7 +1973,7 @@ static DisconnectResult DisconnectBlock(const CBlock& block, CValidationState& s
     // move best block pointer to prevout block
     view.SetBestBlock(pindex->pprev->GetBlockHash());
 
-    if (fAddressIndex) {
+    if (fAddressIndex && !fJustCheck) {
         if (!pblocktree->EraseAddressIndex(addressIndex)) {
             AbortNode(state, "Failed to delete address index");
             return DISCONNECT_FAILED;
@@ -2688,6 +2747,7 @@ void PruneAndFlush() {
 /** Update chainActive and related internal data structures. */
 void static UpdateTip(CBlockIndex *pindexNew, const CChainParams& chainParams) {
     chainActive.SetTip(pindexNew);
+    UpdateStakeModifierIndex();
 
     // New best block
     mempool.AddTransactionsUpdated(1);
@@ -4119,10 +4179,76 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
     return pindexNew;
 }
 
+bool VerifyBlockIndexHashes(int nThreads)
+{
+    // Block index entries are never modified or freed while the node is running, only their status is
+    std::vector<const CBlockIndex*> vIndex;
+    {
+        LOCK(cs_main);
+        vIndex.reserve(mapBlockIndex.size());
+        for (const auto& entry : mapBlockIndex) {
+            vIndex.push_back(entry.second);
+        }
+    }
+
+    int64_t nStart = GetTimeMillis();
+    std::atomic<size_t> nNext(0);
+    std::atomic<bool> fFailed(false);
+    auto verify = [&]() {
+        static const size_t BATCH_SIZE = 1000;
+        while (!fFailed) {
+            boost::this_thread::interruption_point();
+            size_t nBegin = nNext.fetch_add(BATCH_SIZE);
+            if (nBegin >= vIndex.size())
+                break;
+            size_t nEnd = std::min(nBegin + BATCH_SIZE, vIndex.size());
+            for (size_t i = nBegin; i < nEnd; i++) {
+                const CBlockIndex* pindex = vIndex[i];
+                if (pindex->GetBlockHeader().GetHash() != pindex->GetBlockHash()) {
+                    error("%s: block index entry %s at height %d does not match its header", __func__, pindex->GetBlockHash().ToString(), pindex->nHeight);
+                    fFailed = true;
+                    break;
+                }
+            }
+        }
+    };
+
+    if (nThreads <= 1) {
+        verify();
+    } else {
+        std::vector<std::thread> vThreads;
+        for (int i = 0; i < nThreads; i++) {
+            vThreads.emplace_back(verify);
+        }
+        for (auto& thread : vThreads) {
+            thread.join();
+        }
+    }
+
+    LogPrintf("%s: verified %u block index hashes with %d threads in %dms\n", __func__, vIndex.size(), std::max(nThreads, 1), GetTimeMillis() - nStart);
+    return !fFailed;
+}
+
+void ThreadVerifyBlockIndex()
+{
+    RenameThread("sierra-verifyidx");
+    if (!VerifyBlockIndexHashes(1)) {
+        AbortNode("Corrupted block database detected", _("Corrupted block database detected. Please restart with -reindex to recover."));
+    }
+}
+
 bool static LoadBlockIndexDB(const CChainParams& chainparams)
 {
+    int64_t nStart = GetTimeMillis();
+    auto logStage = [&nStart](const char* stage) {
+        int64_t nNow = GetTimeMillis();
+        LogPrintf("LoadBlockIndexDB: %s in %dms\n", stage, nNow - nStart);
+        nStart = nNow;
+    };
+
     if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex))
         return false;
+    logStage("loaded block index entries");
 
     boost::this_thread::interruption_point();
 
@@ -4168,6 +4294,7 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
         if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
             pindexBestHeader = pindex;
     }
+    logStage("computed chain work");
 
     // Load block file info
     pblocktree->ReadLastBlockFile(nLastBlockFile);
@@ -4203,6 +4330,7 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
             return false;
         }
     }
+    logStage("loaded and checked block file info");
 
     // Check whether we have ever pruned block & undo files
     pblocktree->ReadFlag("prunedblockfiles", fHavePruned);
@@ -4222,6 +4350,15 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
     pblocktree->ReadFlag("addressindex", fAddressIndex);
     LogPrintf("%s: address index %s\n", __func__, fAddressIndex ? "enabled" : "disabled");
 
+    // Address indexes from before the balances were tracked need them computed once
+    bool fAddressBalances = false;
+    pblocktree->ReadFlag("addressbalances", fAddressBalances);
+    if (fAddressIndex && !fAddressBalances) {
+        LogPrintf("%s: computing address balances from the address index...\n", __func__);
+        if (!pblocktree->RebuildAddressBalances())
+            return error("%s: failed to compute the address balances", __func__);
+    }
+
     // Check whether we have a timestamp index
     pblocktree->ReadFlag("timestampindex", fTimestampIndex);
     LogPrintf("%s: timestamp index %s\n", __func__, fTimestampIndex ? "enabled" : "disabled");
@@ -4235,8 +4372,10 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
     if (it == mapBlockIndex.end())
         return true;
     chainActive.SetTip(it->second);
+    UpdateStakeModifierIndex();
 
     PruneBlockIndexCandidates();
+    logStage("loaded best chain");
 
     LogPrintf("%s: hashBestChain=%s height=%d date=%s progress=%f\n", __func__,
         chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(),
@@ -4315,7 +4454,7 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         }
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
         if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
-            DisconnectResult res = DisconnectBlock(block, state, pindex, coins);
+            DisconnectResult res = DisconnectBlock(block, state, pindex, coins, true);
             if (res == DISCONNECT_FAILED) {
                 return error("VerifyDB(): *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
             }
@@ -4362,6 +4501,7 @@ void UnloadBlockIndex()
     LOCK(cs_main);
     setBlockIndexCandidates.clear();
     chainActive.SetTip(NULL);
+    UpdateStakeModifierIndex();
     pindexBestInvalid = NULL;
     pindexBestHeader = NULL;
     mempool.clear();
@@ -4422,6 +4562,7 @@ bool InitBlockIndex(const CChainParams& chainparams)
     // Use the provided setting for -addressindex in the new database
     fAddressIndex = GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX);
     pblocktree->WriteFlag("addressindex", fAddressIndex);
+    pblocktree->WriteFlag("addressbalances", fAddressIndex);
 
     // Use the provided setting for -timestampindex in the new database
     fTimestampIndex = GetBoolArg("-timestampindex", DEFAULT_TIMESTAMPINDEX);
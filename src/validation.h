@@ -22,6 +22,7 @@
 
 #include <algorithm>
 #include <exception>
+#include <functional>
 #include <map>
 #include <set>
 #include <stdint.h>
@@ -36,6 +37,7 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CBlockUndo;
 class CBloomFilter;
 class CChainParams;
 class CCoinsViewDB;
@@ -138,11 +140,17 @@ static const bool DEFAULT_PERMIT_BAREMULTISIG = true;
 static const unsigned int DEFAULT_BYTES_PER_SIGOP = 20;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
 static const bool DEFAULT_TXINDEX = true;
+/** Verify the stored block index hashes in the background after startup */
+static const bool DEFAULT_VERIFYBLOCKINDEX = false;
 static const bool DEFAULT_STAKING = false;
 static const bool DEFAULT_STAKE_CACHE = true;
 static const bool DEFAULT_ADDRESSINDEX = false;
 static const bool DEFAULT_TIMESTAMPINDEX = false;
 static const bool DEFAULT_SPENTINDEX = false;
+/** Number of address index entries returned per page when paging without an explicit limit */
+static const unsigned int DEFAULT_ADDRESSINDEX_PAGE_SIZE = 1000;
+/** Maximum number of address index entries returned per page */
+static const unsigned int MAX_ADDRESSINDEX_PAGE_SIZE = 100000;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 
 /** Default for -mempoolreplacement */
@@ -177,10 +185,14 @@ extern std::atomic_bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
+extern bool fAddressIndex;
+extern bool fSpentIndex;
+extern bool fTimestampIndex;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern unsigned int nBytesPerSigOp;
 extern bool fCheckBlockIndex;
+extern bool fVerifyBlockIndex;
 extern bool fCheckpointsEnabled;
 extern size_t nCoinCacheUsage;
 /** A fee rate smaller than this is considered zero fee (for relaying, mining and transaction creation) */
@@ -278,6 +290,10 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
 bool InitBlockIndex(const CChainParams& chainparams);
 /** Load the block tree and coins database from disk */
 bool LoadBlockIndex(const CChainParams& chainparams);
+/** Recompute the hashes of all block index entries from their headers and compare them to the hashes they were stored under */
+bool VerifyBlockIndexHashes(int nThreads);
+/** Run VerifyBlockIndexHashes in the background after startup, shutting down if the block index is corrupted */
+void ThreadVerifyBlockIndex();
 /** Unload database information */
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
@@ -489,11 +505,19 @@ bool GetAddressIndex(uint160 addressHash, int type,
                      int start = 0, int end = 0);
 bool GetAddressUnspent(uint160 addressHash, int type,
                        std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs);
+/** Same as above, but visit the entries one by one instead of collecting them, see CBlockTreeDB */
+bool GetAddressIndex(uint160 addressHash, int type, const CAddressIndexKey* pkeyStart, int start, int end,
+                     const std::function<bool(const CAddressIndexKey&, CAmount)>& fn);
+bool GetAddressUnspent(uint160 addressHash, int type, const CAddressUnspentKey* pkeyStart,
+                       const std::function<bool(const CAddressUnspentKey&, const CAddressUnspentValue&)>& fn);
+/** Get the running totals of the address index entries of an address */
+bool GetAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &value);
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock);
 
 /** Functions for validating blocks and updating the block tree */
 
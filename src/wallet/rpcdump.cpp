@@ -145,6 +145,7 @@ UniValue importprivkey(const JSONRPCRequest& request)
         if (!pwallet->AddKeyPubKey(key, pubkey)) {
             throw JSONRPCError(RPC_WALLET_ERROR, "Error adding key to wallet");
         }
+        pwallet->InvalidateAllPrivateSendRounds();
 
         // whenever a key is imported, we need to scan the whole chain
         pwallet->UpdateTimeFirstKey(1);
@@ -505,6 +506,7 @@ UniValue importwallet(const JSONRPCRequest& request)
             fGood = false;
             continue;
         }
+        pwallet->InvalidateAllPrivateSendRounds();
         pwallet->mapKeyMetadata[keyid].nCreateTime = nTime;
         if (fLabel)
             pwallet->SetAddressBook(keyid, strLabel, "receive");
@@ -603,6 +605,7 @@ UniValue importelectrumwallet(const JSONRPCRequest& request)
                 fGood = false;
                 continue;
             }
+            pwallet->InvalidateAllPrivateSendRounds();
         }
     } else {
         // json
@@ -635,6 +638,7 @@ UniValue importelectrumwallet(const JSONRPCRequest& request)
                 fGood = false;
                 continue;
             }
+            pwallet->InvalidateAllPrivateSendRounds();
         }
     }
     file.close();
@@ -1018,6 +1022,7 @@ UniValue ProcessImport(CWallet * const pwallet, const UniValue& data, const int6
                     if (!pwallet->AddKeyPubKey(key, pubkey)) {
                         throw JSONRPCError(RPC_WALLET_ERROR, "Error adding key to wallet");
                     }
+                    pwallet->InvalidateAllPrivateSendRounds();
 
                     pwallet->UpdateTimeFirstKey(timestamp);
                 }
@@ -1146,6 +1151,7 @@ UniValue ProcessImport(CWallet * const pwallet, const UniValue& data, const int6
                 if (!pwallet->AddKeyPubKey(key, pubKey)) {
                     throw JSONRPCError(RPC_WALLET_ERROR, "Error adding key to wallet");
                 }
+                pwallet->InvalidateAllPrivateSendRounds();
 
                 pwallet->UpdateTimeFirstKey(timestamp);
 
@@ -135,10 +135,6 @@ UniValue getnewaddress(const JSONRPCRequest& request)
     if (request.params.size() > 0)
         strAccount = AccountFromValue(request.params[0]);
 
-    if (!pwallet->IsLocked(true)) {
-        pwallet->TopUpKeyPool();
-    }
-
     // Generate a new key that is added to wallet
     CPubKey newKey;
     if (!pwallet->GetKeyFromPool(newKey, false)) {
@@ -217,10 +213,6 @@ UniValue getrawchangeaddress(const JSONRPCRequest& request)
 
     LOCK2(cs_main, pwallet->cs_wallet);
 
-    if (!pwallet->IsLocked(true)) {
-        pwallet->TopUpKeyPool();
-    }
-
     CReserveKey reservekey(pwallet);
     CPubKey vchPubKey;
     if (!reservekey.GetReservedKey(vchPubKey, true))
@@ -2128,7 +2120,7 @@ UniValue walletpassphrase(const JSONRPCRequest& request)
     if (!pwallet->Unlock(strWalletPass, fForMixingOnly))
         throw JSONRPCError(RPC_WALLET_PASSPHRASE_INCORRECT, "Error: The wallet passphrase entered was incorrect.");
 
-    pwallet->TopUpKeyPool();
+    pwallet->RequestKeyPoolTopUp();
 
     pwallet->nRelockTime = GetTime() + nSleepTime;
     RPCRunLater(strprintf("lockwallet(%s)", pwallet->strWalletFile), boost::bind(LockWallet, pwallet), nSleepTime);
@@ -2517,6 +2509,23 @@ UniValue setprivatesendamount(const JSONRPCRequest& request)
     return NullUniValue;
 }
 
+static UniValue ScanProgressToJSON(const CWalletScanProgress& progress)
+{
+    int nTotal = progress.nTipHeight - progress.nStartHeight + 1;
+    double dProgress = 1.0;
+    if (progress.fScanning && nTotal > 0)
+        dProgress = std::min(1.0, progress.nBlocksScanned / (double)nTotal);
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("startheight", progress.nStartHeight));
+    obj.push_back(Pair("height", progress.nHeight));
+    obj.push_back(Pair("tipheight", progress.nTipHeight));
+    obj.push_back(Pair("progress", dProgress));
+    obj.push_back(Pair("duration", progress.nDurationMillis / 1000.0));
+    obj.push_back(Pair("blocks_per_second", progress.GetBlocksPerSecond()));
+    return obj;
+}
+
 UniValue getwalletinfo(const JSONRPCRequest& request)
 {
     CWallet * const pwallet = GetWalletForJSONRPCRequest(request);
@@ -2553,34 +2562,46 @@ UniValue getwalletinfo(const JSONRPCRequest& request)
             "      }\n"
             "      ,...\n"
             "    ]\n"
+            "  \"scanning\": {               (json object or false) progress of the running rescan, false if there is none.\n"
+            "                               While a rescan is running, the other fields show the wallet as it was when the rescan started\n"
+            "    \"startheight\": xxxx,       (numeric) the height the rescan started at\n"
+            "    \"height\": xxxx,            (numeric) the height of the last scanned block\n"
+            "    \"tipheight\": xxxx,         (numeric) the height the rescan ends at\n"
+            "    \"progress\": x.xxx,         (numeric) the scanned fraction of the blocks\n"
+            "    \"duration\": xxx,           (numeric) elapsed seconds\n"
+            "    \"blocks_per_second\": xxx,  (numeric) scanned blocks per second\n"
+            "  },\n"
+            "  \"lastscan\": {...},           (json object) same fields for the last finished rescan, only present if there was one\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getwalletinfo", "")
             + HelpExampleRpc("getwalletinfo", "")
         );
 
-    LOCK2(cs_main, pwallet->cs_wallet);
+    // a rescan holds cs_main and cs_wallet until it is done, don't wait for it and
+    // report the state the wallet had when the rescan started instead
+    CWalletScanProgress scanProgress = pwallet->GetScanProgress();
+    const CWalletStateSnapshot state = scanProgress.fScanning ? scanProgress.stateAtStart : pwallet->GetStateSnapshot();
 
-    CHDChain hdChainCurrent;
-    bool fHDEnabled = pwallet->GetHDChain(hdChainCurrent);
     UniValue obj(UniValue::VOBJ);
-    obj.push_back(Pair("walletversion", pwallet->GetVersion()));
-    obj.push_back(Pair("balance",       ValueFromAmount(pwallet->GetBalance())));
+    obj.push_back(Pair("walletversion", state.nWalletVersion));
+    obj.push_back(Pair("balance",       ValueFromAmount(state.balances.nTrusted)));
     if(!fLiteMode)
-        obj.push_back(Pair("privatesend_balance",       ValueFromAmount(pwallet->GetAnonymizedBalance())));
-    obj.push_back(Pair("unconfirmed_balance", ValueFromAmount(pwallet->GetUnconfirmedBalance())));
-    obj.push_back(Pair("immature_balance",    ValueFromAmount(pwallet->GetImmatureBalance())));
-    obj.push_back(Pair("txcount",       (int)pwallet->mapWallet.size()));
-    obj.push_back(Pair("keypoololdest", pwallet->GetOldestKeyPoolTime()));
-    obj.push_back(Pair("keypoolsize",   (int64_t)pwallet->KeypoolCountExternalKeys()));
-    if (fHDEnabled) {
-        obj.push_back(Pair("keypoolsize_hd_internal",   (int64_t)(pwallet->KeypoolCountInternalKeys())));
-    }
-    obj.push_back(Pair("keys_left",     pwallet->nKeysLeftSinceAutoBackup));
-    if (pwallet->IsCrypted())
-        obj.push_back(Pair("unlocked_until", pwallet->nRelockTime));
+        obj.push_back(Pair("privatesend_balance",       ValueFromAmount(state.balances.nAnonymized)));
+    obj.push_back(Pair("unconfirmed_balance", ValueFromAmount(state.balances.nUnconfirmed)));
+    obj.push_back(Pair("immature_balance",    ValueFromAmount(state.balances.nImmature)));
+    obj.push_back(Pair("txcount",       (int)state.nTxCount));
+    obj.push_back(Pair("keypoololdest", state.nKeyPoolOldestTime));
+    obj.push_back(Pair("keypoolsize",   (int64_t)state.nKeyPoolExternal));
+    if (state.fHDEnabled) {
+        obj.push_back(Pair("keypoolsize_hd_internal",   (int64_t)state.nKeyPoolInternal));
+    }
+    obj.push_back(Pair("keys_left",     state.nKeysLeftSinceAutoBackup));
+    if (state.fCrypted)
+        obj.push_back(Pair("unlocked_until", state.nRelockTime));
     obj.push_back(Pair("paytxfee",      ValueFromAmount(payTxFee.GetFeePerK())));
-    if (fHDEnabled) {
+    if (state.fHDEnabled) {
+        CHDChain hdChainCurrent = state.hdChain;
         obj.push_back(Pair("hdchainid", hdChainCurrent.GetID().GetHex()));
         obj.push_back(Pair("hdaccountcount", (int64_t)hdChainCurrent.CountAccounts()));
         UniValue accounts(UniValue::VARR);
@@ -2599,6 +2620,13 @@ UniValue getwalletinfo(const JSONRPCRequest& request)
         }
         obj.push_back(Pair("hdaccounts", accounts));
     }
+    if (scanProgress.fScanning) {
+        obj.push_back(Pair("scanning", ScanProgressToJSON(scanProgress)));
+    } else {
+        obj.push_back(Pair("scanning", false));
+        if (scanProgress.nStartTimeMillis != 0)
+            obj.push_back(Pair("lastscan", ScanProgressToJSON(scanProgress)));
+    }
     return obj;
 }
 
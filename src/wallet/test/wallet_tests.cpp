@@ -9,6 +9,7 @@
 #include <utility>
 #include <vector>
 
+#include "privatesend-client.h"
 #include "rpc/server.h"
 #include "test/test_sierra.h"
 #include "validation.h"
@@ -513,6 +514,338 @@ BOOST_FIXTURE_TEST_CASE(coin_mark_dirty_immature_credit, TestChain100Setup)
     BOOST_CHECK_EQUAL(wtx.GetImmatureCredit(), 500*COIN);
 }
 
+// The rescan workers filter blocks against a copy of the wallet taken before the scan, spends of txs which were
+// only found by the scan itself must still be added.
+BOOST_FIXTURE_TEST_CASE(rescan_spend_of_found_tx, TestChain100Setup)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    CMutableTransaction spend;
+    spend.nVersion = 1;
+    spend.vin.resize(1);
+    spend.vin[0].prevout.hash = coinbaseTxns[0].GetHash();
+    spend.vin[0].prevout.n = 0;
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 11 * CENT;
+    spend.vout[0].scriptPubKey = CScript() << OP_TRUE;
+
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+
+    CBlock block = CreateAndProcessBlock({spend}, scriptPubKey);
+    BOOST_REQUIRE(chainActive.Tip()->GetBlockHash() == block.GetHash());
+
+    CWallet wallet;
+    LOCK2(cs_main, wallet.cs_wallet);
+    wallet.AddKeyPubKey(coinbaseKey, coinbaseKey.GetPubKey());
+    BOOST_CHECK_EQUAL(chainActive.Genesis(), wallet.ScanForWalletTransactions(chainActive.Genesis()));
+    BOOST_CHECK(wallet.mapWallet.count(coinbaseTxns[0].GetHash()));
+    BOOST_CHECK(wallet.mapWallet.count(spend.GetHash()));
+    BOOST_CHECK(wallet.IsSpent(coinbaseTxns[0].GetHash(), 0));
+
+    CWalletScanProgress progress = wallet.GetScanProgress();
+    BOOST_CHECK(!progress.fScanning);
+    BOOST_CHECK_EQUAL(progress.nBlocksScanned, chainActive.Height() + 1);
+    BOOST_CHECK_EQUAL(progress.nHeight, chainActive.Height());
+}
+
+// The balance ledger only recomputes dirty and volatile txs, it must agree with a full recomputation after tip
+// changes, new txs and wallet-wide invalidation.
+BOOST_FIXTURE_TEST_CASE(balance_ledger, TestChain100Setup)
+{
+    CWallet wallet;
+    {
+        LOCK2(cs_main, wallet.cs_wallet);
+        wallet.AddKeyPubKey(coinbaseKey, coinbaseKey.GetPubKey());
+        wallet.ScanForWalletTransactions(chainActive.Genesis());
+        BOOST_CHECK(wallet.CheckBalanceLedger());
+    }
+    CWalletBalances balances = wallet.GetBalances();
+    BOOST_CHECK(balances.nTrusted > 0);
+    BOOST_CHECK(balances.nImmature > 0);
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), balances.nTrusted);
+    BOOST_CHECK_EQUAL(wallet.GetImmatureBalance(), balances.nImmature);
+
+    // the wallet isn't registered for notifications, only the tip change lets another coinbase mature
+    CreateAndProcessBlock({}, GetScriptForRawPubKey(coinbaseKey.GetPubKey()));
+    CWalletBalances balancesNewTip = wallet.GetBalances();
+    BOOST_CHECK(balancesNewTip.nTrusted > balances.nTrusted);
+    BOOST_CHECK(balancesNewTip.nImmature < balances.nImmature);
+    BOOST_CHECK(wallet.CheckBalanceLedger());
+
+    // disconnecting the tip makes the coinbase which just matured immature again
+    CBlockIndex* pindexTip = chainActive.Tip();
+    CValidationState state;
+    BOOST_CHECK(InvalidateBlock(state, Params(), pindexTip));
+    CWalletBalances balancesInvalidated = wallet.GetBalances();
+    BOOST_CHECK_EQUAL(balancesInvalidated.nTrusted, balances.nTrusted);
+    BOOST_CHECK_EQUAL(balancesInvalidated.nImmature, balances.nImmature);
+    {
+        LOCK2(cs_main, wallet.cs_wallet);
+        BOOST_CHECK(wallet.CheckBalanceLedger());
+        BOOST_CHECK(ResetBlockFailureFlags(pindexTip));
+    }
+    BOOST_CHECK(ActivateBestChain(state, Params()));
+    BOOST_CHECK(chainActive.Tip() == pindexTip);
+    BOOST_CHECK(wallet.GetBalances() == balancesNewTip);
+
+    LOCK2(cs_main, wallet.cs_wallet);
+
+    // an unconfirmed spend to someone else, only the spent coin is marked dirty
+    std::vector<COutput> vCoins;
+    wallet.AvailableCoins(vCoins);
+    BOOST_REQUIRE(!vCoins.empty());
+    CAmount nValue = vCoins[0].tx->tx->vout[vCoins[0].i].nValue;
+    CMutableTransaction mtx;
+    mtx.vin.emplace_back(COutPoint(vCoins[0].tx->GetHash(), vCoins[0].i));
+    mtx.vout.emplace_back(nValue - 1000, CScript() << OP_TRUE);
+    CWalletTx wtx(&wallet, MakeTransactionRef(mtx));
+    wallet.AddToWallet(wtx);
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), balancesNewTip.nTrusted - nValue);
+    BOOST_CHECK(wallet.CheckBalanceLedger());
+
+    wallet.MarkDirty();
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), balancesNewTip.nTrusted - nValue);
+    BOOST_CHECK(wallet.CheckBalanceLedger());
+}
+
+// AvailableCoins only looks at the index of unspent outputs, so an output must come back when its spender is
+// abandoned.
+BOOST_FIXTURE_TEST_CASE(available_coins_abandoned_spender, TestChain100Setup)
+{
+    CWallet wallet;
+    LOCK2(cs_main, wallet.cs_wallet);
+    wallet.AddKeyPubKey(coinbaseKey, coinbaseKey.GetPubKey());
+    wallet.ScanForWalletTransactions(chainActive.Genesis());
+
+    std::vector<COutput> vCoins;
+    wallet.AvailableCoins(vCoins);
+    BOOST_REQUIRE(!vCoins.empty());
+    size_t nCoins = vCoins.size();
+
+    CMutableTransaction mtx;
+    mtx.vin.emplace_back(COutPoint(vCoins[0].tx->GetHash(), vCoins[0].i));
+    mtx.vout.emplace_back(vCoins[0].tx->tx->vout[vCoins[0].i].nValue - 1000, CScript() << OP_TRUE);
+    CWalletTx wtx(&wallet, MakeTransactionRef(mtx));
+    wallet.AddToWallet(wtx);
+
+    wallet.AvailableCoins(vCoins);
+    BOOST_CHECK_EQUAL(vCoins.size(), nCoins - 1);
+
+    // the spender is neither mined nor in the mempool, so it can be abandoned
+    BOOST_CHECK(wallet.AbandonTransaction(mtx.GetHash()));
+    wallet.AvailableCoins(vCoins);
+    BOOST_CHECK_EQUAL(vCoins.size(), nCoins);
+}
+
+static CMutableTransaction AddDenominatedTx(CWallet& wallet, const COutPoint& prevout, const CScript& scriptPubKey, int nOutputs, const uint256& hashBlock = uint256())
+{
+    CMutableTransaction mtx;
+    mtx.vin.emplace_back(prevout);
+    for (int i = 0; i < nOutputs; i++) {
+        mtx.vout.emplace_back(1 * COIN + 1000, scriptPubKey);
+    }
+    CWalletTx wtx(&wallet, MakeTransactionRef(mtx));
+    if (!hashBlock.IsNull()) {
+        wtx.hashBlock = hashBlock;
+        wtx.nIndex = 1;
+    }
+    wallet.AddToWallet(wtx);
+    return mtx;
+}
+
+// Rounds are computed without recursion, must be capped for long chains and must be recomputed when an
+// ancestor is added to the wallet after its descendants.
+BOOST_AUTO_TEST_CASE(privatesend_rounds)
+{
+    CPrivateSend::InitStandardDenominations();
+
+    CWallet wallet;
+    CKey key;
+    key.MakeNewKey(true);
+    LOCK(wallet.cs_wallet);
+    wallet.AddKeyPubKey(key, key.GetPubKey());
+    CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+    // a chain of denominated txs, the first one spends a coin which is not ours
+    std::vector<CMutableTransaction> vChain;
+    COutPoint prevout(GetRandHash(), 0);
+    for (int i = 0; i < MAX_PRIVATESEND_ROUNDS + 4; i++) {
+        vChain.push_back(AddDenominatedTx(wallet, prevout, scriptPubKey, 2));
+        prevout = COutPoint(vChain.back().GetHash(), 1);
+    }
+    BOOST_CHECK_EQUAL(wallet.GetRealOutpointPrivateSendRounds(COutPoint(vChain[0].GetHash(), 0)), 0);
+    BOOST_CHECK_EQUAL(wallet.GetRealOutpointPrivateSendRounds(COutPoint(vChain[3].GetHash(), 0)), 3);
+    BOOST_CHECK_EQUAL(wallet.GetRealOutpointPrivateSendRounds(COutPoint(vChain.back().GetHash(), 0)), MAX_PRIVATESEND_ROUNDS);
+    BOOST_CHECK_EQUAL(wallet.GetRealOutpointPrivateSendRounds(COutPoint(GetRandHash(), 0)), -1);
+
+    // a non-denominated output and a denominated output next to it
+    CMutableTransaction mtx;
+    mtx.vin.emplace_back(COutPoint(vChain[2].GetHash(), 0));
+    mtx.vout.emplace_back(1 * COIN + 1000, scriptPubKey);
+    mtx.vout.emplace_back(2 * COIN, scriptPubKey);
+    wallet.AddToWallet(CWalletTx(&wallet, MakeTransactionRef(mtx)));
+    BOOST_CHECK_EQUAL(wallet.GetRealOutpointPrivateSendRounds(COutPoint(mtx.GetHash(), 0)), 0);
+    BOOST_CHECK_EQUAL(wallet.GetRealOutpointPrivateSendRounds(COutPoint(mtx.GetHash(), 1)), -2);
+
+    // the child is known first, its input only becomes ours with the parent
+    CMutableTransaction parent;
+    parent.vin.emplace_back(COutPoint(GetRandHash(), 0));
+    parent.vout.emplace_back(1 * COIN + 1000, scriptPubKey);
+    CMutableTransaction child;
+    child.vin.emplace_back(COutPoint(parent.GetHash(), 0));
+    child.vout.emplace_back(1 * COIN + 1000, scriptPubKey);
+    CMutableTransaction grandchild = AddDenominatedTx(wallet, COutPoint(child.GetHash(), 0), scriptPubKey, 1);
+    wallet.AddToWallet(CWalletTx(&wallet, MakeTransactionRef(child)));
+    BOOST_CHECK_EQUAL(wallet.GetRealOutpointPrivateSendRounds(COutPoint(grandchild.GetHash(), 0)), 1);
+    wallet.AddToWallet(CWalletTx(&wallet, MakeTransactionRef(parent)));
+    BOOST_CHECK_EQUAL(wallet.GetRealOutpointPrivateSendRounds(COutPoint(child.GetHash(), 0)), 1);
+    BOOST_CHECK_EQUAL(wallet.GetRealOutpointPrivateSendRounds(COutPoint(grandchild.GetHash(), 0)), 2);
+
+    // the bulk path agrees with the rounds computed on demand
+    wallet.InvalidateAllPrivateSendRounds();
+    wallet.UpdateAllPrivateSendRounds();
+    BOOST_CHECK_EQUAL(wallet.GetRealOutpointPrivateSendRounds(COutPoint(vChain[3].GetHash(), 1)), 3);
+    BOOST_CHECK_EQUAL(wallet.GetRealOutpointPrivateSendRounds(COutPoint(grandchild.GetHash(), 0)), 2);
+}
+
+// The rounds of txs in a block come back with LoadWallet. An import only bumps the epoch, records of an older
+// epoch are ignored by the next LoadWallet and rewritten.
+BOOST_AUTO_TEST_CASE(privatesend_rounds_persisted)
+{
+    CPrivateSend::InitStandardDenominations();
+
+    const std::string strFile = "psrounds_test.dat";
+    bool fFirstRun;
+    CKey key;
+    key.MakeNewKey(true);
+    CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+    std::vector<CMutableTransaction> vChain;
+    {
+        CWallet wallet(strFile);
+        BOOST_CHECK_EQUAL(wallet.LoadWallet(fFirstRun), DB_LOAD_OK);
+        LOCK(wallet.cs_wallet);
+        wallet.AddKeyPubKey(key, key.GetPubKey());
+        COutPoint prevout(GetRandHash(), 0);
+        for (int i = 0; i < 4; i++) {
+            vChain.push_back(AddDenominatedTx(wallet, prevout, scriptPubKey, 2, GetRandHash()));
+            prevout = COutPoint(vChain.back().GetHash(), 1);
+        }
+    }
+
+    COutPoint outpoint(vChain[3].GetHash(), 0);
+    uint32_t nEpoch;
+    {
+        CWallet wallet(strFile);
+        BOOST_CHECK_EQUAL(wallet.LoadWallet(fFirstRun), DB_LOAD_OK);
+        LOCK(wallet.cs_wallet);
+        BOOST_CHECK_EQUAL(wallet.GetRealOutpointPrivateSendRounds(outpoint), 3);
+        nEpoch = wallet.GetPrivateSendRoundsEpoch();
+    }
+
+    // a record of the current epoch is used as it is
+    BOOST_CHECK(CWalletDB(strFile).WritePrivateSendRounds(outpoint, nEpoch, 7));
+    {
+        CWallet wallet(strFile);
+        BOOST_CHECK_EQUAL(wallet.LoadWallet(fFirstRun), DB_LOAD_OK);
+        LOCK(wallet.cs_wallet);
+        BOOST_CHECK_EQUAL(wallet.GetRealOutpointPrivateSendRounds(outpoint), 7);
+
+        CKey keyImported;
+        keyImported.MakeNewKey(true);
+        wallet.AddKeyPubKey(keyImported, keyImported.GetPubKey());
+        wallet.InvalidateAllPrivateSendRounds();
+        BOOST_CHECK_EQUAL(wallet.GetPrivateSendRoundsEpoch(), nEpoch + 1);
+        BOOST_CHECK_EQUAL(wallet.GetRealOutpointPrivateSendRounds(outpoint), 3);
+
+        // the lookup above cached the rounds again, after another import nothing is cached to invalidate
+        wallet.InvalidateAllPrivateSendRounds();
+        wallet.InvalidateAllPrivateSendRounds();
+        BOOST_CHECK_EQUAL(wallet.GetPrivateSendRoundsEpoch(), nEpoch + 2);
+    }
+
+    // the record written before the import is stale and gets recomputed
+    {
+        CWallet wallet(strFile);
+        BOOST_CHECK_EQUAL(wallet.LoadWallet(fFirstRun), DB_LOAD_OK);
+        LOCK(wallet.cs_wallet);
+        BOOST_CHECK_EQUAL(wallet.GetPrivateSendRoundsEpoch(), nEpoch + 2);
+        BOOST_CHECK_EQUAL(wallet.GetRealOutpointPrivateSendRounds(outpoint), 3);
+        BOOST_CHECK_EQUAL(wallet.GetRealOutpointPrivateSendRounds(COutPoint(vChain[1].GetHash(), 1)), 1);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(keypool_batch_topup)
+{
+    std::vector<unsigned char> vchSeed = ParseHex("000102030405060708090a0b0c0d0e0f");
+    CHDChain hdChain;
+    BOOST_CHECK(hdChain.SetSeed(SecureVector(vchSeed.begin(), vchSeed.end()), true));
+
+    {
+        LOCK(pwalletMain->cs_wallet);
+        BOOST_CHECK(pwalletMain->SetHDChain(hdChain, false));
+
+        // a key which is already known is skipped
+        CExtKey knownKey;
+        hdChain.DeriveChildExtKey(0, false, 5, knownKey);
+        BOOST_CHECK(pwalletMain->AddKeyPubKey(knownKey.key, knownKey.key.GetPubKey()));
+
+        // more than one batch per chain
+        BOOST_CHECK(pwalletMain->TopUpKeyPool(1200));
+        BOOST_CHECK_EQUAL(pwalletMain->KeypoolCountExternalKeys(), 1200);
+        BOOST_CHECK_EQUAL(pwalletMain->KeypoolCountInternalKeys(), 1200);
+
+        CHDChain hdChainCurrent;
+        CHDAccount acc;
+        BOOST_CHECK(pwalletMain->GetHDChain(hdChainCurrent));
+        BOOST_CHECK(hdChainCurrent.GetAccount(0, acc));
+        BOOST_CHECK_EQUAL(acc.nExternalChainCounter, 1201);
+        BOOST_CHECK_EQUAL(acc.nInternalChainCounter, 1200);
+
+        // the batch holds the same keys as the derivation of single keys
+        for (uint32_t nChildIndex : {0, 4, 6, 999, 1000, 1200}) {
+            CExtKey childKey;
+            CKey key;
+            hdChain.DeriveChildExtKey(0, false, nChildIndex, childKey);
+            BOOST_CHECK(pwalletMain->GetKey(childKey.key.GetPubKey().GetID(), key));
+            BOOST_CHECK(key == childKey.key);
+            hdChain.DeriveChildExtKey(0, true, nChildIndex - (nChildIndex == 1200), childKey);
+            BOOST_CHECK(pwalletMain->HaveKey(childKey.key.GetPubKey().GetID()));
+        }
+
+        // the oldest key is handed out first
+        CPubKey pubkey;
+        CExtKey firstKey;
+        hdChain.DeriveChildExtKey(0, false, 0, firstKey);
+        BOOST_CHECK(pwalletMain->GetKeyFromPool(pubkey, false));
+        BOOST_CHECK(pubkey == firstKey.key.GetPubKey());
+    }
+
+    // the filler thread tops up the keypool after a key was taken from it
+    ForceSetArg("-keypool", "1300");
+    pwalletMain->StartKeyPoolFiller();
+    CPubKey pubkey;
+    BOOST_CHECK(pwalletMain->GetKeyFromPool(pubkey, true));
+    for (int i = 0; i < 1000; i++) {
+        {
+            LOCK(pwalletMain->cs_wallet);
+            if (pwalletMain->KeypoolCountExternalKeys() == 1300 && pwalletMain->KeypoolCountInternalKeys() == 1300)
+                break;
+        }
+        MilliSleep(10);
+    }
+    pwalletMain->StopKeyPoolFiller();
+    ForceSetArg("-keypool", std::to_string(DEFAULT_KEYPOOL_SIZE));
+
+    LOCK(pwalletMain->cs_wallet);
+    BOOST_CHECK_EQUAL(pwalletMain->KeypoolCountExternalKeys(), 1300);
+    BOOST_CHECK_EQUAL(pwalletMain->KeypoolCountInternalKeys(), 1300);
+}
+
 static int64_t AddTx(CWallet& wallet, uint32_t lockTime, int64_t mockTime, int64_t blockTime)
 {
     CMutableTransaction tx;
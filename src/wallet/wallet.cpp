@@ -42,7 +42,12 @@
 #include "llmq/quorums_instantsend.h"
 #include "llmq/quorums_chainlocks.h"
 
+#include "ctpl.h"
+
 #include <assert.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
@@ -54,6 +59,7 @@ CFeeRate payTxFee(DEFAULT_TRANSACTION_FEE);
 unsigned int nTxConfirmTarget = DEFAULT_TX_CONFIRM_TARGET;
 bool bSpendZeroConfChange = DEFAULT_SPEND_ZEROCONF_CHANGE;
 bool bBIP69Enabled = true;
+bool fCheckBalanceLedger = DEFAULT_CHECK_BALANCE_LEDGER;
 
 const char * DEFAULT_WALLET_DAT = "wallet.dat";
 
@@ -213,39 +219,40 @@ CAmount GetStakeReward(CAmount blockReward, unsigned int percentage)
     return (blockReward / 100) * percentage;
 }
 bool CWallet::CreateCoinStakeKernel(CScript &kernelScript, const CScript &stakeScript,
-                                    unsigned int nBits, const CBlock &blockFrom,
-                                    unsigned int nTxPrevOffset, const CTransactionRef &txPrev,
-                                    const COutPoint &prevout, unsigned int &nTimeTx, bool fPrintProofOfStake) const
+                                    unsigned int nBits, const CStakeCandidate &candidate,
+                                    const COutPoint &prevout, unsigned int &nTimeTx, int64_t nMedianTimePast,
+                                    bool fPrintProofOfStake) const
 {
-    unsigned int nTryTime = 0;
     uint256 hashProofOfStake;
 
-    auto nStakeMinAge = CurrentMinStakeAge(blockFrom.GetBlockTime());
+    auto nStakeMinAge = CurrentMinStakeAge(candidate.nBlockTime);
 
-    if (blockFrom.GetBlockTime() + nStakeMinAge + nHashDrift > nTimeTx) // Min age requirement
+    if (candidate.nBlockTime + nStakeMinAge + nHashDrift > nTimeTx) // Min age requirement
         return false;
+
+    // Try the latest timestamps first, skipping the ones that wouldn't pass time requirements anyway
+    std::vector<unsigned int> vTryTime;
+    vTryTime.reserve(nHashDrift);
     for(unsigned int i = 0; i < nHashDrift; ++i)
     {
-        nTryTime = nTimeTx + nHashDrift - i;
-        bool fValid = CheckStakeKernelHash(nBits, blockFrom, nTxPrevOffset, txPrev, prevout, nTryTime, hashProofOfStake);
-        if (fDebug)
-            LogPrintf("%04x %s\n", i, hashProofOfStake.ToString().c_str());
-        if (fValid) {
-            //Double check that this will pass time requirements
-            if (nTryTime <= chainActive.Tip()->GetMedianTimePast()) {
-                LogPrintf("CreateCoinStakeKernel() : kernel found, but it is too far in the past \n");
-                continue;
-            }
-            // Found a kernel
-            if (fDebug && GetBoolArg("-printcoinstake", false))
-                LogPrintf("CreateCoinStakeKernel : kernel found\n");
-            kernelScript.clear();
-            kernelScript = stakeScript;
-            nTimeTx = nTryTime;
-            return true;
-        }
+        unsigned int nTryTime = nTimeTx + nHashDrift - i;
+        if (nTryTime <= nMedianTimePast)
+            break;
+        vTryTime.emplace_back(nTryTime);
     }
-    return false;
+
+    int nFound = FindStakeKernelHash(nBits, candidate.nBlockTime, candidate.nTxPrevOffset, candidate.nValue,
+                                     candidate.nStakeModifier, prevout, vTryTime, hashProofOfStake);
+    if (nFound < 0)
+        return false;
+
+    // Found a kernel
+    if (fDebug && GetBoolArg("-printcoinstake", false))
+        LogPrintf("CreateCoinStakeKernel : kernel found %s\n", hashProofOfStake.ToString());
+    kernelScript.clear();
+    kernelScript = stakeScript;
+    nTimeTx = vTryTime[nFound];
+    return true;
 }
 void CWallet::FillCoinStakePayments(CMutableTransaction &transaction,
                                     const CScript &scriptPubKeyOut,
@@ -434,6 +441,8 @@ bool CWallet::AddCScript(const CScript& redeemScript)
 {
     if (!CCryptoKeyStore::AddCScript(redeemScript))
         return false;
+    // outputs to the script may be ours now
+    InvalidateAllPrivateSendRounds();
     if (!fFileBacked)
         return true;
     return CWalletDB(strWalletFile).WriteCScript(Hash160(redeemScript), redeemScript);
@@ -459,6 +468,7 @@ bool CWallet::AddWatchOnly(const CScript& dest)
 {
     if (!CCryptoKeyStore::AddWatchOnly(dest))
         return false;
+    InvalidateAllPrivateSendRounds();
     const CKeyMetadata& meta = mapKeyMetadata[CScriptID(dest)];
     UpdateTimeFirstKey(meta.nCreateTime);
     NotifyWatchonlyChanged(true);
@@ -774,10 +784,73 @@ bool CWallet::IsSpent(const uint256& hash, unsigned int n) const
     return false;
 }
 
+void CWallet::AddWalletUTXO(const COutPoint& outpoint, CAmount nValue)
+{
+    setWalletUTXO.insert(outpoint);
+    if (CPrivateSend::IsDenominatedAmount(nValue))
+        setWalletUTXODenominated.insert(outpoint);
+    if (CPrivateSend::IsCollateralAmount(nValue))
+        setWalletUTXOCollateral.insert(outpoint);
+    if (nValue == 10000*COIN)
+        setWalletUTXO1000.insert(outpoint);
+}
+
+void CWallet::EraseWalletUTXO(const COutPoint& outpoint)
+{
+    setWalletUTXO.erase(outpoint);
+    setWalletUTXODenominated.erase(outpoint);
+    setWalletUTXOCollateral.erase(outpoint);
+    setWalletUTXO1000.erase(outpoint);
+}
+
+void CWallet::UpdateWalletUTXO(const COutPoint& outpoint)
+{
+    AssertLockHeld(cs_wallet);
+    auto it = mapWallet.find(outpoint.hash);
+    if (it == mapWallet.end() || outpoint.n >= it->second.tx->vout.size())
+        return;
+    const CTxOut& txout = it->second.tx->vout[outpoint.n];
+    if (IsMine(txout) && !IsSpent(outpoint.hash, outpoint.n)) {
+        AddWalletUTXO(outpoint, txout.nValue);
+    }
+}
+
+void CWallet::RebuildWalletUTXO()
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    setWalletUTXO.clear();
+    setWalletUTXODenominated.clear();
+    setWalletUTXOCollateral.clear();
+    setWalletUTXO1000.clear();
+    for (const auto& pair : mapWallet) {
+        for (unsigned int i = 0; i < pair.second.tx->vout.size(); ++i) {
+            if (IsMine(pair.second.tx->vout[i]) && !IsSpent(pair.first, i)) {
+                AddWalletUTXO(COutPoint(pair.first, i), pair.second.tx->vout[i].nValue);
+            }
+        }
+    }
+}
+
+const std::set<COutPoint>& CWallet::GetWalletUTXOView(AvailableCoinsType nCoinType) const
+{
+    switch (nCoinType) {
+        case ONLY_DENOMINATED: return setWalletUTXODenominated;
+        case ONLY_PRIVATESEND_COLLATERAL: return setWalletUTXOCollateral;
+        case ONLY_1000: return setWalletUTXO1000;
+        default: return setWalletUTXO;
+    }
+}
+
 void CWallet::AddToSpends(const COutPoint& outpoint, const uint256& wtxid)
 {
     mapTxSpends.insert(std::make_pair(outpoint, wtxid));
-    setWalletUTXO.erase(outpoint);
+    EraseWalletUTXO(outpoint);
+
+    // the available credit of the spent tx changed
+    auto it = mapWallet.find(outpoint.hash);
+    if (it != mapWallet.end())
+        it->second.MarkDirty();
 
     std::pair<TxSpends::iterator, TxSpends::iterator> range;
     range = mapTxSpends.equal_range(outpoint);
@@ -1090,6 +1163,11 @@ bool CWallet::GetAccountPubkey(CPubKey &pubKey, std::string strAccount, bool bFo
 
 void CWallet::MarkDirty()
 {
+    {
+        LOCK(cs_balanceledger);
+        fBalanceLedgerStale = true;
+        setBalanceDirty.clear();
+    }
     {
         LOCK(cs_wallet);
         BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
@@ -1120,11 +1198,13 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose)
         wtxOrdered.insert(std::make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
         wtx.nTimeSmart = ComputeTimeSmart(wtx);
         AddToSpends(hash);
+        if (!fLiteMode)
+            InvalidatePrivateSendRounds(hash, &walletdb);
 
         auto mnList = deterministicMNManager->GetListAtChainTip();
         for(unsigned int i = 0; i < wtx.tx->vout.size(); ++i) {
             if (IsMine(wtx.tx->vout[i]) && !IsSpent(hash, i)) {
-                setWalletUTXO.insert(COutPoint(hash, i));
+                AddWalletUTXO(COutPoint(hash, i), wtx.tx->vout[i].nValue);
                 if (deterministicMNManager->IsProTxWithCollateral(wtx.tx, i) || mnList.HasMNByCollateral(COutPoint(hash, i))) {
                     LockCoin(COutPoint(hash, i));
                 }
@@ -1157,6 +1237,11 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose)
             wtx.fFromMe = wtxIn.fFromMe;
             fUpdated = true;
         }
+        // outputs might have become ours since the tx was added, e.g. when rescanning after an import
+        for (unsigned int i = 0; i < wtx.tx->vout.size(); ++i) {
+            if (!setWalletUTXO.count(COutPoint(hash, i)))
+                UpdateWalletUTXO(COutPoint(hash, i));
+        }
     }
 
     //// debug print
@@ -1167,9 +1252,16 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose)
         if (!walletdb.WriteTx(wtx))
             return false;
 
+    // keep the rounds of denominated outputs which made it into a block
+    if (!fLiteMode && (fInsertedNew || fUpdated))
+        SavePrivateSendRounds(wtx, &walletdb);
+
     // Break debit/credit balance caches:
     wtx.MarkDirty();
 
+    if (fInsertedNew || fUpdated)
+        InvalidateStakeCandidates(*wtx.tx);
+
     // Notify UI of new or updated transaction
     NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
 
@@ -1307,8 +1399,10 @@ bool CWallet::AbandonTransaction(const uint256& hashTx)
             // available of the outputs it spends. So force those to be recomputed
             BOOST_FOREACH(const CTxIn& txin, wtx.tx->vin)
             {
-                if (mapWallet.count(txin.prevout.hash))
+                if (mapWallet.count(txin.prevout.hash)) {
                     mapWallet[txin.prevout.hash].MarkDirty();
+                    UpdateWalletUTXO(txin.prevout);
+                }
             }
         }
     }
@@ -1371,8 +1465,10 @@ void CWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
             // available of the outputs it spends. So force those to be recomputed
             BOOST_FOREACH(const CTxIn& txin, wtx.tx->vin)
             {
-                if (mapWallet.count(txin.prevout.hash))
+                if (mapWallet.count(txin.prevout.hash)) {
                     mapWallet[txin.prevout.hash].MarkDirty();
+                    UpdateWalletUTXO(txin.prevout);
+                }
             }
         }
     }
@@ -1435,86 +1531,241 @@ CAmount CWallet::GetDebit(const CTxIn &txin, const isminefilter& filter) const
     return 0;
 }
 
-// Recursively determine the rounds of a given input (How deep is the PrivateSend chain for a given input)
-int CWallet::GetRealOutpointPrivateSendRounds(const COutPoint& outpoint, int nRounds) const
+/** The rounds of an output which don't depend on its inputs, -10 if they do */
+static int GetTerminalPrivateSendRounds(const CTransaction& tx, unsigned int n)
 {
-    static std::map<uint256, CMutableTransaction> mDenomWtxes;
+    // bounds check
+    if (n >= tx.vout.size()) {
+        // should never actually hit this
+        return -4;
+    }
+
+    if (CPrivateSend::IsCollateralAmount(tx.vout[n].nValue))
+        return -3;
 
-    if(nRounds >= MAX_PRIVATESEND_ROUNDS) {
-        // there can only be MAX_PRIVATESEND_ROUNDS rounds max
-        return MAX_PRIVATESEND_ROUNDS - 1;
+    //make sure the final output is non-denominate
+    if (!CPrivateSend::IsDenominatedAmount(tx.vout[n].nValue))
+        return -2;
+
+    // this one is denominated but there is another non-denominated output found in the same tx
+    for (const auto& out : tx.vout) {
+        if (!CPrivateSend::IsDenominatedAmount(out.nValue))
+            return 0;
     }
 
-    uint256 hash = outpoint.hash;
-    unsigned int nout = outpoint.n;
+    return -10;
+}
+
+/**
+ * Determine the rounds of a denominated output of an all-denominated wallet tx, which is one more than the
+ * shortest chain of its denominated inputs. Walks the ancestry depth first with an explicit stack instead of
+ * recursion and caches the rounds of every output on the way.
+ */
+int CWallet::ComputePrivateSendRounds(const COutPoint& outpoint) const
+{
+    AssertLockHeld(cs_wallet);
 
-    const CWalletTx* wtx = GetWalletTx(hash);
-    if(wtx != NULL)
-    {
-        std::map<uint256, CMutableTransaction>::const_iterator mdwi = mDenomWtxes.find(hash);
-        if (mdwi == mDenomWtxes.end()) {
-            // not known yet, let's add it
-            LogPrint("privatesend", "GetRealOutpointPrivateSendRounds INSERTING %s\n", hash.ToString());
-            mDenomWtxes[hash] = CMutableTransaction(*wtx);
-        } else if(mDenomWtxes[hash].vout[nout].nRounds != -10) {
-            // found and it's not an initial value, just return it
-            return mDenomWtxes[hash].vout[nout].nRounds;
+    struct Frame {
+        COutPoint outpoint;
+        const CWalletTx* wtx;
+        size_t nNextInput;
+        int nShortest; // -10 until a denominated input was found
+    };
+
+    auto applyInput = [](Frame& frame, int n) {
+        // denom found, find the shortest chain or initially assign nShortest with the first found value
+        if (n >= 0 && (n < frame.nShortest || frame.nShortest == -10))
+            frame.nShortest = n;
+    };
+
+    std::vector<Frame> vStack;
+    vStack.push_back(Frame{outpoint, GetWalletTx(outpoint.hash), 0, -10});
+    int nResult = 0;
+    while (!vStack.empty()) {
+        Frame& frame = vStack.back();
+        if (frame.nNextInput < frame.wtx->tx->vin.size()) {
+            const CTxIn& txin = frame.wtx->tx->vin[frame.nNextInput++];
+            if (!IsMine(txin))
+                continue;
+            const CWalletTx* prev = GetWalletTx(txin.prevout.hash);
+            int n = GetTerminalPrivateSendRounds(*prev->tx, txin.prevout.n);
+            if (n == -10) {
+                auto it = mapOutpointRounds.find(txin.prevout);
+                if (it == mapOutpointRounds.end()) {
+                    vStack.push_back(Frame{txin.prevout, prev, 0, -10});
+                    continue;
+                }
+                n = it->second;
+            }
+            applyInput(frame, n);
+            continue;
         }
 
+        // good, we add 1 to the shortest one but only MAX_PRIVATESEND_ROUNDS rounds max allowed,
+        // if there is none we are the first one in that chain
+        nResult = frame.nShortest == -10 ? 0 : std::min(frame.nShortest + 1, MAX_PRIVATESEND_ROUNDS);
+        mapOutpointRounds[frame.outpoint] = nResult;
+        LogPrint("privatesend", "CWallet::%s -- UPDATED %s %3d\n", __func__, frame.outpoint.ToStringShort(), nResult);
+        vStack.pop_back();
+        if (!vStack.empty())
+            applyInput(vStack.back(), nResult);
+    }
+    return nResult;
+}
 
-        // bounds check
-        if (nout >= wtx->tx->vout.size()) {
-            // should never actually hit this
-            LogPrint("privatesend", "GetRealOutpointPrivateSendRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, -4);
-            return -4;
-        }
+// Determine the rounds of a given input (How deep is the PrivateSend chain for a given input)
+int CWallet::GetRealOutpointPrivateSendRounds(const COutPoint& outpoint) const
+{
+    LOCK(cs_wallet);
 
-        if (CPrivateSend::IsCollateralAmount(wtx->tx->vout[nout].nValue)) {
-            mDenomWtxes[hash].vout[nout].nRounds = -3;
-            LogPrint("privatesend", "GetRealOutpointPrivateSendRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
-            return mDenomWtxes[hash].vout[nout].nRounds;
-        }
+    const CWalletTx* wtx = GetWalletTx(outpoint.hash);
+    if (wtx == NULL)
+        return -1;
 
-        //make sure the final output is non-denominate
-        if (!CPrivateSend::IsDenominatedAmount(wtx->tx->vout[nout].nValue)) { //NOT DENOM
-            mDenomWtxes[hash].vout[nout].nRounds = -2;
-            LogPrint("privatesend", "GetRealOutpointPrivateSendRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
-            return mDenomWtxes[hash].vout[nout].nRounds;
+    int nRounds = GetTerminalPrivateSendRounds(*wtx->tx, outpoint.n);
+    if (nRounds != -10)
+        return nRounds;
+
+    auto it = mapOutpointRounds.find(outpoint);
+    if (it != mapOutpointRounds.end())
+        return it->second;
+
+    return ComputePrivateSendRounds(outpoint);
+}
+
+void CWallet::LoadPrivateSendRounds(const COutPoint& outpoint, uint32_t nEpoch, int nRounds)
+{
+    LOCK(cs_wallet);
+    mapOutpointRounds[outpoint] = nRounds;
+    mapOutpointRoundsSaved[outpoint] = nEpoch;
+}
+
+void CWallet::LoadPrivateSendRoundsEpoch(uint32_t nEpoch)
+{
+    LOCK(cs_wallet);
+    nPrivateSendRoundsEpoch = nEpoch;
+}
+
+uint32_t CWallet::GetPrivateSendRoundsEpoch() const
+{
+    LOCK(cs_wallet);
+    return nPrivateSendRoundsEpoch;
+}
+
+/** Stores the rounds of the denominated outputs of a tx which made it into a block, returns how many were written */
+size_t CWallet::SavePrivateSendRounds(const CWalletTx& wtx, CWalletDB* pwalletdb)
+{
+    AssertLockHeld(cs_wallet);
+
+    if (!fFileBacked || wtx.hashUnset() || wtx.nIndex == -1)
+        return 0;
+
+    const uint256& hash = wtx.GetHash();
+    size_t nWritten = 0;
+    for (unsigned int i = 0; i < wtx.tx->vout.size(); i++) {
+        COutPoint outpoint(hash, i);
+        int nTerminal = GetTerminalPrivateSendRounds(*wtx.tx, i);
+        if (nTerminal == 0)
+            break; // not an all-denominated tx
+        if (nTerminal != -10)
+            continue;
+        auto it = mapOutpointRoundsSaved.find(outpoint);
+        if (it != mapOutpointRoundsSaved.end() && it->second == nPrivateSendRoundsEpoch)
+            continue;
+        if (pwalletdb->WritePrivateSendRounds(outpoint, nPrivateSendRoundsEpoch, GetRealOutpointPrivateSendRounds(outpoint))) {
+            mapOutpointRoundsSaved[outpoint] = nPrivateSendRoundsEpoch;
+            nWritten++;
         }
+    }
+    return nWritten;
+}
+
+/** Forgets the rounds of the descendants of a tx which was added after them, their inputs became ours */
+void CWallet::InvalidatePrivateSendRounds(const uint256& hashTx, CWalletDB* pwalletdb)
+{
+    AssertLockHeld(cs_wallet);
 
-        bool fAllDenoms = true;
-        for (const auto& out : wtx->tx->vout) {
-            fAllDenoms = fAllDenoms && CPrivateSend::IsDenominatedAmount(out.nValue);
+    std::vector<uint256> vTodo{hashTx};
+    std::set<uint256> setDone;
+    while (!vTodo.empty()) {
+        uint256 hash = vTodo.back();
+        vTodo.pop_back();
+        if (!setDone.insert(hash).second)
+            continue;
+        auto it = mapWallet.find(hash);
+        if (it == mapWallet.end())
+            continue;
+        for (unsigned int i = 0; i < it->second.tx->vout.size(); i++) {
+            COutPoint outpoint(hash, i);
+            mapOutpointRounds.erase(outpoint);
+            if (mapOutpointRoundsSaved.erase(outpoint))
+                pwalletdb->ErasePrivateSendRounds(outpoint);
+            auto range = mapTxSpends.equal_range(outpoint);
+            for (auto spend = range.first; spend != range.second; ++spend) {
+                vTodo.push_back(spend->second);
+            }
         }
+    }
+}
 
-        // this one is denominated but there is another non-denominated output found in the same tx
-        if (!fAllDenoms) {
-            mDenomWtxes[hash].vout[nout].nRounds = 0;
-            LogPrint("privatesend", "GetRealOutpointPrivateSendRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
-            return mDenomWtxes[hash].vout[nout].nRounds;
+void CWallet::InvalidateAllPrivateSendRounds()
+{
+    LOCK(cs_wallet);
+    // every record of the current epoch is cached too, nothing to invalidate if the cache is empty
+    if (mapOutpointRounds.empty())
+        return;
+    mapOutpointRounds.clear();
+    nPrivateSendRoundsEpoch++;
+    if (fFileBacked)
+        CWalletDB(strWalletFile).WritePrivateSendRoundsEpoch(nPrivateSendRoundsEpoch);
+}
+
+void CWallet::UpdateAllPrivateSendRounds()
+{
+    if (fLiteMode)
+        return;
+
+    LOCK(cs_wallet);
+
+    int64_t nStart = GetTimeMillis();
+    size_t nComputed = 0;
+    size_t nSaved = 0;
+    std::unique_ptr<CWalletDB> walletdb;
+    if (fFileBacked)
+        walletdb.reset(new CWalletDB(strWalletFile));
+
+    // drop what was stored for txs which are gone, e.g. after -zapwallettxes, and
+    // don't trust what was stored before the last import, it is rewritten below
+    for (auto it = mapOutpointRoundsSaved.begin(); it != mapOutpointRoundsSaved.end(); ) {
+        if (it->second != nPrivateSendRoundsEpoch)
+            mapOutpointRounds.erase(it->first);
+        if (mapWallet.count(it->first.hash)) {
+            ++it;
+            continue;
         }
+        mapOutpointRounds.erase(it->first);
+        if (walletdb)
+            walletdb->ErasePrivateSendRounds(it->first);
+        it = mapOutpointRoundsSaved.erase(it);
+    }
 
-        int nShortest = -10; // an initial value, should be no way to get this by calculations
-        bool fDenomFound = false;
-        // only denoms here so let's look up
-        for (const auto& txinNext : wtx->tx->vin) {
-            if (IsMine(txinNext)) {
-                int n = GetRealOutpointPrivateSendRounds(txinNext.prevout, nRounds + 1);
-                // denom found, find the shortest chain or initially assign nShortest with the first found value
-                if(n >= 0 && (n < nShortest || nShortest == -10)) {
-                    nShortest = n;
-                    fDenomFound = true;
-                }
-            }
+    for (const auto& pair : mapWallet) {
+        const CWalletTx& wtx = pair.second;
+        for (unsigned int i = 0; i < wtx.tx->vout.size(); i++) {
+            int nTerminal = GetTerminalPrivateSendRounds(*wtx.tx, i);
+            if (nTerminal == 0)
+                break; // not an all-denominated tx
+            if (nTerminal != -10 || mapOutpointRounds.count(COutPoint(pair.first, i)))
+                continue;
+            ComputePrivateSendRounds(COutPoint(pair.first, i));
+            nComputed++;
         }
-        mDenomWtxes[hash].vout[nout].nRounds = fDenomFound
-                ? (nShortest >= MAX_PRIVATESEND_ROUNDS - 1 ? MAX_PRIVATESEND_ROUNDS : nShortest + 1) // good, we a +1 to the shortest one but only MAX_PRIVATESEND_ROUNDS rounds max allowed
-                : 0;            // too bad, we are the fist one in that chain
-        LogPrint("privatesend", "GetRealOutpointPrivateSendRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
-        return mDenomWtxes[hash].vout[nout].nRounds;
+        if (walletdb)
+            nSaved += SavePrivateSendRounds(wtx, walletdb.get());
     }
 
-    return nRounds - 1;
+    LogPrint("privatesend", "CWallet::%s -- computed %u, saved %u, %u cached in %dms\n", __func__,
+        nComputed, nSaved, mapOutpointRounds.size(), GetTimeMillis() - nStart);
 }
 
 // respect current settings
@@ -1887,11 +2138,109 @@ void CWalletTx::GetAccountAmounts(const std::string& strAccount, CAmount& nRecei
     }
 }
 
+namespace {
+
+/** Number of blocks the reader may get ahead of the in-order commit of a rescan */
+const size_t MAX_RESCAN_BLOCKS_AHEAD = 256;
+const int MAX_RESCAN_THREADS = 8;
+
+} // anonymous namespace
+
+/**
+ * Copy of everything which makes a transaction relevant to the wallet, taken before a rescan so that the
+ * rescan workers can filter blocks without cs_wallet. It errs on the side of matching, the final decision
+ * is made by AddToWalletIfInvolvingMe.
+ */
+class CWalletScanFilter
+{
+private:
+    std::set<CKeyID> setKeyIds;
+    std::set<CScriptID> setScriptIds;
+    std::set<CScript> setWatchOnly;
+    std::set<uint256> setTxids;
+    std::set<COutPoint> setSpent;
+
+    bool MatchScript(const CScript& script) const
+    {
+        if (setWatchOnly.count(script))
+            return true;
+
+        std::vector<std::vector<unsigned char> > vSolutions;
+        txnouttype whichType;
+        if (!Solver(script, whichType, vSolutions))
+            return false;
+
+        switch (whichType) {
+        case TX_PUBKEY:
+            return setKeyIds.count(CPubKey(vSolutions[0]).GetID()) != 0;
+        case TX_PUBKEYHASH:
+            return setKeyIds.count(CKeyID(uint160(vSolutions[0]))) != 0;
+        case TX_SCRIPTHASH:
+            return setScriptIds.count(CScriptID(uint160(vSolutions[0]))) != 0;
+        case TX_MULTISIG:
+            // IsMine wants all keys, one is enough to look closer
+            for (size_t i = 1; i + 1 < vSolutions.size(); i++) {
+                if (setKeyIds.count(CPubKey(vSolutions[i]).GetID()))
+                    return true;
+            }
+            return false;
+        default:
+            return false;
+        }
+    }
+
+public:
+    explicit CWalletScanFilter(const CWallet& wallet)
+    {
+        AssertLockHeld(wallet.cs_wallet);
+
+        wallet.GetKeys(setKeyIds);
+        for (const auto& pair : wallet.mapHdPubKeys) {
+            setKeyIds.insert(pair.first);
+        }
+        {
+            LOCK(wallet.cs_KeyStore);
+            for (const auto& pair : wallet.mapScripts) {
+                setScriptIds.insert(pair.first);
+            }
+            setWatchOnly = wallet.setWatchOnly;
+        }
+        for (const auto& pair : wallet.mapWallet) {
+            setTxids.insert(pair.first);
+        }
+        for (const auto& pair : wallet.mapTxSpends) {
+            setSpent.insert(pair.first);
+        }
+    }
+
+    /** Whether the tx might pay to, spend from or conflict with the wallet */
+    bool Match(const CTransaction& tx) const
+    {
+        if (setTxids.count(tx.GetHash()))
+            return true;
+        for (const CTxIn& txin : tx.vin) {
+            if (setTxids.count(txin.prevout.hash) || setSpent.count(txin.prevout))
+                return true;
+        }
+        for (const CTxOut& txout : tx.vout) {
+            if (MatchScript(txout.scriptPubKey))
+                return true;
+        }
+        return false;
+    }
+};
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
  * exist in the wallet will be updated.
  *
+ * A reader thread prefetches the blocks and worker threads match them against
+ * a CWalletScanFilter, while this thread adds the matches to the wallet in block
+ * order. Keys and scripts can't be added without cs_wallet, which is held for the
+ * whole scan, so the filter only misses txs spending from txs found by the scan
+ * itself, which are tracked here.
+ *
  * Returns pointer to the first block in the last contiguous range that was
  * successfully scanned.
  *
@@ -1911,36 +2260,226 @@ CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool f
         while (pindex && nTimeFirstKey && (pindex->GetBlockTime() < (nTimeFirstKey - TIMESTAMP_WINDOW)))
             pindex = chainActive.Next(pindex);
 
+        std::vector<CBlockIndex*> vBlocks;
+        for (CBlockIndex* pindexScan = pindex; pindexScan; pindexScan = chainActive.Next(pindexScan)) {
+            vBlocks.push_back(pindexScan);
+        }
+
+        CWalletStateSnapshot stateAtStart = GetStateSnapshot();
+        {
+            LOCK(cs_scanprogress);
+            scanProgress = CWalletScanProgress();
+            scanProgress.stateAtStart = std::move(stateAtStart);
+            scanProgress.fScanning = true;
+            scanProgress.nStartHeight = pindex ? pindex->nHeight : chainActive.Height();
+            scanProgress.nHeight = scanProgress.nStartHeight;
+            scanProgress.nTipHeight = chainActive.Height();
+            scanProgress.nStartTimeMillis = GetTimeMillis();
+        }
+
         ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
         double dProgressStart = GuessVerificationProgress(chainParams.TxData(), pindex);
         double dProgressTip = GuessVerificationProgress(chainParams.TxData(), chainActive.Tip());
-        while (pindex)
-        {
-            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
-                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((GuessVerificationProgress(chainParams.TxData(), pindex) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
-            if (GetTime() >= nNow + 60) {
-                nNow = GetTime();
-                LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, GuessVerificationProgress(chainParams.TxData(), pindex));
+
+        const size_t nBlocks = vBlocks.size();
+        const size_t nWindow = std::max<size_t>(1, std::min(nBlocks, MAX_RESCAN_BLOCKS_AHEAD));
+        const int nWorkers = std::max(1, std::min(GetNumCores() - 1, MAX_RESCAN_THREADS));
+        const CWalletScanFilter filter(*this);
+
+        struct ScanSlot {
+            std::shared_ptr<const CBlock> block;
+            std::vector<size_t> vMatches;
+            bool fMatched{false};
+        };
+        std::vector<ScanSlot> vSlots(nWindow);
+
+        std::mutex cs;
+        std::condition_variable cvRead;
+        std::condition_variable cvMatched;
+        std::condition_variable cvCommitted;
+        size_t nRead = 0;
+        size_t nNextMatch = 0;
+        size_t nCommitted = 0;
+        bool fStop = false;
+
+        auto reader = [&]() {
+            for (size_t i = 0; i < nBlocks; i++) {
+                {
+                    std::unique_lock<std::mutex> lock(cs);
+                    cvCommitted.wait(lock, [&] { return fStop || i < nCommitted + nWindow; });
+                    if (fStop)
+                        return;
+                }
+                // a failed read is passed on as a null block
+                auto block = std::make_shared<CBlock>();
+                if (!ReadBlockFromDisk(*block, vBlocks[i], chainParams.GetConsensus()))
+                    block = nullptr;
+                {
+                    std::unique_lock<std::mutex> lock(cs);
+                    vSlots[i % nWindow].block = std::move(block);
+                    nRead = i + 1;
+                }
+                cvRead.notify_all();
             }
+        };
 
-            CBlock block;
-            if (ReadBlockFromDisk(block, pindex, Params().GetConsensus())) {
-                for (size_t posInBlock = 0; posInBlock < block.vtx.size(); ++posInBlock) {
-                    AddToWalletIfInvolvingMe(*block.vtx[posInBlock], pindex, posInBlock, fUpdate);
+        auto worker = [&]() {
+            while (true) {
+                size_t i;
+                std::shared_ptr<const CBlock> block;
+                {
+                    std::unique_lock<std::mutex> lock(cs);
+                    cvRead.wait(lock, [&] { return fStop || nNextMatch < nRead || nNextMatch == nBlocks; });
+                    if (fStop || nNextMatch == nBlocks)
+                        return;
+                    i = nNextMatch++;
+                    block = vSlots[i % nWindow].block;
                 }
-                if (!ret) {
-                    ret = pindex;
+                std::vector<size_t> vMatches;
+                if (block) {
+                    for (size_t posInBlock = 0; posInBlock < block->vtx.size(); ++posInBlock) {
+                        if (filter.Match(*block->vtx[posInBlock]))
+                            vMatches.push_back(posInBlock);
+                    }
                 }
-            } else {
-                ret = nullptr;
+                {
+                    std::unique_lock<std::mutex> lock(cs);
+                    vSlots[i % nWindow].vMatches = std::move(vMatches);
+                    vSlots[i % nWindow].fMatched = true;
+                }
+                cvMatched.notify_all();
             }
-            pindex = chainActive.Next(pindex);
+        };
+
+        std::vector<std::thread> vThreads;
+        if (nBlocks != 0) {
+            vThreads.emplace_back([&reader] {
+                RenameThread("sierra-rescanread");
+                reader();
+            });
+            for (int i = 0; i < nWorkers; i++) {
+                vThreads.emplace_back([&worker, i] {
+                    RenameThread(strprintf("sierra-rescan.%d", i).c_str());
+                    worker();
+                });
+            }
+        }
+
+        auto stopThreads = [&]() {
+            {
+                std::unique_lock<std::mutex> lock(cs);
+                fStop = true;
+            }
+            cvRead.notify_all();
+            cvCommitted.notify_all();
+            for (std::thread& thread : vThreads) {
+                thread.join();
+            }
+            vThreads.clear();
+        };
+
+        // txs added by this scan and the outpoints they spend, the filter doesn't know about them
+        std::set<uint256> setScanTxids;
+        std::set<COutPoint> setScanSpent;
+
+        try {
+            for (size_t i = 0; i < nBlocks; i++) {
+                pindex = vBlocks[i];
+                if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
+                    ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((GuessVerificationProgress(chainParams.TxData(), pindex) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+                if (GetTime() >= nNow + 60) {
+                    nNow = GetTime();
+                    LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, GuessVerificationProgress(chainParams.TxData(), pindex));
+                }
+
+                ScanSlot slot;
+                {
+                    std::unique_lock<std::mutex> lock(cs);
+                    cvMatched.wait(lock, [&] { return vSlots[i % nWindow].fMatched; });
+                    std::swap(slot, vSlots[i % nWindow]);
+                    nCommitted = i + 1;
+                }
+                cvCommitted.notify_one();
+
+                if (slot.block) {
+                    auto itMatch = slot.vMatches.begin();
+                    for (size_t posInBlock = 0; posInBlock < slot.block->vtx.size(); ++posInBlock) {
+                        const CTransaction& tx = *slot.block->vtx[posInBlock];
+                        bool fMatch = itMatch != slot.vMatches.end() && *itMatch == posInBlock;
+                        if (fMatch) {
+                            ++itMatch;
+                        } else if (!setScanTxids.empty()) {
+                            for (const CTxIn& txin : tx.vin) {
+                                if (setScanTxids.count(txin.prevout.hash) || setScanSpent.count(txin.prevout)) {
+                                    fMatch = true;
+                                    break;
+                                }
+                            }
+                        }
+                        if (fMatch && AddToWalletIfInvolvingMe(tx, pindex, posInBlock, fUpdate)) {
+                            setScanTxids.insert(tx.GetHash());
+                            for (const CTxIn& txin : tx.vin) {
+                                setScanSpent.insert(txin.prevout);
+                            }
+                        }
+                    }
+                    if (!ret) {
+                        ret = pindex;
+                    }
+                } else {
+                    ret = nullptr;
+                }
+
+                LOCK(cs_scanprogress);
+                scanProgress.nHeight = pindex->nHeight;
+                scanProgress.nBlocksScanned = (int)(i + 1);
+                scanProgress.nDurationMillis = GetTimeMillis() - scanProgress.nStartTimeMillis;
+            }
+        } catch (...) {
+            stopThreads();
+            LOCK(cs_scanprogress);
+            scanProgress.fScanning = false;
+            throw;
+        }
+        stopThreads();
+
+        {
+            LOCK(cs_scanprogress);
+            scanProgress.fScanning = false;
+            scanProgress.nDurationMillis = GetTimeMillis() - scanProgress.nStartTimeMillis;
+            LogPrintf("Rescan of %d blocks done in %dms (%.1f blocks/s)\n", scanProgress.nBlocksScanned, scanProgress.nDurationMillis, scanProgress.GetBlocksPerSecond());
         }
         ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     }
     return ret;
 }
 
+CWalletScanProgress CWallet::GetScanProgress() const
+{
+    LOCK(cs_scanprogress);
+    CWalletScanProgress ret = scanProgress;
+    if (ret.fScanning)
+        ret.nDurationMillis = GetTimeMillis() - ret.nStartTimeMillis;
+    return ret;
+}
+
+CWalletStateSnapshot CWallet::GetStateSnapshot()
+{
+    LOCK2(cs_main, cs_wallet);
+    CWalletStateSnapshot ret;
+    ret.nWalletVersion = nWalletVersion;
+    ret.balances = GetBalances();
+    ret.nTxCount = mapWallet.size();
+    ret.nKeyPoolOldestTime = GetOldestKeyPoolTime();
+    ret.nKeyPoolExternal = KeypoolCountExternalKeys();
+    ret.nKeyPoolInternal = KeypoolCountInternalKeys();
+    ret.nKeysLeftSinceAutoBackup = nKeysLeftSinceAutoBackup;
+    ret.fCrypted = IsCrypted();
+    ret.nRelockTime = nRelockTime;
+    ret.fHDEnabled = GetHDChain(ret.hdChain);
+    return ret;
+}
+
 void CWallet::ReacceptWalletTransactions()
 {
     // If transactions aren't being broadcasted, don't let them into local mempool either
@@ -2079,6 +2618,25 @@ CAmount CWalletTx::GetCredit(const isminefilter& filter) const
     return credit;
 }
 
+void CWalletTx::MarkDirty()
+{
+    fCreditCached = false;
+    fAvailableCreditCached = false;
+    fImmatureCreditCached = false;
+    fAnonymizedCreditCached = false;
+    fDenomUnconfCreditCached = false;
+    fDenomConfCreditCached = false;
+    fWatchDebitCached = false;
+    fWatchCreditCached = false;
+    fAvailableWatchCreditCached = false;
+    fImmatureWatchCreditCached = false;
+    fDebitCached = false;
+    fChangeCached = false;
+
+    if (pwallet)
+        pwallet->MarkBalanceDirty(GetHash());
+}
+
 CAmount CWalletTx::GetImmatureCredit(bool fUseCache) const
 {
     if ((IsCoinBase() || IsCoinStake()) && GetBlocksToMaturity() > 0 && IsInMainChain())
@@ -2363,39 +2921,220 @@ void CWallet::ResendWalletTransactions(int64_t nBestBlockTime, CConnman* connman
  */
 
 
-CAmount CWallet::GetBalance() const
+CWalletBalances& CWalletBalances::operator+=(const CWalletBalances& b)
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableCredit();
-        }
+    nTrusted += b.nTrusted;
+    nUnconfirmed += b.nUnconfirmed;
+    nImmature += b.nImmature;
+    nWatchOnlyTrusted += b.nWatchOnlyTrusted;
+    nWatchOnlyUnconfirmed += b.nWatchOnlyUnconfirmed;
+    nWatchOnlyImmature += b.nWatchOnlyImmature;
+    nAnonymized += b.nAnonymized;
+    nDenominatedConfirmed += b.nDenominatedConfirmed;
+    nDenominatedUnconfirmed += b.nDenominatedUnconfirmed;
+    nStake += b.nStake;
+    return *this;
+}
+
+CWalletBalances& CWalletBalances::operator-=(const CWalletBalances& b)
+{
+    nTrusted -= b.nTrusted;
+    nUnconfirmed -= b.nUnconfirmed;
+    nImmature -= b.nImmature;
+    nWatchOnlyTrusted -= b.nWatchOnlyTrusted;
+    nWatchOnlyUnconfirmed -= b.nWatchOnlyUnconfirmed;
+    nWatchOnlyImmature -= b.nWatchOnlyImmature;
+    nAnonymized -= b.nAnonymized;
+    nDenominatedConfirmed -= b.nDenominatedConfirmed;
+    nDenominatedUnconfirmed -= b.nDenominatedUnconfirmed;
+    nStake -= b.nStake;
+    return *this;
+}
+
+bool CWalletBalances::operator==(const CWalletBalances& b) const
+{
+    return nTrusted == b.nTrusted &&
+           nUnconfirmed == b.nUnconfirmed &&
+           nImmature == b.nImmature &&
+           nWatchOnlyTrusted == b.nWatchOnlyTrusted &&
+           nWatchOnlyUnconfirmed == b.nWatchOnlyUnconfirmed &&
+           nWatchOnlyImmature == b.nWatchOnlyImmature &&
+           nAnonymized == b.nAnonymized &&
+           nDenominatedConfirmed == b.nDenominatedConfirmed &&
+           nDenominatedUnconfirmed == b.nDenominatedUnconfirmed &&
+           nStake == b.nStake;
+}
+
+std::string CWalletBalances::ToString() const
+{
+    return strprintf("CWalletBalances(trusted=%s, unconfirmed=%s, immature=%s, watchonly=%s/%s/%s, anonymized=%s, denominated=%s/%s, stake=%s)",
+        FormatMoney(nTrusted), FormatMoney(nUnconfirmed), FormatMoney(nImmature),
+        FormatMoney(nWatchOnlyTrusted), FormatMoney(nWatchOnlyUnconfirmed), FormatMoney(nWatchOnlyImmature),
+        FormatMoney(nAnonymized), FormatMoney(nDenominatedConfirmed), FormatMoney(nDenominatedUnconfirmed), FormatMoney(nStake));
+}
+
+void CWallet::MarkBalanceDirty(const uint256& hash) const
+{
+    LOCK(cs_balanceledger);
+    // a stale ledger is rebuilt from scratch anyway
+    if (!fBalanceLedgerStale)
+        setBalanceDirty.insert(hash);
+}
+
+/**
+ * The contribution of a single tx to the balances. fVolatileRet tells whether it can change without the tx
+ * being marked dirty, nStakeAgeTimeRet is the time at which it becomes old enough to stake, 0 if that
+ * doesn't matter.
+ */
+CWalletBalances CWallet::ComputeTxBalances(const CWalletTx& wtx, bool& fVolatileRet, int64_t& nStakeAgeTimeRet) const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    CWalletBalances ret;
+    const int nDepth = wtx.GetDepthInMainChain();
+    const bool fTrusted = wtx.IsTrusted();
+    if (fTrusted) {
+        ret.nTrusted = wtx.GetAvailableCredit();
+        ret.nWatchOnlyTrusted = wtx.GetAvailableWatchOnlyCredit();
+    } else if (nDepth == 0 && !wtx.IsLockedByInstantSend() && wtx.InMempool()) {
+        ret.nUnconfirmed = wtx.GetAvailableCredit();
+        ret.nWatchOnlyUnconfirmed = wtx.GetAvailableWatchOnlyCredit();
+    }
+    ret.nImmature = wtx.GetImmatureCredit();
+    ret.nWatchOnlyImmature = wtx.GetImmatureWatchOnlyCredit();
+
+    if (!fLiteMode) {
+        if (fTrusted)
+            ret.nAnonymized = wtx.GetAnonymizedCredit();
+        ret.nDenominatedConfirmed = wtx.GetDenominatedCredit(false);
+        ret.nDenominatedUnconfirmed = wtx.GetDenominatedCredit(true);
+    }
+
+    // ppcoin: coins staked (non-spendable until maturity)
+    nStakeAgeTimeRet = 0;
+    if (fTrusted && wtx.GetBlocksToMaturity() < (wtx.tx->IsCoinStake() ? COINBASE_MATURITY : 10)) {
+        auto nStakeMinAge = CurrentMinStakeAge(wtx.GetTxTime());
+        if (GetTime() - wtx.GetTxTime() > nStakeMinAge)
+            ret.nStake = ret.nTrusted;
+        else
+            nStakeAgeTimeRet = wtx.GetTxTime() + nStakeMinAge + 1;
     }
 
-    return nTotal;
+    fVolatileRet = !fTrusted || nDepth < 1 || wtx.GetBlocksToMaturity() > 0 || nStakeAgeTimeRet != 0;
+    return ret;
 }
 
-// ppcoin: total coins staked (non-spendable until maturity)
-CAmount CWallet::GetStake() const
+void CWallet::UpdateBalanceLedger() const
 {
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
 
-    CAmount nTotal = 0;
+    bool fRebuild;
+    std::set<uint256> setDirty;
     {
-        LOCK2(cs_main, cs_wallet);
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            auto nStakeMinAge = CurrentMinStakeAge(pcoin->GetTxTime());
-            if (pcoin->IsTrusted() && GetTime() - pcoin->GetTxTime() > nStakeMinAge && pcoin->GetBlocksToMaturity() < (pcoin->tx->IsCoinStake() ? COINBASE_MATURITY : 10))
-                nTotal += pcoin->GetAvailableCredit();
+        LOCK(cs_balanceledger);
+        fRebuild = fBalanceLedgerStale || nBalancePrivateSendRounds != privateSendClient.nPrivateSendRounds;
+        fBalanceLedgerStale = false;
+        // matured txs aren't recomputed on tip changes, but disconnecting blocks can make them immature again
+        if (pindexBalanceTip && !chainActive.Contains(pindexBalanceTip))
+            fRebuild = true;
+        setDirty.swap(setBalanceDirty);
+    }
+
+    const unsigned int nMempoolUpdated = mempool.GetTransactionsUpdated();
+    const unsigned int nLockEvents = nBalanceLockEvents;
+    const int64_t nNow = GetTime();
+
+    auto addTx = [&](const uint256& hash, const CWalletTx& wtx) {
+        bool fVolatile;
+        int64_t nStakeAgeTime;
+        CWalletBalances balances = ComputeTxBalances(wtx, fVolatile, nStakeAgeTime);
+        if (fVolatile)
+            setBalanceVolatile.insert(hash);
+        if (nStakeAgeTime != 0)
+            nBalanceNextStakeAgeTime = std::min(nBalanceNextStakeAgeTime, nStakeAgeTime);
+        if (balances != CWalletBalances()) {
+            balancesTotal += balances;
+            mapTxBalances.emplace(hash, balances);
+        }
+    };
+
+    if (fRebuild) {
+        mapTxBalances.clear();
+        setBalanceVolatile.clear();
+        balancesTotal = CWalletBalances();
+        nBalanceNextStakeAgeTime = std::numeric_limits<int64_t>::max();
+        for (const auto& pair : mapWallet) {
+            addTx(pair.first, pair.second);
+        }
+    } else {
+        if (pindexBalanceTip != chainActive.Tip() || nBalanceMempoolUpdated != nMempoolUpdated ||
+            nBalanceLockEventsSeen != nLockEvents || nNow >= nBalanceNextStakeAgeTime) {
+            setDirty.insert(setBalanceVolatile.begin(), setBalanceVolatile.end());
+            nBalanceNextStakeAgeTime = std::numeric_limits<int64_t>::max();
+        }
+        for (const uint256& hash : setDirty) {
+            auto it = mapTxBalances.find(hash);
+            if (it != mapTxBalances.end()) {
+                balancesTotal -= it->second;
+                mapTxBalances.erase(it);
+            }
+            setBalanceVolatile.erase(hash);
+            auto mi = mapWallet.find(hash);
+            if (mi != mapWallet.end())
+                addTx(hash, mi->second);
         }
     }
 
-    return nTotal;
+    pindexBalanceTip = chainActive.Tip();
+    nBalanceMempoolUpdated = nMempoolUpdated;
+    nBalanceLockEventsSeen = nLockEvents;
+    nBalancePrivateSendRounds = privateSendClient.nPrivateSendRounds;
+}
+
+CWalletBalances CWallet::GetBalances() const
+{
+    LOCK2(cs_main, cs_wallet);
+    UpdateBalanceLedger();
+    if (fCheckBalanceLedger)
+        assert(CheckBalanceLedger());
+    return balancesTotal;
+}
+
+CWalletBalances CWallet::ComputeBalances() const
+{
+    LOCK2(cs_main, cs_wallet);
+    CWalletBalances ret;
+    for (const auto& pair : mapWallet) {
+        bool fVolatile;
+        int64_t nStakeAgeTime;
+        ret += ComputeTxBalances(pair.second, fVolatile, nStakeAgeTime);
+    }
+    return ret;
+}
+
+bool CWallet::CheckBalanceLedger() const
+{
+    LOCK2(cs_main, cs_wallet);
+    UpdateBalanceLedger();
+    CWalletBalances balances = ComputeBalances();
+    if (balances != balancesTotal) {
+        LogPrintf("CWallet::%s -- balance ledger mismatch, ledger: %s, computed: %s\n", __func__, balancesTotal.ToString(), balances.ToString());
+        return false;
+    }
+    return true;
+}
+
+CAmount CWallet::GetBalance() const
+{
+    return GetBalances().nTrusted;
+}
+
+// ppcoin: total coins staked (non-spendable until maturity)
+CAmount CWallet::GetStake() const
+{
+    return GetBalances().nStake;
 }
 
 int CWallet::GetStakeInputs() const
@@ -2432,22 +3171,7 @@ CAmount CWallet::GetAnonymizedBalance() const
 {
     if(fLiteMode) return 0;
 
-    CAmount nTotal = 0;
-
-    LOCK2(cs_main, cs_wallet);
-
-    std::set<uint256> setWalletTxesCounted;
-    for (const auto& outpoint : setWalletUTXO) {
-
-        if (!setWalletTxesCounted.emplace(outpoint.hash).second) continue;
-
-        const auto it = mapWallet.find(outpoint.hash);
-        if (it == mapWallet.end() || !it->second.IsTrusted()) continue;
-
-        nTotal += it->second.GetAnonymizedCredit();
-    }
-
-    return nTotal;
+    return GetBalances().nAnonymized;
 }
 
 // Note: calculated including unconfirmed,
@@ -2460,7 +3184,7 @@ float CWallet::GetAverageAnonymizedRounds() const
     int nCount = 0;
 
     LOCK2(cs_main, cs_wallet);
-    for (const auto& outpoint : setWalletUTXO) {
+    for (const auto& outpoint : setWalletUTXODenominated) {
         if(!IsDenominated(outpoint)) continue;
 
         nTotal += GetCappedOutpointPrivateSendRounds(outpoint);
@@ -2481,7 +3205,7 @@ CAmount CWallet::GetNormalizedAnonymizedBalance() const
     CAmount nTotal = 0;
 
     LOCK2(cs_main, cs_wallet);
-    for (const auto& outpoint : setWalletUTXO) {
+    for (const auto& outpoint : setWalletUTXODenominated) {
         const auto it = mapWallet.find(outpoint.hash);
         if (it == mapWallet.end()) continue;
 
@@ -2500,95 +3224,33 @@ CAmount CWallet::GetDenominatedBalance(bool unconfirmed) const
 {
     if(fLiteMode) return 0;
 
-    CAmount nTotal = 0;
-
-    LOCK2(cs_main, cs_wallet);
-
-    std::set<uint256> setWalletTxesCounted;
-    for (const auto& outpoint : setWalletUTXO) {
-        if (!setWalletTxesCounted.emplace(outpoint.hash).second) continue;
-
-        const auto it = mapWallet.find(outpoint.hash);
-        if (it == mapWallet.end()) continue;
-
-        nTotal += it->second.GetDenominatedCredit(unconfirmed);
-    }
-
-    return nTotal;
+    CWalletBalances balances = GetBalances();
+    return unconfirmed ? balances.nDenominatedUnconfirmed : balances.nDenominatedConfirmed;
 }
 
 CAmount CWallet::GetUnconfirmedBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && !pcoin->IsLockedByInstantSend() && pcoin->InMempool())
-                nTotal += pcoin->GetAvailableCredit();
-        }
-    }
-    return nTotal;
+    return GetBalances().nUnconfirmed;
 }
 
 CAmount CWallet::GetImmatureBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureCredit();
-        }
-    }
-    return nTotal;
+    return GetBalances().nImmature;
 }
 
 CAmount CWallet::GetWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
-    }
-
-    return nTotal;
+    return GetBalances().nWatchOnlyTrusted;
 }
 
 CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && !pcoin->IsLockedByInstantSend() && pcoin->InMempool())
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
-    }
-    return nTotal;
+    return GetBalances().nWatchOnlyUnconfirmed;
 }
 
 CAmount CWallet::GetImmatureWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureWatchOnlyCredit();
-        }
-    }
-    return nTotal;
+    return GetBalances().nWatchOnlyImmature;
 }
 
 void CWallet::AvailableCoins(std::vector<COutput>& vCoins, bool fOnlySafe, const CCoinControl *coinControl, bool fIncludeZeroValue, AvailableCoinsType nCoinType, bool fUseInstantSend) const
@@ -2599,9 +3261,20 @@ void CWallet::AvailableCoins(std::vector<COutput>& vCoins, bool fOnlySafe, const
         LOCK2(cs_main, cs_wallet);
         int nInstantSendConfirmationsRequired = Params().GetConsensus().nInstantSendConfirmationsRequired;
 
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        // Only look at our unspent outputs of the requested type instead of the whole history. The view is ordered
+        // by outpoint, so all outputs of a tx are next to each other and the per tx checks are done once.
+        const std::set<COutPoint>& setCoins = GetWalletUTXOView(nCoinType);
+        for (auto itCoin = setCoins.begin(); itCoin != setCoins.end(); )
         {
-            const uint256& wtxid = it->first;
+            const uint256 wtxid = itCoin->hash;
+            auto itTxBegin = itCoin;
+            while (itCoin != setCoins.end() && itCoin->hash == wtxid)
+                ++itCoin;
+            auto itTxEnd = itCoin;
+
+            std::map<uint256, CWalletTx>::const_iterator it = mapWallet.find(wtxid);
+            if (it == mapWallet.end())
+                continue;
             const CWalletTx* pcoin = &(*it).second;
 
             if (!CheckFinalTx(*pcoin))
@@ -2631,7 +3304,10 @@ void CWallet::AvailableCoins(std::vector<COutput>& vCoins, bool fOnlySafe, const
                 continue;
             }
 
-            for (unsigned int i = 0; i < pcoin->tx->vout.size(); i++) {
+            for (auto itOut = itTxBegin; itOut != itTxEnd; ++itOut) {
+                unsigned int i = itOut->n;
+                if (i >= pcoin->tx->vout.size())
+                    continue;
                 bool found = false;
                 if(nCoinType == ONLY_DENOMINATED) {
                     found = CPrivateSend::IsDenominatedAmount(pcoin->tx->vout[i].nValue);
@@ -4013,37 +4689,64 @@ bool CWallet::CreateCoinStake(unsigned int nBits,
     if (GetAdjustedTime() <= chainActive.Tip()->nTime)
         return false;
     bool fKernelFound = false;
-    CAmount nCredit = 0;
 
+    std::vector<std::pair<COutPoint, const CStakeCandidate*> > vCandidates;
+    vCandidates.reserve(setStakeCoins.size());
     for(const std::pair<const CWalletTx*, unsigned int> &pcoin : setStakeCoins)
     {
-        //make sure that enough time has elapsed between
-        CBlockIndex* pindex = NULL;
-        BlockMap::iterator it = mapBlockIndex.find(pcoin.first->hashBlock);
-        if (it != mapBlockIndex.end())
-            pindex = it->second;
-        else {
-            LogPrintf("failed to find block index ");
-            continue;
+        const CStakeCandidate* pcandidate = GetStakeCandidate(*pcoin.first, pcoin.second);
+        if (pcandidate)
+            vCandidates.emplace_back(COutPoint(pcoin.first->GetHash(), pcoin.second), pcandidate);
+    }
+
+    // Hashing doesn't touch any shared state, so the candidates are split into contiguous ranges
+    // and searched in parallel. The lowest matching index wins, same as a sequential search would.
+    const unsigned int nSearchTime = GetAdjustedTime();
+    const int64_t nMedianTimePast = chainActive.Tip()->GetMedianTimePast();
+    std::vector<unsigned int> vKernelTime(vCandidates.size(), nSearchTime);
+    std::atomic<size_t> nFound{vCandidates.size()};
+
+    auto searchRange = [&](size_t nBegin, size_t nEnd) {
+        for (size_t i = nBegin; i < nEnd && i < nFound; i++) {
+            CScript kernelScript;
+            if (CreateCoinStakeKernel(kernelScript, CScript(), nBits, *vCandidates[i].second,
+                                      vCandidates[i].first, vKernelTime[i], nMedianTimePast, false)) {
+                size_t nPrev = nFound;
+                while (i < nPrev && !nFound.compare_exchange_weak(nPrev, i)) {}
+                return;
+            }
         }
-        // Read block header
-        CBlockHeader block = pindex->GetBlockHeader();
-        COutPoint prevoutStake = COutPoint(pcoin.first->GetHash(), pcoin.second);
-        nTxNewTime = GetAdjustedTime();
-        CDiskTxPos postx;
-        if (!pblocktree->ReadTxIndex(prevoutStake.hash, postx))
-            continue;
-        //iterates each utxo inside of CheckStakeKernelHash()
-        CScript kernelScript;
-        auto stakeScript = pcoin.first->tx->vout[pcoin.second].scriptPubKey;
-        fKernelFound = CreateCoinStakeKernel(kernelScript, stakeScript, nBits,
-                                             block, postx.nTxOffset + CBlockHeader::NORMAL_SERIALIZE_SIZE, pcoin.first->tx,
-                                             prevoutStake, nTxNewTime, false);
-        if(fKernelFound)
-        {
-            FillCoinStakePayments(txNew, kernelScript, prevoutStake, blockReward);
-            break;
+    };
+
+    size_t nChunks = std::min<size_t>(GetStakeSearchThreads(), vCandidates.size() / STAKE_SEARCH_MIN_COINS_PER_THREAD);
+    if (nChunks <= 1) {
+        searchRange(0, vCandidates.size());
+    } else {
+        if (!stakeSearchPool) {
+            stakeSearchPool = std::make_shared<ctpl::thread_pool>(GetStakeSearchThreads());
+            RenameThreadPool(*stakeSearchPool, "sierra-stake");
+        }
+        size_t nChunkSize = (vCandidates.size() + nChunks - 1) / nChunks;
+        std::vector<std::future<void> > futures;
+        futures.reserve(nChunks);
+        for (size_t nBegin = 0; nBegin < vCandidates.size(); nBegin += nChunkSize) {
+            size_t nEnd = std::min(nBegin + nChunkSize, vCandidates.size());
+            futures.emplace_back(stakeSearchPool->push([&searchRange, nBegin, nEnd](int) {
+                searchRange(nBegin, nEnd);
+            }));
         }
+        for (auto& f : futures) {
+            f.get();
+        }
+    }
+
+    if (nFound < vCandidates.size())
+    {
+        const COutPoint& prevoutStake = vCandidates[nFound].first;
+        const CScript& kernelScript = mapWallet.at(prevoutStake.hash).tx->vout[prevoutStake.n].scriptPubKey;
+        nTxNewTime = vKernelTime[nFound];
+        FillCoinStakePayments(txNew, kernelScript, prevoutStake, blockReward);
+        fKernelFound = true;
     }
     if(!fKernelFound)
     {
@@ -4055,6 +4758,76 @@ bool CWallet::CreateCoinStake(unsigned int nBits,
     return true;
 }
 
+unsigned int CWallet::GetStakeSearchThreads()
+{
+    int nThreads = GetArg("-stakethreads", DEFAULT_STAKE_THREADS);
+    if (nThreads <= 0)
+        nThreads += GetNumCores();
+    return std::max(1, std::min(nThreads, MAX_STAKE_THREADS));
+}
+
+const CStakeCandidate* CWallet::GetStakeCandidate(const CWalletTx& wtx, unsigned int nOut)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    // Block positions and modifiers resolved on a chain we reorged away from are worthless
+    if (pindexStakeCandidates != chainActive.Tip()) {
+        if (pindexStakeCandidates && !chainActive.Contains(pindexStakeCandidates)) {
+            LogPrint("staking", "%s -- chain reorganized, flushing %d stake candidates\n", __func__, mapStakeCandidates.size());
+            mapStakeCandidates.clear();
+        }
+        pindexStakeCandidates = chainActive.Tip();
+    }
+
+    COutPoint outpoint(wtx.GetHash(), nOut);
+    auto it = mapStakeCandidates.find(outpoint);
+    if (it == mapStakeCandidates.end()) {
+        BlockMap::iterator mi = mapBlockIndex.find(wtx.hashBlock);
+        if (mi == mapBlockIndex.end()) {
+            LogPrintf("failed to find block index ");
+            return nullptr;
+        }
+        CDiskTxPos postx;
+        if (!pblocktree->ReadTxIndex(outpoint.hash, postx))
+            return nullptr;
+
+        CStakeCandidate candidate;
+        candidate.pindexFrom = mi->second;
+        candidate.nBlockTime = mi->second->GetBlockTime();
+        candidate.nTxPrevOffset = postx.nTxOffset + CBlockHeader::NORMAL_SERIALIZE_SIZE;
+        candidate.nValue = wtx.tx->vout[nOut].nValue;
+        it = mapStakeCandidates.emplace(outpoint, candidate).first;
+    }
+
+    CStakeCandidate& candidate = it->second;
+    if (!candidate.fModifierResolved) {
+        // an incomplete modifier is still usable for this round, but must be resolved again on the next one
+        bool fComplete = false;
+        if (!GetKernelStakeModifier(candidate.pindexFrom, candidate.nStakeModifier, fComplete))
+            return nullptr;
+        candidate.fModifierResolved = fComplete;
+    }
+
+    return &candidate;
+}
+
+void CWallet::InvalidateStakeCandidates(const CTransaction& tx)
+{
+    AssertLockHeld(cs_wallet);
+
+    if (mapStakeCandidates.empty())
+        return;
+
+    const uint256& hash = tx.GetHash();
+    for (unsigned int i = 0; i < tx.vout.size(); i++) {
+        mapStakeCandidates.erase(COutPoint(hash, i));
+    }
+    for (const CTxIn& txin : tx.vin) {
+        mapStakeCandidates.erase(txin.prevout);
+    }
+}
+
 bool CWallet::AddAccountingEntry(const CAccountingEntry& acentry)
 {
     CWalletDB walletdb(strWalletFile);
@@ -4126,17 +4899,13 @@ DBErrors CWallet::LoadWallet(bool& fFirstRunRet)
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (auto& pair : mapWallet) {
-            for(unsigned int i = 0; i < pair.second.tx->vout.size(); ++i) {
-                if (IsMine(pair.second.tx->vout[i]) && !IsSpent(pair.first, i)) {
-                    setWalletUTXO.insert(COutPoint(pair.first, i));
-                }
-            }
-        }
+        RebuildWalletUTXO();
     }
 
     if (nLoadWalletRet != DB_LOAD_OK)
         return nLoadWalletRet;
+
+    UpdateAllPrivateSendRounds();
     fFirstRunRet = !vchDefaultKey.IsValid();
 
     uiInterface.LoadWallet(this);
@@ -4168,9 +4937,32 @@ DBErrors CWallet::ZapSelectTx(std::vector<uint256>& vHashIn, std::vector<uint256
         return DB_LOAD_OK;
     AssertLockHeld(cs_wallet); // mapWallet
     vchDefaultKey = CPubKey();
-    DBErrors nZapSelectTxRet = CWalletDB(strWalletFile,"cr+").ZapSelectTx(vHashIn, vHashOut);
-    for (uint256 hash : vHashOut)
-        mapWallet.erase(hash);
+    DBErrors nZapSelectTxRet;
+    {
+        // closed before a rewrite, which waits until the file isn't used anymore
+        CWalletDB walletdb(strWalletFile, "cr+");
+        nZapSelectTxRet = walletdb.ZapSelectTx(vHashIn, vHashOut);
+        for (uint256 hash : vHashOut) {
+            auto it = mapWallet.find(hash);
+            if (it != mapWallet.end()) {
+                CTransactionRef tx = it->second.tx;
+                InvalidateStakeCandidates(*tx);
+                // the inputs of its descendants aren't ours anymore
+                if (!fLiteMode)
+                    InvalidatePrivateSendRounds(hash, &walletdb);
+                mapWallet.erase(it);
+                for (unsigned int i = 0; i < tx->vout.size(); i++) {
+                    EraseWalletUTXO(COutPoint(hash, i));
+                }
+                // the outputs spent by the zapped tx might be spendable again
+                if (!tx->IsCoinBase()) {
+                    for (const auto& txin : tx->vin) {
+                        UpdateWalletUTXO(txin.prevout);
+                    }
+                }
+            }
+        }
+    }
 
     if (nZapSelectTxRet == DB_NEED_REWRITE)
     {
@@ -4316,68 +5108,299 @@ size_t CWallet::KeypoolCountInternalKeys()
     return setInternalKeyPool.size();
 }
 
+namespace {
+
+/** Number of keys added to the keypool at once, cs_wallet is held while one batch is stored */
+const int64_t KEYPOOL_BATCH_SIZE = 1000;
+const int MAX_KEYPOOL_THREADS = 8;
+/** Smallest number of keys worth an extra derivation thread */
+const size_t MIN_KEYPOOL_KEYS_PER_THREAD = 64;
+
+unsigned int GetKeyPoolTargetSize(unsigned int kpSize)
+{
+    if (kpSize > 0)
+        return kpSize;
+    return std::max(GetArg("-keypool", DEFAULT_KEYPOOL_SIZE), (int64_t) 0);
+}
+
+/** Derives the public keys of the children nStart..nStart+nCount-1 of parentKey, spread over several threads */
+void DeriveChildPubKeys(const CExtKey& parentKey, uint32_t nStart, size_t nCount, std::vector<CExtPubKey>& vKeysRet)
+{
+    vKeysRet.resize(nCount);
+    const size_t nThreads = std::max<size_t>(1, std::min<size_t>(std::min(GetNumCores(), MAX_KEYPOOL_THREADS), nCount / MIN_KEYPOOL_KEYS_PER_THREAD));
+    const size_t nPerThread = (nCount + nThreads - 1) / nThreads;
+
+    auto derive = [&](size_t nBegin, size_t nEnd) {
+        CExtKey childKey;
+        for (size_t i = nBegin; i < nEnd; i++) {
+            parentKey.Derive(childKey, nStart + i);
+            vKeysRet[i] = childKey.Neuter();
+        }
+    };
+
+    std::vector<std::thread> vThreads;
+    for (size_t i = 1; i < nThreads; i++) {
+        vThreads.emplace_back(derive, std::min(nCount, i * nPerThread), std::min(nCount, (i + 1) * nPerThread));
+    }
+    derive(0, std::min(nCount, nPerThread));
+    for (std::thread& thread : vThreads) {
+        thread.join();
+    }
+}
+
+} // anonymous namespace
+
 bool CWallet::TopUpKeyPool(unsigned int kpSize)
 {
+    const unsigned int nTargetSize = GetKeyPoolTargetSize(kpSize);
+
+    bool fDone = false;
+    while (!fDone) {
+        if (!TopUpKeyPoolBatch(nTargetSize, fDone))
+            return false;
+
+        LOCK(cs_wallet);
+        double dProgress = 100.f * (setInternalKeyPool.size() + setExternalKeyPool.size()) / ((IsHDEnabled() ? 2 : 1) * nTargetSize + 1);
+        std::string strMsg = strprintf(_("Loading wallet... (%3.2f %%)"), dProgress);
+        uiInterface.InitMessage(strMsg);
+    }
+    return true;
+}
+
+bool CWallet::TopUpKeyPoolBatch(unsigned int nTargetSize, bool& fDoneRet)
+{
+    fDoneRet = false;
+
+    // make sure the keypool of external and internal keys fits the user selected target (-keypool)
+    const int64_t nTarget = std::max((int64_t) nTargetSize, (int64_t) 1);
+
+    CHDChain hdChainTmp;
+    CHDAccount acc;
+    int64_t missingExternal;
+    int64_t missingInternal;
     {
         LOCK(cs_wallet);
 
         if (IsLocked(true))
             return false;
 
-        // Top up key pool
-        unsigned int nTargetSize;
-        if (kpSize > 0)
-            nTargetSize = kpSize;
-        else
-            nTargetSize = std::max(GetArg("-keypool", DEFAULT_KEYPOOL_SIZE), (int64_t) 0);
-
         // count amount of available keys (internal, external)
-        // make sure the keypool of external and internal keys fits the user selected target (-keypool)
-        int64_t amountExternal = setExternalKeyPool.size();
-        int64_t amountInternal = setInternalKeyPool.size();
-        int64_t missingExternal = std::max(std::max((int64_t) nTargetSize, (int64_t) 1) - amountExternal, (int64_t) 0);
-        int64_t missingInternal = std::max(std::max((int64_t) nTargetSize, (int64_t) 1) - amountInternal, (int64_t) 0);
+        missingExternal = std::max(nTarget - (int64_t) setExternalKeyPool.size(), (int64_t) 0);
+        missingInternal = std::max(nTarget - (int64_t) setInternalKeyPool.size(), (int64_t) 0);
 
-        if (!IsHDEnabled())
-        {
-            // don't create extra internal keys
-            missingInternal = 0;
-        } else {
-            nTargetSize *= 2;
-        }
-        bool fInternal = false;
-        CWalletDB walletdb(strWalletFile);
-        for (int64_t i = missingInternal + missingExternal; i--;)
-        {
-            int64_t nEnd = 1;
-            if (i < missingInternal) {
-                fInternal = true;
-            }
+        if (!IsHDEnabled()) {
+            // don't create extra internal keys, keys are random so there is nothing to derive ahead
+            CWalletDB walletdb(strWalletFile);
+            int64_t nEnd = setExternalKeyPool.empty() ? 1 : *(--setExternalKeyPool.end()) + 1;
             if (!setInternalKeyPool.empty()) {
-                nEnd = *(--setInternalKeyPool.end()) + 1;
+                nEnd = std::max(nEnd, *(--setInternalKeyPool.end()) + 1);
             }
-            if (!setExternalKeyPool.empty()) {
-                nEnd = std::max(nEnd, *(--setExternalKeyPool.end()) + 1);
+            for (int64_t i = std::min(missingExternal, KEYPOOL_BATCH_SIZE); i--; nEnd++) {
+                if (!walletdb.WritePool(nEnd, CKeyPool(GenerateNewKey(0, false), false)))
+                    throw std::runtime_error(std::string(__func__) + ": writing generated key failed");
+                setExternalKeyPool.insert(nEnd);
+                LogPrintf("keypool added key %d, size=%u, internal=%d\n", nEnd, setInternalKeyPool.size() + setExternalKeyPool.size(), false);
             }
-            // TODO: implement keypools for all accounts?
-            if (!walletdb.WritePool(nEnd, CKeyPool(GenerateNewKey(0, fInternal), fInternal)))
-                throw std::runtime_error(std::string(__func__) + ": writing generated key failed");
+            fDoneRet = missingExternal <= KEYPOOL_BATCH_SIZE;
+            return true;
+        }
 
-            if (fInternal) {
-                setInternalKeyPool.insert(nEnd);
-            } else {
-                setExternalKeyPool.insert(nEnd);
+        if (missingExternal == 0 && missingInternal == 0) {
+            fDoneRet = true;
+            return true;
+        }
+
+        if (!GetHDChain(hdChainTmp))
+            throw std::runtime_error(std::string(__func__) + ": GetHDChain failed");
+        if (!DecryptHDChain(hdChainTmp))
+            throw std::runtime_error(std::string(__func__) + ": DecryptHDChainSeed failed");
+        // make sure seed matches this chain
+        if (hdChainTmp.GetID() != hdChainTmp.GetSeedHash())
+            throw std::runtime_error(std::string(__func__) + ": Wrong HD chain!");
+        // TODO: implement keypools for all accounts?
+        if (!hdChainTmp.GetAccount(0, acc))
+            throw std::runtime_error(std::string(__func__) + ": Wrong HD account!");
+    }
+
+    // Derive the batch without holding cs_wallet. The hardened part of the keypath is derived once per
+    // chain, the children are derived from their parent in parallel.
+    const int64_t nExternal = std::min(missingExternal, KEYPOOL_BATCH_SIZE);
+    const int64_t nInternal = std::min(missingInternal, KEYPOOL_BATCH_SIZE - nExternal);
+    std::vector<CExtPubKey> vExternalKeys;
+    std::vector<CExtPubKey> vInternalKeys;
+    CExtKey parentKey;
+    if (nExternal > 0) {
+        hdChainTmp.DeriveChangeExtKey(0, false, parentKey);
+        DeriveChildPubKeys(parentKey, acc.nExternalChainCounter, nExternal, vExternalKeys);
+    }
+    if (nInternal > 0) {
+        hdChainTmp.DeriveChangeExtKey(0, true, parentKey);
+        DeriveChildPubKeys(parentKey, acc.nInternalChainCounter, nInternal, vInternalKeys);
+    }
+
+    LOCK(cs_wallet);
+
+    if (IsLocked(true))
+        return false;
+
+    // the batch is only usable if nobody derived keys in the meantime, otherwise the caller tries again
+    CHDChain hdChainCurrent;
+    CHDAccount accCurrent;
+    if (!GetHDChain(hdChainCurrent) || hdChainCurrent.GetID() != hdChainTmp.GetID() || !hdChainCurrent.GetAccount(0, accCurrent) ||
+        accCurrent.nExternalChainCounter != acc.nExternalChainCounter || accCurrent.nInternalChainCounter != acc.nInternalChainCounter) {
+        return true;
+    }
+
+    int64_t nEnd = 1;
+    if (!setInternalKeyPool.empty()) {
+        nEnd = *(--setInternalKeyPool.end()) + 1;
+    }
+    if (!setExternalKeyPool.empty()) {
+        nEnd = std::max(nEnd, *(--setExternalKeyPool.end()) + 1);
+    }
+
+    // skip keys already known to the wallet, the chain counters move past them
+    std::vector<std::pair<int64_t, CHDPubKey> > vNewKeys;
+    auto addKeys = [&](const std::vector<CExtPubKey>& vKeys, bool fInternal, int64_t nMissing, uint32_t& nChildIndex) {
+        for (const CExtPubKey& extPubKey : vKeys) {
+            if (nMissing == 0)
+                break;
+            nChildIndex++;
+            if (HaveKey(extPubKey.pubkey.GetID()))
+                continue;
+            CHDPubKey hdPubKey;
+            hdPubKey.extPubKey = extPubKey;
+            hdPubKey.hdchainID = hdChainCurrent.GetID();
+            hdPubKey.nChangeIndex = fInternal ? 1 : 0;
+            vNewKeys.emplace_back(nEnd++, hdPubKey);
+            nMissing--;
+        }
+    };
+    addKeys(vExternalKeys, false, std::max(nTarget - (int64_t) setExternalKeyPool.size(), (int64_t) 0), accCurrent.nExternalChainCounter);
+    addKeys(vInternalKeys, true, std::max(nTarget - (int64_t) setInternalKeyPool.size(), (int64_t) 0), accCurrent.nInternalChainCounter);
+
+    if (!hdChainCurrent.SetAccount(0, accCurrent))
+        throw std::runtime_error(std::string(__func__) + ": SetAccount failed");
+
+    // store the whole batch and the new chain counters in one transaction
+    const int64_t nCreationTime = GetTime();
+    if (fFileBacked) {
+        CWalletDB walletdb(strWalletFile);
+        if (!walletdb.TxnBegin())
+            throw std::runtime_error(std::string(__func__) + ": TxnBegin failed");
+        for (const auto& newKey : vNewKeys) {
+            const CHDPubKey& hdPubKey = newKey.second;
+            if (!walletdb.WriteHDPubKey(hdPubKey, CKeyMetadata(nCreationTime)) ||
+                !walletdb.WritePool(newKey.first, CKeyPool(hdPubKey.extPubKey.pubkey, hdPubKey.nChangeIndex == 1))) {
+                walletdb.TxnAbort();
+                throw std::runtime_error(std::string(__func__) + ": writing generated key failed");
             }
-            LogPrintf("keypool added key %d, size=%u, internal=%d\n", nEnd, setInternalKeyPool.size() + setExternalKeyPool.size(), fInternal);
+        }
+        if (!(IsCrypted() ? walletdb.WriteCryptedHDChain(hdChainCurrent) : walletdb.WriteHDChain(hdChainCurrent))) {
+            walletdb.TxnAbort();
+            throw std::runtime_error(std::string(__func__) + ": writing HD chain failed");
+        }
+        if (!walletdb.TxnCommit())
+            throw std::runtime_error(std::string(__func__) + ": TxnCommit failed");
+    }
 
-            double dProgress = 100.f * nEnd / (nTargetSize + 1);
-            std::string strMsg = strprintf(_("Loading wallet... (%3.2f %%)"), dProgress);
-            uiInterface.InitMessage(strMsg);
+    if (IsCrypted() ? !SetCryptedHDChain(hdChainCurrent, true) : !SetHDChain(hdChainCurrent, true))
+        throw std::runtime_error(std::string(__func__) + ": updating HD chain failed");
+
+    for (const auto& newKey : vNewKeys) {
+        const CHDPubKey& hdPubKey = newKey.second;
+        const CPubKey& pubkey = hdPubKey.extPubKey.pubkey;
+        mapKeyMetadata[pubkey.GetID()] = CKeyMetadata(nCreationTime);
+        mapHdPubKeys[pubkey.GetID()] = hdPubKey;
+        if (hdPubKey.nChangeIndex == 1) {
+            setInternalKeyPool.insert(newKey.first);
+        } else {
+            setExternalKeyPool.insert(newKey.first);
         }
+
+        // check if we need to remove from watch-only
+        CScript script;
+        script = GetScriptForDestination(pubkey.GetID());
+        if (HaveWatchOnly(script))
+            RemoveWatchOnly(script);
+        script = GetScriptForRawPubKey(pubkey);
+        if (HaveWatchOnly(script))
+            RemoveWatchOnly(script);
+    }
+    if (!vNewKeys.empty()) {
+        UpdateTimeFirstKey(nCreationTime);
+        LogPrintf("keypool added %u keys, size=%u, internal=%u\n", vNewKeys.size(), setInternalKeyPool.size() + setExternalKeyPool.size(), setInternalKeyPool.size());
     }
+
+    fDoneRet = (int64_t) setExternalKeyPool.size() >= nTarget && (int64_t) setInternalKeyPool.size() >= nTarget;
     return true;
 }
 
+void CWallet::ThreadKeyPoolFiller()
+{
+    RenameThread("sierra-keypool");
+
+    std::unique_lock<std::mutex> lock(cs_keypoolfiller);
+    while (true) {
+        cvKeyPoolFiller.wait(lock, [this] { return fKeyPoolFillerWake || fStopKeyPoolFiller; });
+        if (fStopKeyPoolFiller)
+            break;
+        fKeyPoolFillerWake = false;
+        lock.unlock();
+
+        try {
+            const unsigned int nTargetSize = GetKeyPoolTargetSize(0);
+            bool fDone = false;
+            while (!fDone && !fStopKeyPoolFiller) {
+                if (!TopUpKeyPoolBatch(nTargetSize, fDone))
+                    break;
+            }
+        } catch (...) {
+            PrintExceptionContinue(std::current_exception(), "ThreadKeyPoolFiller()");
+        }
+
+        lock.lock();
+    }
+}
+
+void CWallet::StartKeyPoolFiller()
+{
+    if (fKeyPoolFillerRunning)
+        return;
+
+    fStopKeyPoolFiller = false;
+    keyPoolFillerThread = std::thread(&CWallet::ThreadKeyPoolFiller, this);
+    fKeyPoolFillerRunning = true;
+}
+
+void CWallet::StopKeyPoolFiller()
+{
+    if (!fKeyPoolFillerRunning)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(cs_keypoolfiller);
+        fStopKeyPoolFiller = true;
+    }
+    cvKeyPoolFiller.notify_one();
+    keyPoolFillerThread.join();
+    fKeyPoolFillerRunning = false;
+}
+
+void CWallet::RequestKeyPoolTopUp()
+{
+    if (!fKeyPoolFillerRunning) {
+        TopUpKeyPool();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(cs_keypoolfiller);
+        fKeyPoolFillerWake = true;
+    }
+    cvKeyPoolFiller.notify_one();
+}
+
 void CWallet::ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool, bool fInternal)
 {
     nIndex = -1;
@@ -4385,12 +5408,16 @@ void CWallet::ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool, bool fIn
     {
         LOCK(cs_wallet);
 
-        if (!IsLocked(true))
-            TopUpKeyPool();
-
         fInternal = fInternal && IsHDEnabled();
         std::set<int64_t>& setKeyPool = fInternal ? setInternalKeyPool : setExternalKeyPool;
 
+        if (!IsLocked(true)) {
+            // only wait for new keys if there are none left, the keypool filler tops up the rest
+            if (fKeyPoolFillerRunning && setKeyPool.empty())
+                TopUpKeyPool(1);
+            RequestKeyPoolTopUp();
+        }
+
         // Get the oldest key
         if(setKeyPool.empty())
             return;
@@ -5032,6 +6059,8 @@ std::string CWallet::GetWalletHelpString(bool showDebug)
                                                             CURRENCY_UNIT, FormatMoney(payTxFee.GetFeePerK())));
     strUsage += HelpMessageOpt("-rescan", _("Rescan the block chain for missing wallet transactions on startup"));
     strUsage += HelpMessageOpt("-salvagewallet", _("Attempt to recover private keys from a corrupt wallet on startup"));
+    strUsage += HelpMessageOpt("-stakethreads=<n>", strprintf(_("Set the number of proof-of-stake kernel search threads (up to %u, 0 = one per core, <0 = leave that many cores free, default: %d)"),
+        MAX_STAKE_THREADS, DEFAULT_STAKE_THREADS));
     strUsage += HelpMessageOpt("-spendzeroconfchange", strprintf(_("Spend unconfirmed change when sending transactions (default: %u)"), DEFAULT_SPEND_ZEROCONF_CHANGE));
     strUsage += HelpMessageOpt("-txconfirmtarget=<n>", strprintf(_("If paytxfee is not set, include enough fee so transactions begin confirmation on average within n blocks (default: %u)"), DEFAULT_TX_CONFIRM_TARGET));
     strUsage += HelpMessageOpt("-usehd", _("Use hierarchical deterministic key generation (HD) after BIP39/BIP44. Only has effect during wallet creation/first start") + " " + strprintf(_("(default: %u)"), DEFAULT_USE_HD_WALLET));
@@ -5056,6 +6085,7 @@ std::string CWallet::GetWalletHelpString(bool showDebug)
     {
         strUsage += HelpMessageGroup(_("Wallet debugging/testing options:"));
 
+        strUsage += HelpMessageOpt("-checkbalanceledger", strprintf("Check the balance ledger against the wallet transactions on every balance query (default: %u)", DEFAULT_CHECK_BALANCE_LEDGER));
         strUsage += HelpMessageOpt("-dblogsize=<n>", strprintf("Flush wallet database activity from memory to disk log every <n> megabytes (default: %u)", DEFAULT_WALLET_DBLOGSIZE));
         strUsage += HelpMessageOpt("-flushwallet", strprintf("Run a thread to flush wallet periodically (default: %u)", DEFAULT_FLUSHWALLET));
         strUsage += HelpMessageOpt("-privdb", strprintf("Sets the DB_PRIVATE flag in the wallet db environment (default: %u)", DEFAULT_WALLET_PRIVDB));
@@ -5303,6 +6333,10 @@ void CWallet::postInitProcess(CScheduler& scheduler)
     // Do this here as mempool requires genesis block to be loaded
     ReacceptWalletTransactions();
 
+    // Top up the keypool in the background from now on
+    StartKeyPoolFiller();
+    RequestKeyPoolTopUp();
+
     // Run a thread to flush wallet periodically
     if (!CWallet::fFlushScheduled.exchange(true)) {
         scheduler.scheduleEvery(MaybeCompactWalletDB, 500);
@@ -5389,6 +6423,7 @@ bool CWallet::ParameterInteraction()
     }
     nTxConfirmTarget = GetArg("-txconfirmtarget", DEFAULT_TX_CONFIRM_TARGET);
     bSpendZeroConfChange = GetBoolArg("-spendzeroconfchange", DEFAULT_SPEND_ZEROCONF_CHANGE);
+    fCheckBalanceLedger = GetBoolArg("-checkbalanceledger", DEFAULT_CHECK_BALANCE_LEDGER);
 
     if (IsArgSet("-walletbackupsdir")) {
         if (!boost::filesystem::is_directory(GetArg("-walletbackupsdir", ""))) {
@@ -5590,6 +6625,9 @@ bool AutoBackupWallet(CWallet* wallet, const std::string& strWalletFile_, std::s
 
 void CWallet::NotifyTransactionLock(const CTransaction &tx)
 {
+    // trust in unconfirmed txs depends on IS locks
+    nBalanceLockEvents++;
+
     LOCK(cs_wallet);
     // Only notify UI if this transaction is in this wallet
     std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(tx.GetHash());
@@ -5600,6 +6638,7 @@ void CWallet::NotifyTransactionLock(const CTransaction &tx)
 
 void CWallet::NotifyChainLock(const CBlockIndex* pindexChainLock)
 {
+    nBalanceLockEvents++;
     NotifyChainLockReceived(pindexChainLock->nHeight);
 }
 
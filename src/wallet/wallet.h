@@ -23,12 +23,16 @@
 
 #include <algorithm>
 #include <atomic>
+#include <condition_variable>
 #include <deque>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <stdexcept>
 #include <stdint.h>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -43,6 +47,7 @@ extern CFeeRate payTxFee;
 extern unsigned int nTxConfirmTarget;
 extern bool bSpendZeroConfChange;
 extern bool bBIP69Enabled;
+extern bool fCheckBalanceLedger;
 
 static const unsigned int DEFAULT_KEYPOOL_SIZE = 1000;
 //! -paytxfee default
@@ -65,8 +70,15 @@ static const bool DEFAULT_WALLET_REJECT_LONG_CHAINS = false;
 static const unsigned int DEFAULT_TX_CONFIRM_TARGET = 6;
 static const bool DEFAULT_WALLETBROADCAST = true;
 static const bool DEFAULT_DISABLE_WALLET = false;
+//! -checkbalanceledger default
+static const bool DEFAULT_CHECK_BALANCE_LEDGER = false;
 //! Minimum amount required as valid stake input
 const CAmount nMinimumStakeValue = 100 * COIN;
+//! -stakethreads default, 0 = one thread per core
+static const int DEFAULT_STAKE_THREADS = 0;
+static const int MAX_STAKE_THREADS = 16;
+//! Stake coin sets smaller than this per thread are searched on the minter thread itself
+static const size_t STAKE_SEARCH_MIN_COINS_PER_THREAD = 64;
 
 extern const char * DEFAULT_WALLET_DAT;
 
@@ -117,6 +129,20 @@ struct CompactTallyItem
     }
 };
 
+/**
+ * Stake kernel inputs of a wallet output. Everything except the stake modifier
+ * stays valid for as long as the containing block is part of the active chain.
+ */
+struct CStakeCandidate
+{
+    const CBlockIndex* pindexFrom{nullptr};
+    unsigned int nBlockTime{0};
+    unsigned int nTxPrevOffset{0};
+    CAmount nValue{0};
+    uint64_t nStakeModifier{0};
+    bool fModifierResolved{false};
+};
+
 /** A key pool entry */
 class CKeyPool
 {
@@ -462,22 +488,8 @@ public:
         mapValue.erase("timesmart");
     }
 
-    //! make sure balances are recalculated
-    void MarkDirty()
-    {
-        fCreditCached = false;
-        fAvailableCreditCached = false;
-        fImmatureCreditCached = false;
-        fAnonymizedCreditCached = false;
-        fDenomUnconfCreditCached = false;
-        fDenomConfCreditCached = false;
-        fWatchDebitCached = false;
-        fWatchCreditCached = false;
-        fAvailableWatchCreditCached = false;
-        fImmatureWatchCreditCached = false;
-        fDebitCached = false;
-        fChangeCached = false;
-    }
+    //! make sure balances are recalculated, including the wallet's balance ledger entry
+    void MarkDirty();
 
     void BindWallet(CWallet *pwalletIn)
     {
@@ -669,6 +681,64 @@ private:
 };
 
 
+class CWalletScanFilter;
+
+/** Balances of the wallet by category */
+struct CWalletBalances
+{
+    CAmount nTrusted{0};
+    CAmount nUnconfirmed{0};
+    CAmount nImmature{0};
+    CAmount nWatchOnlyTrusted{0};
+    CAmount nWatchOnlyUnconfirmed{0};
+    CAmount nWatchOnlyImmature{0};
+    CAmount nAnonymized{0};
+    CAmount nDenominatedConfirmed{0};
+    CAmount nDenominatedUnconfirmed{0};
+    CAmount nStake{0};
+
+    CWalletBalances& operator+=(const CWalletBalances& b);
+    CWalletBalances& operator-=(const CWalletBalances& b);
+    bool operator==(const CWalletBalances& b) const;
+    bool operator!=(const CWalletBalances& b) const { return !(*this == b); }
+    std::string ToString() const;
+};
+
+/** Wallet state reported by getwalletinfo, see CWallet::GetStateSnapshot */
+struct CWalletStateSnapshot
+{
+    int nWalletVersion{0};
+    CWalletBalances balances;
+    size_t nTxCount{0};
+    int64_t nKeyPoolOldestTime{0};
+    size_t nKeyPoolExternal{0};
+    size_t nKeyPoolInternal{0};
+    int64_t nKeysLeftSinceAutoBackup{0};
+    bool fCrypted{false};
+    int64_t nRelockTime{0};
+    bool fHDEnabled{false};
+    CHDChain hdChain;
+};
+
+/** Progress of the running or last finished ScanForWalletTransactions */
+struct CWalletScanProgress
+{
+    bool fScanning{false};
+    int nStartHeight{0};
+    int nHeight{0};
+    int nTipHeight{0};
+    int nBlocksScanned{0};
+    int64_t nStartTimeMillis{0};
+    int64_t nDurationMillis{0};
+    //! Wallet state as of the start of the scan, reported while the scan holds cs_wallet
+    CWalletStateSnapshot stateAtStart;
+
+    double GetBlocksPerSecond() const
+    {
+        return nDurationMillis > 0 ? nBlocksScanned * 1000.0 / nDurationMillis : 0.0;
+    }
+};
+
 /** 
  * A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
@@ -676,6 +746,8 @@ private:
 class CWallet : public CCryptoKeyStore, public CValidationInterface
 {
 private:
+    friend class CWalletScanFilter;
+
     static std::atomic<bool> fFlushScheduled;
 
     /**
@@ -720,7 +792,48 @@ private:
     void AddToSpends(const COutPoint& outpoint, const uint256& wtxid);
     void AddToSpends(const uint256& wtxid);
 
+    /**
+     * Outputs which are ours and not spent, with views by output type. Kept up to date when txes are added,
+     * spent, conflicted, abandoned or zapped, so that AvailableCoins scales with the number of unspent outputs
+     * instead of the size of the history. Entries can be stale, users still have to do the usual checks.
+     */
     std::set<COutPoint> setWalletUTXO;
+    std::set<COutPoint> setWalletUTXODenominated;
+    std::set<COutPoint> setWalletUTXOCollateral;
+    std::set<COutPoint> setWalletUTXO1000;
+    void AddWalletUTXO(const COutPoint& outpoint, CAmount nValue);
+    void EraseWalletUTXO(const COutPoint& outpoint);
+    /** Re-adds an output which might have become unspent because its spender was conflicted, abandoned or removed */
+    void UpdateWalletUTXO(const COutPoint& outpoint);
+    void RebuildWalletUTXO();
+    const std::set<COutPoint>& GetWalletUTXOView(AvailableCoinsType nCoinType) const;
+
+    /**
+     * PrivateSend rounds of denominated outputs whose rounds depend on their inputs. The rounds of outputs of
+     * txs in a block are also stored in the wallet database so that they survive restarts. They only change
+     * when an ancestor is added to the wallet later or keys are imported. An import bumps the epoch instead
+     * of erasing the stored rounds, records of an older epoch are ignored and rewritten when next saved.
+     */
+    mutable std::map<COutPoint, int> mapOutpointRounds;
+    std::map<COutPoint, uint32_t> mapOutpointRoundsSaved; // epoch each stored record was written in
+    uint32_t nPrivateSendRoundsEpoch;
+    int ComputePrivateSendRounds(const COutPoint& outpoint) const;
+    size_t SavePrivateSendRounds(const CWalletTx& wtx, CWalletDB* pwalletdb);
+    void InvalidatePrivateSendRounds(const uint256& hashTx, CWalletDB* pwalletdb);
+
+    /**
+     * Cache of stake kernel inputs so that the minter doesn't hit the tx index
+     * and walk the chain for every coin on every iteration.
+     * Flushed on reorgs, entries are dropped when the wallet txes change.
+     */
+    std::map<COutPoint, CStakeCandidate> mapStakeCandidates;
+    const CBlockIndex* pindexStakeCandidates;
+    const CStakeCandidate* GetStakeCandidate(const CWalletTx& wtx, unsigned int nOut);
+    void InvalidateStakeCandidates(const CTransaction& tx);
+
+    //! Workers for the kernel search of large stake coin sets, created on first use
+    std::shared_ptr<ctpl::thread_pool> stakeSearchPool;
+    static unsigned int GetStakeSearchThreads();
 
     /* Mark a transaction (and its in-wallet descendants) as conflicting with a particular block. */
     void MarkConflicted(const uint256& hashBlock, const uint256& hashTx);
@@ -730,10 +843,29 @@ private:
     /* HD derive new child key (on internal or external chain) */
     void DeriveNewChildKey(const CKeyMetadata& metadata, CKey& secretRet, uint32_t nAccountIndex, bool fInternal /*= false*/);
 
+    /**
+     * Adds up to one batch of the keys missing in the keypool. HD keys are derived without holding cs_wallet
+     * and written in one database transaction. fDoneRet is set once the keypool has nTargetSize keys.
+     * Returns false if the wallet is locked.
+     */
+    bool TopUpKeyPoolBatch(unsigned int nTargetSize, bool& fDoneRet);
+
+    /**
+     * Thread which tops up the keypool after keys were taken from it, so that callers only have to wait
+     * for new keys when the keypool ran empty.
+     */
+    std::thread keyPoolFillerThread;
+    std::mutex cs_keypoolfiller; // protects fKeyPoolFillerWake and fStopKeyPoolFiller
+    std::condition_variable cvKeyPoolFiller;
+    bool fKeyPoolFillerWake;
+    std::atomic<bool> fStopKeyPoolFiller;
+    std::atomic<bool> fKeyPoolFillerRunning;
+    void ThreadKeyPoolFiller();
+
     bool CreateCoinStakeKernel(CScript &kernelScript, const CScript &stakeScript,
-                               unsigned int nBits, const CBlock& blockFrom,
-                               unsigned int nTxPrevOffset, const CTransactionRef &txPrev,
-                               const COutPoint& prevout, unsigned int &nTimeTx, bool fPrintProofOfStake) const;
+                               unsigned int nBits, const CStakeCandidate& candidate,
+                               const COutPoint& prevout, unsigned int &nTimeTx, int64_t nMedianTimePast,
+                               bool fPrintProofOfStake) const;
     void FillCoinStakePayments(CMutableTransaction &transaction,
                                const CScript &kernelScript,
                                const COutPoint &stakePrevout, CAmount blockReward) const;
@@ -755,6 +887,31 @@ private:
      */
     bool AddWatchOnly(const CScript& dest) override;
 
+    /**
+     * Ledger of the balances by category, made of the contribution of each wallet tx so that balance queries
+     * don't have to walk mapWallet. The contributions of txs marked dirty are recomputed on the next query,
+     * as are those which can still change with the tip, the mempool, IS locks or time: unconfirmed and
+     * immature txs and those not old enough to stake. MarkDirty() on the whole wallet rebuilds it.
+     */
+    mutable CCriticalSection cs_balanceledger; // protects fBalanceLedgerStale and setBalanceDirty
+    mutable bool fBalanceLedgerStale;
+    mutable std::set<uint256> setBalanceDirty;
+    mutable std::map<uint256, CWalletBalances> mapTxBalances;
+    mutable std::set<uint256> setBalanceVolatile;
+    mutable CWalletBalances balancesTotal;
+    mutable const CBlockIndex* pindexBalanceTip;
+    mutable unsigned int nBalanceMempoolUpdated;
+    mutable int64_t nBalanceNextStakeAgeTime;
+    mutable int nBalancePrivateSendRounds;
+    std::atomic<unsigned int> nBalanceLockEvents;
+    mutable unsigned int nBalanceLockEventsSeen;
+    CWalletBalances ComputeTxBalances(const CWalletTx& wtx, bool& fVolatileRet, int64_t& nStakeAgeTimeRet) const;
+    void UpdateBalanceLedger() const;
+
+    //! Not protected by cs_wallet so that it can be queried while a rescan holds cs_wallet
+    mutable CCriticalSection cs_scanprogress;
+    CWalletScanProgress scanProgress;
+
 public:
     /*
      * Main wallet lock.
@@ -806,6 +963,7 @@ public:
 
     ~CWallet()
     {
+        StopKeyPoolFiller();
         delete pwalletdbEncryption;
         pwalletdbEncryption = NULL;
     }
@@ -836,6 +994,20 @@ public:
         // Stake statistics
         nStakingAmount = 0;
         nMintableCoins = 0;
+        pindexStakeCandidates = NULL;
+
+        fBalanceLedgerStale = true;
+        pindexBalanceTip = NULL;
+        nBalanceMempoolUpdated = 0;
+        nBalanceNextStakeAgeTime = 0;
+        nBalancePrivateSendRounds = 0;
+        nBalanceLockEvents = 0;
+        nPrivateSendRoundsEpoch = 0;
+        nBalanceLockEventsSeen = 0;
+
+        fKeyPoolFillerWake = false;
+        fStopKeyPoolFiller = false;
+        fKeyPoolFillerRunning = false;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
@@ -895,7 +1067,15 @@ public:
     int  CountInputsWithAmount(CAmount nInputAmount) const;
 
     // get the PrivateSend chain depth for a given input
-    int GetRealOutpointPrivateSendRounds(const COutPoint& outpoint, int nRounds = 0) const;
+    int GetRealOutpointPrivateSendRounds(const COutPoint& outpoint) const;
+    //! Adds rounds stored in the wallet database to the cache (used by LoadWallet)
+    void LoadPrivateSendRounds(const COutPoint& outpoint, uint32_t nEpoch, int nRounds);
+    void LoadPrivateSendRoundsEpoch(uint32_t nEpoch);
+    uint32_t GetPrivateSendRoundsEpoch() const;
+    //! Forgets the rounds of all outputs after keys or scripts were imported, more inputs may be ours now
+    void InvalidateAllPrivateSendRounds();
+    //! Computes the rounds of all denominated outputs at once and stores those of txs in a block
+    void UpdateAllPrivateSendRounds();
     // respect current settings
     int GetCappedOutpointPrivateSendRounds(const COutPoint& outpoint) const;
 
@@ -983,9 +1163,19 @@ public:
     void SyncTransaction(const CTransaction& tx, const CBlockIndex *pindex, int posInBlock) override;
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlockIndex* pIndex, int posInBlock, bool fUpdate);
     CBlockIndex* ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
+    CWalletScanProgress GetScanProgress() const;
+    CWalletStateSnapshot GetStateSnapshot();
     void ReacceptWalletTransactions();
     void ResendWalletTransactions(int64_t nBestBlockTime, CConnman* connman) override;
     std::vector<uint256> ResendWalletTransactionsBefore(int64_t nTime, CConnman* connman);
+    //! Marks the balance ledger entry of a tx for recomputation
+    void MarkBalanceDirty(const uint256& hash) const;
+    //! All balances from the ledger
+    CWalletBalances GetBalances() const;
+    //! All balances computed from every wallet tx, the slow path the ledger is checked against
+    CWalletBalances ComputeBalances() const;
+    //! Whether the ledger agrees with ComputeBalances, logs the difference if not
+    bool CheckBalanceLedger() const;
     CAmount GetBalance() const;
     CAmount GetUnconfirmedBalance() const;
     CAmount GetImmatureBalance() const;
@@ -1049,6 +1239,10 @@ public:
     size_t KeypoolCountExternalKeys();
     size_t KeypoolCountInternalKeys();
     bool TopUpKeyPool(unsigned int kpSize = 0);
+    /** Tops up the keypool on the keypool filler thread, or right away if it is not running */
+    void RequestKeyPoolTopUp();
+    void StartKeyPoolFiller();
+    void StopKeyPoolFiller();
     void ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool, bool fInternal);
     void KeepKey(int64_t nIndex);
     void ReturnKey(int64_t nIndex, bool fInternal);
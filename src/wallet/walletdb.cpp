@@ -526,6 +526,22 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
                 return false;
             }
         }
+        else if (strType == "psrounds")
+        {
+            COutPoint outpoint;
+            ssKey >> outpoint;
+            uint32_t nEpoch;
+            int nRounds;
+            ssValue >> nEpoch;
+            ssValue >> nRounds;
+            pwallet->LoadPrivateSendRounds(outpoint, nEpoch, nRounds);
+        }
+        else if (strType == "psroundsepoch")
+        {
+            uint32_t nEpoch;
+            ssValue >> nEpoch;
+            pwallet->LoadPrivateSendRoundsEpoch(nEpoch);
+        }
         else if (strType == "hdchain")
         {
             CHDChain chain;
@@ -897,6 +913,24 @@ bool CWalletDB::EraseDestData(const std::string &address, const std::string &key
     return Erase(std::make_pair(std::string("destdata"), std::make_pair(address, key)));
 }
 
+bool CWalletDB::WritePrivateSendRounds(const COutPoint& outpoint, uint32_t nEpoch, int nRounds)
+{
+    nWalletDBUpdateCounter++;
+    return Write(std::make_pair(std::string("psrounds"), outpoint), std::make_pair(nEpoch, nRounds));
+}
+
+bool CWalletDB::WritePrivateSendRoundsEpoch(uint32_t nEpoch)
+{
+    nWalletDBUpdateCounter++;
+    return Write(std::string("psroundsepoch"), nEpoch);
+}
+
+bool CWalletDB::ErasePrivateSendRounds(const COutPoint& outpoint)
+{
+    nWalletDBUpdateCounter++;
+    return Erase(std::make_pair(std::string("psrounds"), outpoint));
+}
+
 bool CWalletDB::WriteHDChain(const CHDChain& chain)
 {
     nWalletDBUpdateCounter++;
@@ -25,6 +25,7 @@ struct CBlockLocator;
 class CKeyPool;
 class CMasterKey;
 class CScript;
+class COutPoint;
 class CWallet;
 class CWalletTx;
 class uint160;
@@ -112,6 +113,10 @@ public:
 
     bool WriteMinVersion(int nVersion);
 
+    bool WritePrivateSendRounds(const COutPoint& outpoint, uint32_t nEpoch, int nRounds);
+    bool WritePrivateSendRoundsEpoch(uint32_t nEpoch);
+    bool ErasePrivateSendRounds(const COutPoint& outpoint);
+
     /// This writes directly to the database, and will not update the CWallet's cached accounting entries!
     /// Use wallet.AddAccountingEntry instead, to write *and* update its caches.
     bool WriteAccountingEntry(const uint64_t nAccEntryNum, const CAccountingEntry& acentry);